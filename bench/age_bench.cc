@@ -0,0 +1,492 @@
+#include "age_engine.hh"
+#include "age_host_allocator.hh"
+#include "age_trace.hh"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Headless frame time benchmark
+// Runs each scene for a fixed number of frames and prints the results
+// as JSON, so a CPU only driver (lavapipe) gives a baseline on every build
+//
+//   bin/age_bench [--frames N] [--warmup N] [--frames-in-flight N]
+//                 [--workers N] [--scene NAME]... [--dispatch-calls N]
+//                 [--out PATH]
+
+namespace {
+
+    struct BenchOptions {
+        uint64_t frames = 500;          // measured frames per scene
+        uint64_t warmup = 30;           // frames run before measuring
+        uint32_t frames_in_flight = 2;
+        uint32_t worker_threads = 0;
+        std::vector<std::string> scenes; // empty runs all of them
+        uint64_t dispatch_calls = 1000000; // calls per dispatch microbenchmark round, 0 skips it
+        std::string out_path;            // empty prints to stdout
+    };
+
+    struct Distribution {
+        double mean = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    struct SceneResult {
+        std::string name;
+        std::string device;
+        double startup_ms = 0.0;       // engine construction
+        Distribution frame_ms;
+        Distribution cpu_ms;
+        Distribution gpu_ms;
+        uint64_t frame_samples = 0;
+        uint64_t gpu_samples = 0;
+        uint64_t gpu_dropped_frames = 0;
+        uint64_t host_peak_bytes[age::age_host_allocator::SCOPE_COUNT] = {}; // per VkSystemAllocationScope
+        uint64_t host_arena_bytes = 0;
+    };
+
+    // Cost of one call through the loader and through the device's table
+    struct DispatchResult {
+        bool ran = false;
+        double fence_loader_ns = 0.0;   // vkGetFenceStatus, the kind of call made every frame
+        double fence_direct_ns = 0.0;
+        double record_loader_ns = 0.0;  // vkCmdSetScissor, the kind of call made per draw
+        double record_direct_ns = 0.0;
+    };
+
+    // Names of the VkSystemAllocationScope values, in order
+    const char *HOST_SCOPE_NAMES[age::age_host_allocator::SCOPE_COUNT] = {
+        "command", "object", "cache", "device", "instance"
+    };
+
+    // Work a scene adds to every frame
+    // setup runs once the engine is up, teardown once it is idle
+    struct Scene {
+        const char *name;
+        const char *description;
+        std::function<age::FrameCallback(age::age_engine &engine)> setup;
+        std::function<void(age::age_engine &engine)> teardown;
+    };
+
+    // Nearest rank percentile of sorted samples
+    double
+    percentile(const std::vector<double> &sorted, double p) {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+        return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+    }
+
+    Distribution
+    summarize(std::vector<double> samples) {
+        Distribution result;
+        if (samples.empty()) {
+            return result;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        result.mean = sum / static_cast<double>(samples.size());
+        result.p50 = percentile(samples, 50.0);
+        result.p95 = percentile(samples, 95.0);
+        result.p99 = percentile(samples, 99.0);
+        result.max = samples.back();
+        return result;
+    }
+
+    /**********************************************
+     *                 Scenes
+     *********************************************/
+
+    // Buffer the upload scene streams into
+    struct UploadState {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        age::age_allocation allocation;
+        std::vector<uint8_t> data;
+    };
+    UploadState g_upload;
+
+    // Data the jobs scene transforms
+    std::vector<float> g_particles;
+
+    std::vector<Scene>
+    make_scenes() {
+        std::vector<Scene> scenes;
+
+        // Only the render graph's clear pass, the engine's fixed cost
+        scenes.push_back({
+            "clear",
+            "render graph clear pass only",
+            [](age::age_engine &engine) {
+                return age::FrameCallback{};
+            },
+            [](age::age_engine &engine) {}
+        });
+
+        // 4 MiB streamed through the transfer queue every frame,
+        // with the frame waiting on the copy
+        scenes.push_back({
+            "upload",
+            "4 MiB buffer upload per frame, graphics waits on the transfer",
+            [](age::age_engine &engine) {
+                const VkDeviceSize size = 4ull * 1024 * 1024;
+                age::QueueFamilyIndices indices = engine.get_device().find_physical_device_queue_families();
+                engine.get_device().get_allocator().create_buffer(
+                        size,
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        g_upload.buffer,
+                        g_upload.allocation,
+                        {indices.graphics_family.value(), indices.transfer_family.value()});
+                g_upload.data.assign(size, 0);
+
+                return age::FrameCallback([](age::age_engine &engine, uint64_t frame) {
+                    std::fill(g_upload.data.begin(), g_upload.data.begin() + 256, static_cast<uint8_t>(frame));
+                    uint64_t value = engine.get_upload_manager().upload_buffer(
+                            g_upload.buffer,
+                            0,
+                            g_upload.data.data(),
+                            g_upload.data.size());
+                    engine.add_frame_wait({
+                            engine.get_upload_manager().get_semaphore(),
+                            value,
+                            VK_PIPELINE_STAGE_TRANSFER_BIT});
+                });
+            },
+            [](age::age_engine &engine) {
+                engine.get_device().get_allocator().destroy_buffer(g_upload.buffer, g_upload.allocation);
+                g_upload.buffer = VK_NULL_HANDLE;
+                g_upload.data.clear();
+            }
+        });
+
+        // A million particles integrated on the job system every frame
+        scenes.push_back({
+            "jobs",
+            "1M element parallel_for per frame",
+            [](age::age_engine &engine) {
+                g_particles.assign(1u << 20, 1.0F);
+                return age::FrameCallback([](age::age_engine &engine, uint64_t frame) {
+                    engine.get_job_system().parallel_for(
+                            static_cast<uint32_t>(g_particles.size()),
+                            4096,
+                            [](uint32_t begin, uint32_t end) {
+                                for (uint32_t i = begin; i < end; i++) {
+                                    g_particles[i] = g_particles[i] * 0.999F + std::sqrt(static_cast<float>(i)) * 0.001F;
+                                }
+                            });
+                });
+            },
+            [](age::age_engine &engine) {
+                g_particles.clear();
+            }
+        });
+
+        return scenes;
+    }
+
+    /**********************************************
+     *                 Running
+     *********************************************/
+
+    SceneResult
+    run_scene(const Scene &scene, const BenchOptions &options) {
+        age::EngineConfig config;
+        config.headless = true;
+        config.frames_in_flight = options.frames_in_flight;
+        config.frame_limit = options.warmup + options.frames;
+        config.present_policy = age::PresentPolicy::uncapped_benchmark;
+        config.pipeline_cache_path = ""; // every run starts cold
+        config.worker_threads = options.worker_threads;
+
+        SceneResult result;
+        result.name = scene.name;
+
+        double start_us = age::age_trace::now_us();
+        age::age_engine engine(800, 600, "Apollo Bench", config);
+        result.startup_ms = (age::age_trace::now_us() - start_us) / 1000.0;
+
+        VkPhysicalDeviceProperties properties;
+        engine.get_device().get_dispatch().vkGetPhysicalDeviceProperties(engine.get_device().get_physical_device(), &properties);
+        result.device = properties.deviceName;
+
+        std::vector<double> frame_ms;
+        std::vector<double> cpu_ms;
+        std::vector<double> gpu_ms;
+        uint64_t gpu_read_frames = 0;
+
+        // The stats the engine reports at the start of a frame belong to the one before it
+        age::age_gpu_profiler &profiler = engine.get_gpu_profiler();
+        age::FrameCallback scene_callback = scene.setup(engine);
+        engine.set_frame_callback([&](age::age_engine &current, uint64_t frame) {
+            if (frame > options.warmup) {
+                age::FrameStats stats = current.get_frame_stats();
+                frame_ms.push_back(stats.frame_ms);
+                cpu_ms.push_back(stats.cpu_ms);
+            }
+            if (profiler.get_read_frames() != gpu_read_frames) {
+                gpu_read_frames = profiler.get_read_frames();
+                for (const age::GpuScopeResult &scope : profiler.get_results()) {
+                    if (frame > options.warmup && scope.depth == 0 && std::strcmp(scope.name, "frame") == 0) {
+                        gpu_ms.push_back(scope.duration_ms);
+                    }
+                }
+            }
+            if (scene_callback) {
+                scene_callback(current, frame);
+            }
+        });
+
+        engine.run();
+        age::FrameStats stats = engine.get_frame_stats();
+        frame_ms.push_back(stats.frame_ms);
+        cpu_ms.push_back(stats.cpu_ms);
+        scene.teardown(engine);
+
+        age::age_host_allocator &host_allocator = engine.get_device().get_host_allocator();
+        for (uint32_t scope = 0; scope < age::age_host_allocator::SCOPE_COUNT; scope++) {
+            result.host_peak_bytes[scope] = host_allocator.get_stats(static_cast<VkSystemAllocationScope>(scope)).peak_bytes;
+        }
+        result.host_arena_bytes = host_allocator.get_arena_bytes();
+
+        result.frame_ms = summarize(frame_ms);
+        result.cpu_ms = summarize(cpu_ms);
+        result.gpu_ms = summarize(gpu_ms);
+        result.frame_samples = frame_ms.size();
+        result.gpu_samples = gpu_ms.size();
+        result.gpu_dropped_frames = profiler.get_dropped_frames();
+        return result;
+    }
+
+    // Time a call made count times, in ns per call
+    template <typename Call>
+    double
+    time_calls(uint64_t count, Call call) {
+        double start_us = age::age_trace::now_us();
+        for (uint64_t i = 0; i < count; i++) {
+            call();
+        }
+        return (age::age_trace::now_us() - start_us) * 1000.0 / static_cast<double>(count);
+    }
+
+    // Loader trampolines against the device level table
+    // Rounds alternate between the two and the fastest round of each is kept,
+    // so frequency scaling and cache warmup do not favour either
+    DispatchResult
+    run_dispatch(const BenchOptions &options) {
+        age::EngineConfig config;
+        config.headless = true;
+        config.pipeline_cache_path = "";
+        config.worker_threads = 1;
+        age::age_engine engine(64, 64, "Apollo Bench", config);
+        age::age_device &device = engine.get_device();
+        const age::age_dispatch &vk = device.get_dispatch();
+        VkDevice dev = device.get_device();
+
+        VkFenceCreateInfo fence_info{};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if (vk.vkCreateFence(dev, &fence_info, device.get_allocation_callbacks(), &fence) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create fence");
+        }
+
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = device.get_command_pool();
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        VkCommandBuffer command_buffer;
+        if (vk.vkAllocateCommandBuffers(dev, &alloc_info, &command_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to allocate command buffer");
+        }
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkRect2D scissor{{0, 0}, {64, 64}};
+        uint64_t record_calls = std::max<uint64_t>(options.dispatch_calls / 10, 1); // keeps the command buffer small
+
+        DispatchResult result;
+        result.ran = true;
+        result.fence_loader_ns = result.fence_direct_ns = 1e30;
+        result.record_loader_ns = result.record_direct_ns = 1e30;
+        for (int round = 0; round < 5; round++) {
+            result.fence_loader_ns = std::min(result.fence_loader_ns, time_calls(options.dispatch_calls, [&]() {
+                vkGetFenceStatus(dev, fence);
+            }));
+            result.fence_direct_ns = std::min(result.fence_direct_ns, time_calls(options.dispatch_calls, [&]() {
+                vk.vkGetFenceStatus(dev, fence);
+            }));
+
+            vk.vkBeginCommandBuffer(command_buffer, &begin_info);
+            result.record_loader_ns = std::min(result.record_loader_ns, time_calls(record_calls, [&]() {
+                vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+            }));
+            vk.vkEndCommandBuffer(command_buffer);
+            vk.vkResetCommandBuffer(command_buffer, 0);
+
+            vk.vkBeginCommandBuffer(command_buffer, &begin_info);
+            result.record_direct_ns = std::min(result.record_direct_ns, time_calls(record_calls, [&]() {
+                vk.vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+            }));
+            vk.vkEndCommandBuffer(command_buffer);
+            vk.vkResetCommandBuffer(command_buffer, 0);
+        }
+
+        vk.vkFreeCommandBuffers(dev, device.get_command_pool(), 1, &command_buffer);
+        vk.vkDestroyFence(dev, fence, device.get_allocation_callbacks());
+        return result;
+    }
+
+    void
+    write_distribution(std::FILE *out, const char *name, const Distribution &distribution) {
+        std::fprintf(out,
+                "      \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+                name,
+                distribution.mean,
+                distribution.p50,
+                distribution.p95,
+                distribution.p99,
+                distribution.max);
+    }
+
+    void
+    write_json(std::FILE *out, const BenchOptions &options, const std::vector<SceneResult> &results, const DispatchResult &dispatch) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::fprintf(out, "{\n");
+        std::fprintf(out, "  \"frames\": %llu,\n", static_cast<unsigned long long>(options.frames));
+        std::fprintf(out, "  \"warmup\": %llu,\n", static_cast<unsigned long long>(options.warmup));
+        std::fprintf(out, "  \"frames_in_flight\": %u,\n", options.frames_in_flight);
+        std::fprintf(out, "  \"peak_rss_kib\": %ld,\n", usage.ru_maxrss);
+        if (dispatch.ran) {
+            std::fprintf(out,
+                    "  \"dispatch_ns\": {\"fence_loader\": %.3f, \"fence_direct\": %.3f, \"record_loader\": %.3f, \"record_direct\": %.3f},\n",
+                    dispatch.fence_loader_ns,
+                    dispatch.fence_direct_ns,
+                    dispatch.record_loader_ns,
+                    dispatch.record_direct_ns);
+        }
+        std::fprintf(out, "  \"scenes\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const SceneResult &result = results[i];
+            std::fprintf(out, "    {\n");
+            std::fprintf(out, "      \"name\": \"%s\",\n", result.name.c_str());
+            std::fprintf(out, "      \"device\": \"%s\",\n", result.device.c_str());
+            std::fprintf(out, "      \"startup_ms\": %.4f,\n", result.startup_ms);
+            write_distribution(out, "frame_ms", result.frame_ms);
+            write_distribution(out, "cpu_ms", result.cpu_ms);
+            write_distribution(out, "gpu_ms", result.gpu_ms);
+            std::fprintf(out, "      \"frame_samples\": %llu,\n", static_cast<unsigned long long>(result.frame_samples));
+            std::fprintf(out, "      \"gpu_samples\": %llu,\n", static_cast<unsigned long long>(result.gpu_samples));
+            std::fprintf(out, "      \"gpu_dropped_frames\": %llu,\n", static_cast<unsigned long long>(result.gpu_dropped_frames));
+            std::fprintf(out, "      \"host_peak_bytes\": {");
+            for (uint32_t scope = 0; scope < age::age_host_allocator::SCOPE_COUNT; scope++) {
+                std::fprintf(out, "%s\"%s\": %llu",
+                        scope == 0 ? "" : ", ",
+                        HOST_SCOPE_NAMES[scope],
+                        static_cast<unsigned long long>(result.host_peak_bytes[scope]));
+            }
+            std::fprintf(out, "},\n");
+            std::fprintf(out, "      \"host_arena_bytes\": %llu\n", static_cast<unsigned long long>(result.host_arena_bytes));
+            std::fprintf(out, "    }%s\n", i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(out, "  ]\n");
+        std::fprintf(out, "}\n");
+    }
+}
+
+int
+main (int argc, char **argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.frames = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            options.warmup = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            options.frames_in_flight = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            options.worker_threads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            options.scenes.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--dispatch-calls") == 0 && i + 1 < argc) {
+            options.dispatch_calls = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            options.out_path = argv[++i];
+        } else {
+            std::cerr << "Error: unknown argument " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.frames == 0) {
+        std::cerr << "Error: --frames must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Scene> scenes = make_scenes();
+    for (const std::string &name : options.scenes) {
+        bool found = std::any_of(scenes.begin(), scenes.end(), [&](const Scene &scene) {
+            return name == scene.name;
+        });
+        if (!found) {
+            std::cerr << "Error: unknown scene " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<SceneResult> results;
+    DispatchResult dispatch;
+    try {
+        for (const Scene &scene : scenes) {
+            if (!options.scenes.empty() &&
+                std::find(options.scenes.begin(), options.scenes.end(), scene.name) == options.scenes.end()) {
+                continue;
+            }
+            std::cerr << "bench: " << scene.name << " (" << scene.description << ")" << std::endl;
+            results.push_back(run_scene(scene, options));
+        }
+        if (options.dispatch_calls > 0) {
+            std::cerr << "bench: dispatch (loader trampolines against the device table)" << std::endl;
+            dispatch = run_dispatch(options);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::FILE *out = stdout;
+    if (!options.out_path.empty()) {
+        out = std::fopen(options.out_path.c_str(), "w");
+        if (out == nullptr) {
+            std::cerr << "Error: failed to open " << options.out_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    write_json(out, options, results, dispatch);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    return EXIT_SUCCESS;
+}
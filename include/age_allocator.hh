@@ -0,0 +1,173 @@
+#pragma once
+#ifndef AGE_ALLOCATOR
+#define AGE_ALLOCATOR
+
+#include "age_dispatch.hh"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+    class age_memory_block;
+
+    // How a resource is laid out in memory.
+    // Linear (buffers, linear images) and optimal (tiled images) resources
+    // are kept in separate blocks so that bufferImageGranularity never
+    // has to be checked between neighbouring sub-allocations
+    enum class AllocationKind {
+        linear,
+        optimal
+    };
+
+    // A range of device memory handed out by the allocator
+    struct age_allocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE; // memory object the range lives in
+        VkDeviceSize offset = 0;                // offset of the range inside the memory object
+        VkDeviceSize size = 0;                  // size that was requested
+        void *mapped = nullptr;                 // host pointer to the range if the memory is host visible
+        uint32_t memory_type = 0;               // memory type index the range was taken from
+        AllocationKind kind = AllocationKind::linear;
+        bool dedicated = false;                 // the range owns its memory object
+
+        age_memory_block *block = nullptr;      // block the range was carved from (internal)
+        uint32_t node = 0;                      // block node that tracks the range (internal)
+    };
+
+    // Usage statistics for all the memory the allocator owns
+    struct AllocationStats {
+        uint64_t block_count = 0;               // large memory objects that are sub-allocated
+        uint64_t allocation_count = 0;          // live sub-allocations
+        uint64_t dedicated_count = 0;           // live dedicated allocations
+        VkDeviceSize reserved_bytes = 0;        // bytes held in blocks
+        VkDeviceSize used_bytes = 0;            // bytes handed out from blocks (including alignment padding)
+        VkDeviceSize dedicated_bytes = 0;       // bytes held by dedicated allocations
+        VkDeviceSize largest_free_range = 0;    // largest contiguous free range over all blocks
+        float fragmentation = 0.0F;             // 1 - largest free range / total free bytes
+    };
+
+    // A single large memory object sub-allocated with a two-level
+    // segregated fit (TLSF) scheme: free ranges are binned by size class
+    // in bitmaps, so finding and returning a range is O(1)
+    class age_memory_block {
+        public:
+            age_memory_block(VkDeviceMemory memory, VkDeviceSize size, void *mapped);
+
+            bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, uint32_t &node);
+            void free(uint32_t node);
+
+            bool empty();
+            VkDeviceSize get_size();
+            VkDeviceSize get_used();
+            VkDeviceSize get_largest_free_range();
+            uint32_t get_allocation_count();
+            VkDeviceMemory get_memory();
+            void* get_mapped();
+
+        private:
+            static const uint32_t SL_LOG2 = 5;              // log2 of the number of second level lists
+            static const uint32_t SL_COUNT = 1 << SL_LOG2;  // second level lists per first level
+            static const uint32_t FL_COUNT = 64;            // first level lists (one per power of two)
+            static const uint32_t NIL = UINT32_MAX;         // null node index
+
+            struct Node {
+                VkDeviceSize offset;
+                VkDeviceSize size;
+                uint32_t prev_phys;  // neighbour ranges in address order
+                uint32_t next_phys;
+                uint32_t prev_free;  // neighbours in the free list of this size class
+                uint32_t next_free;
+                bool free;
+            };
+
+            void _mapping_insert(VkDeviceSize size, uint32_t &fl, uint32_t &sl);
+            void _mapping_search(VkDeviceSize size, uint32_t &fl, uint32_t &sl);
+            uint32_t _find_free(uint32_t &fl, uint32_t &sl);
+            void _insert_free(uint32_t node);
+            void _remove_free(uint32_t node);
+            uint32_t _split(uint32_t node, VkDeviceSize size); // split off the tail of a node, returns the tail
+            void _merge(uint32_t left, uint32_t right);        // absorb right into left
+            uint32_t _new_node();
+
+            VkDeviceMemory _memory;
+            VkDeviceSize _size;
+            void *_mapped;
+            VkDeviceSize _used;
+            uint32_t _allocation_count;
+
+            std::vector<Node> _nodes;
+            std::vector<uint32_t> _free_nodes;        // recycled node slots
+            uint64_t _fl_bitmap;                      // first levels with a non-empty list
+            uint32_t _sl_bitmap[FL_COUNT];            // second levels with a non-empty list
+            uint32_t _heads[FL_COUNT][SL_COUNT];      // free list heads
+    };
+
+    // Device memory allocator that carves large blocks per memory type
+    // Safe to call from any thread
+    class age_allocator {
+        public:
+            age_allocator(
+                    VkPhysicalDevice physical_device,
+                    VkDevice device,
+                    const age_dispatch &dispatch,                                 // function table of the device
+                    const VkAllocationCallbacks *allocation_callbacks = nullptr, // host allocator the device was created with
+                    VkDeviceSize block_size = 64ull * 1024 * 1024);
+            age_allocator(const age_allocator&) = delete;
+            age_allocator& operator= (const age_allocator&) = delete;
+            ~age_allocator();
+
+            age_allocation allocate(                             // allocate memory that satisfies the requirements
+                    const VkMemoryRequirements &requirements,
+                    VkMemoryPropertyFlags properties,
+                    AllocationKind kind,
+                    bool dedicated = false);
+            void free(age_allocation &allocation);               // return memory to its block or the driver
+            void flush(const age_allocation &allocation, VkDeviceSize offset, VkDeviceSize size); // make host writes visible for non-coherent memory
+
+            void create_buffer(                                  // create a buffer and bind memory to it
+                    VkDeviceSize size,
+                    VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties,
+                    VkBuffer &buffer,
+                    age_allocation &allocation,
+                    const std::vector<uint32_t> &queue_families = {}); // families that share the buffer, concurrent if more than one
+            void destroy_buffer(VkBuffer buffer, age_allocation &allocation);
+            void create_image(                                   // create an image and bind memory to it
+                    const VkImageCreateInfo &image_info,
+                    VkMemoryPropertyFlags properties,
+                    VkImage &image,
+                    age_allocation &allocation);
+            void destroy_image(VkImage image, age_allocation &allocation);
+
+            uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags properties);
+            AllocationStats get_stats();
+
+        private:
+            // Blocks of one memory type and allocation kind
+            struct Pool {
+                std::mutex mutex;
+                std::vector<std::unique_ptr<age_memory_block>> blocks;
+            };
+
+            Pool& _get_pool(uint32_t memory_type, AllocationKind kind);
+            age_allocation _allocate_dedicated(VkDeviceSize size, uint32_t memory_type);
+            VkDeviceMemory _allocate_memory(VkDeviceSize size, uint32_t memory_type, void **mapped);
+
+            VkDevice _device;
+            const age_dispatch &_vk;
+            const VkAllocationCallbacks *_allocation_callbacks;
+            VkPhysicalDeviceMemoryProperties _memory_properties;
+            VkDeviceSize _buffer_image_granularity;
+            VkDeviceSize _non_coherent_atom_size;
+            VkDeviceSize _block_size[VK_MAX_MEMORY_TYPES];   // block size per memory type, capped by heap size
+            Pool _pools[VK_MAX_MEMORY_TYPES][2];             // indexed by memory type then allocation kind
+
+            std::mutex _dedicated_mutex;
+            uint64_t _dedicated_count;
+            VkDeviceSize _dedicated_bytes;
+    };
+}
+
+#endif /* AGE_ALLOCATOR */
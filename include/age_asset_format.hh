@@ -0,0 +1,86 @@
+#pragma once
+#ifndef AGE_ASSET_FORMAT
+#define AGE_ASSET_FORMAT
+
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+// Layout of an asset pack file, shared by the engine and tools/age_pack
+//
+//   AssetPackHeader
+//   AssetEntry[slot_count]      hash index, see asset_slot
+//   asset data                  every asset starts on ASSET_PACK_ALIGNMENT
+//
+// Asset data is stored exactly as it is uploaded: meshes as AssetVertex
+// followed by uint32_t indices, textures as tightly packed texels of mip 0,
+// shaders as SPIR-V words. Everything is little endian
+namespace age {
+
+    static const uint32_t ASSET_PACK_MAGIC = 0x50414741;   // "AGAP"
+    static const uint32_t ASSET_PACK_VERSION = 1;
+
+    // Above every optimalBufferCopyOffsetAlignment and nonCoherentAtomSize
+    // in the wild, so data can be copied into a staging ring as is
+    static const uint64_t ASSET_PACK_ALIGNMENT = 256;
+
+    enum class AssetType : uint32_t {
+        empty = 0,      // unused index slot
+        mesh = 1,
+        texture = 2,
+        shader = 3,
+    };
+
+    struct AssetPackHeader {
+        uint32_t magic;                 // ASSET_PACK_MAGIC
+        uint32_t version;               // ASSET_PACK_VERSION
+        uint32_t asset_count;
+        uint32_t slot_count;            // entries in the index, a power of two
+        uint64_t index_offset;          // byte offset of the index
+        uint64_t file_size;             // catches truncated files
+    };
+
+    struct AssetEntry {
+        uint64_t id;                    // asset_id of the name, 0 in an empty slot
+        uint64_t offset;                // byte offset of the data in the file
+        uint64_t size;                  // bytes of data
+        AssetType type;
+        uint32_t format;                // VkFormat of a texture
+        uint32_t width;                 // texture extent
+        uint32_t height;
+        uint32_t vertex_count;          // mesh counts, the indices follow the vertices
+        uint32_t index_count;
+        uint32_t reserved[4];
+    };
+
+    // Vertex of every mesh in a pack
+    struct AssetVertex {
+        float position[3];
+        float normal[3];
+        float uv[2];
+    };
+
+    static_assert(sizeof(AssetPackHeader) == 32, "AssetPackHeader is part of the file format");
+    static_assert(sizeof(AssetEntry) == 64, "AssetEntry is part of the file format");
+    static_assert(sizeof(AssetVertex) == 32, "AssetVertex is part of the file format");
+
+    // Assets are looked up by a 64 bit FNV-1a hash of their name
+    // The low bit is forced on so that no name hashes to an empty slot
+    inline uint64_t
+    asset_id(const char *name) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const char *c = name; *c != '\0'; c++) {
+            hash = (hash ^ static_cast<uint8_t>(*c)) * 0x100000001b3ull;
+        }
+        return hash | 1;
+    }
+
+    // First index slot to probe for an id
+    // Collisions move on to the next slot, wrapping at the end
+    inline uint32_t
+    asset_slot(uint64_t id, uint32_t slot_count) {
+        return static_cast<uint32_t>(id ^ (id >> 32)) & (slot_count - 1);
+    }
+}
+
+#endif /* AGE_ASSET_FORMAT */
@@ -0,0 +1,82 @@
+#pragma once
+#ifndef AGE_ASSET_PACK
+#define AGE_ASSET_PACK
+
+#include "age_asset_format.hh"
+#include "age_device.hh"
+#include "age_allocator.hh"
+#include "age_dispatch.hh"
+#include "age_upload_manager.hh"
+
+#include <cstdint>
+#include <string>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Mesh loaded from a pack
+    // Vertices and indices share one buffer, the indices start at index_offset
+    struct MeshAsset {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        age_allocation allocation;
+        VkDeviceSize index_offset = 0;
+        uint32_t vertex_count = 0;
+        uint32_t index_count = 0;
+        uint64_t upload_value = 0;      // upload manager value that signals the data is in place
+    };
+
+    // Texture loaded from a pack, a single mip level
+    struct TextureAsset {
+        VkImage image = VK_NULL_HANDLE;
+        age_allocation allocation;
+        VkImageView view = VK_NULL_HANDLE;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent{};
+        uint64_t upload_value = 0;      // the image is in SHADER_READ_ONLY_OPTIMAL once this is signaled
+    };
+
+    // Read-only asset pack written by tools/age_pack
+    // The file is mapped, not read: assets are found through the pack's
+    // hash index and their bytes go straight from the mapping into the
+    // upload manager's staging ring. Pages are only read from disk when an
+    // asset is first loaded. The whole index is validated on open, so
+    // loading never has to check the data again.
+    //
+    // Wait on upload_value (add_frame_wait on the engine) before drawing
+    // with a loaded asset.
+    // Safe to call from any thread
+    class age_asset_pack {
+        public:
+            age_asset_pack(age_device &device, age_upload_manager &uploads, const std::string &path);
+            age_asset_pack(const age_asset_pack&) = delete;
+            age_asset_pack& operator= (const age_asset_pack&) = delete;
+            ~age_asset_pack();
+
+            const AssetEntry* find(uint64_t id);        // null if the pack has no such asset
+            const AssetEntry* find(const char *name);
+            const void* get_data(const AssetEntry &entry); // the asset's bytes inside the mapping
+            uint32_t get_asset_count();
+
+            MeshAsset load_mesh(const char *name);
+            TextureAsset load_texture(const char *name);
+            VkShaderModule load_shader(const char *name);
+            void destroy_mesh(MeshAsset &mesh);         // once the frames using it are done
+            void destroy_texture(TextureAsset &texture);
+
+        private:
+            const AssetEntry& _get(const char *name, AssetType type); // throws if missing or of another type
+            void _validate();                                        // check the header and every entry against the file
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            age_upload_manager &_uploads;
+            std::string _path;
+
+            const uint8_t *_mapping;
+            size_t _mapping_size;
+            const AssetPackHeader *_header;
+            const AssetEntry *_index;
+    };
+}
+
+#endif /* AGE_ASSET_PACK */
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef AGE_BINDLESS
+#define AGE_BINDLESS
+
+#include "age_device.hh"
+#include "age_dispatch.hh"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    struct BindlessStats {
+        uint32_t texture_capacity = 0;
+        uint32_t buffer_capacity = 0;
+        uint32_t texture_count = 0;         // slots holding a texture
+        uint32_t buffer_count = 0;          // slots holding a storage buffer
+        uint64_t last_flush_writes = 0;     // descriptors written by the last flush
+    };
+
+    // One global descriptor set holding every texture and storage buffer
+    // Resources are registered once and addressed from shaders by the integer
+    // handle they get back, so a draw only pushes handles instead of binding
+    // descriptor sets. Binding 0 is an array of combined image samplers,
+    // binding 1 an array of storage buffers.
+    //
+    // The set is created update-after-bind and partially bound: writes are
+    // queued and issued in one vkUpdateDescriptorSets per frame by flush(),
+    // while frames in flight keep using the set. A released slot is only
+    // handed out again once the GPU is done with the frame that released it.
+    // Needs a device created with bindless enabled.
+    // Safe to call from any thread
+    class age_bindless {
+        public:
+            static const uint32_t INVALID_HANDLE = UINT32_MAX;
+            static const uint32_t TEXTURE_BINDING = 0;
+            static const uint32_t BUFFER_BINDING = 1;
+
+            age_bindless(age_device &device, uint32_t texture_capacity = 16384, uint32_t buffer_capacity = 16384);
+            age_bindless(const age_bindless&) = delete;
+            age_bindless& operator= (const age_bindless&) = delete;
+            ~age_bindless();                            // the device must be idle
+
+            uint32_t register_texture(VkImageView image_view, VkSampler sampler,
+                    VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            uint32_t register_buffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+            void release_texture(uint32_t handle);      // the slot is reused once frames in flight are done with it
+            void release_buffer(uint32_t handle);
+            void flush();                               // write queued descriptors, once per frame before recording
+
+            void bind(                                  // bind the heap as set_index of a pipeline layout
+                    VkCommandBuffer command_buffer,
+                    VkPipelineBindPoint bind_point,
+                    VkPipelineLayout layout,
+                    uint32_t set_index = 0);
+
+            VkDescriptorSetLayout get_set_layout();     // put this in every pipeline layout that reads the heap
+            VkDescriptorSet get_set();
+            BindlessStats get_stats();
+
+        private:
+            // Slots of one binding
+            struct SlotList {
+                uint32_t capacity;
+                uint32_t next_unused;           // slots below this have been handed out before
+                uint32_t live;
+                std::vector<uint32_t> free;     // released slots the GPU is done with
+            };
+
+            uint32_t _take_slot(SlotList &slots, const char *kind); // (mutex held)
+            void _release_slot(SlotList &slots, uint32_t handle);
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            std::mutex _mutex;
+
+            VkDescriptorSetLayout _set_layout;
+            VkDescriptorPool _pool;
+            VkDescriptorSet _set;
+
+            SlotList _textures;
+            SlotList _buffers;
+
+            // Writes waiting for the next flush
+            // Infos are kept apart from the writes so that growing
+            // them does not leave the writes pointing at freed memory
+            std::vector<VkDescriptorImageInfo> _pending_images;
+            std::vector<uint32_t> _pending_image_slots;
+            std::vector<VkDescriptorBufferInfo> _pending_buffers;
+            std::vector<uint32_t> _pending_buffer_slots;
+            uint64_t _last_flush_writes;
+    };
+}
+
+#endif /* AGE_BINDLESS */
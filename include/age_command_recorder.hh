@@ -0,0 +1,65 @@
+#pragma once
+#ifndef AGE_COMMAND_RECORDER
+#define AGE_COMMAND_RECORDER
+
+#include "age_device.hh"
+#include "age_job_system.hh"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Time one thread spent recording during the last record() call
+    struct RecordTiming {
+        double cpu_ms = 0.0;        // time spent inside record callbacks
+        uint32_t task_count = 0;    // tasks the thread recorded
+        uint32_t batch_count = 0;   // secondary command buffers the thread filled
+    };
+
+    // Records a frame's commands on every core
+    // Each job system thread has its own command pool per frame in flight,
+    // so threads never share a pool and a frame's pools are reset wholesale
+    // instead of buffer by buffer. Tasks are grouped into batches, each
+    // batch goes into a secondary command buffer, and the secondaries are
+    // executed in batch order, so the result does not depend on which
+    // thread recorded what.
+    // Call begin_frame and record from one thread
+    class age_command_recorder {
+        public:
+            age_command_recorder(age_device &device, age_job_system &jobs, uint32_t frames_in_flight);
+            age_command_recorder(const age_command_recorder&) = delete;
+            age_command_recorder& operator= (const age_command_recorder&) = delete;
+            ~age_command_recorder();
+
+            void begin_frame(uint32_t frame_slot);  // reset the slot's pools, its previous frame must have finished
+            void record(                            // record tasks in parallel and execute them in the primary buffer
+                    VkCommandBuffer primary,
+                    uint32_t task_count,
+                    const VkCommandBufferInheritanceInfo &inheritance,
+                    const std::function<void(VkCommandBuffer command_buffer, uint32_t task)> &record_task);
+
+            const std::vector<RecordTiming>& get_timings(); // per job system thread, from the last record()
+
+        private:
+            // Command pool of one thread for one frame slot
+            struct ThreadPool {
+                VkCommandPool pool;
+                std::vector<VkCommandBuffer> secondaries; // allocated on demand, reused every frame
+                uint32_t used;                            // secondaries handed out this frame
+            };
+
+            VkCommandBuffer _get_secondary(ThreadPool &thread_pool);
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            age_job_system &_jobs;
+            uint32_t _frame_slot;
+            std::vector<std::vector<ThreadPool>> _pools; // indexed by frame slot then thread index
+            std::vector<RecordTiming> _timings;          // indexed by thread index
+    };
+}
+
+#endif /* AGE_COMMAND_RECORDER */
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef AGE_COMPUTE
+#define AGE_COMPUTE
+
+#include "age_device.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // A compute shader together with its layout
+    // The shader sees storage buffers at bindings 0..storage_buffer_count-1
+    // of set 0 and an optional push constant block. storage_buffer_count
+    // is limited to age_compute::MAX_STORAGE_BUFFERS
+    class age_compute_pipeline {
+        public:
+            age_compute_pipeline(
+                    age_device &device,
+                    const std::vector<char> &spirv,
+                    uint32_t storage_buffer_count,
+                    uint32_t push_constant_size = 0);
+            age_compute_pipeline(const age_compute_pipeline&) = delete;
+            age_compute_pipeline& operator= (const age_compute_pipeline&) = delete;
+            ~age_compute_pipeline();
+
+            static std::vector<char> read_spirv(const std::string &path); // read a compiled shader from disk
+
+            VkPipeline get_pipeline();
+            VkPipelineLayout get_layout();
+            VkDescriptorSetLayout get_descriptor_set_layout();
+            uint32_t get_storage_buffer_count();
+            uint32_t get_push_constant_size();
+
+        private:
+            age_device &_device;
+            const age_dispatch &_vk;
+            uint32_t _storage_buffer_count;
+            uint32_t _push_constant_size;
+            VkDescriptorSetLayout _descriptor_set_layout;
+            VkPipelineLayout _layout;
+            VkPipeline _pipeline;
+    };
+
+    // Records and submits work on the async compute queue.
+    // Every submission signals a timeline semaphore value. Graphics work
+    // that consumes the results waits for it by passing a TimelineWait to
+    // the swapchain submit, so the CPU never blocks on compute.
+    //
+    // Buffers shared with the graphics queue must be created CONCURRENT
+    // between the two families (see age_allocator::create_buffer).
+    // Record from one thread at a time
+    class age_compute {
+        public:
+            static const uint32_t MAX_STORAGE_BUFFERS = 256;   // per descriptor pool, so also per set
+            static const uint32_t MAX_SETS_PER_POOL = 64;
+
+            age_compute(age_device &device, uint32_t frames_in_flight = 2);
+            age_compute(const age_compute&) = delete;
+            age_compute& operator= (const age_compute&) = delete;
+            ~age_compute();
+
+            VkCommandBuffer begin();                      // start recording in the next slot
+            void bind(                                    // bind a pipeline and its storage buffers
+                    VkCommandBuffer command_buffer,
+                    age_compute_pipeline &pipeline,
+                    const std::vector<VkDescriptorBufferInfo> &buffers);
+            void push_constants(
+                    VkCommandBuffer command_buffer,
+                    age_compute_pipeline &pipeline,
+                    const void *data,
+                    uint32_t size);
+            void dispatch(VkCommandBuffer command_buffer, uint32_t x, uint32_t y = 1, uint32_t z = 1);
+            void barrier(VkCommandBuffer command_buffer); // make writes of earlier dispatches visible to later ones
+            uint64_t submit(                              // submit the recording, returns the value that signals it
+                    VkCommandBuffer command_buffer,
+                    const std::vector<TimelineWait> &waits = {});
+
+            VkSemaphore get_semaphore();                  // timeline semaphore signaled by the compute queue
+            bool is_complete(uint64_t value);
+            void wait(uint64_t value);
+
+        private:
+            // Resources of one submission, reused once its value is reached
+            struct Slot {
+                VkCommandPool command_pool;
+                VkCommandBuffer command_buffer;
+                std::vector<VkDescriptorPool> descriptor_pools; // grown when a frame needs more sets
+                uint32_t descriptor_pool_index;                 // pool sets are currently allocated from
+                uint64_t value;                                 // value signaled by the last submission
+            };
+
+            VkDescriptorPool _create_descriptor_pool();
+            VkDescriptorSet _allocate_descriptor_set(Slot &slot, VkDescriptorSetLayout layout);
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            std::vector<Slot> _slots;
+            uint32_t _current_slot;
+            VkSemaphore _timeline;
+            uint64_t _submitted_value;
+    };
+}
+
+#endif /* AGE_COMPUTE */
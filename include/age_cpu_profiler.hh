@@ -0,0 +1,119 @@
+#pragma once
+#ifndef AGE_CPU_PROFILER
+#define AGE_CPU_PROFILER
+
+#include "age_trace.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Zones are compiled in for debug builds, release builds
+// opt in with -DAGE_ENABLE_PROFILING
+#if !defined(NDEBUG) || defined(AGE_ENABLE_PROFILING)
+#define AGE_PROFILING 1
+#endif
+
+#define AGE_PROFILE_CONCAT_INNER(a, b) a##b
+#define AGE_PROFILE_CONCAT(a, b) AGE_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef AGE_PROFILING
+// Time the rest of the enclosing scope, name must be a string literal
+#define AGE_PROFILE_ZONE(name) ::age::age_cpu_zone AGE_PROFILE_CONCAT(_age_zone_, __LINE__)(name)
+#define AGE_PROFILE_FUNCTION() AGE_PROFILE_ZONE(__func__)
+#define AGE_PROFILE_THREAD(name) ::age::age_cpu_profiler::get().set_thread_name(name)
+#else
+#define AGE_PROFILE_ZONE(name) ((void)0)
+#define AGE_PROFILE_FUNCTION() ((void)0)
+#define AGE_PROFILE_THREAD(name) ((void)0)
+#endif
+
+namespace age {
+
+    // A finished zone
+    struct CpuZoneRecord {
+        const char *name;   // string literal, never copied
+        double start_us;
+        double end_us;
+    };
+
+    // Single producer, single consumer ring of zones
+    // The owning thread pushes, the collector pops, neither locks
+    class age_zone_ring {
+        public:
+            static const uint32_t CAPACITY = 8192; // power of two
+
+            age_zone_ring(uint32_t thread);
+
+            bool push(const CpuZoneRecord &record);     // owner only, false when full
+            uint32_t pop(CpuZoneRecord *out, uint32_t max_count); // collector only
+            uint32_t get_thread();
+
+        private:
+            alignas(64) std::atomic<uint64_t> _head;   // next slot the owner writes
+            alignas(64) std::atomic<uint64_t> _tail;   // next slot the collector reads
+            uint32_t _thread;
+            CpuZoneRecord _records[CAPACITY];
+    };
+
+    // Gathers zones from every thread's ring into a trace
+    // Threads get a ring the first time they record a zone. A collector
+    // thread drains the rings while the profiler runs, so the hot path is
+    // two clock reads and a ring write. Zones recorded before start() wait
+    // in the rings, zones that find their ring full are counted and dropped
+    class age_cpu_profiler {
+        public:
+            static age_cpu_profiler& get();
+
+            void start(age_trace *trace);             // start draining into a trace
+            void stop();                              // drain what is left and stop the collector
+            void record(const CpuZoneRecord &record); // add a zone for the calling thread
+            void set_thread_name(const std::string &name);
+            uint64_t get_dropped_count();
+
+        private:
+            age_cpu_profiler();
+            ~age_cpu_profiler();
+
+            age_zone_ring* _get_ring();     // ring of the calling thread, created on first use
+            void _collect();                // collector thread body
+            void _drain();
+
+            std::mutex _rings_mutex;        // only taken when a thread registers or rings are drained
+            std::vector<std::unique_ptr<age_zone_ring>> _rings;
+            std::vector<std::pair<uint32_t, std::string>> _pending_names; // names set before start()
+
+            std::mutex _collector_mutex;
+            std::condition_variable _collector_wake;
+            std::thread _collector;
+            bool _running;
+            age_trace *_trace;
+            std::atomic<uint64_t> _dropped;
+    };
+
+    // Records the time between its construction and destruction
+    class age_cpu_zone {
+        public:
+            age_cpu_zone(const char *name)
+            : _name{name},
+              _start_us{age_trace::now_us()} {}
+
+            ~age_cpu_zone() {
+                age_cpu_profiler::get().record({this->_name, this->_start_us, age_trace::now_us()});
+            }
+
+            age_cpu_zone(const age_cpu_zone&) = delete;
+            age_cpu_zone& operator= (const age_cpu_zone&) = delete;
+
+        private:
+            const char *_name;
+            double _start_us;
+    };
+}
+
+#endif /* AGE_CPU_PROFILER */
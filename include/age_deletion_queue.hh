@@ -0,0 +1,71 @@
+#pragma once
+#ifndef AGE_DELETION_QUEUE
+#define AGE_DELETION_QUEUE
+
+#include "age_allocator.hh"
+#include "age_dispatch.hh"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+    class age_device;
+
+    // Destroys objects once the GPU can no longer be using them
+    // Every deletion waits for a timeline value. By default that is the value
+    // the frame being recorded signals on the frame timeline, which covers
+    // any command buffer recorded so far. Work on other queues (uploads,
+    // async compute) can pass its own semaphore and value instead.
+    // collect() never blocks, so nothing here needs vkDeviceWaitIdle.
+    // Safe to call from any thread
+    class age_deletion_queue {
+        public:
+            age_deletion_queue(age_device &device);
+            age_deletion_queue(const age_deletion_queue&) = delete;
+            age_deletion_queue& operator= (const age_deletion_queue&) = delete;
+            ~age_deletion_queue();                      // destroys everything left, the device must be idle
+
+            // Destroy after the frame being recorded is done
+            void destroy_buffer(VkBuffer buffer, const age_allocation &allocation);
+            void destroy_image(VkImage image, const age_allocation &allocation);
+            void destroy_image_view(VkImageView image_view);
+            void destroy_pipeline(VkPipeline pipeline);
+            void destroy_pipeline_layout(VkPipelineLayout layout);
+            void destroy_descriptor_set_layout(VkDescriptorSetLayout layout);
+            void destroy_descriptor_pool(VkDescriptorPool pool);
+            void free_descriptor_sets(VkDescriptorPool pool, const std::vector<VkDescriptorSet> &sets); // pool needs FREE_DESCRIPTOR_SET_BIT
+            void destroy_shader_module(VkShaderModule shader_module);
+            void destroy_semaphore(VkSemaphore semaphore);
+            void destroy_swapchain(VkSwapchainKHR swapchain);
+            void defer(std::function<void()> destroy);
+
+            // Destroy once a timeline semaphore reaches a value
+            void defer_until(VkSemaphore semaphore, uint64_t value, std::function<void()> destroy);
+
+            void collect();                             // destroy what the GPU is done with, call once per frame
+            void flush();                               // destroy everything now, the device must be idle
+
+            VkSemaphore get_frame_semaphore();          // timeline the graphics queue signals at the end of every frame
+            uint64_t signal_frame();                    // value the frame being submitted signals, called once per submission
+            uint64_t get_pending_count();
+
+        private:
+            struct Deletion {
+                VkSemaphore semaphore;
+                uint64_t value;
+                std::function<void()> destroy;
+            };
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            std::mutex _mutex;
+            std::vector<Deletion> _pending;             // in the order they were queued
+            VkSemaphore _frame_semaphore;
+            uint64_t _frame_value;                      // value signaled by the last submitted frame
+    };
+}
+
+#endif /* AGE_DELETION_QUEUE */
@@ -3,9 +3,18 @@
 #define AGE_DEVICE
 
 #include "age_window.hh"
+#include "age_allocator.hh"
+#include "age_deletion_queue.hh"
+#include "age_dispatch.hh"
+#include "age_host_allocator.hh"
+#include "age_init_graph.hh"
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <vulkan/vulkan_core.h>
 #include <vector>
 #include <vulkan/vulkan.h>
@@ -14,10 +23,34 @@ namespace age {
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphics_family;
         std::optional<uint32_t> present_family;
+        std::optional<uint32_t> transfer_family; // dedicated copy family if there is one, else the graphics family
+        std::optional<uint32_t> compute_family;  // async compute family if there is one, else the graphics family
 
         bool is_complete();
     };
 
+    // A timeline semaphore value that a submission waits for
+    struct TimelineWait {
+        VkSemaphore semaphore;
+        uint64_t value;
+        VkPipelineStageFlags stage; // stages that may not start before the value is reached
+    };
+
+    // What the engine needs from a GPU and what it would rather have
+    // Devices missing a requirement are never picked, the preferences
+    // only decide between the devices that are left
+    struct DeviceRequirements {
+        uint32_t api_version = VK_API_VERSION_1_0;  // lowest Vulkan version the device must run
+        std::vector<const char*> extensions;       // needed on top of swapchain and timeline semaphores
+        VkPhysicalDeviceFeatures features{};       // every member set to VK_TRUE must be supported, and is enabled
+        VkDeviceSize min_device_local_bytes = 0;   // smallest acceptable device local heap
+
+        bool prefer_discrete = true;
+        bool prefer_async_compute = true;          // a compute family without graphics
+        bool prefer_dedicated_transfer = true;     // a transfer family without graphics or compute
+        bool bindless = false;                     // descriptor indexing on Vulkan 1.2, enabled if the picked GPU has it
+    };
+
     struct SwapChainSupportDetails {
         VkSurfaceCapabilitiesKHR capabilities;
         std::vector <VkSurfaceFormatKHR> formats;
@@ -32,7 +65,12 @@ namespace age {
             const bool enable_validation_layers = true;
 #endif
 
-            age_device(age_window &window);
+            age_device(
+                    age_window &window,
+                    std::string pipeline_cache_path = "",
+                    DeviceRequirements requirements = DeviceRequirements{},
+                    std::string device_cache_path = "",        // remembers the chosen GPU, empty to always scan
+                    age_job_system *jobs = nullptr);           // runs independent startup steps in parallel, null for none
             age_device(const age_device&) = delete;
             age_device& operator= (const age_device&) = delete;
             ~age_device();
@@ -41,23 +79,50 @@ namespace age {
             QueueFamilyIndices find_physical_device_queue_families();
             VkSurfaceKHR get_surface(); // get the surface
             VkDevice get_device(); // get the logical device
+            VkPhysicalDevice get_physical_device(); // get the GPU the device was created on
+            VkQueue get_graphics_queue(); // get the queue that graphics work is submitted to
+            VkQueue get_present_queue();  // get the queue that presents to the surface
+            VkQueue get_transfer_queue(); // get the queue that uploads are submitted to
+            VkQueue get_compute_queue();  // get the queue that async compute work is submitted to
+            VkResult queue_submit(VkQueue queue, uint32_t submit_count, const VkSubmitInfo *submits, VkFence fence);
+            VkResult queue_present(VkQueue queue, const VkPresentInfoKHR *present_info);
+            VkSemaphore create_timeline_semaphore(uint64_t initial_value = 0);
+            uint64_t get_semaphore_value(VkSemaphore semaphore);       // current value of a timeline semaphore
+            VkResult wait_semaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout = UINT64_MAX);
+            VkCommandPool get_command_pool(); // get the command pool for the graphics queue family
+            age_allocator& get_allocator();   // get the device memory allocator
+            age_deletion_queue& get_deletion_queue(); // destroy objects once the GPU is done with them
+            VkPipelineCache get_pipeline_cache(); // get the pipeline cache shared by all pipeline creation
+            const VkAllocationCallbacks* get_allocation_callbacks(); // pass to every vkCreate* and vkDestroy* on this device
+            age_host_allocator& get_host_allocator(); // host memory the driver uses for our objects
+            const age_dispatch& get_dispatch();       // Vulkan functions of this instance and device, call these instead of the loader's
+            uint32_t get_api_version();               // Vulkan version the instance and device were created for
+            bool is_bindless_enabled();               // descriptor indexing was requested and the device supports it
+            std::vector<InitStepTiming> get_startup_timings(); // steps of the constructor
+            double get_startup_ms();                  // wall time of the constructor's steps
 
         private:
+            // Features of a GPU that the scoring looks at
+            struct DeviceFeatures {
+                VkPhysicalDeviceFeatures core;
+                bool descriptor_indexing;   // everything age_bindless relies on
+            };
+
             static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback( // static member callback function for debug error messages
                 VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,     
                 VkDebugUtilsMessageTypeFlagsEXT message_type,                
                 const VkDebugUtilsMessengerCallbackDataEXT *p_callback_data, 
                 void* p_user_data);
-            static void destroy_debug_messenger( // static member function to be used to destroy the debug messenger at cleanup
-                VkInstance instance,
-                VkDebugUtilsMessengerEXT debug_messenger,
-                const VkAllocationCallbacks *p_allocator);
 
             // Private Member Functions
             void _init_vulkan();                    // initialize vulkan
             void _create_window_surface();          // create the surface for the window to interface with
             void _pick_physical_device();           // pick the GPU that we are going to use
             void _create_logical_device();          // create the logical device to interface with
+            void _create_command_pool();            // create the command pool for graphics command buffers
+            void _read_pipeline_cache_file();       // load the cache file into memory, before the device is known
+            void _create_pipeline_cache();          // create the pipeline cache, seeded from disk when it matches this device
+            void _save_pipeline_cache();            // write the pipeline cache back to disk
             void _create_instance();                // create the vulkan instance
             void _setup_debug_messenger();          // setup necessary steps to create the debug messenger
             bool _check_device_extension_support(   // check the device to see if it supports the extensions we need
@@ -65,33 +130,51 @@ namespace age {
             );  
             SwapChainSupportDetails _query_swap_chain_support(VkPhysicalDevice device); // populate the swap chain support details struct
             void _populate_debug_messenger_create_info(VkDebugUtilsMessengerCreateInfoEXT &debug_info); // fill in debug create info struct
-            VkResult _create_debug_utils_messenger( // create the debug messenger that can send the messages
-                VkInstance instance,
-                const VkDebugUtilsMessengerCreateInfoEXT *debug_info,
-                const VkAllocationCallbacks *p_allocator,
-                VkDebugUtilsMessengerEXT *p_debug_messenger
-            );
             
             std::vector <const char*> _get_required_extensions(); // get list of the required extensions
             bool _check_validation_layer_support();               // checks that we are able to use the validation layers we specify
-            bool _is_device_suitable(VkPhysicalDevice device); // check if an available device is suitable for operations we need to perform
-            int _rate_device_suitability(VkPhysicalDevice device); // rate the desirability of a GPU to choose from
+            int _score_device(VkPhysicalDevice device);           // 0 if the device misses a requirement, higher is better
+            bool _get_device_uuid(VkPhysicalDevice device, uint8_t *uuid); // needs Vulkan 1.1 on both sides
+            uint64_t _get_device_cache_key(const std::vector<VkPhysicalDevice> &devices); // requirements and installed GPUs
+            bool _load_device_choice(uint64_t key, uint8_t *uuid);
+            void _save_device_choice(uint64_t key);
             QueueFamilyIndices _find_queue_families(VkPhysicalDevice device); // find the queue families we can put command and other queues into
+            DeviceFeatures _query_features(VkPhysicalDevice device);
             
             // Private memeber fields
             age_window &_window;                                   // Apollo engine window to draw to
+            age_host_allocator _host_allocator;                    // host memory for every Vulkan object, outlives the instance
+            age_dispatch _vk;                                      // function table, filled in as the instance and device are created
             VkInstance _instance;                                  // Vulkan instance
             VkPhysicalDevice _physical_device;                     // the physical GPU
             VkQueue _graphics_queue;                               // queue for the graphics
             VkQueue _present_queue;                                // queue for the surface
+            VkQueue _transfer_queue;                               // queue for uploads
+            VkQueue _compute_queue;                                // queue for async compute
+            QueueFamilyIndices _queue_family_indices;              // families of the chosen device
+            std::map<VkQueue, std::unique_ptr<std::mutex>> _queue_mutexes; // one lock per distinct queue
             VkDevice _logical_device;                              // logical device to interface with
             VkDebugUtilsMessengerEXT _debug_messenger;             // debug messenger
             VkSurfaceKHR _window_surface;                          // abstracted surface to render images to
+            VkCommandPool _command_pool;                           // pool that graphics command buffers are allocated from
+            std::unique_ptr<age_allocator> _allocator;             // sub-allocator for all device memory
+            std::unique_ptr<age_deletion_queue> _deletion_queue;   // frees into the allocator, so destroyed before it
+            VkPipelineCache _pipeline_cache;                       // cache of compiled pipelines
+            std::string _pipeline_cache_path;                      // file the pipeline cache persists to, empty to disable
+            std::string _device_cache_path;                        // file the chosen GPU persists to, empty to disable
+            DeviceRequirements _requirements;
+            uint32_t _api_version;                                 // version the instance was created for
+            bool _bindless_enabled;
+            bool _validation_layers_available;                     // true when validation is off
+            std::vector<uint8_t> _pipeline_cache_file;             // file contents until the pipeline cache is created
+            std::vector<InitStepTiming> _startup_timings;
+            double _startup_ms;
             const std::vector <const char*> _validation_layers = { // validation layer checks that we want
                 "VK_LAYER_KHRONOS_validation"
             };
-            const std::vector <const char*> _device_extensions = { // list of required device extensions
-                VK_KHR_SWAPCHAIN_EXTENSION_NAME
+            std::vector <const char*> _device_extensions = {       // required device extensions, the requirements add theirs
+                VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+                VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME
             };
     };
 }
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef AGE_DISPATCH
+#define AGE_DISPATCH
+
+#include <vulkan/vulkan.h>
+
+// Every Vulkan function the engine calls, by the level it is loaded at.
+// Add a function to the right list and it is a member of age_dispatch
+
+// Loaded before there is an instance
+#define AGE_GLOBAL_FUNCTIONS(X)                         \
+    X(vkCreateInstance)                                 \
+    X(vkEnumerateInstanceLayerProperties)
+
+// Loaded before there is an instance, null on Vulkan 1.0 loaders
+#define AGE_GLOBAL_OPTIONAL_FUNCTIONS(X)                \
+    X(vkEnumerateInstanceVersion)
+
+// Loaded from the instance
+#define AGE_INSTANCE_FUNCTIONS(X)                       \
+    X(vkDestroyInstance)                                \
+    X(vkEnumeratePhysicalDevices)                       \
+    X(vkEnumerateDeviceExtensionProperties)             \
+    X(vkGetPhysicalDeviceProperties)                    \
+    X(vkGetPhysicalDeviceFeatures)                      \
+    X(vkGetPhysicalDeviceMemoryProperties)              \
+    X(vkGetPhysicalDeviceQueueFamilyProperties)         \
+    X(vkGetPhysicalDeviceSurfaceSupportKHR)             \
+    X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR)        \
+    X(vkGetPhysicalDeviceSurfaceFormatsKHR)             \
+    X(vkGetPhysicalDeviceSurfacePresentModesKHR)        \
+    X(vkDestroySurfaceKHR)                              \
+    X(vkCreateDevice)                                   \
+    X(vkGetDeviceProcAddr)
+
+// Loaded from the instance, null when their extension or
+// API version is not enabled
+#define AGE_INSTANCE_EXTENSION_FUNCTIONS(X)             \
+    X(vkCreateDebugUtilsMessengerEXT)                   \
+    X(vkDestroyDebugUtilsMessengerEXT)                  \
+    X(vkGetPhysicalDeviceFeatures2)                     \
+    X(vkGetPhysicalDeviceProperties2)
+
+// Loaded from the device, so calls go straight to the driver
+#define AGE_DEVICE_FUNCTIONS(X)                         \
+    X(vkDestroyDevice)                                  \
+    X(vkGetDeviceQueue)                                 \
+    X(vkDeviceWaitIdle)                                 \
+    X(vkQueueSubmit)                                    \
+    X(vkQueuePresentKHR)                                \
+    X(vkCreateSwapchainKHR)                             \
+    X(vkDestroySwapchainKHR)                            \
+    X(vkGetSwapchainImagesKHR)                          \
+    X(vkAcquireNextImageKHR)                            \
+    X(vkAllocateMemory)                                 \
+    X(vkFreeMemory)                                     \
+    X(vkMapMemory)                                      \
+    X(vkFlushMappedMemoryRanges)                        \
+    X(vkCreateBuffer)                                   \
+    X(vkDestroyBuffer)                                  \
+    X(vkGetBufferMemoryRequirements)                    \
+    X(vkBindBufferMemory)                               \
+    X(vkCreateImage)                                    \
+    X(vkDestroyImage)                                   \
+    X(vkGetImageMemoryRequirements)                     \
+    X(vkBindImageMemory)                                \
+    X(vkCreateImageView)                                \
+    X(vkDestroyImageView)                               \
+    X(vkCreateSemaphore)                                \
+    X(vkDestroySemaphore)                               \
+    X(vkWaitSemaphoresKHR)                              \
+    X(vkGetSemaphoreCounterValueKHR)                    \
+    X(vkCreateFence)                                    \
+    X(vkDestroyFence)                                   \
+    X(vkWaitForFences)                                  \
+    X(vkResetFences)                                    \
+    X(vkGetFenceStatus)                                 \
+    X(vkCreateQueryPool)                                \
+    X(vkDestroyQueryPool)                               \
+    X(vkGetQueryPoolResults)                            \
+    X(vkCreateCommandPool)                              \
+    X(vkDestroyCommandPool)                             \
+    X(vkResetCommandPool)                               \
+    X(vkAllocateCommandBuffers)                         \
+    X(vkFreeCommandBuffers)                             \
+    X(vkBeginCommandBuffer)                             \
+    X(vkEndCommandBuffer)                               \
+    X(vkResetCommandBuffer)                             \
+    X(vkCreatePipelineCache)                            \
+    X(vkDestroyPipelineCache)                           \
+    X(vkGetPipelineCacheData)                           \
+    X(vkCreateShaderModule)                             \
+    X(vkDestroyShaderModule)                            \
+    X(vkCreatePipelineLayout)                           \
+    X(vkDestroyPipelineLayout)                          \
+    X(vkCreateComputePipelines)                         \
+    X(vkCreateGraphicsPipelines)                        \
+    X(vkDestroyPipeline)                                \
+    X(vkCreateDescriptorSetLayout)                      \
+    X(vkDestroyDescriptorSetLayout)                     \
+    X(vkCreateDescriptorPool)                           \
+    X(vkDestroyDescriptorPool)                          \
+    X(vkResetDescriptorPool)                            \
+    X(vkAllocateDescriptorSets)                         \
+    X(vkFreeDescriptorSets)                             \
+    X(vkUpdateDescriptorSets)                           \
+    X(vkCmdPipelineBarrier)                             \
+    X(vkCmdCopyBuffer)                                  \
+    X(vkCmdCopyBufferToImage)                           \
+    X(vkCmdClearColorImage)                             \
+    X(vkCmdExecuteCommands)                             \
+    X(vkCmdBindPipeline)                                \
+    X(vkCmdBindDescriptorSets)                          \
+    X(vkCmdPushConstants)                               \
+    X(vkCmdDispatch)                                    \
+    X(vkCmdSetScissor)                                  \
+    X(vkCmdWriteTimestamp)                              \
+    X(vkCmdResetQueryPool)
+
+namespace age {
+
+    // Vulkan function pointers loaded once (like volk's tables)
+    // Calling through the loader's exported functions goes via a trampoline
+    // that looks up the dispatch table of the handle on every call. Device
+    // functions fetched with vkGetDeviceProcAddr point at the driver itself.
+    // The device owns the table, everything else calls through it
+    class age_dispatch {
+        public:
+#define AGE_DISPATCH_MEMBER(name) PFN_##name name = nullptr;
+            AGE_GLOBAL_FUNCTIONS(AGE_DISPATCH_MEMBER)
+            AGE_GLOBAL_OPTIONAL_FUNCTIONS(AGE_DISPATCH_MEMBER)
+            AGE_INSTANCE_FUNCTIONS(AGE_DISPATCH_MEMBER)
+            AGE_INSTANCE_EXTENSION_FUNCTIONS(AGE_DISPATCH_MEMBER)
+            AGE_DEVICE_FUNCTIONS(AGE_DISPATCH_MEMBER)
+#undef AGE_DISPATCH_MEMBER
+
+            void load_global();                     // functions needed to create an instance
+            void load_instance(VkInstance instance);
+            void load_device(VkDevice device);      // needs load_instance first
+    };
+}
+
+#endif /* AGE_DISPATCH */
@@ -2,34 +2,123 @@
 #ifndef AGE_ENGINE
 #define AGE_ENGINE
 
+#include "age_job_system.hh"
 #include "age_window.hh"
 #include "age_device.hh"
 #include "age_swapchain.hh"
+#include "age_upload_manager.hh"
+#include "age_uniform_ring.hh"
+#include "age_bindless.hh"
+#include "age_compute.hh"
+#include "age_command_recorder.hh"
+#include "age_render_graph.hh"
+#include "age_gpu_profiler.hh"
+#include "age_init_graph.hh"
+#include "age_asset_pack.hh"
+#include "age_pipeline_manager.hh"
+#include "age_trace.hh"
 
 #include <vulkan/vulkan.h>
 
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace age {
+
+    // Adds steps of the application to the engine's startup graph
+    // The device is ready, the engine's own subsystems are still being
+    // built alongside the steps and must not be used by them
+    using StartupCallback = std::function<void(age_device &device, age_init_graph &graph)>;
+
+    // Options that are fixed when the engine is constructed
+    struct EngineConfig {
+        bool headless = false;         // render to a VK_EXT_headless_surface instead of a GLFW window
+        uint32_t frames_in_flight = 2; // frames the CPU may record ahead of the GPU
+        uint64_t frame_limit = 0;      // stop after this many frames, 0 runs until the window closes
+        PresentPolicy present_policy = PresentPolicy::low_latency;
+        std::string pipeline_cache_path = "pipeline_cache.bin"; // where compiled pipelines persist, empty to disable
+        uint32_t worker_threads = 0;   // job system workers, 0 uses one per core
+        std::string trace_path = "";   // write a Chrome trace of the run here, empty to disable
+        std::string device_cache_path = "device_choice.bin"; // remembers the picked GPU for fast startup, empty to disable
+        DeviceRequirements device_requirements;                // what the GPU must have, set bindless for a bindless descriptor heap
+        std::string asset_pack_path = ""; // asset pack built by tools/age_pack, mapped at startup, empty for none
+        bool hot_reload_shaders = false; // rebuild pipelines when their SPIR-V files change
+        StartupCallback startup;       // add shader, pipeline and asset loading to the startup graph
+    };
     
+    // CPU side timing of the last frame
+    struct FrameStats {
+        double frame_ms = 0.0; // whole iteration of the main loop
+        double cpu_ms = 0.0;   // the iteration minus waiting for a free swapchain image
+    };
+
+    class age_engine;
+    using FrameCallback = std::function<void(age_engine &engine, uint64_t frame)>;
+
     class age_engine {
         public:
-            age_engine(uint32_t width, uint32_t height, std::string name);
+            age_engine(uint32_t width, uint32_t height, std::string name, EngineConfig config = EngineConfig{});
             age_engine(const age_engine&) = delete;
             age_engine& operator= (const age_engine&) = delete;
             ~age_engine();
 
             void run();
+            void set_present_policy(PresentPolicy policy); // switch presentation behaviour between frames
+            age_device& get_device();                      // create resources of your own
+            age_job_system& get_job_system();              // run work on every core
+            age_upload_manager& get_upload_manager();      // stream data into device local resources
+            age_uniform_ring& get_uniform_ring();          // per-draw constants of the frame being recorded
+            age_bindless* get_bindless();                  // global descriptor heap, null when bindless is off
+            age_asset_pack* get_assets();                  // meshes, textures and shaders, null without a pack
+            age_pipeline_manager& get_pipelines();         // pipelines compiled in the background
+            age_compute& get_compute();                    // record and submit async compute work
+            age_command_recorder& get_command_recorder();  // record the frame's draws on every core
+            age_gpu_profiler& get_gpu_profiler();          // GPU time of the frame and its passes
+            age_trace& get_trace();                        // timeline written to trace_path on shutdown
+            void add_frame_wait(TimelineWait wait);        // make the next frame wait for compute or upload results
+            void set_frame_callback(FrameCallback callback); // run at the start of every frame, before uploads are flushed
+            FrameStats get_frame_stats();                  // timing of the last finished frame
+            std::vector<InitStepTiming> get_startup_timings(); // every step of construction, device steps first
+            double get_startup_ms();                       // wall time of the constructor
 
         private:
             void _main_loop();
+            void _draw_frame();
+            void _recreate_swapchain();
+            void _create_command_buffers();
+            void _build_render_graph();
+            void _record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index);
 
             // Member fields
+            EngineConfig _config;
+            double _start_us;                              // when construction began
+            age_trace _trace;
+            age_job_system _jobs;  // first in, last out: every subsystem may use it
             age_window _window;
             age_device _device;
-            age_swapchain _swapchain;
+            const age_dispatch &_vk;
+            std::unique_ptr<age_swapchain> _swapchain;
+            std::unique_ptr<age_upload_manager> _upload_manager;
+            std::unique_ptr<age_uniform_ring> _uniform_ring;
+            std::unique_ptr<age_bindless> _bindless;
+            std::unique_ptr<age_asset_pack> _assets;
+            std::unique_ptr<age_pipeline_manager> _pipelines;
+            std::unique_ptr<age_compute> _compute;
+            std::unique_ptr<age_command_recorder> _recorder;
+            std::unique_ptr<age_gpu_profiler> _gpu_profiler;
+            std::unique_ptr<age_render_graph> _render_graph;
+            uint32_t _backbuffer;                          // graph resource for the acquired swapchain image
+            std::vector<VkCommandBuffer> _command_buffers; // one per frame in flight
+            std::vector<TimelineWait> _frame_waits;        // waits for the next frame's submission
+            uint64_t _frame_count;                         // frames submitted so far
+            FrameCallback _frame_callback;
+            FrameStats _frame_stats;
+            double _acquire_ms;                            // time the current frame spent waiting to acquire
+            std::vector<InitStepTiming> _startup_timings;
+            double _startup_ms;
  
             // Utils
             void _create_instance();
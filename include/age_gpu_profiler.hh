@@ -0,0 +1,81 @@
+#pragma once
+#ifndef AGE_GPU_PROFILER
+#define AGE_GPU_PROFILER
+
+#include "age_device.hh"
+#include "age_trace.hh"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // GPU time of one scope
+    struct GpuScopeResult {
+        const char *name;
+        uint32_t depth;       // nesting level, 0 for outermost scopes
+        double start_ms;      // from the first timestamp of the frame
+        double duration_ms;
+    };
+
+    // Measures GPU time of named scopes with timestamp queries
+    // Each frame in flight has its own query pool. A slot's results are read
+    // when the slot comes around again, by which point the swapchain has
+    // already waited for it, so reading never stalls. Results that are not
+    // ready anyway are dropped rather than waited for.
+    // Scope names must stay valid until the frame's results are read
+    class age_gpu_profiler {
+        public:
+            age_gpu_profiler(age_device &device, uint32_t frames_in_flight, uint32_t max_scopes = 256);
+            age_gpu_profiler(const age_gpu_profiler&) = delete;
+            age_gpu_profiler& operator= (const age_gpu_profiler&) = delete;
+            ~age_gpu_profiler();
+
+            void begin_frame(VkCommandBuffer command_buffer, uint32_t frame_slot); // read the slot's last results and reset its queries
+            uint32_t begin_scope(VkCommandBuffer command_buffer, const char *name);
+            void end_scope(VkCommandBuffer command_buffer, uint32_t scope);
+            void read_pending();                              // read every frame still holding results, call once the device is idle
+
+            void set_trace(age_trace *trace);                 // also export read back scopes to a trace
+            bool is_supported();                              // the graphics queue can write timestamps
+            const std::vector<GpuScopeResult>& get_results(); // scopes of the most recently read frame
+            uint64_t get_read_frames();                       // frames whose results were read, changes when get_results does
+            uint64_t get_dropped_frames();                    // frames whose results were not ready
+
+        private:
+            struct Scope {
+                const char *name;
+                uint32_t depth;
+                uint32_t begin_query;
+                uint32_t end_query;    // UINT32_MAX until the scope is ended
+            };
+
+            // Queries of one frame in flight
+            struct Frame {
+                VkQueryPool pool;
+                std::vector<Scope> scopes;
+                uint32_t query_count;   // queries written this frame
+                double cpu_start_us;    // when the frame was recorded, anchors it in the trace
+            };
+
+            void _read_results(Frame &frame);
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            bool _supported;
+            double _ns_per_tick;            // VkPhysicalDeviceLimits::timestampPeriod
+            uint64_t _tick_mask;            // only timestampValidBits of a timestamp are meaningful
+            uint32_t _max_queries;
+            std::vector<Frame> _frames;
+            uint32_t _current;
+            uint32_t _depth;                // open scopes in the current frame
+            std::vector<uint64_t> _ticks;   // readback scratch
+            std::vector<GpuScopeResult> _results;
+            uint64_t _read_frames;
+            uint64_t _dropped_frames;
+            age_trace *_trace;
+    };
+}
+
+#endif /* AGE_GPU_PROFILER */
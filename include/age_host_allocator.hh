@@ -0,0 +1,79 @@
+#pragma once
+#ifndef AGE_HOST_ALLOCATOR
+#define AGE_HOST_ALLOCATOR
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Host memory the driver used for one allocation scope
+    struct HostAllocationStats {
+        uint64_t live_count = 0;          // allocations not freed yet
+        uint64_t total_count = 0;         // allocations ever made, reallocations included
+        uint64_t pooled_count = 0;        // of those, served from a size class pool
+        uint64_t live_bytes = 0;          // bytes the driver asked for and still holds
+        uint64_t peak_bytes = 0;          // high-water mark of live_bytes
+        uint64_t internal_bytes = 0;      // memory the driver allocated itself and reported
+        uint64_t internal_peak_bytes = 0;
+    };
+
+    // VkAllocationCallbacks that track every host allocation the driver makes
+    // Small allocations are carved from arenas into power of two size classes
+    // and recycled through free lists, so the driver's constant churn of small
+    // objects never reaches malloc. Larger ones go straight to malloc. Arena
+    // memory is only returned when the allocator is destroyed, which must be
+    // after every object created with its callbacks.
+    // Safe to call from any thread
+    class age_host_allocator {
+        public:
+            static const uint32_t SCOPE_COUNT = 5; // VK_SYSTEM_ALLOCATION_SCOPE_COMMAND .. _INSTANCE
+
+            age_host_allocator();
+            age_host_allocator(const age_host_allocator&) = delete;
+            age_host_allocator& operator= (const age_host_allocator&) = delete;
+            ~age_host_allocator();
+
+            const VkAllocationCallbacks* get_callbacks();          // pass to every vkCreate*, vkDestroy*, vkAllocateMemory and vkFreeMemory
+            HostAllocationStats get_stats(VkSystemAllocationScope scope);
+            HostAllocationStats get_total_stats();                  // every scope added up, peaks are per scope sums
+            uint64_t get_arena_bytes();                             // memory reserved from the system for the pools
+
+        private:
+            // Placed right in front of every pointer handed to the driver
+            struct alignas(16) Header {
+                uint32_t size_class;   // NO_CLASS for allocations that went to malloc
+                uint32_t scope;
+                size_t size;           // bytes the driver asked for
+                size_t capacity;       // bytes usable from the returned pointer
+                size_t offset;         // returned pointer minus the start of the block
+            };
+
+            static const uint32_t CLASS_COUNT = 8;         // blocks of 64 B .. 8 KiB
+            static const size_t MIN_CLASS_SIZE = 64;
+            static const size_t ARENA_SIZE = 256 * 1024;
+            static const uint32_t NO_CLASS = UINT32_MAX;
+
+            static VKAPI_ATTR void* VKAPI_CALL _allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope);
+            static VKAPI_ATTR void* VKAPI_CALL _reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+            static VKAPI_ATTR void VKAPI_CALL _free(void *user_data, void *memory);
+            static VKAPI_ATTR void VKAPI_CALL _internal_allocation(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+            static VKAPI_ATTR void VKAPI_CALL _internal_free(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+            void* _allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+            void _release(void *memory);
+            void* _take_block(uint32_t size_class); // pop a free block or carve one (mutex held)
+
+            std::mutex _mutex;
+            void *_free_lists[CLASS_COUNT];         // singly linked through the first bytes of each block
+            std::vector<void*> _arenas;
+            size_t _arena_used;                     // bytes carved from the newest arena
+            HostAllocationStats _stats[SCOPE_COUNT];
+            VkAllocationCallbacks _callbacks;
+    };
+}
+
+#endif /* AGE_HOST_ALLOCATOR */
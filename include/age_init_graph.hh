@@ -0,0 +1,77 @@
+#pragma once
+#ifndef AGE_INIT_GRAPH
+#define AGE_INIT_GRAPH
+
+#include "age_job_system.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace age {
+
+    // How long one startup step took
+    struct InitStepTiming {
+        const char *name;
+        uint32_t thread;        // job system thread index that ran it, 0 for the calling thread
+        double start_ms;        // since the trace epoch
+        double duration_ms;
+    };
+
+    // Startup work as a graph of steps
+    // A step runs as soon as every step it depends on has finished. Steps
+    // that only build their own objects run on the job system's workers,
+    // steps that must stay on the calling thread run there in the order
+    // they become ready. The first exception a step throws is rethrown by
+    // run() once the steps already running have finished, and everything
+    // depending on the failed step is skipped
+    class age_init_graph {
+        public:
+            age_init_graph(age_job_system *jobs);  // null runs every step on the calling thread
+            age_init_graph(const age_init_graph&) = delete;
+            age_init_graph& operator= (const age_init_graph&) = delete;
+
+            uint32_t add_step(                      // returns the id later steps depend on
+                    const char *name,               // string literal, also names the profiler zone
+                    std::function<void()> step,
+                    std::vector<uint32_t> dependencies = {},
+                    bool main_thread = false);
+            void run();                             // run every step, returns when all are done
+
+            std::vector<InitStepTiming> get_timings(); // in the order the steps finished
+            double get_total_ms();                  // wall time of run()
+            std::string get_report();               // one line per step, for the log
+
+        private:
+            struct Step {
+                const char *name;
+                std::function<void()> function;
+                std::vector<uint32_t> dependents;
+                uint32_t remaining;                 // dependencies not finished yet
+                bool main_thread;
+                bool skipped;                       // a dependency failed
+            };
+
+            void _ready(uint32_t id);               // queue a step whose dependencies are done (mutex held)
+            void _execute(uint32_t id);
+            void _finish(uint32_t id, bool failed);
+
+            age_job_system *_jobs;
+            std::vector<Step> _steps;
+
+            std::mutex _mutex;
+            std::condition_variable _changed;       // a step finished or became ready for the calling thread
+            std::deque<uint32_t> _main_ready;       // steps waiting for the calling thread
+            uint32_t _finished;
+            std::exception_ptr _error;
+            std::vector<InitStepTiming> _timings;
+            double _total_ms;
+    };
+}
+
+#endif /* AGE_INIT_GRAPH */
@@ -0,0 +1,130 @@
+#pragma once
+#ifndef AGE_JOB_SYSTEM
+#define AGE_JOB_SYSTEM
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace age {
+    struct age_job;
+
+    // Counts jobs that have not finished yet
+    // A counter is attached to jobs when they are run and reaches
+    // zero once all of them are done. Jobs can also be held back until
+    // a counter reaches zero, which is how dependencies are expressed.
+    // Do not add jobs to a counter again until waiting on it returned
+    // A job that throws still counts as done, the first exception is
+    // rethrown by waiting on the counter
+    class age_job_counter {
+        public:
+            age_job_counter();
+            age_job_counter(const age_job_counter&) = delete;
+            age_job_counter& operator= (const age_job_counter&) = delete;
+
+            bool is_done();          // all jobs attached to the counter have finished
+            uint32_t get_value();    // jobs still pending
+
+        private:
+            friend class age_job_system;
+
+            std::atomic<uint32_t> _value;
+            std::mutex _mutex;                // guards the waiting jobs and the exception
+            std::vector<age_job*> _waiting;   // jobs that run once the counter reaches zero
+            std::exception_ptr _exception;    // first exception thrown by one of the jobs
+    };
+
+    // Chase-Lev work-stealing deque
+    // The owning worker pushes and pops at the bottom without locks,
+    // other threads steal from the top
+    class age_job_deque {
+        public:
+            age_job_deque();
+            age_job_deque(const age_job_deque&) = delete;
+            age_job_deque& operator= (const age_job_deque&) = delete;
+            ~age_job_deque();
+
+            void push(age_job *job); // owner only
+            age_job* pop();          // owner only, nullptr if empty
+            age_job* steal();        // any thread, nullptr if empty or lost a race
+
+        private:
+            // Circular array, replaced with a larger copy when full
+            // Old arrays are kept until destruction because a thief may still read them
+            struct Array {
+                int64_t capacity;
+                std::unique_ptr<std::atomic<age_job*>[]> slots;
+
+                Array(int64_t size);
+                age_job* get(int64_t index);
+                void put(int64_t index, age_job *job);
+            };
+
+            Array* _grow(Array *array, int64_t bottom, int64_t top);
+
+            alignas(64) std::atomic<int64_t> _top;     // steal end, kept on its own cache line
+            alignas(64) std::atomic<int64_t> _bottom;  // owner end
+            std::atomic<Array*> _array;
+            std::vector<std::unique_ptr<Array>> _arrays; // every array ever used, owned by the deque
+    };
+
+    // Runs jobs on a pool of worker threads, one per core
+    // Every worker owns a deque and steals from the others when it runs
+    // dry. Threads outside the pool push into a shared injection queue.
+    // Waiting on a counter executes other jobs instead of blocking, so
+    // jobs may wait for jobs they spawned
+    class age_job_system {
+        public:
+            age_job_system(uint32_t worker_count = 0); // 0 uses one worker per core, minus the calling thread
+            age_job_system(const age_job_system&) = delete;
+            age_job_system& operator= (const age_job_system&) = delete;
+            ~age_job_system();
+
+            void run(                                    // queue a job
+                    std::function<void()> function,
+                    age_job_counter *counter = nullptr,     // counter to decrement when the job is done
+                    age_job_counter *dependency = nullptr); // counter that must reach zero before the job runs
+            void wait(age_job_counter &counter);         // run jobs until the counter reaches zero, rethrows a job's exception
+            void parallel_for(                           // split [0, count) into ranges of grain items and run them in parallel
+                    uint32_t count,
+                    uint32_t grain,
+                    const std::function<void(uint32_t begin, uint32_t end)> &function);
+
+            uint32_t get_worker_count();
+            uint32_t get_thread_count();  // workers plus the one slot shared by outside threads
+            static uint32_t get_thread_index(); // 1..N on workers, 0 on every other thread
+
+        private:
+            struct Worker {
+                age_job_deque deque;
+                std::thread thread;
+            };
+
+            void _worker_loop(uint32_t index);
+            void _schedule(age_job *job);       // make a job runnable
+            age_job* _find_job();               // own deque, then injection queue, then steal
+            void _execute(age_job *job);
+            void _finish(age_job_counter *counter);
+
+            std::vector<std::unique_ptr<Worker>> _workers;
+
+            std::mutex _injection_mutex;
+            std::deque<age_job*> _injection;    // jobs queued by threads outside the pool
+
+            // Idle workers sleep until a job is queued
+            std::mutex _sleep_mutex;
+            std::condition_variable _wake;
+            std::atomic<int64_t> _queued;       // runnable jobs not yet taken
+            std::atomic<uint32_t> _sleeping;
+            std::atomic<bool> _stop;
+    };
+}
+
+#endif /* AGE_JOB_SYSTEM */
@@ -0,0 +1,94 @@
+#pragma once
+#ifndef AGE_LOG
+#define AGE_LOG
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace age {
+
+    enum class LogSeverity {
+        verbose,
+        info,
+        warning,
+        error
+    };
+
+    // Logs from any thread without blocking on I/O
+    // Messages are pushed onto a lock-free queue and written by a background
+    // thread. Messages that carry a key (validation message IDs) are shown a
+    // few times and then only counted, with the counts reported periodically.
+    // Output is rate limited, errors are never dropped by the limit.
+    class age_log {
+        public:
+            static const uint32_t REPEATS_SHOWN = 3;      // messages with the same key written before they are only counted
+            static const uint32_t LINES_PER_SECOND = 100; // lines written per second before the rest are dropped
+
+            static age_log& get();
+
+            void write(LogSeverity severity, const char *tag, std::string message, uint64_t key = 0); // key 0 is never deduplicated
+            bool is_enabled(LogSeverity severity);        // check before building an expensive message
+            void set_min_severity(LogSeverity severity);  // messages below it are discarded by the caller
+            void set_output(std::FILE *file);             // stderr by default
+            void flush();                                 // block until everything written so far is out
+
+        private:
+            // Queue node, the queue always holds one node that was already consumed
+            struct Message {
+                LogSeverity severity;
+                const char *tag;                  // string literal
+                std::string text;
+                uint64_t key;
+                std::atomic<Message*> next;
+            };
+
+            // What the writer knows about a key
+            struct KeyState {
+                std::string tag;
+                std::string text;                 // first message seen, used in the summary
+                uint64_t count;                   // times seen
+                uint64_t reported;                // count at the last summary
+            };
+
+            age_log();
+            ~age_log();
+
+            void _push(Message *message);         // any thread
+            Message* _pop();                      // writer thread only
+            void _run();                          // writer thread body
+            void _wake_writer();
+            void _drain();
+            void _emit(const Message &message);
+            void _report_repeats();
+            bool _take_line();                    // rate limit
+
+            alignas(64) std::atomic<Message*> _head; // producers swap themselves in here
+            alignas(64) Message *_tail;              // consumed end, owned by the writer
+            std::atomic<uint64_t> _pushed;
+            std::atomic<int> _min_severity;
+
+            std::mutex _writer_mutex;
+            std::condition_variable _writer_wake;
+            std::condition_variable _flushed;
+            std::thread _writer;
+            bool _running;
+            bool _wake;                              // write now instead of at the next tick
+            uint64_t _written;                       // messages the writer has handled
+            std::atomic<std::FILE*> _output;
+
+            // Writer thread state
+            std::unordered_map<uint64_t, KeyState> _keys;
+            double _last_report_us;
+            double _window_start_us;
+            uint32_t _window_lines;                  // lines written in the current one second window
+            uint64_t _rate_dropped;                  // messages dropped since the last notice
+    };
+}
+
+#endif /* AGE_LOG */
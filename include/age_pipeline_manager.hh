@@ -0,0 +1,151 @@
+#pragma once
+#ifndef AGE_PIPELINE_MANAGER
+#define AGE_PIPELINE_MANAGER
+
+#include "age_device.hh"
+#include "age_dispatch.hh"
+#include "age_job_system.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    struct ComputePipelineDesc {
+        std::string shader_path;                    // SPIR-V file
+        std::string entry_point = "main";
+        VkPipelineLayout layout = VK_NULL_HANDLE;   // owned by the caller, must outlive the pipeline
+    };
+
+    // Graphics pipeline with dynamic viewport and scissor
+    struct GraphicsPipelineDesc {
+        std::string vertex_shader_path;
+        std::string fragment_shader_path;           // empty for depth only passes
+        std::string entry_point = "main";
+        VkPipelineLayout layout = VK_NULL_HANDLE;   // owned by the caller, must outlive the pipeline
+        VkRenderPass render_pass = VK_NULL_HANDLE;  // a compatible render pass is enough
+        uint32_t subpass = 0;
+
+        std::vector<VkVertexInputBindingDescription> vertex_bindings;
+        std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+        VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+        VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+        bool depth_test = true;
+        bool depth_write = true;
+        VkCompareOp depth_compare = VK_COMPARE_OP_LESS_OR_EQUAL;
+        bool alpha_blend = false;                   // premultiplied alpha on every color attachment
+        uint32_t color_attachment_count = 1;
+    };
+
+    enum class PipelineState {
+        building,   // first build still running, get() serves the fallback
+        ready,
+        failed,     // first build failed, get() keeps serving the fallback
+    };
+
+    struct PipelineManagerStats {
+        uint32_t pipeline_count = 0;        // distinct pipelines
+        uint32_t ready_count = 0;
+        uint32_t failed_count = 0;
+        uint32_t pending_builds = 0;        // queued or running on the job system
+        uint64_t request_count = 0;         // create_compute and create_graphics calls
+        uint64_t hit_count = 0;             // requests answered with an existing pipeline
+        double hit_rate = 0.0;              // hit_count / request_count
+        uint64_t build_count = 0;           // builds finished, successful or not
+        uint64_t reload_count = 0;          // pipelines replaced after a shader file changed
+        double last_build_ms = 0.0;         // reading the shaders and compiling the last pipeline
+        double max_build_ms = 0.0;
+        double total_build_ms = 0.0;        // summed over workers, not wall time
+    };
+
+    // Builds pipelines on the job system
+    // Creating a pipeline returns a handle right away. Its SPIR-V is read
+    // and the pipeline compiled against the device's pipeline cache on a
+    // worker; until that is done get() hands out the fallback pipeline
+    // given at creation, or null when there is none and the draw has to
+    // be skipped. A fallback must be compatible with the pipeline it
+    // stands in for (same layout and render pass).
+    //
+    // With hot reload on, the directories of every shader are watched with
+    // inotify. update() picks up changed files and rebuilds the pipelines
+    // that use them in the background; the new pipeline replaces the old
+    // one once it is compiled and the old one is destroyed after the
+    // frames using it have finished. A shader that fails to build leaves
+    // the previous pipeline in place.
+    //
+    // Requests are deduplicated by a hash of the whole description, so
+    // materials asking for the same state share one handle and one
+    // VkPipeline, and only the first request pays for compilation. Shaders
+    // are identified by path. A repeated request keeps the fallback of the
+    // first one.
+    // Safe to call from any thread
+    class age_pipeline_manager {
+        public:
+            static const uint32_t INVALID_PIPELINE = UINT32_MAX;
+
+            age_pipeline_manager(age_device &device, age_job_system &jobs, bool hot_reload = false);
+            age_pipeline_manager(const age_pipeline_manager&) = delete;
+            age_pipeline_manager& operator= (const age_pipeline_manager&) = delete;
+            ~age_pipeline_manager();                    // waits for builds, the device must be idle
+
+            uint32_t create_compute(const ComputePipelineDesc &desc, uint32_t fallback = INVALID_PIPELINE);
+            uint32_t create_graphics(const GraphicsPipelineDesc &desc, uint32_t fallback = INVALID_PIPELINE);
+            VkPipeline get(uint32_t handle);            // the pipeline, else its fallback, else null
+            PipelineState get_state(uint32_t handle);
+            void wait_idle();                           // block until no build is pending
+            void update();                              // rebuild pipelines whose shaders changed, once per frame
+            PipelineManagerStats get_stats();
+
+        private:
+            struct Pipeline {
+                bool compute;
+                ComputePipelineDesc compute_desc;
+                GraphicsPipelineDesc graphics_desc;
+                uint32_t fallback;
+                VkPipeline pipeline;
+                PipelineState state;
+                bool building;          // a build is queued or running
+                bool rebuild;           // a shader changed while building, build again when done
+            };
+
+            static uint64_t _hash(const Pipeline &pipeline);
+            static bool _same_desc(const Pipeline &a, const Pipeline &b);
+
+            uint32_t _add(Pipeline pipeline, const std::vector<std::string> &shader_paths);
+            void _schedule(uint32_t handle);            // (mutex held)
+            void _run_inline();                         // run builds queued while there are no workers
+            void _build(uint32_t handle);               // job body
+            VkPipeline _compile(const Pipeline &pipeline);
+            VkShaderModule _create_shader_module(const std::string &path);
+            void _watch(uint32_t handle, const std::string &path); // (mutex held)
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            age_job_system &_jobs;
+
+            std::mutex _mutex;
+            std::condition_variable _idle;              // signaled when the last pending build finishes
+            std::deque<Pipeline> _pipelines;            // deque so that builds can hold references while more are added
+            std::unordered_multimap<uint64_t, uint32_t> _by_hash; // handles by description hash
+            uint32_t _pending_builds;
+            std::deque<uint32_t> _inline_builds;        // builds for the caller when the job system has no workers
+            PipelineManagerStats _stats;
+
+            // Hot reload
+            int _inotify_fd;                                     // -1 when hot reload is off
+            std::map<int, std::string> _watched_directories;     // by inotify watch descriptor
+            std::map<std::string, std::vector<uint32_t>> _users; // pipelines by shader path, as directory/name
+    };
+}
+
+#endif /* AGE_PIPELINE_MANAGER */
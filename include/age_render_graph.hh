@@ -0,0 +1,185 @@
+#pragma once
+#ifndef AGE_RENDER_GRAPH
+#define AGE_RENDER_GRAPH
+
+#include "age_device.hh"
+#include "age_allocator.hh"
+#include "age_gpu_profiler.hh"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // How a pass uses an image
+    // Decides the layout, pipeline stages and access the graph syncs on
+    enum class ResourceUsage {
+        color_attachment,
+        depth_attachment,
+        sampled,         // read in fragment or compute shaders
+        storage,         // read or written as a storage image
+        transfer_src,
+        transfer_dst
+    };
+
+    // Description of an image the graph creates and owns
+    struct TransientImageDesc {
+        VkFormat format;
+        VkExtent2D extent;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        VkImageUsageFlags usage = 0; // extra usage, the declared uses are added automatically
+    };
+
+    // What the last compile produced
+    struct RenderGraphStats {
+        uint32_t pass_count = 0;           // passes added
+        uint32_t culled_pass_count = 0;    // passes whose output nothing used
+        uint32_t barrier_count = 0;        // vkCmdPipelineBarrier calls per execution
+        uint32_t image_barrier_count = 0;  // image barriers per execution
+        VkDeviceSize transient_bytes = 0;  // memory the transient images would need on their own
+        VkDeviceSize allocated_bytes = 0;  // memory they use with aliasing
+    };
+
+    // The CPU-only planning steps of compile() work on these, so they
+    // can be checked without a device
+
+    // A pass reading or writing an image
+    struct PassAccess {
+        uint32_t resource;
+        bool write;
+    };
+
+    // A transient image's memory and the live passes that use it
+    struct TransientLifetime {
+        VkMemoryRequirements requirements;
+        int32_t first_pass;
+        int32_t last_pass;
+    };
+
+    // Where a transient image is placed
+    struct TransientPlacement {
+        uint32_t group;         // memory block, one per compatible set of memory types
+        VkDeviceSize offset;    // offset in that block
+    };
+
+    // Frame graph of passes over images
+    // Passes declare which images they read and write. compile() drops
+    // passes that do not contribute to an imported image, works out the
+    // barriers between passes (batched into one call per pass), and places
+    // transient images whose lifetimes do not overlap in the same memory.
+    // Build and compile once, then execute every frame, updating imported
+    // images (like the swapchain image) with set_imported_image
+    class age_render_graph {
+        public:
+            using PassExecute = std::function<void(VkCommandBuffer command_buffer, age_render_graph &graph)>;
+
+            age_render_graph(age_device &device);
+            age_render_graph(const age_render_graph&) = delete;
+            age_render_graph& operator= (const age_render_graph&) = delete;
+            ~age_render_graph();
+
+            uint32_t create_image(const std::string &name, const TransientImageDesc &desc); // image owned by the graph
+            uint32_t import_image(                             // image owned elsewhere
+                    const std::string &name,
+                    VkImageAspectFlags aspect,
+                    VkImageLayout initial_layout,              // layout the image is in before the graph runs
+                    VkImageLayout final_layout);               // layout it is left in
+            void set_imported_image(uint32_t resource, VkImage image, VkImageView view = VK_NULL_HANDLE);
+
+            uint32_t add_pass(const std::string &name, PassExecute execute);
+            void read(uint32_t pass, uint32_t resource, ResourceUsage usage);
+            void write(uint32_t pass, uint32_t resource, ResourceUsage usage);
+
+            void compile();                                    // cull, alias and plan barriers
+            void execute(VkCommandBuffer command_buffer);      // record every live pass with its barriers
+            void set_profiler(age_gpu_profiler *profiler);     // time every pass on the GPU
+
+            VkImage get_image(uint32_t resource);
+            VkImageView get_image_view(uint32_t resource);
+            RenderGraphStats get_stats();
+
+            static std::vector<bool> cull_passes(               // which passes contribute to an imported image
+                    const std::vector<std::vector<PassAccess>> &passes,
+                    const std::vector<bool> &imported);         // by resource
+            static std::vector<VkMemoryRequirements> place_transients( // alias images with disjoint lifetimes, returns every block's requirements
+                    const std::vector<TransientLifetime> &images,
+                    std::vector<TransientPlacement> &placements);
+
+        private:
+            // Pipeline state an image is left in
+            struct State {
+                VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                VkPipelineStageFlags write_stages = 0;  // stages of the last write
+                VkAccessFlags write_access = 0;
+                VkPipelineStageFlags read_stages = 0;   // stages that read since the last write
+                VkAccessFlags read_access = 0;
+            };
+
+            struct Resource {
+                std::string name;
+                bool imported;
+                TransientImageDesc desc;
+                VkImageLayout initial_layout;
+                VkImageLayout final_layout;
+                VkImageUsageFlags usage;         // accumulated from the declared uses
+                VkImage image;
+                VkImageView view;
+                uint32_t group;                  // memory block the image is placed in
+                VkDeviceSize offset;             // offset in that block
+                VkMemoryRequirements requirements;
+                int32_t first_pass;              // lifetime over live passes, -1 if unused
+                int32_t last_pass;
+            };
+
+            struct Use {
+                uint32_t resource;
+                ResourceUsage usage;
+                bool write;
+            };
+
+            struct Barrier {
+                uint32_t resource;
+                VkImageLayout old_layout;
+                VkImageLayout new_layout;
+                VkAccessFlags src_access;
+                VkAccessFlags dst_access;
+            };
+
+            // Barriers recorded before a pass (or after the last one)
+            struct BarrierBatch {
+                VkPipelineStageFlags src_stages = 0;
+                VkPipelineStageFlags dst_stages = 0;
+                std::vector<Barrier> barriers;
+            };
+
+            struct Pass {
+                std::string name;
+                PassExecute execute;
+                std::vector<Use> uses;
+                bool alive;
+                BarrierBatch barriers;
+            };
+
+            void _cull();
+            void _allocate_transients();
+            void _plan_barriers();
+            void _simulate(std::vector<State> &states, bool record); // walk the live passes tracking image states
+            void _destroy_transients();
+            void _record_batch(VkCommandBuffer command_buffer, const BarrierBatch &batch);
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            std::vector<Resource> _resources;
+            std::vector<Pass> _passes;
+            BarrierBatch _final_barriers;       // move imported images to their final layout
+            std::vector<age_allocation> _memory; // blocks shared by transient images, one per compatible memory type set
+            bool _compiled;
+            RenderGraphStats _stats;
+            age_gpu_profiler *_profiler;
+    };
+}
+
+#endif /* AGE_RENDER_GRAPH */
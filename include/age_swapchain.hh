@@ -7,34 +7,82 @@
 #include <vector>
 
 namespace age {
+    // What the presentation should be optimized for.
+    // Each policy picks a present mode (falling back to FIFO, which is
+    // always available) and how many images the swapchain holds
+    enum class PresentPolicy {
+        low_latency,        // MAILBOX > FIFO_RELAXED > FIFO, shallow image queue
+        max_throughput,     // MAILBOX > IMMEDIATE > FIFO_RELAXED > FIFO, deep image queue
+        power_saving,       // FIFO with as few images as allowed
+        uncapped_benchmark  // IMMEDIATE > MAILBOX > FIFO_RELAXED > FIFO, never waits for vblank
+    };
+
     class age_swapchain {
         public:
-            age_swapchain(age_device &device, VkExtent2D extent);
+            age_swapchain(
+                    age_device &device,
+                    VkExtent2D extent,
+                    uint32_t frames_in_flight = 2,
+                    PresentPolicy policy = PresentPolicy::low_latency);
             age_swapchain(const age_swapchain&) = delete;
             age_swapchain& operator= (const age_swapchain&) = delete;
             ~age_swapchain();
 
-        private:
+            void recreate(VkExtent2D extent);                   // rebuild the swapchain without waiting for the device to idle
+            void set_present_policy(PresentPolicy policy);      // switch policy, recreating the swapchain if it changes
+            VkResult acquire_next_image(uint32_t *image_index); // wait for the current frame slot and acquire an image
+            VkResult submit_command_buffers(                    // submit the frame's work and present the image
+                    const VkCommandBuffer *buffers,
+                    uint32_t buffer_count,
+                    uint32_t image_index,
+                    const std::vector<TimelineWait> &waits = {}); // timeline values the frame's work depends on
 
+            uint32_t get_frames_in_flight(); // number of frames the CPU may record ahead of the GPU
+            uint32_t get_current_frame();    // index of the frame slot being recorded
+            uint32_t get_image_count();
+            VkImage get_image(uint32_t index);
+            VkImageView get_image_view(uint32_t index);
+            VkFormat get_image_format();
+            VkExtent2D get_extent();
+            PresentPolicy get_present_policy();
+            VkPresentModeKHR get_present_mode(); // mode the policy resolved to on this surface
+
+        private:
             VkSurfaceFormatKHR _choose_swap_surface_format(
                     const std::vector<VkSurfaceFormatKHR>& available_formats);
             VkPresentModeKHR _choose_swap_present_mode(
                     const std::vector<VkPresentModeKHR>& available_present_modes);
             VkExtent2D _choose_swap_extent(
                     const VkSurfaceCapabilitiesKHR& capabilities);
+            uint32_t _choose_image_count(
+                    const VkSurfaceCapabilitiesKHR& capabilities,
+                    VkPresentModeKHR present_mode);
 
             void _init();
-            void _create_swapchain();
-            void _create_image_views();
+            void _create_swapchain(VkSwapchainKHR old_swapchain);
+            void _create_image_view(uint32_t index);
+            void _create_sync_objects();
+            void _create_present_semaphores();
 
             // Member fields
             age_device& _device;
+            const age_dispatch& _vk;
             VkExtent2D _extent;
+            PresentPolicy _policy;
+            VkPresentModeKHR _present_mode;
             VkSwapchainKHR _swapchain;
             VkFormat _swapchain_image_format;
             VkExtent2D _swapchain_extent;
             std::vector<VkImage> _swapchain_images;
-            std::vector<VkImageView> _swapchain_image_views;
+            std::vector<VkImageView> _swapchain_image_views; // created the first time each image is acquired
+
+            // Frame synchronization
+            uint32_t _frames_in_flight;                     // number of frame slots
+            uint32_t _current_frame;                        // frame slot currently being recorded
+            std::vector<VkSemaphore> _image_available;      // per frame: signaled when the acquired image can be written
+            std::vector<VkSemaphore> _render_finished;      // per image: signaled when the image can be presented
+            std::vector<VkFence> _in_flight_fences;         // per frame: signaled when the GPU is done with the frame slot
+            std::vector<VkFence> _images_in_flight;         // per image: fence of the frame that last used the image
     };
 }
 
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef AGE_TRACE
+#define AGE_TRACE
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace age {
+
+    // Tracks of a trace file
+    // Chrome trace viewers show each process id as a group of threads
+    enum TraceProcess : uint32_t {
+        TRACE_PROCESS_CPU = 1,
+        TRACE_PROCESS_GPU = 2
+    };
+
+    // A timed scope on one track
+    struct TraceEvent {
+        std::string name;
+        const char *category;
+        uint32_t process;
+        uint32_t thread;
+        double start_us;      // microseconds since the trace epoch
+        double duration_us;
+    };
+
+    // Collects timed scopes and writes them in the Chrome trace event
+    // format, which chrome://tracing and ui.perfetto.dev both open
+    // Safe to call from any thread
+    class age_trace {
+        public:
+            age_trace();
+            age_trace(const age_trace&) = delete;
+            age_trace& operator= (const age_trace&) = delete;
+
+            void add_event(TraceEvent event);
+            void add_events(std::vector<TraceEvent> &events);   // moves a batch of events in under one lock
+            void set_track_name(uint32_t process, uint32_t thread, const std::string &name);
+            bool write(const std::string &path);                // false if the file could not be written
+            size_t get_event_count();
+
+            static double now_us();   // microseconds since the trace epoch on the steady clock
+
+        private:
+            struct TrackName {
+                uint32_t process;
+                uint32_t thread;
+                std::string name;
+            };
+
+            std::mutex _mutex;
+            std::vector<TraceEvent> _events;
+            std::vector<TrackName> _track_names;
+    };
+}
+
+#endif /* AGE_TRACE */
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef AGE_UNIFORM_RING
+#define AGE_UNIFORM_RING
+
+#include "age_device.hh"
+#include "age_allocator.hh"
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Space for one draw's constants, bound as a dynamic uniform buffer
+    struct UniformAllocation {
+        VkBuffer buffer = VK_NULL_HANDLE;   // buffer to bind, changes when the ring grows
+        uint32_t offset = 0;                // dynamic offset to pass to vkCmdBindDescriptorSets
+        void *data = nullptr;               // mapped memory to write the constants to
+    };
+
+    struct UniformRingStats {
+        VkDeviceSize frame_capacity = 0;    // bytes each frame may use before the ring grows
+        VkDeviceSize last_frame_bytes = 0;  // bytes used by the last finished frame, padding included
+        VkDeviceSize peak_frame_bytes = 0;  // most bytes any frame used
+        uint64_t last_frame_allocations = 0;
+        uint64_t grow_count = 0;            // times a frame overflowed and the ring was replaced
+    };
+
+    // Linear allocator for per-draw uniform data
+    // One persistently mapped, coherent buffer is split into a region per
+    // frame in flight. A frame's constants are bumped one after the other
+    // from the start of its region, aligned to minUniformBufferOffsetAlignment,
+    // and the whole region is reused once the frame slot comes around again.
+    //
+    // A frame that overflows its region replaces the buffer with one twice
+    // the size. The old buffer goes to the deletion queue, so allocations
+    // already handed out stay valid until the GPU is done with them.
+    // Descriptor sets must be rewritten when get_generation() changes.
+    // Safe to call from any thread
+    class age_uniform_ring {
+        public:
+            age_uniform_ring(age_device &device, uint32_t frames_in_flight, VkDeviceSize frame_capacity = 256 * 1024);
+            age_uniform_ring(const age_uniform_ring&) = delete;
+            age_uniform_ring& operator= (const age_uniform_ring&) = delete;
+            ~age_uniform_ring();
+
+            void begin_frame(uint32_t frame);               // the GPU must be done with the frame slot
+            UniformAllocation allocate(VkDeviceSize size);  // space for size bytes in the current frame
+
+            // Copy a value into the current frame
+            template<typename T>
+            UniformAllocation
+            push(const T &value) {
+                UniformAllocation allocation = this->allocate(sizeof(T));
+                std::memcpy(allocation.data, &value, sizeof(T));
+                return allocation;
+            }
+
+            VkBuffer get_buffer();
+            uint64_t get_generation();                      // bumped every time the buffer is replaced
+            VkDeviceSize get_alignment();
+            UniformRingStats get_stats();
+
+        private:
+            void _create_buffer(VkDeviceSize frame_capacity);
+            void _grow(VkDeviceSize size);                  // replace the buffer so size fits in a frame (mutex held)
+
+            age_device &_device;
+            std::mutex _mutex;
+            uint32_t _frames_in_flight;
+            VkDeviceSize _alignment;
+            VkDeviceSize _max_range;                        // largest range a uniform buffer descriptor may cover
+
+            VkBuffer _buffer;
+            age_allocation _allocation;
+            uint64_t _generation;
+
+            uint32_t _frame;                                // frame slot being written
+            VkDeviceSize _head;                             // next free byte in the slot's region
+            VkDeviceSize _frame_bytes;                      // bytes used by the frame so far, across growths
+            uint64_t _frame_allocations;
+            UniformRingStats _stats;
+    };
+}
+
+#endif /* AGE_UNIFORM_RING */
@@ -0,0 +1,86 @@
+#pragma once
+#ifndef AGE_UPLOAD_MANAGER
+#define AGE_UPLOAD_MANAGER
+
+#include "age_device.hh"
+#include "age_allocator.hh"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Streams data from the host into device local resources.
+    // Copies are staged in a persistently mapped ring buffer, recorded into
+    // a batch and submitted on the transfer queue, which signals a timeline
+    // semaphore when the batch is done. Consumers wait on that value
+    // (on the GPU or with is_complete) instead of stalling their queue.
+    //
+    // Destinations used by another queue family must be created with
+    // VK_SHARING_MODE_CONCURRENT, the manager does not transfer ownership.
+    // Safe to call from any thread
+    class age_upload_manager {
+        public:
+            age_upload_manager(age_device &device, VkDeviceSize staging_size = 32ull * 1024 * 1024);
+            age_upload_manager(const age_upload_manager&) = delete;
+            age_upload_manager& operator= (const age_upload_manager&) = delete;
+            ~age_upload_manager();
+
+            uint64_t upload_buffer(                     // copy data into a buffer, returns the value that signals completion
+                    VkBuffer dst,
+                    VkDeviceSize dst_offset,
+                    const void *data,
+                    VkDeviceSize size);
+            uint64_t upload_image(                      // copy tightly packed texels into mip 0 of a color image
+                    VkImage dst,
+                    VkExtent3D extent,
+                    const void *data,
+                    VkDeviceSize size,
+                    VkImageLayout final_layout);
+            uint64_t flush();                           // submit the recorded copies, returns the value that signals them
+            bool is_complete(uint64_t value);           // check without blocking if a value has been reached
+            void wait(uint64_t value);                  // block until a value has been reached
+
+            VkSemaphore get_semaphore();                // timeline semaphore signaled by the transfer queue
+            uint64_t get_completed_value();             // last value the transfer queue signaled
+
+        private:
+            // Copies that were submitted together
+            struct Batch {
+                VkCommandBuffer command_buffer;
+                uint64_t value;          // timeline value signaled when the batch is done
+                VkDeviceSize ring_end;   // staging space up to here is free once the batch is done
+            };
+
+            VkDeviceSize _reserve(VkDeviceSize size, VkDeviceSize alignment); // take staging space, returns its offset in the ring
+            VkCommandBuffer _get_recording();   // command buffer of the open batch, begun on first use
+            uint64_t _flush();                  // submit the open batch (mutex held)
+            void _retire_completed();           // release staging space and command buffers of finished batches
+
+            age_device &_device;
+            const age_dispatch &_vk;
+            std::mutex _mutex;
+
+            // Staging ring
+            // _head and _tail only ever grow, their position in
+            // the ring is the value modulo the ring size
+            VkBuffer _staging_buffer;
+            age_allocation _staging_allocation;
+            VkDeviceSize _staging_size;
+            VkDeviceSize _head;                 // next free byte
+            VkDeviceSize _tail;                 // oldest byte still in use by the GPU
+
+            // Batches
+            VkCommandPool _command_pool;                        // pool on the transfer queue family
+            VkCommandBuffer _recording;                         // open batch, null if nothing is recorded
+            std::deque<Batch> _in_flight;                       // submitted batches, oldest first
+            std::vector<VkCommandBuffer> _free_command_buffers; // recycled from finished batches
+            VkSemaphore _timeline;
+            uint64_t _submitted_value;                          // value of the last submitted batch
+    };
+}
+
+#endif /* AGE_UPLOAD_MANAGER */
@@ -4,13 +4,14 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 #include <vulkan/vulkan_core.h>
 #include <GLFW/glfw3.h>
 
 namespace age {
     class age_window {
         public:
-            age_window(uint32_t width, uint32_t height, std::string name);
+            age_window(uint32_t width, uint32_t height, std::string name, bool headless = false);
             age_window(const age_window&) = delete;
             age_window& operator= (const age_window&) = delete;
             ~age_window();
@@ -18,14 +19,22 @@ namespace age {
             void open();
             void init_window();
             bool should_close();
+            void poll_events();
+            void wait_events();      // block until an event arrives, used while minimized
+            bool was_resized();      // the framebuffer size changed since the flag was last reset
+            void reset_resized_flag();
+            bool is_headless();
             VkExtent2D get_extent();
-            void create_window_surface(VkInstance instance, VkSurfaceKHR *surface);
+            std::vector<const char*> get_required_instance_extensions(); // instance extensions needed to create the surface
+            void create_window_surface(VkInstance instance, const VkAllocationCallbacks *allocation_callbacks, VkSurfaceKHR *surface);
 
         private:
-            // static void _resize_framebuffer_callback(GLFWwindow* window, int width, int height);
+            static void _resize_framebuffer_callback(GLFWwindow* window, int width, int height);
             uint32_t _width;
             uint32_t _height;
             std::string _name;
+            bool _headless;       // no GLFW window -- surface comes from VK_EXT_headless_surface
+            bool _framebuffer_resized;
             GLFWwindow* _window;
     };
 }
@@ -0,0 +1,619 @@
+#include "age_allocator.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+    static VkDeviceSize
+    align_up(VkDeviceSize value, VkDeviceSize alignment) {
+        return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+    }
+
+    static VkDeviceSize
+    align_down(VkDeviceSize value, VkDeviceSize alignment) {
+        return alignment > 1 ? value / alignment * alignment : value;
+    }
+
+    /// MEMORY BLOCK ///
+    /**********************************************
+     *                Public
+     *********************************************/
+    // Constructor //
+    // The whole block starts out as a single free range
+    age_memory_block::age_memory_block(VkDeviceMemory memory, VkDeviceSize size, void *mapped)
+    : _memory{memory}, _size{size}, _mapped{mapped}, _used{0}, _allocation_count{0}, _fl_bitmap{0} {
+        for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+            this->_sl_bitmap[fl] = 0;
+            for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+                this->_heads[fl][sl] = NIL;
+            }
+        }
+
+        uint32_t node = this->_new_node();
+        this->_nodes[node].offset = 0;
+        this->_nodes[node].size = size;
+        this->_insert_free(node);
+    }
+
+    // Carve an aligned range out of the block
+    // The search is done for size + alignment - 1 so that any range in the
+    // returned list can hold the request once its start has been aligned
+    bool
+    age_memory_block::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, uint32_t &node) {
+        if (size == 0) {
+            size = 1;
+        }
+
+        uint32_t fl, sl;
+        this->_mapping_search(size + (alignment > 1 ? alignment - 1 : 0), fl, sl);
+        if (fl >= FL_COUNT) {
+            return false;
+        }
+
+        uint32_t found = this->_find_free(fl, sl);
+        if (found == NIL) {
+            return false;
+        }
+        this->_remove_free(found);
+
+        // Give the alignment padding in front back to the free lists
+        VkDeviceSize padding = align_up(this->_nodes[found].offset, alignment) - this->_nodes[found].offset;
+        if (padding > 0) {
+            uint32_t tail = this->_split(found, padding);
+            this->_insert_free(found);
+            found = tail;
+        }
+
+        // Give the unused tail back to the free lists
+        if (this->_nodes[found].size > size) {
+            uint32_t tail = this->_split(found, size);
+            this->_insert_free(tail);
+        }
+
+        this->_nodes[found].free = false;
+        this->_used += this->_nodes[found].size;
+        this->_allocation_count++;
+
+        offset = this->_nodes[found].offset;
+        node = found;
+        return true;
+    }
+
+    // Return a range to the block, merging it with free neighbours
+    void
+    age_memory_block::free(uint32_t node) {
+        this->_used -= this->_nodes[node].size;
+        this->_allocation_count--;
+
+        uint32_t prev = this->_nodes[node].prev_phys;
+        if (prev != NIL && this->_nodes[prev].free) {
+            this->_remove_free(prev);
+            this->_merge(prev, node);
+            node = prev;
+        }
+
+        uint32_t next = this->_nodes[node].next_phys;
+        if (next != NIL && this->_nodes[next].free) {
+            this->_remove_free(next);
+            this->_merge(node, next);
+        }
+
+        this->_insert_free(node);
+    }
+
+    bool
+    age_memory_block::empty() {
+        return this->_allocation_count == 0;
+    }
+
+    VkDeviceSize
+    age_memory_block::get_size() {
+        return this->_size;
+    }
+
+    VkDeviceSize
+    age_memory_block::get_used() {
+        return this->_used;
+    }
+
+    uint32_t
+    age_memory_block::get_allocation_count() {
+        return this->_allocation_count;
+    }
+
+    VkDeviceMemory
+    age_memory_block::get_memory() {
+        return this->_memory;
+    }
+
+    void*
+    age_memory_block::get_mapped() {
+        return this->_mapped;
+    }
+
+    // The largest free range lives in the highest non-empty list,
+    // which only needs a scan of that one list
+    VkDeviceSize
+    age_memory_block::get_largest_free_range() {
+        if (this->_fl_bitmap == 0) {
+            return 0;
+        }
+
+        uint32_t fl = 63 - __builtin_clzll(this->_fl_bitmap);
+        uint32_t sl = 31 - __builtin_clz(this->_sl_bitmap[fl]);
+
+        VkDeviceSize largest = 0;
+        for (uint32_t node = this->_heads[fl][sl]; node != NIL; node = this->_nodes[node].next_free) {
+            largest = std::max(largest, this->_nodes[node].size);
+        }
+        return largest;
+    }
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Map a size to the list it is stored in
+    // Sizes below SL_COUNT share the first level, every other power of
+    // two is split linearly into SL_COUNT second level lists
+    void
+    age_memory_block::_mapping_insert(VkDeviceSize size, uint32_t &fl, uint32_t &sl) {
+        if (size < SL_COUNT) {
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+        } else {
+            uint32_t log2 = 63 - __builtin_clzll(size);
+            sl = static_cast<uint32_t>(size >> (log2 - SL_LOG2)) ^ SL_COUNT;
+            fl = log2 - SL_LOG2 + 1;
+        }
+    }
+
+    // Map a size to the first list whose ranges are all large enough
+    void
+    age_memory_block::_mapping_search(VkDeviceSize size, uint32_t &fl, uint32_t &sl) {
+        if (size >= SL_COUNT) {
+            uint32_t log2 = 63 - __builtin_clzll(size);
+            size += (1ull << (log2 - SL_LOG2)) - 1;
+        }
+        this->_mapping_insert(size, fl, sl);
+    }
+
+    // Find a non-empty list at or above (fl, sl) using the bitmaps
+    uint32_t
+    age_memory_block::_find_free(uint32_t &fl, uint32_t &sl) {
+        uint32_t sl_map = this->_sl_bitmap[fl] & (~0u << sl);
+        if (sl_map == 0) {
+            uint64_t fl_map = fl + 1 < FL_COUNT ? this->_fl_bitmap & (~0ull << (fl + 1)) : 0;
+            if (fl_map == 0) {
+                return NIL;
+            }
+
+            fl = __builtin_ctzll(fl_map);
+            sl_map = this->_sl_bitmap[fl];
+        }
+
+        sl = __builtin_ctz(sl_map);
+        return this->_heads[fl][sl];
+    }
+
+    void
+    age_memory_block::_insert_free(uint32_t node) {
+        uint32_t fl, sl;
+        this->_mapping_insert(this->_nodes[node].size, fl, sl);
+
+        uint32_t head = this->_heads[fl][sl];
+        this->_nodes[node].free = true;
+        this->_nodes[node].prev_free = NIL;
+        this->_nodes[node].next_free = head;
+        if (head != NIL) {
+            this->_nodes[head].prev_free = node;
+        }
+
+        this->_heads[fl][sl] = node;
+        this->_fl_bitmap |= 1ull << fl;
+        this->_sl_bitmap[fl] |= 1u << sl;
+    }
+
+    void
+    age_memory_block::_remove_free(uint32_t node) {
+        uint32_t fl, sl;
+        this->_mapping_insert(this->_nodes[node].size, fl, sl);
+
+        uint32_t prev = this->_nodes[node].prev_free;
+        uint32_t next = this->_nodes[node].next_free;
+        if (prev != NIL) {
+            this->_nodes[prev].next_free = next;
+        }
+        if (next != NIL) {
+            this->_nodes[next].prev_free = prev;
+        }
+
+        if (this->_heads[fl][sl] == node) {
+            this->_heads[fl][sl] = next;
+            if (next == NIL) {
+                this->_sl_bitmap[fl] &= ~(1u << sl);
+                if (this->_sl_bitmap[fl] == 0) {
+                    this->_fl_bitmap &= ~(1ull << fl);
+                }
+            }
+        }
+
+        this->_nodes[node].free = false;
+    }
+
+    uint32_t
+    age_memory_block::_split(uint32_t node, VkDeviceSize size) {
+        uint32_t tail = this->_new_node(); // may grow _nodes, so no references are held across it
+
+        this->_nodes[tail].offset = this->_nodes[node].offset + size;
+        this->_nodes[tail].size = this->_nodes[node].size - size;
+        this->_nodes[tail].prev_phys = node;
+        this->_nodes[tail].next_phys = this->_nodes[node].next_phys;
+        if (this->_nodes[node].next_phys != NIL) {
+            this->_nodes[this->_nodes[node].next_phys].prev_phys = tail;
+        }
+
+        this->_nodes[node].next_phys = tail;
+        this->_nodes[node].size = size;
+        return tail;
+    }
+
+    void
+    age_memory_block::_merge(uint32_t left, uint32_t right) {
+        this->_nodes[left].size += this->_nodes[right].size;
+        this->_nodes[left].next_phys = this->_nodes[right].next_phys;
+        if (this->_nodes[right].next_phys != NIL) {
+            this->_nodes[this->_nodes[right].next_phys].prev_phys = left;
+        }
+
+        this->_free_nodes.push_back(right);
+    }
+
+    uint32_t
+    age_memory_block::_new_node() {
+        uint32_t node;
+        if (!this->_free_nodes.empty()) {
+            node = this->_free_nodes.back();
+            this->_free_nodes.pop_back();
+        } else {
+            node = static_cast<uint32_t>(this->_nodes.size());
+            this->_nodes.emplace_back();
+        }
+
+        this->_nodes[node] = Node{0, 0, NIL, NIL, NIL, NIL, false};
+        return node;
+    }
+
+
+    /// ALLOCATOR ///
+    /**********************************************
+     *                Public
+     *********************************************/
+    // Constructor //
+    // Blocks are capped at an eighth of their heap so small heaps
+    // (e.g. the host visible BAR window) are not exhausted by one block
+    age_allocator::age_allocator(
+            VkPhysicalDevice physical_device,
+            VkDevice device,
+            const age_dispatch &dispatch,
+            const VkAllocationCallbacks *allocation_callbacks,
+            VkDeviceSize block_size)
+    : _device{device}, _vk{dispatch}, _allocation_callbacks{allocation_callbacks}, _dedicated_count{0}, _dedicated_bytes{0} {
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(physical_device, &properties);
+        this->_vk.vkGetPhysicalDeviceMemoryProperties(physical_device, &this->_memory_properties);
+
+        this->_buffer_image_granularity = properties.limits.bufferImageGranularity;
+        this->_non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+
+        for (uint32_t i = 0; i < this->_memory_properties.memoryTypeCount; i++) {
+            VkDeviceSize heap_size = this->_memory_properties.memoryHeaps[this->_memory_properties.memoryTypes[i].heapIndex].size;
+            this->_block_size[i] = std::min(block_size, align_up(heap_size / 8, 1024 * 1024));
+        }
+    }
+
+    // Destructor //
+    // Everything handed out should have been freed by now, the blocks
+    // themselves are returned to the driver here
+    age_allocator::~age_allocator() {
+        for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+            for (Pool &pool : this->_pools[i]) {
+                for (std::unique_ptr<age_memory_block> &block : pool.blocks) {
+                    this->_vk.vkFreeMemory(this->_device, block->get_memory(), this->_allocation_callbacks);
+                }
+                pool.blocks.clear();
+            }
+        }
+    }
+
+    // Allocate memory that satisfies the requirements
+    // Large requests get their own memory object, everything else
+    // is sub-allocated from a block of the matching memory type
+    age_allocation
+    age_allocator::allocate(
+            const VkMemoryRequirements &requirements,
+            VkMemoryPropertyFlags properties,
+            AllocationKind kind,
+            bool dedicated) {
+        uint32_t memory_type = this->find_memory_type(requirements.memoryTypeBits, properties);
+        VkDeviceSize block_size = this->_block_size[memory_type];
+
+        if (dedicated || requirements.size > block_size / 2) {
+            return this->_allocate_dedicated(requirements.size, memory_type);
+        }
+
+        age_allocation allocation;
+        allocation.size = requirements.size;
+        allocation.memory_type = memory_type;
+        allocation.kind = kind;
+
+        Pool &pool = this->_get_pool(memory_type, kind);
+        std::lock_guard<std::mutex> lock(pool.mutex);
+
+        age_memory_block *block = nullptr;
+        for (std::unique_ptr<age_memory_block> &candidate : pool.blocks) {
+            if (candidate->allocate(requirements.size, requirements.alignment, allocation.offset, allocation.node)) {
+                block = candidate.get();
+                break;
+            }
+        }
+
+        if (block == nullptr) {
+            void *mapped = nullptr;
+            VkDeviceMemory memory = this->_allocate_memory(block_size, memory_type, &mapped);
+            if (memory == VK_NULL_HANDLE) {
+                // Not enough room for another block, the request may still fit on its own
+                return this->_allocate_dedicated(requirements.size, memory_type);
+            }
+
+            pool.blocks.push_back(std::make_unique<age_memory_block>(memory, block_size, mapped));
+            block = pool.blocks.back().get();
+            if (!block->allocate(requirements.size, requirements.alignment, allocation.offset, allocation.node)) {
+                throw std::runtime_error("Error: allocation does not fit in a new memory block");
+            }
+        }
+
+        allocation.memory = block->get_memory();
+        allocation.block = block;
+        if (block->get_mapped() != nullptr) {
+            allocation.mapped = static_cast<char*>(block->get_mapped()) + allocation.offset;
+        }
+        return allocation;
+    }
+
+    // Return memory to its block, or to the driver for dedicated allocations
+    // An empty block is released as long as another block of its pool remains
+    void
+    age_allocator::free(age_allocation &allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) {
+            return;
+        }
+
+        if (allocation.dedicated) {
+            this->_vk.vkFreeMemory(this->_device, allocation.memory, this->_allocation_callbacks);
+
+            std::lock_guard<std::mutex> lock(this->_dedicated_mutex);
+            this->_dedicated_count--;
+            this->_dedicated_bytes -= allocation.size;
+        } else {
+            Pool &pool = this->_get_pool(allocation.memory_type, allocation.kind);
+            std::lock_guard<std::mutex> lock(pool.mutex);
+
+            allocation.block->free(allocation.node);
+            if (allocation.block->empty() && pool.blocks.size() > 1) {
+                auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                        [&](const std::unique_ptr<age_memory_block> &block) { return block.get() == allocation.block; });
+                this->_vk.vkFreeMemory(this->_device, allocation.block->get_memory(), this->_allocation_callbacks);
+                pool.blocks.erase(it);
+            }
+        }
+
+        allocation = age_allocation{};
+    }
+
+    // Flush host writes to a non-coherent allocation
+    // The range is widened to nonCoherentAtomSize as the spec requires
+    void
+    age_allocator::flush(const age_allocation &allocation, VkDeviceSize offset, VkDeviceSize size) {
+        VkMemoryPropertyFlags flags = this->_memory_properties.memoryTypes[allocation.memory_type].propertyFlags;
+        if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+            return;
+        }
+
+        VkDeviceSize memory_size = allocation.dedicated ? allocation.size : allocation.block->get_size();
+        VkDeviceSize begin = align_down(allocation.offset + offset, this->_non_coherent_atom_size);
+        VkDeviceSize end = align_up(allocation.offset + offset + size, this->_non_coherent_atom_size);
+
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = allocation.memory;
+        range.offset = begin;
+        range.size = end > memory_size ? VK_WHOLE_SIZE : end - begin;
+        this->_vk.vkFlushMappedMemoryRanges(this->_device, 1, &range);
+    }
+
+    // Create a buffer and bind sub-allocated memory to it
+    void
+    age_allocator::create_buffer(
+            VkDeviceSize size,
+            VkBufferUsageFlags usage,
+            VkMemoryPropertyFlags properties,
+            VkBuffer &buffer,
+            age_allocation &allocation,
+            const std::vector<uint32_t> &queue_families) {
+        VkBufferCreateInfo buffer_info{};
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = size;
+        buffer_info.usage = usage;
+
+        // Buffers used from several queue families are shared concurrently
+        // so that no ownership transfer barriers are needed
+        std::vector<uint32_t> families;
+        for (uint32_t family : queue_families) {
+            if (std::find(families.begin(), families.end(), family) == families.end()) {
+                families.push_back(family);
+            }
+        }
+        if (families.size() > 1) {
+            buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            buffer_info.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+            buffer_info.pQueueFamilyIndices = families.data();
+        } else {
+            buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+
+        if (this->_vk.vkCreateBuffer(this->_device, &buffer_info, this->_allocation_callbacks, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create buffer");
+        }
+
+        VkMemoryRequirements requirements;
+        this->_vk.vkGetBufferMemoryRequirements(this->_device, buffer, &requirements);
+
+        try {
+            allocation = this->allocate(requirements, properties, AllocationKind::linear);
+        } catch (...) {
+            this->_vk.vkDestroyBuffer(this->_device, buffer, this->_allocation_callbacks);
+            throw;
+        }
+        this->_vk.vkBindBufferMemory(this->_device, buffer, allocation.memory, allocation.offset);
+    }
+
+    void
+    age_allocator::destroy_buffer(VkBuffer buffer, age_allocation &allocation) {
+        this->_vk.vkDestroyBuffer(this->_device, buffer, this->_allocation_callbacks);
+        this->free(allocation);
+    }
+
+    // Create an image and bind sub-allocated memory to it
+    void
+    age_allocator::create_image(
+            const VkImageCreateInfo &image_info,
+            VkMemoryPropertyFlags properties,
+            VkImage &image,
+            age_allocation &allocation) {
+        if (this->_vk.vkCreateImage(this->_device, &image_info, this->_allocation_callbacks, &image) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create image");
+        }
+
+        VkMemoryRequirements requirements;
+        this->_vk.vkGetImageMemoryRequirements(this->_device, image, &requirements);
+
+        AllocationKind kind = image_info.tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationKind::optimal : AllocationKind::linear;
+        try {
+            allocation = this->allocate(requirements, properties, kind);
+        } catch (...) {
+            this->_vk.vkDestroyImage(this->_device, image, this->_allocation_callbacks);
+            throw;
+        }
+        this->_vk.vkBindImageMemory(this->_device, image, allocation.memory, allocation.offset);
+    }
+
+    void
+    age_allocator::destroy_image(VkImage image, age_allocation &allocation) {
+        this->_vk.vkDestroyImage(this->_device, image, this->_allocation_callbacks);
+        this->free(allocation);
+    }
+
+    // Find the first memory type allowed by the resource
+    // that has all of the requested properties
+    uint32_t
+    age_allocator::find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags properties) {
+        for (uint32_t i = 0; i < this->_memory_properties.memoryTypeCount; i++) {
+            if ((type_bits & (1u << i))
+                && (this->_memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("Error: failed to find a suitable memory type");
+    }
+
+    // Gather usage and fragmentation over every pool
+    AllocationStats
+    age_allocator::get_stats() {
+        AllocationStats stats;
+        VkDeviceSize free_bytes = 0;
+
+        for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+            for (Pool &pool : this->_pools[i]) {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                for (std::unique_ptr<age_memory_block> &block : pool.blocks) {
+                    stats.block_count++;
+                    stats.allocation_count += block->get_allocation_count();
+                    stats.reserved_bytes += block->get_size();
+                    stats.used_bytes += block->get_used();
+                    stats.largest_free_range = std::max(stats.largest_free_range, block->get_largest_free_range());
+                    free_bytes += block->get_size() - block->get_used();
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->_dedicated_mutex);
+            stats.dedicated_count = this->_dedicated_count;
+            stats.dedicated_bytes = this->_dedicated_bytes;
+        }
+
+        if (free_bytes > 0) {
+            stats.fragmentation = 1.0F - static_cast<float>(stats.largest_free_range) / static_cast<float>(free_bytes);
+        }
+        return stats;
+    }
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Linear and optimal resources only need separate pools when the
+    // device actually has a buffer/image granularity to respect
+    age_allocator::Pool&
+    age_allocator::_get_pool(uint32_t memory_type, AllocationKind kind) {
+        size_t index = (kind == AllocationKind::optimal && this->_buffer_image_granularity > 1) ? 1 : 0;
+        return this->_pools[memory_type][index];
+    }
+
+    age_allocation
+    age_allocator::_allocate_dedicated(VkDeviceSize size, uint32_t memory_type) {
+        age_allocation allocation;
+        allocation.size = size;
+        allocation.memory_type = memory_type;
+        allocation.dedicated = true;
+        allocation.memory = this->_allocate_memory(size, memory_type, &allocation.mapped);
+        if (allocation.memory == VK_NULL_HANDLE) {
+            throw std::runtime_error("Error: failed to allocate device memory");
+        }
+
+        std::lock_guard<std::mutex> lock(this->_dedicated_mutex);
+        this->_dedicated_count++;
+        this->_dedicated_bytes += size;
+        return allocation;
+    }
+
+    // Allocate a memory object, persistently mapping it when it is host visible
+    // Returns VK_NULL_HANDLE if the driver is out of memory
+    VkDeviceMemory
+    age_allocator::_allocate_memory(VkDeviceSize size, uint32_t memory_type, void **mapped) {
+        VkMemoryAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = size;
+        alloc_info.memoryTypeIndex = memory_type;
+
+        VkDeviceMemory memory;
+        if (this->_vk.vkAllocateMemory(this->_device, &alloc_info, this->_allocation_callbacks, &memory) != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+
+        *mapped = nullptr;
+        if (this->_memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            if (this->_vk.vkMapMemory(this->_device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+                this->_vk.vkFreeMemory(this->_device, memory, this->_allocation_callbacks);
+                throw std::runtime_error("Error: failed to map device memory");
+            }
+        }
+        return memory;
+    }
+}
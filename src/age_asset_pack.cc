@@ -0,0 +1,306 @@
+#include "age_asset_pack.hh"
+#include "age_cpu_profiler.hh"
+#include "age_deletion_queue.hh"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Bytes per texel of the texture formats a pack may hold
+    static uint32_t
+    texel_size(uint32_t format) {
+        switch (static_cast<VkFormat>(format)) {
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_asset_pack::age_asset_pack(age_device &device, age_upload_manager &uploads, const std::string &path)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _uploads{uploads},
+      _path{path},
+      _mapping{nullptr},
+      _mapping_size{0},
+      _header{nullptr},
+      _index{nullptr} {
+        AGE_PROFILE_ZONE("age_asset_pack");
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Error: failed to open asset pack " + path);
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(AssetPackHeader))) {
+            close(fd);
+            throw std::runtime_error("Error: asset pack " + path + " is too small");
+        }
+
+        // The mapping keeps the file alive on its own
+        void *mapping = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("Error: failed to map asset pack " + path);
+        }
+        this->_mapping = static_cast<const uint8_t*>(mapping);
+        this->_mapping_size = static_cast<size_t>(file_stat.st_size);
+
+        try {
+            this->_validate();
+        } catch (...) {
+            munmap(const_cast<uint8_t*>(this->_mapping), this->_mapping_size);
+            throw;
+        }
+    }
+
+    // Destructor
+    // Uploads copy out of the mapping as they are recorded, so
+    // nothing still points into it
+    age_asset_pack::~age_asset_pack() {
+        munmap(const_cast<uint8_t*>(this->_mapping), this->_mapping_size);
+    }
+
+    // Look an asset up in the index
+    const AssetEntry*
+    age_asset_pack::find(uint64_t id) {
+        uint32_t mask = this->_header->slot_count - 1;
+        uint32_t slot = asset_slot(id, this->_header->slot_count);
+        for (uint32_t probe = 0; probe < this->_header->slot_count; probe++) {
+            const AssetEntry &entry = this->_index[(slot + probe) & mask];
+            if (entry.id == id) {
+                return &entry;
+            }
+            if (entry.type == AssetType::empty) {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    const AssetEntry*
+    age_asset_pack::find(const char *name) {
+        return this->find(asset_id(name));
+    }
+
+    const void*
+    age_asset_pack::get_data(const AssetEntry &entry) {
+        return this->_mapping + entry.offset;
+    }
+
+    uint32_t
+    age_asset_pack::get_asset_count() {
+        return this->_header->asset_count;
+    }
+
+    // Create a device local buffer for a mesh and upload it
+    // Vertices and indices go up as a single copy
+    MeshAsset
+    age_asset_pack::load_mesh(const char *name) {
+        AGE_PROFILE_FUNCTION();
+        const AssetEntry &entry = this->_get(name, AssetType::mesh);
+        QueueFamilyIndices indices = this->_device.find_physical_device_queue_families();
+
+        MeshAsset mesh;
+        mesh.index_offset = static_cast<VkDeviceSize>(entry.vertex_count) * sizeof(AssetVertex);
+        mesh.vertex_count = entry.vertex_count;
+        mesh.index_count = entry.index_count;
+        this->_device.get_allocator().create_buffer(
+                entry.size,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                mesh.buffer,
+                mesh.allocation,
+                {indices.graphics_family.value(), indices.transfer_family.value()});
+        mesh.upload_value = this->_uploads.upload_buffer(mesh.buffer, 0, this->get_data(entry), entry.size);
+        return mesh;
+    }
+
+    // Create a sampled image for a texture and upload it
+    TextureAsset
+    age_asset_pack::load_texture(const char *name) {
+        AGE_PROFILE_FUNCTION();
+        const AssetEntry &entry = this->_get(name, AssetType::texture);
+        QueueFamilyIndices indices = this->_device.find_physical_device_queue_families();
+
+        TextureAsset texture;
+        texture.format = static_cast<VkFormat>(entry.format);
+        texture.extent = {entry.width, entry.height};
+
+        // Written on the transfer queue and sampled on the graphics
+        // queue without an ownership transfer
+        uint32_t queue_family_indices[] = {
+            indices.graphics_family.value(),
+            indices.transfer_family.value()
+        };
+
+        VkImageCreateInfo image_info{};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = texture.format;
+        image_info.extent = {entry.width, entry.height, 1};
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (indices.graphics_family != indices.transfer_family) {
+            image_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            image_info.queueFamilyIndexCount = 2;
+            image_info.pQueueFamilyIndices = queue_family_indices;
+        } else {
+            image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+        this->_device.get_allocator().create_image(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.allocation);
+
+        VkImageViewCreateInfo view_info{};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = texture.image;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = texture.format;
+        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view_info.subresourceRange.baseMipLevel = 0;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.baseArrayLayer = 0;
+        view_info.subresourceRange.layerCount = 1;
+        if (this->_vk.vkCreateImageView(this->_device.get_device(), &view_info, this->_device.get_allocation_callbacks(), &texture.view) != VK_SUCCESS) {
+            this->_device.get_allocator().destroy_image(texture.image, texture.allocation);
+            throw std::runtime_error(std::string("Error: failed to create image view for texture ") + name);
+        }
+
+        texture.upload_value = this->_uploads.upload_image(
+                texture.image,
+                {entry.width, entry.height, 1},
+                this->get_data(entry),
+                entry.size,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return texture;
+    }
+
+    // Create a shader module straight from the mapping
+    // Pack data is aligned, so the words can be handed over as they are
+    VkShaderModule
+    age_asset_pack::load_shader(const char *name) {
+        const AssetEntry &entry = this->_get(name, AssetType::shader);
+
+        VkShaderModuleCreateInfo module_info{};
+        module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        module_info.codeSize = entry.size;
+        module_info.pCode = static_cast<const uint32_t*>(this->get_data(entry));
+
+        VkShaderModule shader_module;
+        if (this->_vk.vkCreateShaderModule(this->_device.get_device(), &module_info, this->_device.get_allocation_callbacks(), &shader_module) != VK_SUCCESS) {
+            throw std::runtime_error(std::string("Error: failed to create shader module ") + name);
+        }
+        return shader_module;
+    }
+
+    void
+    age_asset_pack::destroy_mesh(MeshAsset &mesh) {
+        this->_device.get_deletion_queue().destroy_buffer(mesh.buffer, mesh.allocation);
+        mesh = MeshAsset{};
+    }
+
+    void
+    age_asset_pack::destroy_texture(TextureAsset &texture) {
+        this->_device.get_deletion_queue().destroy_image_view(texture.view);
+        this->_device.get_deletion_queue().destroy_image(texture.image, texture.allocation);
+        texture = TextureAsset{};
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    const AssetEntry&
+    age_asset_pack::_get(const char *name, AssetType type) {
+        const AssetEntry *entry = this->find(name);
+        if (entry == nullptr) {
+            throw std::runtime_error(std::string("Error: asset ") + name + " is not in " + this->_path);
+        }
+        if (entry->type != type) {
+            throw std::runtime_error(std::string("Error: asset ") + name + " has a different type than requested");
+        }
+        return *entry;
+    }
+
+    // Check everything the loaders rely on
+    // Only the header and index pages are touched, asset data stays on disk
+    void
+    age_asset_pack::_validate() {
+        const std::string error = "Error: asset pack " + this->_path;
+        this->_header = reinterpret_cast<const AssetPackHeader*>(this->_mapping);
+        const AssetPackHeader &header = *this->_header;
+        if (header.magic != ASSET_PACK_MAGIC) {
+            throw std::runtime_error(error + " is not an asset pack");
+        }
+        if (header.version != ASSET_PACK_VERSION) {
+            throw std::runtime_error(error + " has version " + std::to_string(header.version)
+                    + ", expected " + std::to_string(ASSET_PACK_VERSION));
+        }
+        if (header.file_size != this->_mapping_size) {
+            throw std::runtime_error(error + " is truncated");
+        }
+        if (header.slot_count == 0 || (header.slot_count & (header.slot_count - 1)) != 0
+            || header.asset_count > header.slot_count
+            || header.index_offset % alignof(AssetEntry) != 0
+            || header.index_offset > this->_mapping_size
+            || (this->_mapping_size - header.index_offset) / sizeof(AssetEntry) < header.slot_count) {
+            throw std::runtime_error(error + " has a broken index");
+        }
+        this->_index = reinterpret_cast<const AssetEntry*>(this->_mapping + header.index_offset);
+
+        uint32_t count = 0;
+        for (uint32_t slot = 0; slot < header.slot_count; slot++) {
+            const AssetEntry &entry = this->_index[slot];
+            if (entry.type == AssetType::empty) {
+                continue;
+            }
+            count++;
+
+            bool valid = entry.id != 0
+                         && entry.offset % ASSET_PACK_ALIGNMENT == 0
+                         && entry.offset <= this->_mapping_size
+                         && entry.size <= this->_mapping_size - entry.offset
+                         && entry.size > 0;
+            switch (entry.type) {
+                case AssetType::mesh:
+                    valid = valid && entry.size == static_cast<uint64_t>(entry.vertex_count) * sizeof(AssetVertex)
+                                                   + static_cast<uint64_t>(entry.index_count) * sizeof(uint32_t);
+                    break;
+                case AssetType::texture:
+                    valid = valid && texel_size(entry.format) != 0
+                                  && entry.size == static_cast<uint64_t>(entry.width) * entry.height * texel_size(entry.format);
+                    break;
+                case AssetType::shader:
+                    valid = valid && entry.size % sizeof(uint32_t) == 0;
+                    break;
+                default:
+                    valid = false;
+                    break;
+            }
+            if (!valid) {
+                throw std::runtime_error(error + " has a broken entry in slot " + std::to_string(slot));
+            }
+        }
+        if (count != header.asset_count) {
+            throw std::runtime_error(error + " has a broken index");
+        }
+    }
+}
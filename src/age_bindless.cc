@@ -0,0 +1,271 @@
+#include "age_bindless.hh"
+#include "age_deletion_queue.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_bindless::age_bindless(age_device &device, uint32_t texture_capacity, uint32_t buffer_capacity)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _textures{0, 0, 0, {}},
+      _buffers{0, 0, 0, {}},
+      _last_flush_writes{0} {
+        if (!this->_device.is_bindless_enabled()) {
+            throw std::runtime_error("Error: bindless descriptors are not enabled on this device");
+        }
+
+        // Update-after-bind descriptors have their own, usually much higher, limits
+        VkPhysicalDeviceDescriptorIndexingProperties indexing_properties{};
+        indexing_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &indexing_properties;
+        this->_vk.vkGetPhysicalDeviceProperties2(this->_device.get_physical_device(), &properties);
+
+        this->_textures.capacity = std::min({
+                texture_capacity,
+                indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+                indexing_properties.maxDescriptorSetUpdateAfterBindSamplers,
+                indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers});
+        this->_buffers.capacity = std::min({
+                buffer_capacity,
+                indexing_properties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+        if (this->_textures.capacity == 0 || this->_buffers.capacity == 0) {
+            throw std::runtime_error("Error: bindless heap needs room for at least one texture and one buffer");
+        }
+
+        VkDevice dev = this->_device.get_device();
+
+        VkDescriptorSetLayoutBinding bindings[2]{};
+        bindings[0].binding = TEXTURE_BINDING;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = this->_textures.capacity;
+        bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+        bindings[1].binding = BUFFER_BINDING;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = this->_buffers.capacity;
+        bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+        // Slots that are never written, or written while the set is in use,
+        // are fine as long as a shader does not read them
+        VkDescriptorBindingFlags binding_flags[2];
+        for (VkDescriptorBindingFlags &flags : binding_flags) {
+            flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+                    | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+                    | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        }
+        VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{};
+        binding_flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        binding_flags_info.bindingCount = 2;
+        binding_flags_info.pBindingFlags = binding_flags;
+
+        VkDescriptorSetLayoutCreateInfo set_layout_info{};
+        set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        set_layout_info.pNext = &binding_flags_info;
+        set_layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        set_layout_info.bindingCount = 2;
+        set_layout_info.pBindings = bindings;
+        if (this->_vk.vkCreateDescriptorSetLayout(dev, &set_layout_info, this->_device.get_allocation_callbacks(), &this->_set_layout) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create bindless descriptor set layout");
+        }
+
+        VkDescriptorPoolSize pool_sizes[2];
+        pool_sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        pool_sizes[0].descriptorCount = this->_textures.capacity;
+        pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        pool_sizes[1].descriptorCount = this->_buffers.capacity;
+
+        VkDescriptorPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        pool_info.maxSets = 1;
+        pool_info.poolSizeCount = 2;
+        pool_info.pPoolSizes = pool_sizes;
+        if (this->_vk.vkCreateDescriptorPool(dev, &pool_info, this->_device.get_allocation_callbacks(), &this->_pool) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create bindless descriptor pool");
+        }
+
+        VkDescriptorSetAllocateInfo set_info{};
+        set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        set_info.descriptorPool = this->_pool;
+        set_info.descriptorSetCount = 1;
+        set_info.pSetLayouts = &this->_set_layout;
+        if (this->_vk.vkAllocateDescriptorSets(dev, &set_info, &this->_set) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to allocate bindless descriptor set");
+        }
+    }
+
+    // Destructor
+    age_bindless::~age_bindless() {
+        // Pending releases point back at us, run them while we still exist
+        this->_device.get_deletion_queue().flush();
+
+        this->_vk.vkDestroyDescriptorPool(this->_device.get_device(), this->_pool, this->_device.get_allocation_callbacks());
+        this->_vk.vkDestroyDescriptorSetLayout(this->_device.get_device(), this->_set_layout, this->_device.get_allocation_callbacks());
+    }
+
+    // Give a texture a slot in the heap
+    // The descriptor is written by the next flush
+    uint32_t
+    age_bindless::register_texture(VkImageView image_view, VkSampler sampler, VkImageLayout layout) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        uint32_t handle = this->_take_slot(this->_textures, "texture");
+        this->_pending_images.push_back({sampler, image_view, layout});
+        this->_pending_image_slots.push_back(handle);
+        return handle;
+    }
+
+    // Give a range of a storage buffer a slot in the heap
+    uint32_t
+    age_bindless::register_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        uint32_t handle = this->_take_slot(this->_buffers, "buffer");
+        this->_pending_buffers.push_back({buffer, offset, range});
+        this->_pending_buffer_slots.push_back(handle);
+        return handle;
+    }
+
+    void
+    age_bindless::release_texture(uint32_t handle) {
+        this->_release_slot(this->_textures, handle);
+    }
+
+    void
+    age_bindless::release_buffer(uint32_t handle) {
+        this->_release_slot(this->_buffers, handle);
+    }
+
+    // Write every queued descriptor with a single vkUpdateDescriptorSets
+    // Runs of consecutive slots share one write
+    void
+    age_bindless::flush() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (this->_pending_images.empty() && this->_pending_buffers.empty()) {
+            this->_last_flush_writes = 0;
+            return;
+        }
+
+        std::vector<VkWriteDescriptorSet> writes;
+        auto add_writes = [&](uint32_t binding, VkDescriptorType type, const std::vector<uint32_t> &slots,
+                              const VkDescriptorImageInfo *images, const VkDescriptorBufferInfo *buffers) {
+            for (size_t i = 0; i < slots.size(); i++) {
+                if (i > 0 && slots[i] == slots[i - 1] + 1) {
+                    writes.back().descriptorCount++;
+                    continue;
+                }
+
+                VkWriteDescriptorSet write{};
+                write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                write.dstSet = this->_set;
+                write.dstBinding = binding;
+                write.dstArrayElement = slots[i];
+                write.descriptorCount = 1;
+                write.descriptorType = type;
+                write.pImageInfo = images != nullptr ? images + i : nullptr;
+                write.pBufferInfo = buffers != nullptr ? buffers + i : nullptr;
+                writes.push_back(write);
+            }
+        };
+        add_writes(TEXTURE_BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                this->_pending_image_slots, this->_pending_images.data(), nullptr);
+        add_writes(BUFFER_BINDING, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                this->_pending_buffer_slots, nullptr, this->_pending_buffers.data());
+
+        this->_vk.vkUpdateDescriptorSets(
+                this->_device.get_device(),
+                static_cast<uint32_t>(writes.size()),
+                writes.data(),
+                0,
+                nullptr);
+
+        this->_last_flush_writes = this->_pending_images.size() + this->_pending_buffers.size();
+        this->_pending_images.clear();
+        this->_pending_image_slots.clear();
+        this->_pending_buffers.clear();
+        this->_pending_buffer_slots.clear();
+    }
+
+    // Bind the heap
+    // Only needed when a pipeline layout changes, draws just push handles
+    void
+    age_bindless::bind(
+            VkCommandBuffer command_buffer,
+            VkPipelineBindPoint bind_point,
+            VkPipelineLayout layout,
+            uint32_t set_index) {
+        this->_vk.vkCmdBindDescriptorSets(command_buffer, bind_point, layout, set_index, 1, &this->_set, 0, nullptr);
+    }
+
+    VkDescriptorSetLayout
+    age_bindless::get_set_layout() {
+        return this->_set_layout;
+    }
+
+    VkDescriptorSet
+    age_bindless::get_set() {
+        return this->_set;
+    }
+
+    BindlessStats
+    age_bindless::get_stats() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        BindlessStats stats;
+        stats.texture_capacity = this->_textures.capacity;
+        stats.buffer_capacity = this->_buffers.capacity;
+        stats.texture_count = this->_textures.live;
+        stats.buffer_count = this->_buffers.live;
+        stats.last_flush_writes = this->_last_flush_writes;
+        return stats;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Take a recycled slot, else the next one never used
+    uint32_t
+    age_bindless::_take_slot(SlotList &slots, const char *kind) {
+        uint32_t handle;
+        if (!slots.free.empty()) {
+            handle = slots.free.back();
+            slots.free.pop_back();
+        } else if (slots.next_unused < slots.capacity) {
+            handle = slots.next_unused++;
+        } else {
+            throw std::runtime_error(std::string("Error: bindless heap is out of ") + kind + " slots");
+        }
+        slots.live++;
+        return handle;
+    }
+
+    // Frames in flight may still index the slot, so it only goes
+    // back on the free list once the current frame has finished
+    void
+    age_bindless::_release_slot(SlotList &slots, uint32_t handle) {
+        if (handle == INVALID_HANDLE) {
+            return;
+        }
+
+        SlotList *list = &slots;
+        this->_device.get_deletion_queue().defer([this, list, handle]() {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            list->free.push_back(handle);
+            list->live--;
+        });
+    }
+}
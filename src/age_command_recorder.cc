@@ -0,0 +1,151 @@
+#include "age_command_recorder.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_command_recorder::age_command_recorder(age_device &device, age_job_system &jobs, uint32_t frames_in_flight)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _jobs{jobs},
+      _frame_slot{0} {
+        uint32_t thread_count = this->_jobs.get_thread_count();
+        this->_timings.resize(thread_count);
+
+        this->_pools.resize(frames_in_flight);
+        for (std::vector<ThreadPool> &slot_pools : this->_pools) {
+            slot_pools.resize(thread_count);
+            for (ThreadPool &thread_pool : slot_pools) {
+                VkCommandPoolCreateInfo pool_info{};
+                pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                pool_info.queueFamilyIndex = this->_device.find_physical_device_queue_families().graphics_family.value();
+
+                if (this->_vk.vkCreateCommandPool(this->_device.get_device(), &pool_info, this->_device.get_allocation_callbacks(), &thread_pool.pool) != VK_SUCCESS) {
+                    throw std::runtime_error("Error: failed to create recording command pool");
+                }
+                thread_pool.used = 0;
+            }
+        }
+    }
+
+    // Destructor
+    // Destroying the pools frees their command buffers
+    age_command_recorder::~age_command_recorder() {
+        for (std::vector<ThreadPool> &slot_pools : this->_pools) {
+            for (ThreadPool &thread_pool : slot_pools) {
+                this->_vk.vkDestroyCommandPool(this->_device.get_device(), thread_pool.pool, this->_device.get_allocation_callbacks());
+            }
+        }
+    }
+
+    // Start recording a frame in a slot
+    // The caller must know the slot's previous frame has finished on the
+    // GPU, which is the case right after the swapchain acquired an image
+    void
+    age_command_recorder::begin_frame(uint32_t frame_slot) {
+        this->_frame_slot = frame_slot;
+        for (ThreadPool &thread_pool : this->_pools[frame_slot]) {
+            if (thread_pool.used > 0) {
+                this->_vk.vkResetCommandPool(this->_device.get_device(), thread_pool.pool, 0);
+                thread_pool.used = 0;
+            }
+        }
+    }
+
+    // Record tasks into secondary command buffers on every thread
+    // Batches are sized from the thread count alone, so the same
+    // task count always yields the same command stream
+    void
+    age_command_recorder::record(
+            VkCommandBuffer primary,
+            uint32_t task_count,
+            const VkCommandBufferInheritanceInfo &inheritance,
+            const std::function<void(VkCommandBuffer command_buffer, uint32_t task)> &record_task) {
+        for (RecordTiming &timing : this->_timings) {
+            timing = RecordTiming{};
+        }
+        if (task_count == 0) {
+            return;
+        }
+
+        // A few batches per thread leaves room for stealing when tasks are uneven
+        uint32_t batch_size = std::max<uint32_t>(task_count / (this->_jobs.get_thread_count() * 4), 1);
+        uint32_t batch_count = (task_count + batch_size - 1) / batch_size;
+        std::vector<VkCommandBuffer> batches(batch_count);
+
+        this->_jobs.parallel_for(task_count, batch_size, [&](uint32_t begin, uint32_t end) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            // Each thread only ever touches its own pool and timing
+            uint32_t thread = age_job_system::get_thread_index();
+            VkCommandBuffer secondary = this->_get_secondary(this->_pools[this->_frame_slot][thread]);
+
+            VkCommandBufferBeginInfo begin_info{};
+            begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            if (inheritance.renderPass != VK_NULL_HANDLE) {
+                begin_info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            }
+            begin_info.pInheritanceInfo = &inheritance;
+            if (this->_vk.vkBeginCommandBuffer(secondary, &begin_info) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to begin secondary command buffer");
+            }
+
+            for (uint32_t task = begin; task < end; task++) {
+                record_task(secondary, task);
+            }
+
+            if (this->_vk.vkEndCommandBuffer(secondary) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to record secondary command buffer");
+            }
+            batches[begin / batch_size] = secondary;
+
+            RecordTiming &timing = this->_timings[thread];
+            timing.cpu_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            timing.task_count += end - begin;
+            timing.batch_count++;
+        });
+
+        this->_vk.vkCmdExecuteCommands(primary, batch_count, batches.data());
+    }
+
+    const std::vector<RecordTiming>&
+    age_command_recorder::get_timings() {
+        return this->_timings;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Hand out the next secondary command buffer of a thread's pool
+    VkCommandBuffer
+    age_command_recorder::_get_secondary(ThreadPool &thread_pool) {
+        if (thread_pool.used == thread_pool.secondaries.size()) {
+            VkCommandBufferAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool = thread_pool.pool;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            alloc_info.commandBufferCount = 1;
+
+            VkCommandBuffer command_buffer;
+            if (this->_vk.vkAllocateCommandBuffers(this->_device.get_device(), &alloc_info, &command_buffer) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to allocate secondary command buffer");
+            }
+            thread_pool.secondaries.push_back(command_buffer);
+        }
+        return thread_pool.secondaries[thread_pool.used++];
+    }
+}
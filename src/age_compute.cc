@@ -0,0 +1,428 @@
+#include "age_compute.hh"
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+
+    /**********************************************
+     *           age_compute_pipeline
+     *********************************************/
+
+    // Constructor
+    age_compute_pipeline::age_compute_pipeline(
+            age_device &device,
+            const std::vector<char> &spirv,
+            uint32_t storage_buffer_count,
+            uint32_t push_constant_size)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _storage_buffer_count{storage_buffer_count},
+      _push_constant_size{push_constant_size} {
+        // A larger set could never be allocated from age_compute's pools
+        if (storage_buffer_count > age_compute::MAX_STORAGE_BUFFERS) {
+            throw std::runtime_error("Error: compute pipeline uses " + std::to_string(storage_buffer_count)
+                    + " storage buffers, at most " + std::to_string(age_compute::MAX_STORAGE_BUFFERS) + " are supported");
+        }
+        VkDevice dev = this->_device.get_device();
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings(storage_buffer_count);
+        for (uint32_t i = 0; i < storage_buffer_count; i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo set_layout_info{};
+        set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        set_layout_info.bindingCount = storage_buffer_count;
+        set_layout_info.pBindings = bindings.data();
+        if (this->_vk.vkCreateDescriptorSetLayout(dev, &set_layout_info, this->_device.get_allocation_callbacks(), &this->_descriptor_set_layout) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create compute descriptor set layout");
+        }
+
+        VkPushConstantRange push_range{};
+        push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_range.offset = 0;
+        push_range.size = push_constant_size;
+
+        VkPipelineLayoutCreateInfo layout_info{};
+        layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_info.setLayoutCount = 1;
+        layout_info.pSetLayouts = &this->_descriptor_set_layout;
+        layout_info.pushConstantRangeCount = push_constant_size > 0 ? 1 : 0;
+        layout_info.pPushConstantRanges = &push_range;
+        if (this->_vk.vkCreatePipelineLayout(dev, &layout_info, this->_device.get_allocation_callbacks(), &this->_layout) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create compute pipeline layout");
+        }
+
+        VkShaderModuleCreateInfo module_info{};
+        module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        module_info.codeSize = spirv.size();
+        module_info.pCode = reinterpret_cast<const uint32_t*>(spirv.data());
+
+        VkShaderModule shader_module;
+        if (this->_vk.vkCreateShaderModule(dev, &module_info, this->_device.get_allocation_callbacks(), &shader_module) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create compute shader module");
+        }
+
+        VkComputePipelineCreateInfo pipeline_info{};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = shader_module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = this->_layout;
+
+        VkResult result = this->_vk.vkCreateComputePipelines(
+                dev,
+                this->_device.get_pipeline_cache(),
+                1,
+                &pipeline_info,
+                this->_device.get_allocation_callbacks(),
+                &this->_pipeline);
+
+        // The module is only needed while the pipeline is compiled
+        this->_vk.vkDestroyShaderModule(dev, shader_module, this->_device.get_allocation_callbacks());
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create compute pipeline");
+        }
+    }
+
+    // Destructor
+    age_compute_pipeline::~age_compute_pipeline() {
+        this->_vk.vkDestroyPipeline(this->_device.get_device(), this->_pipeline, this->_device.get_allocation_callbacks());
+        this->_vk.vkDestroyPipelineLayout(this->_device.get_device(), this->_layout, this->_device.get_allocation_callbacks());
+        this->_vk.vkDestroyDescriptorSetLayout(this->_device.get_device(), this->_descriptor_set_layout, this->_device.get_allocation_callbacks());
+    }
+
+    // Read a SPIR-V binary
+    std::vector<char>
+    age_compute_pipeline::read_spirv(const std::string &path) {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Error: failed to open shader " + path);
+        }
+
+        std::vector<char> code(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(code.data(), static_cast<std::streamsize>(code.size()));
+        if (code.size() % 4 != 0) {
+            throw std::runtime_error("Error: shader " + path + " is not valid SPIR-V");
+        }
+        return code;
+    }
+
+    VkPipeline
+    age_compute_pipeline::get_pipeline() {
+        return this->_pipeline;
+    }
+
+    VkPipelineLayout
+    age_compute_pipeline::get_layout() {
+        return this->_layout;
+    }
+
+    VkDescriptorSetLayout
+    age_compute_pipeline::get_descriptor_set_layout() {
+        return this->_descriptor_set_layout;
+    }
+
+    uint32_t
+    age_compute_pipeline::get_storage_buffer_count() {
+        return this->_storage_buffer_count;
+    }
+
+    uint32_t
+    age_compute_pipeline::get_push_constant_size() {
+        return this->_push_constant_size;
+    }
+
+
+    /**********************************************
+     *                age_compute
+     *********************************************/
+
+    // Constructor
+    age_compute::age_compute(age_device &device, uint32_t frames_in_flight)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _current_slot{0},
+      _submitted_value{0} {
+        this->_timeline = this->_device.create_timeline_semaphore(0);
+
+        // One slot per frame in flight so recording the next frame's
+        // work never waits for the one still executing
+        this->_slots.resize(frames_in_flight);
+        for (Slot &slot : this->_slots) {
+            VkCommandPoolCreateInfo pool_info{};
+            pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            pool_info.queueFamilyIndex = this->_device.find_physical_device_queue_families().compute_family.value();
+            if (this->_vk.vkCreateCommandPool(this->_device.get_device(), &pool_info, this->_device.get_allocation_callbacks(), &slot.command_pool) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create compute command pool");
+            }
+
+            VkCommandBufferAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool = slot.command_pool;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            alloc_info.commandBufferCount = 1;
+            if (this->_vk.vkAllocateCommandBuffers(this->_device.get_device(), &alloc_info, &slot.command_buffer) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to allocate compute command buffer");
+            }
+
+            slot.descriptor_pools.push_back(this->_create_descriptor_pool());
+            slot.descriptor_pool_index = 0;
+            slot.value = 0;
+        }
+    }
+
+    // Destructor
+    age_compute::~age_compute() {
+        this->wait(this->_submitted_value);
+
+        for (Slot &slot : this->_slots) {
+            for (VkDescriptorPool pool : slot.descriptor_pools) {
+                this->_vk.vkDestroyDescriptorPool(this->_device.get_device(), pool, this->_device.get_allocation_callbacks());
+            }
+            this->_vk.vkDestroyCommandPool(this->_device.get_device(), slot.command_pool, this->_device.get_allocation_callbacks());
+        }
+        this->_vk.vkDestroySemaphore(this->_device.get_device(), this->_timeline, this->_device.get_allocation_callbacks());
+    }
+
+    // Start recording compute work
+    // The slot's previous submission has normally finished long ago,
+    // the wait only blocks if compute falls a whole ring of frames behind
+    VkCommandBuffer
+    age_compute::begin() {
+        Slot &slot = this->_slots[this->_current_slot];
+        this->wait(slot.value);
+
+        // Everything allocated for the previous submission is recycled at once
+        this->_vk.vkResetCommandPool(this->_device.get_device(), slot.command_pool, 0);
+        for (VkDescriptorPool pool : slot.descriptor_pools) {
+            this->_vk.vkResetDescriptorPool(this->_device.get_device(), pool, 0);
+        }
+        slot.descriptor_pool_index = 0;
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (this->_vk.vkBeginCommandBuffer(slot.command_buffer, &begin_info) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to begin compute command buffer");
+        }
+
+        return slot.command_buffer;
+    }
+
+    // Bind a pipeline and point its bindings at the given buffers
+    void
+    age_compute::bind(
+            VkCommandBuffer command_buffer,
+            age_compute_pipeline &pipeline,
+            const std::vector<VkDescriptorBufferInfo> &buffers) {
+        if (buffers.size() != pipeline.get_storage_buffer_count()) {
+            throw std::runtime_error("Error: compute pipeline bound with the wrong number of buffers");
+        }
+
+        this->_vk.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.get_pipeline());
+        if (buffers.empty()) {
+            return;
+        }
+
+        VkDescriptorSet set = this->_allocate_descriptor_set(
+                this->_slots[this->_current_slot],
+                pipeline.get_descriptor_set_layout());
+
+        std::vector<VkWriteDescriptorSet> writes(buffers.size());
+        for (uint32_t i = 0; i < writes.size(); i++) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &buffers[i];
+        }
+        this->_vk.vkUpdateDescriptorSets(
+                this->_device.get_device(),
+                static_cast<uint32_t>(writes.size()),
+                writes.data(),
+                0,
+                nullptr);
+
+        this->_vk.vkCmdBindDescriptorSets(
+                command_buffer,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                pipeline.get_layout(),
+                0,
+                1,
+                &set,
+                0,
+                nullptr);
+    }
+
+    void
+    age_compute::push_constants(
+            VkCommandBuffer command_buffer,
+            age_compute_pipeline &pipeline,
+            const void *data,
+            uint32_t size) {
+        this->_vk.vkCmdPushConstants(command_buffer, pipeline.get_layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, size, data);
+    }
+
+    void
+    age_compute::dispatch(VkCommandBuffer command_buffer, uint32_t x, uint32_t y, uint32_t z) {
+        this->_vk.vkCmdDispatch(command_buffer, x, y, z);
+    }
+
+    // Order dispatches that depend on each other's output
+    void
+    age_compute::barrier(VkCommandBuffer command_buffer) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        this->_vk.vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                1, &barrier,
+                0, nullptr,
+                0, nullptr);
+    }
+
+    // Submit the recorded work to the compute queue
+    // The returned value is what graphics submissions wait on
+    uint64_t
+    age_compute::submit(VkCommandBuffer command_buffer, const std::vector<TimelineWait> &waits) {
+        if (this->_vk.vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to record compute command buffer");
+        }
+
+        uint64_t value = this->_submitted_value + 1;
+
+        std::vector<VkSemaphore> wait_semaphores;
+        std::vector<VkPipelineStageFlags> wait_stages;
+        std::vector<uint64_t> wait_values;
+        for (const TimelineWait &wait : waits) {
+            wait_semaphores.push_back(wait.semaphore);
+            wait_stages.push_back(wait.stage);
+            wait_values.push_back(wait.value);
+        }
+
+        VkTimelineSemaphoreSubmitInfo timeline_info{};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+        timeline_info.pWaitSemaphoreValues = wait_values.data();
+        timeline_info.signalSemaphoreValueCount = 1;
+        timeline_info.pSignalSemaphoreValues = &value;
+
+        VkSubmitInfo submit_info{};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.pNext = &timeline_info;
+        submit_info.waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size());
+        submit_info.pWaitSemaphores = wait_semaphores.data();
+        submit_info.pWaitDstStageMask = wait_stages.data();
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &command_buffer;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &this->_timeline;
+
+        if (this->_device.queue_submit(this->_device.get_compute_queue(), 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to submit compute work");
+        }
+
+        this->_slots[this->_current_slot].value = value;
+        this->_current_slot = (this->_current_slot + 1) % static_cast<uint32_t>(this->_slots.size());
+        this->_submitted_value = value;
+        return value;
+    }
+
+    VkSemaphore
+    age_compute::get_semaphore() {
+        return this->_timeline;
+    }
+
+    // Check without blocking if the compute queue has reached a value
+    bool
+    age_compute::is_complete(uint64_t value) {
+        return this->_device.get_semaphore_value(this->_timeline) >= value;
+    }
+
+    // Block until the compute queue has reached a value
+    void
+    age_compute::wait(uint64_t value) {
+        if (value == 0) {
+            return;
+        }
+        if (this->_device.wait_semaphore(this->_timeline, value) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to wait for compute work");
+        }
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Create a pool for the descriptor sets of one slot
+    VkDescriptorPool
+    age_compute::_create_descriptor_pool() {
+        VkDescriptorPoolSize pool_size{};
+        pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        pool_size.descriptorCount = age_compute::MAX_STORAGE_BUFFERS;
+
+        VkDescriptorPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.maxSets = age_compute::MAX_SETS_PER_POOL;
+        pool_info.poolSizeCount = 1;
+        pool_info.pPoolSizes = &pool_size;
+
+        VkDescriptorPool pool;
+        if (this->_vk.vkCreateDescriptorPool(this->_device.get_device(), &pool_info, this->_device.get_allocation_callbacks(), &pool) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create compute descriptor pool");
+        }
+        return pool;
+    }
+
+    // Allocate a descriptor set for this submission
+    // Moves on to the next pool (creating one if needed) when the current one is full
+    VkDescriptorSet
+    age_compute::_allocate_descriptor_set(Slot &slot, VkDescriptorSetLayout layout) {
+        // Pools after the current one have not been used since begin(),
+        // so a set that does not fit there will not fit in any new pool
+        bool empty_pool = false;
+        for (;;) {
+            VkDescriptorSetAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            alloc_info.descriptorPool = slot.descriptor_pools[slot.descriptor_pool_index];
+            alloc_info.descriptorSetCount = 1;
+            alloc_info.pSetLayouts = &layout;
+
+            VkDescriptorSet set;
+            VkResult result = this->_vk.vkAllocateDescriptorSets(this->_device.get_device(), &alloc_info, &set);
+            if (result == VK_SUCCESS) {
+                return set;
+            }
+            if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+                throw std::runtime_error("Error: failed to allocate compute descriptor set");
+            }
+            if (empty_pool) {
+                throw std::runtime_error("Error: compute descriptor set does not fit in an empty descriptor pool");
+            }
+
+            empty_pool = true;
+            slot.descriptor_pool_index++;
+            if (slot.descriptor_pool_index == slot.descriptor_pools.size()) {
+                slot.descriptor_pools.push_back(this->_create_descriptor_pool());
+            }
+        }
+    }
+}
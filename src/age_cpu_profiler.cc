@@ -0,0 +1,204 @@
+#include "age_cpu_profiler.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace age {
+
+    namespace {
+        thread_local age_zone_ring *t_ring = nullptr;
+    }
+
+    /**********************************************
+     *               age_zone_ring
+     *********************************************/
+
+    age_zone_ring::age_zone_ring(uint32_t thread)
+    : _head{0},
+      _tail{0},
+      _thread{thread} {}
+
+    // Add a record
+    // The release store publishes the record to the collector
+    bool
+    age_zone_ring::push(const CpuZoneRecord &record) {
+        uint64_t head = this->_head.load(std::memory_order_relaxed);
+        if (head - this->_tail.load(std::memory_order_acquire) >= CAPACITY) {
+            return false;
+        }
+        this->_records[head & (CAPACITY - 1)] = record;
+        this->_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Take up to max_count records
+    uint32_t
+    age_zone_ring::pop(CpuZoneRecord *out, uint32_t max_count) {
+        uint64_t tail = this->_tail.load(std::memory_order_relaxed);
+        uint64_t head = this->_head.load(std::memory_order_acquire);
+
+        uint32_t count = 0;
+        while (tail != head && count < max_count) {
+            out[count++] = this->_records[tail & (CAPACITY - 1)];
+            tail++;
+        }
+        this->_tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    uint32_t
+    age_zone_ring::get_thread() {
+        return this->_thread;
+    }
+
+
+    /**********************************************
+     *              age_cpu_profiler
+     *********************************************/
+
+    // The one profiler every zone reports to
+    age_cpu_profiler&
+    age_cpu_profiler::get() {
+        static age_cpu_profiler profiler;
+        return profiler;
+    }
+
+    // Constructor
+    age_cpu_profiler::age_cpu_profiler()
+    : _running{false},
+      _trace{nullptr},
+      _dropped{0} {}
+
+    // Destructor
+    age_cpu_profiler::~age_cpu_profiler() {
+        this->stop();
+    }
+
+    // Start the collector
+    void
+    age_cpu_profiler::start(age_trace *trace) {
+        std::lock_guard<std::mutex> lock(this->_collector_mutex);
+        if (this->_running) {
+            return;
+        }
+
+        this->_trace = trace;
+        {
+            std::lock_guard<std::mutex> rings_lock(this->_rings_mutex);
+            for (const std::pair<uint32_t, std::string> &name : this->_pending_names) {
+                this->_trace->set_track_name(TRACE_PROCESS_CPU, name.first, name.second);
+            }
+            this->_pending_names.clear();
+        }
+
+        this->_running = true;
+        this->_collector = std::thread(&age_cpu_profiler::_collect, this);
+    }
+
+    // Stop the collector after a last drain
+    void
+    age_cpu_profiler::stop() {
+        {
+            std::lock_guard<std::mutex> lock(this->_collector_mutex);
+            if (!this->_running) {
+                return;
+            }
+            this->_running = false;
+        }
+        this->_collector_wake.notify_all();
+        this->_collector.join();
+
+        this->_drain();
+        this->_trace = nullptr;
+    }
+
+    // Hot path: no locks and no allocation once the thread has a ring
+    void
+    age_cpu_profiler::record(const CpuZoneRecord &record) {
+        if (!this->_get_ring()->push(record)) {
+            this->_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Name the calling thread's track
+    void
+    age_cpu_profiler::set_thread_name(const std::string &name) {
+        uint32_t thread = this->_get_ring()->get_thread();
+
+        std::lock_guard<std::mutex> lock(this->_collector_mutex);
+        if (this->_trace != nullptr) {
+            this->_trace->set_track_name(TRACE_PROCESS_CPU, thread, name);
+        } else {
+            std::lock_guard<std::mutex> rings_lock(this->_rings_mutex);
+            this->_pending_names.push_back({thread, name});
+        }
+    }
+
+    uint64_t
+    age_cpu_profiler::get_dropped_count() {
+        return this->_dropped.load(std::memory_order_relaxed);
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Get the calling thread's ring
+    // Rings belong to the profiler, so zones recorded just before
+    // a thread exits are still collected
+    age_zone_ring*
+    age_cpu_profiler::_get_ring() {
+        if (t_ring == nullptr) {
+            std::lock_guard<std::mutex> lock(this->_rings_mutex);
+            this->_rings.push_back(std::make_unique<age_zone_ring>(static_cast<uint32_t>(this->_rings.size() + 1)));
+            t_ring = this->_rings.back().get();
+        }
+        return t_ring;
+    }
+
+    // Drain the rings every few milliseconds until stopped
+    void
+    age_cpu_profiler::_collect() {
+        std::unique_lock<std::mutex> lock(this->_collector_mutex);
+        while (this->_running) {
+            lock.unlock();
+            this->_drain();
+            lock.lock();
+            this->_collector_wake.wait_for(lock, std::chrono::milliseconds(2), [this]() {
+                return !this->_running;
+            });
+        }
+    }
+
+    // Move every ring's records into the trace
+    void
+    age_cpu_profiler::_drain() {
+        CpuZoneRecord records[256];
+        std::vector<TraceEvent> events;
+
+        std::lock_guard<std::mutex> lock(this->_rings_mutex);
+        for (std::unique_ptr<age_zone_ring> &ring : this->_rings) {
+            uint32_t count;
+            while ((count = ring->pop(records, 256)) > 0) {
+                for (uint32_t i = 0; i < count; i++) {
+                    events.push_back({
+                        records[i].name,
+                        "cpu",
+                        TRACE_PROCESS_CPU,
+                        ring->get_thread(),
+                        records[i].start_us,
+                        records[i].end_us - records[i].start_us});
+                }
+            }
+        }
+
+        if (this->_trace != nullptr && !events.empty()) {
+            this->_trace->add_events(events);
+        }
+    }
+}
@@ -0,0 +1,202 @@
+#include "age_deletion_queue.hh"
+#include "age_device.hh"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_deletion_queue::age_deletion_queue(age_device &device)
+    : _device{device}, _vk{device.get_dispatch()}, _frame_value{0} {
+        this->_frame_semaphore = this->_device.create_timeline_semaphore(0);
+    }
+
+    // Destructor
+    age_deletion_queue::~age_deletion_queue() {
+        this->flush();
+        this->_vk.vkDestroySemaphore(this->_device.get_device(), this->_frame_semaphore, this->_device.get_allocation_callbacks());
+    }
+
+    // Destroy a buffer and return its memory to the allocator
+    void
+    age_deletion_queue::destroy_buffer(VkBuffer buffer, const age_allocation &allocation) {
+        this->defer([this, buffer, owned = allocation]() mutable {
+            this->_device.get_allocator().destroy_buffer(buffer, owned);
+        });
+    }
+
+    // Destroy an image and return its memory to the allocator
+    void
+    age_deletion_queue::destroy_image(VkImage image, const age_allocation &allocation) {
+        this->defer([this, image, owned = allocation]() mutable {
+            this->_device.get_allocator().destroy_image(image, owned);
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_image_view(VkImageView image_view) {
+        this->defer([this, image_view]() {
+            this->_vk.vkDestroyImageView(this->_device.get_device(), image_view, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_pipeline(VkPipeline pipeline) {
+        this->defer([this, pipeline]() {
+            this->_vk.vkDestroyPipeline(this->_device.get_device(), pipeline, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_pipeline_layout(VkPipelineLayout layout) {
+        this->defer([this, layout]() {
+            this->_vk.vkDestroyPipelineLayout(this->_device.get_device(), layout, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_descriptor_set_layout(VkDescriptorSetLayout layout) {
+        this->defer([this, layout]() {
+            this->_vk.vkDestroyDescriptorSetLayout(this->_device.get_device(), layout, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_descriptor_pool(VkDescriptorPool pool) {
+        this->defer([this, pool]() {
+            this->_vk.vkDestroyDescriptorPool(this->_device.get_device(), pool, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    // Return descriptor sets to their pool
+    // The pool itself must outlive the deletion, so queue its destruction after this
+    void
+    age_deletion_queue::free_descriptor_sets(VkDescriptorPool pool, const std::vector<VkDescriptorSet> &sets) {
+        if (sets.empty()) {
+            return;
+        }
+        this->defer([this, pool, sets]() {
+            this->_vk.vkFreeDescriptorSets(this->_device.get_device(), pool, static_cast<uint32_t>(sets.size()), sets.data());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_shader_module(VkShaderModule shader_module) {
+        this->defer([this, shader_module]() {
+            this->_vk.vkDestroyShaderModule(this->_device.get_device(), shader_module, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_semaphore(VkSemaphore semaphore) {
+        this->defer([this, semaphore]() {
+            this->_vk.vkDestroySemaphore(this->_device.get_device(), semaphore, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    void
+    age_deletion_queue::destroy_swapchain(VkSwapchainKHR swapchain) {
+        this->defer([this, swapchain]() {
+            this->_vk.vkDestroySwapchainKHR(this->_device.get_device(), swapchain, this->_device.get_allocation_callbacks());
+        });
+    }
+
+    // Run a deleter once the frame being recorded has finished on the GPU
+    void
+    age_deletion_queue::defer(std::function<void()> destroy) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_pending.push_back({this->_frame_semaphore, this->_frame_value + 1, std::move(destroy)});
+    }
+
+    void
+    age_deletion_queue::defer_until(VkSemaphore semaphore, uint64_t value, std::function<void()> destroy) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_pending.push_back({semaphore, value, std::move(destroy)});
+    }
+
+    // Run every deleter whose timeline value has been reached
+    // Each semaphore is queried once, and deleters run outside the lock
+    // so they may queue further deletions
+    void
+    age_deletion_queue::collect() {
+        std::vector<Deletion> ready;
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            if (this->_pending.empty()) {
+                return;
+            }
+
+            std::unordered_map<VkSemaphore, uint64_t> reached;
+            size_t kept = 0;
+            for (size_t i = 0; i < this->_pending.size(); i++) {
+                Deletion &deletion = this->_pending[i];
+                auto found = reached.find(deletion.semaphore);
+                if (found == reached.end()) {
+                    found = reached.emplace(deletion.semaphore, this->_device.get_semaphore_value(deletion.semaphore)).first;
+                }
+
+                if (deletion.value <= found->second) {
+                    ready.push_back(std::move(deletion));
+                } else {
+                    if (kept != i) {
+                        this->_pending[kept] = std::move(deletion);
+                    }
+                    kept++;
+                }
+            }
+            this->_pending.resize(kept);
+        }
+
+        for (Deletion &deletion : ready) {
+            deletion.destroy();
+        }
+    }
+
+    // Run every deleter regardless of the GPU
+    // Loops because a deleter may queue further deletions
+    void
+    age_deletion_queue::flush() {
+        while (true) {
+            std::vector<Deletion> pending;
+            {
+                std::lock_guard<std::mutex> lock(this->_mutex);
+                pending.swap(this->_pending);
+            }
+            if (pending.empty()) {
+                return;
+            }
+
+            for (Deletion &deletion : pending) {
+                deletion.destroy();
+            }
+        }
+    }
+
+    VkSemaphore
+    age_deletion_queue::get_frame_semaphore() {
+        return this->_frame_semaphore;
+    }
+
+    // Everything queued before this call is destroyed once the returned value is signaled
+    uint64_t
+    age_deletion_queue::signal_frame() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return ++this->_frame_value;
+    }
+
+    uint64_t
+    age_deletion_queue::get_pending_count() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_pending.size();
+    }
+}
@@ -1,16 +1,90 @@
 #include "age_device.hh"
+#include "age_host_allocator.hh"
+#include "age_log.hh"
+#include "age_cpu_profiler.hh"
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
 #include <cstring>
+#include <cstdio>
+#include <fstream>
 #include <map>
 #include <set>
 #include <stdexcept>
 #include <GLFW/glfw3.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
 namespace age {
+    // Header written in front of the driver's pipeline cache blob.
+    // The driver validates its own header, but we also check the driver
+    // version and a checksum so a stale or torn file is never handed to it
+    struct PipelineCacheFileHeader {
+        uint32_t magic;                          // PIPELINE_CACHE_MAGIC
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint32_t driver_version;
+        uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+        uint64_t data_size;                      // bytes of cache data following the header
+        uint64_t checksum;                       // FNV-1a of the cache data
+    };
+
+    static const uint32_t PIPELINE_CACHE_MAGIC = 0x43504741; // "AGPC"
+
+    // The GPU picked on a previous run
+    // The key changes with the requirements or the set of installed GPUs,
+    // either of which may make a different device the better choice
+    struct DeviceChoiceFile {
+        uint32_t magic;                          // DEVICE_CHOICE_MAGIC
+        uint32_t reserved;
+        uint64_t key;
+        uint8_t device_uuid[VK_UUID_SIZE];
+    };
+
+    static const uint32_t DEVICE_CHOICE_MAGIC = 0x43444741; // "AGDC"
+
+    static const uint64_t FNV1A_OFFSET = 0xcbf29ce484222325ull;
+
+    // Pass a previous result as hash to extend it with more data
+    static uint64_t
+    fnv1a(const void *data, size_t size, uint64_t hash = FNV1A_OFFSET) {
+        const uint8_t *bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // Write a header and data to a temporary file that is synced and renamed
+    // over path, so a crash mid-write never leaves a torn file behind
+    static bool
+    replace_file(const std::string &path, const void *header, size_t header_size, const void *data, size_t data_size) {
+        std::string temp_path = path + ".tmp";
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        bool written = write(fd, header, header_size) == static_cast<ssize_t>(header_size)
+                       && (data_size == 0 || write(fd, data, data_size) == static_cast<ssize_t>(data_size))
+                       && fsync(fd) == 0;
+        close(fd);
+
+        if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+            unlink(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static uint32_t
+    major_minor(uint32_t version) {
+        return VK_MAKE_API_VERSION(0, VK_API_VERSION_MAJOR(version), VK_API_VERSION_MINOR(version), 0);
+    }
+
     /// QUEUE FAMILY ///
     bool
     QueueFamilyIndices::is_complete() {
@@ -24,24 +98,86 @@ namespace age {
      *                Public
      *********************************************/
     // Constructor //
-    age_device::age_device(age_window &window) 
-    : _window{window} {
-        this->_create_instance();
-        this->_setup_debug_messenger();
-        this->_create_window_surface();
-        this->_pick_physical_device();
-        this->_create_logical_device();
+    // Startup runs as a graph so that file and layer queries overlap the
+    // instance and device creation they do not depend on
+    age_device::age_device(
+            age_window &window,
+            std::string pipeline_cache_path,
+            DeviceRequirements requirements,
+            std::string device_cache_path,
+            age_job_system *jobs)
+    : _window{window},
+      _pipeline_cache_path{pipeline_cache_path},
+      _device_cache_path{device_cache_path},
+      _requirements{requirements},
+      _api_version{VK_API_VERSION_1_0},
+      _bindless_enabled{requirements.bindless},
+      _validation_layers_available{false},
+      _startup_ms{0.0} {
+        AGE_PROFILE_ZONE("age_device");
+        this->_device_extensions.insert(
+                this->_device_extensions.end(),
+                this->_requirements.extensions.begin(),
+                this->_requirements.extensions.end());
+
+        age_init_graph graph(jobs);
+        uint32_t load = graph.add_step("load_vulkan", [this]() {
+            this->_vk.load_global();
+        });
+        uint32_t layers = graph.add_step("check_validation_layers", [this]() {
+            this->_validation_layers_available = !this->enable_validation_layers || this->_check_validation_layer_support();
+        }, {load});
+        uint32_t cache_file = graph.add_step("read_pipeline_cache", [this]() {
+            this->_read_pipeline_cache_file();
+        });
+        uint32_t instance = graph.add_step("create_instance", [this]() {
+            this->_create_instance();
+        }, {load, layers});
+        graph.add_step("setup_debug_messenger", [this]() {
+            this->_setup_debug_messenger();
+        }, {instance});
+        uint32_t surface = graph.add_step("create_window_surface", [this]() {
+            this->_create_window_surface();
+        }, {instance}, true);                       // the window belongs to the main thread
+        uint32_t physical = graph.add_step("pick_physical_device", [this]() {
+            this->_pick_physical_device();
+        }, {surface});
+        uint32_t logical = graph.add_step("create_logical_device", [this]() {
+            this->_create_logical_device();
+        }, {physical});
+        graph.add_step("create_command_pool", [this]() {
+            this->_create_command_pool();
+        }, {logical});
+        graph.add_step("create_allocator", [this]() {
+            this->_allocator = std::make_unique<age_allocator>(this->_physical_device, this->_logical_device, this->_vk, this->get_allocation_callbacks());
+        }, {logical});
+        graph.add_step("create_deletion_queue", [this]() {
+            this->_deletion_queue = std::make_unique<age_deletion_queue>(*this);
+        }, {logical});
+        graph.add_step("create_pipeline_cache", [this]() {
+            this->_create_pipeline_cache();
+        }, {logical, cache_file});
+        graph.run();
+
+        this->_startup_timings = graph.get_timings();
+        this->_startup_ms = graph.get_total_ms();
+        age_log::get().write(LogSeverity::info, "device", "startup " + graph.get_report());
     }
 
     // Destructor //
     age_device::~age_device() {
-        vkDestroyDevice(this->_logical_device, nullptr);
+        this->_deletion_queue.reset();
+        this->_save_pipeline_cache();
+        this->_vk.vkDestroyPipelineCache(this->_logical_device, this->_pipeline_cache, this->get_allocation_callbacks());
+        this->_allocator.reset();
+        this->_vk.vkDestroyCommandPool(this->_logical_device, this->_command_pool, this->get_allocation_callbacks());
+        this->_vk.vkDestroyDevice(this->_logical_device, this->get_allocation_callbacks());
         if (this->enable_validation_layers) {
-            age_device::destroy_debug_messenger(this->_instance, this->_debug_messenger, nullptr);
+            this->_vk.vkDestroyDebugUtilsMessengerEXT(this->_instance, this->_debug_messenger, this->get_allocation_callbacks());
         }
 
-        vkDestroySurfaceKHR(this->_instance, this->_window_surface, nullptr);
-        vkDestroyInstance(this->_instance, nullptr);
+        this->_vk.vkDestroySurfaceKHR(this->_instance, this->_window_surface, this->get_allocation_callbacks());
+        this->_vk.vkDestroyInstance(this->_instance, this->get_allocation_callbacks());
     }
 
     SwapChainSupportDetails
@@ -58,7 +194,7 @@ namespace age {
     // Get the device queue families
     QueueFamilyIndices
     age_device::find_physical_device_queue_families() {
-        return this->_find_queue_families(this->_physical_device);
+        return this->_queue_family_indices;
     }
 
     // Get the logical device
@@ -68,6 +204,159 @@ namespace age {
         return this->_logical_device;
     }
 
+    // Get the physical device
+    VkPhysicalDevice
+    age_device::get_physical_device() {
+        return this->_physical_device;
+    }
+
+    // Get the graphics queue
+    VkQueue
+    age_device::get_graphics_queue() {
+        return this->_graphics_queue;
+    }
+
+    // Get the present queue
+    VkQueue
+    age_device::get_present_queue() {
+        return this->_present_queue;
+    }
+
+    // Get the transfer queue
+    // This is a dedicated copy queue when the device has one
+    VkQueue
+    age_device::get_transfer_queue() {
+        return this->_transfer_queue;
+    }
+
+    // Get the async compute queue
+    // This runs alongside the graphics queue when the device has a separate family
+    VkQueue
+    age_device::get_compute_queue() {
+        return this->_compute_queue;
+    }
+
+    // Submit work to a queue
+    // Queues can be shared between roles and threads, so
+    // submissions are serialized per queue
+    VkResult
+    age_device::queue_submit(VkQueue queue, uint32_t submit_count, const VkSubmitInfo *submits, VkFence fence) {
+        std::lock_guard<std::mutex> lock(*this->_queue_mutexes.at(queue));
+        return this->_vk.vkQueueSubmit(queue, submit_count, submits, fence);
+    }
+
+    // Present on a queue
+    VkResult
+    age_device::queue_present(VkQueue queue, const VkPresentInfoKHR *present_info) {
+        std::lock_guard<std::mutex> lock(*this->_queue_mutexes.at(queue));
+        return this->_vk.vkQueuePresentKHR(queue, present_info);
+    }
+
+    // Create a timeline semaphore starting at the given value
+    VkSemaphore
+    age_device::create_timeline_semaphore(uint64_t initial_value) {
+        VkSemaphoreTypeCreateInfo type_info{};
+        type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        type_info.initialValue = initial_value;
+
+        VkSemaphoreCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        create_info.pNext = &type_info;
+
+        VkSemaphore semaphore;
+        if (this->_vk.vkCreateSemaphore(this->_logical_device, &create_info, this->get_allocation_callbacks(), &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create timeline semaphore");
+        }
+        return semaphore;
+    }
+
+    // Get the current value of a timeline semaphore without blocking
+    uint64_t
+    age_device::get_semaphore_value(VkSemaphore semaphore) {
+        uint64_t value = 0;
+        this->_vk.vkGetSemaphoreCounterValueKHR(this->_logical_device, semaphore, &value);
+        return value;
+    }
+
+    // Block until a timeline semaphore reaches a value
+    VkResult
+    age_device::wait_semaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout) {
+        VkSemaphoreWaitInfo wait_info{};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &semaphore;
+        wait_info.pValues = &value;
+        return this->_vk.vkWaitSemaphoresKHR(this->_logical_device, &wait_info, timeout);
+    }
+
+    // Get the command pool for the graphics queue family
+    VkCommandPool
+    age_device::get_command_pool() {
+        return this->_command_pool;
+    }
+
+    // Get the allocator that owns all device memory
+    age_allocator&
+    age_device::get_allocator() {
+        return *this->_allocator;
+    }
+
+    // Get the deletion queue
+    age_deletion_queue&
+    age_device::get_deletion_queue() {
+        return *this->_deletion_queue;
+    }
+
+    // Get the pipeline cache
+    VkPipelineCache
+    age_device::get_pipeline_cache() {
+        return this->_pipeline_cache;
+    }
+
+    // Get the host allocation callbacks
+    // Objects must be destroyed with the callbacks they were created with
+    const VkAllocationCallbacks*
+    age_device::get_allocation_callbacks() {
+        return this->_host_allocator.get_callbacks();
+    }
+
+    // Get the host allocator
+    // Its statistics show how much host memory the driver spends on our objects
+    age_host_allocator&
+    age_device::get_host_allocator() {
+        return this->_host_allocator;
+    }
+
+    // Get the dispatch table
+    const age_dispatch&
+    age_device::get_dispatch() {
+        return this->_vk;
+    }
+
+    uint32_t
+    age_device::get_api_version() {
+        return this->_api_version;
+    }
+
+    // Whether age_bindless can be used on this device
+    // Bindless has to be requested, it is off when the loader or GPU lacks support
+    bool
+    age_device::is_bindless_enabled() {
+        return this->_bindless_enabled;
+    }
+
+    // How long each step of creating the device took
+    std::vector<InitStepTiming>
+    age_device::get_startup_timings() {
+        return this->_startup_timings;
+    }
+
+    double
+    age_device::get_startup_ms() {
+        return this->_startup_ms;
+    }
+
     /**********************************************
      *                 Private
      *********************************************/
@@ -81,8 +370,24 @@ namespace age {
             void* p_user_data                                            // pointer specified during setup of callback that
                                                                          // allows you to pass your own data to it
         ) {
-        if (message_severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-            std::cerr << "Validation layer: " << p_callback_data->pMessage << std::endl;
+        LogSeverity severity = LogSeverity::verbose;
+        if (message_severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+            severity = LogSeverity::error;
+        } else if (message_severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+            severity = LogSeverity::warning;
+        } else if (message_severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+            severity = LogSeverity::info;
+        }
+
+        // Runs on whatever thread made the Vulkan call, so it only queues the
+        // message. Repeats are recognised by their message ID, or by their
+        // text for messages that have none
+        age_log &log = age_log::get();
+        if (log.is_enabled(severity)) {
+            uint64_t key = p_callback_data->messageIdNumber != 0
+                ? (1ull << 32) | static_cast<uint32_t>(p_callback_data->messageIdNumber)
+                : fnv1a(reinterpret_cast<const uint8_t*>(p_callback_data->pMessage), strlen(p_callback_data->pMessage)) | 1;
+            log.write(severity, "validation", p_callback_data->pMessage, key);
         }
         return VK_FALSE;
     }
@@ -101,6 +406,7 @@ namespace age {
         create_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
         create_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
         create_info.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT 
+                                     | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
                                      | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
                                      | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
         create_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
@@ -112,12 +418,32 @@ namespace age {
     // Create the vulkan instance
     void
     age_device::_create_instance() {
-        if (enable_validation_layers && !_check_validation_layer_support()) {
+        AGE_PROFILE_FUNCTION();
+        if (!this->_validation_layers_available) {
             throw std::runtime_error("Error: validation layer requested but not available");
         }
 
-        uint32_t glfw_extension_count = 0;
-        const char** glfw_extensions;
+        // Ask for 1.1 whenever the loader has it, that is where
+        // vkGetPhysicalDeviceFeatures2 and device UUIDs come from.
+        // Descriptor indexing needs 1.2
+        uint32_t loader_version = VK_API_VERSION_1_0;
+        if (this->_vk.vkEnumerateInstanceVersion != nullptr) {
+            this->_vk.vkEnumerateInstanceVersion(&loader_version);
+        }
+        loader_version = major_minor(loader_version);
+        if (loader_version < major_minor(this->_requirements.api_version)) {
+            throw std::runtime_error("Error: the Vulkan loader is older than the required API version");
+        }
+        if (this->_bindless_enabled && loader_version < VK_API_VERSION_1_2) {
+            age_log::get().write(LogSeverity::warning, "device", "bindless needs a Vulkan 1.2 loader, continuing without it");
+            this->_bindless_enabled = false;
+        }
+
+        uint32_t wanted_version = std::max(major_minor(this->_requirements.api_version), VK_API_VERSION_1_1);
+        if (this->_bindless_enabled) {
+            wanted_version = std::max(wanted_version, VK_API_VERSION_1_2);
+        }
+        this->_api_version = std::min(wanted_version, loader_version);
 
         // Create the application info struct to later create the vulkan instance
         VkApplicationInfo app_info{};
@@ -126,7 +452,7 @@ namespace age {
         app_info.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
         app_info.pEngineName = "No engine";
         app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        app_info.apiVersion = VK_API_VERSION_1_0;
+        app_info.apiVersion = this->_api_version;
         app_info.pNext = nullptr; // This can be used to point to extension information in the future
  
         // Create the vulkan instance
@@ -134,8 +460,6 @@ namespace age {
         instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
         instance_create_info.pApplicationInfo = &app_info;
 
-        glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-
         // Set the extension information
         std::vector <const char*> extensions = this->_get_required_extensions();
         instance_create_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
@@ -155,85 +479,158 @@ namespace age {
         }
 
         // Create the instance
-        VkResult result = vkCreateInstance(&instance_create_info, nullptr, &this->_instance);
+        VkResult result = this->_vk.vkCreateInstance(&instance_create_info, this->get_allocation_callbacks(), &this->_instance);
         if (result != VK_SUCCESS) {
             throw std::runtime_error("Error: unable to create vulkan instance");
         }
+        this->_vk.load_instance(this->_instance);
     }
 
     // Create the surface to interface with the window
     void
     age_device::_create_window_surface() {
-        this->_window.create_window_surface(this->_instance, &this->_window_surface);
+        AGE_PROFILE_FUNCTION();
+        this->_window.create_window_surface(this->_instance, this->get_allocation_callbacks(), &this->_window_surface);
     }
 
     // Pick the physical device (GPU)
     // that we are going to be using
+    //
+    // Scoring a GPU enumerates its extensions, scans its queue families and
+    // queries the surface. A warm start only does that for the GPU chosen
+    // last time, found by its UUID, and scans everything if it no longer
+    // qualifies or the requirements or installed GPUs changed
     void
     age_device::_pick_physical_device() {
+        AGE_PROFILE_FUNCTION();
         this->_physical_device = VK_NULL_HANDLE;
         uint32_t device_count = 0;
         
-        vkEnumeratePhysicalDevices(this->_instance, &device_count, nullptr);
+        this->_vk.vkEnumeratePhysicalDevices(this->_instance, &device_count, nullptr);
 
         // Cannot find a GPU 
         if (device_count == 0) {
             throw std::runtime_error("Error: failed to find GPU with vulkan support");
         }
 
-        std::multimap<int, VkPhysicalDevice> candidates;
         std::vector<VkPhysicalDevice> devices(device_count);
-        vkEnumeratePhysicalDevices(this->_instance, &device_count, devices.data());
-
-        for (VkPhysicalDevice &device : devices) {
-            int score = this->_rate_device_suitability(device);
-            candidates.insert(std::make_pair(score, device));
-//            if (this->_is_device_suitable(device)) {
-//                this->_physical_device = device;
-//                break;
-//            }
+        this->_vk.vkEnumeratePhysicalDevices(this->_instance, &device_count, devices.data());
+
+        uint64_t cache_key = this->_get_device_cache_key(devices);
+        uint8_t cached_uuid[VK_UUID_SIZE];
+        if (cache_key != 0 && this->_load_device_choice(cache_key, cached_uuid)) {
+            for (VkPhysicalDevice device : devices) {
+                uint8_t uuid[VK_UUID_SIZE];
+                if (this->_get_device_uuid(device, uuid)
+                    && memcmp(uuid, cached_uuid, VK_UUID_SIZE) == 0
+                    && this->_score_device(device) > 0) {
+                    this->_physical_device = device;
+                    break;
+                }
+            }
         }
 
-        if (candidates.rbegin()->first > 0) {
-            this->_physical_device = candidates.rbegin()->second;
-        } else {
-            throw std::runtime_error("Error: unable to find suitable GPU");
+        bool scanned = this->_physical_device == VK_NULL_HANDLE;
+        if (scanned) {
+            int best_score = 0;
+            for (VkPhysicalDevice device : devices) {
+                int score = this->_score_device(device);
+                if (score > best_score) {
+                    best_score = score;
+                    this->_physical_device = device;
+                }
+            }
+            if (this->_physical_device == VK_NULL_HANDLE) {
+                throw std::runtime_error("Error: unable to find suitable GPU");
+            }
+            if (cache_key != 0) {
+                this->_save_device_choice(cache_key);
+            }
         }
 
-//        if (this->_physical_device == VK_NULL_HANDLE) {
-//            throw std::runtime_error("Error: failed to find suitable GPU");
-//        } 
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(this->_physical_device, &properties);
+        age_log::get().write(LogSeverity::info, "device",
+                std::string(scanned ? "picked " : "picked cached ") + properties.deviceName);
+
+        if (this->_bindless_enabled && !this->_query_features(this->_physical_device).descriptor_indexing) {
+            age_log::get().write(LogSeverity::warning, "device", "GPU does not support descriptor indexing, continuing without bindless");
+            this->_bindless_enabled = false;
+        }
     }
 
     // Create the logical device that 
     // we are going to interface with
     void
     age_device::_create_logical_device() {
-        float queue_priority = 1.0F;
+        AGE_PROFILE_FUNCTION();
         QueueFamilyIndices indices = this->_find_queue_families(this->_physical_device);
+        this->_queue_family_indices = indices;
 
-        std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
-        std::set<uint32_t> unique_queue_families = {indices.graphics_family.value(), indices.present_family.value()};
+        uint32_t queue_family_count = 0;
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(this->_physical_device, &queue_family_count, nullptr);
+        std::vector <VkQueueFamilyProperties> queue_families(queue_family_count);
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(this->_physical_device, &queue_family_count, queue_families.data());
+
+        // Give every role its own queue while the family has queues left,
+        // after that roles share the family's last queue
+        std::map<uint32_t, uint32_t> queue_counts;
+        auto claim_queue = [&](uint32_t family) {
+            uint32_t index = queue_counts[family];
+            if (index < queue_families[family].queueCount) {
+                queue_counts[family]++;
+                return index;
+            }
+            return queue_families[family].queueCount - 1;
+        };
+
+        uint32_t graphics_index = claim_queue(indices.graphics_family.value());
+        uint32_t present_index = indices.present_family == indices.graphics_family
+                                 ? graphics_index
+                                 : claim_queue(indices.present_family.value());
+        uint32_t transfer_index = claim_queue(indices.transfer_family.value());
+        uint32_t compute_index = claim_queue(indices.compute_family.value());
 
-        // Describes the number of queues that we want for a single queue family.
-        // We are only interested in a queue with graphics capabilities
-        // right now
-        for (uint32_t queue_family : unique_queue_families) {
+        // Describes the number of queues that we want for each queue family
+        std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+        std::vector<float> queue_priorities(4, 1.0F);
+        for (const std::pair<const uint32_t, uint32_t> &family : queue_counts) {
             VkDeviceQueueCreateInfo queue_create_info{};
             queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queue_create_info.queueFamilyIndex = indices.graphics_family.value();
-            queue_create_info.queueCount = 1;
-            queue_create_info.pQueuePriorities = &queue_priority; // 1.0F for right now
+            queue_create_info.queueFamilyIndex = family.first;
+            queue_create_info.queueCount = family.second;
+            queue_create_info.pQueuePriorities = queue_priorities.data(); // 1.0F for right now
             queue_create_infos.push_back(queue_create_info);
         }
 
-
-        // Specify the set of device features that we will be using
-        // FOR NOW: we don't need anything special, so we can leave it
-        VkPhysicalDeviceFeatures device_features{};
+        // Timeline semaphores are how the transfer and graphics
+        // queues tell each other that work is done
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features{};
+        timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        timeline_features.timelineSemaphore = VK_TRUE;
+
+        // On 1.2 the same feature lives in the 1.2 struct, which may not be
+        // chained together with the separate timeline struct
+        VkPhysicalDeviceVulkan12Features vulkan12_features{};
+        vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12_features.timelineSemaphore = VK_TRUE;
+        vulkan12_features.descriptorIndexing = VK_TRUE;
+        vulkan12_features.runtimeDescriptorArray = VK_TRUE;
+        vulkan12_features.descriptorBindingPartiallyBound = VK_TRUE;
+        vulkan12_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        vulkan12_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        vulkan12_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        vulkan12_features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+
+        // The scoring made sure every required feature is there
+        VkPhysicalDeviceFeatures device_features = this->_requirements.features;
         VkDeviceCreateInfo device_create_info{};
 
         device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        device_create_info.pNext = this->_bindless_enabled
+                                   ? static_cast<void*>(&vulkan12_features)
+                                   : static_cast<void*>(&timeline_features);
         device_create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
         device_create_info.pQueueCreateInfos = queue_create_infos.data();
         device_create_info.pEnabledFeatures = &device_features;
@@ -249,66 +646,222 @@ namespace age {
         }
 
         // Create the instance of hte logical device
-        if (vkCreateDevice(this->_physical_device, &device_create_info, nullptr, &this->_logical_device) != VK_SUCCESS) {
+        if (this->_vk.vkCreateDevice(this->_physical_device, &device_create_info, this->get_allocation_callbacks(), &this->_logical_device) != VK_SUCCESS) {
             throw std::runtime_error("Error: failed to create logical device");
         }
+        this->_vk.load_device(this->_logical_device);
 
-        // Get the device queue for the graphics queue family 
-        // and the present queue family for this device
+        // Get the device queue for the graphics queue family,
+        // the present queue family, the transfer and the compute queue family for this device
         // -- implicity cleaned up when the logical device is destroyed --
-        vkGetDeviceQueue(
+        this->_vk.vkGetDeviceQueue(
             this->_logical_device,
             indices.graphics_family.value(),
-            0,
+            graphics_index,
             &this->_graphics_queue
         );
-        vkGetDeviceQueue(
+        this->_vk.vkGetDeviceQueue(
             this->_logical_device,
             indices.present_family.value(),
-            0,
+            present_index,
             &this->_present_queue
         );
+        this->_vk.vkGetDeviceQueue(
+            this->_logical_device,
+            indices.transfer_family.value(),
+            transfer_index,
+            &this->_transfer_queue
+        );
+        this->_vk.vkGetDeviceQueue(
+            this->_logical_device,
+            indices.compute_family.value(),
+            compute_index,
+            &this->_compute_queue
+        );
+
+        // Queues must be externally synchronized and roles may share one,
+        // so every distinct queue gets a lock
+        for (VkQueue queue : {this->_graphics_queue, this->_present_queue, this->_transfer_queue, this->_compute_queue}) {
+            if (this->_queue_mutexes.find(queue) == this->_queue_mutexes.end()) {
+                this->_queue_mutexes[queue] = std::make_unique<std::mutex>();
+            }
+        }
+
     }
 
-    // Rate the suitability of devices that we can choose from
-    int
-    age_device::_rate_device_suitability(VkPhysicalDevice device) {
-        bool swap_chain_adequate = false;
-        bool extensions_supported = this->_check_device_extension_support(device);
-        QueueFamilyIndices indices = this->_find_queue_families(device);
+    // Create the command pool that the per-frame command buffers
+    // are allocated from. Buffers are re-recorded every frame so
+    // they need to be individually resettable
+    void
+    age_device::_create_command_pool() {
+        AGE_PROFILE_FUNCTION();
+        QueueFamilyIndices indices = this->_queue_family_indices;
 
-        if (!indices.is_complete() 
-            || !extensions_supported
-            ) {
-            return 0;
+        VkCommandPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_info.queueFamilyIndex = indices.graphics_family.value();
+
+        if (this->_vk.vkCreateCommandPool(this->_logical_device, &pool_info, this->get_allocation_callbacks(), &this->_command_pool) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create command pool");
+        }
+    }
+
+    // Read the pipeline cache file
+    // Only the bytes are read here, they are checked against the
+    // device once it is known
+    void
+    age_device::_read_pipeline_cache_file() {
+        if (this->_pipeline_cache_path.empty()) {
+            return;
         }
 
-        if (extensions_supported) {
-            SwapChainSupportDetails swap_chain_support = this->_query_swap_chain_support(device);
-            swap_chain_adequate = !swap_chain_support.formats.empty()
-                                  && !swap_chain_support.present_modes.empty();
+        std::ifstream file(this->_pipeline_cache_path, std::ios::ate | std::ios::binary);
+        if (!file) {
+            return;
         }
+        this->_pipeline_cache_file.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(this->_pipeline_cache_file.data()), this->_pipeline_cache_file.size())) {
+            this->_pipeline_cache_file.clear();
+        }
+    }
 
-        VkPhysicalDeviceProperties device_properties;
-        VkPhysicalDeviceFeatures device_features;
+    // Create the pipeline cache
+    // If the cache file was written by this exact device and driver
+    // it is used as the initial data, otherwise we start empty
+    void
+    age_device::_create_pipeline_cache() {
+        AGE_PROFILE_FUNCTION();
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(this->_physical_device, &properties);
+
+        const std::vector<uint8_t> &file = this->_pipeline_cache_file;
+        const uint8_t *data = nullptr;
+        size_t data_size = 0;
+        PipelineCacheFileHeader header{};
+        if (file.size() >= sizeof(header)) {
+            memcpy(&header, file.data(), sizeof(header));
+            if (header.magic == PIPELINE_CACHE_MAGIC
+                && header.vendor_id == properties.vendorID
+                && header.device_id == properties.deviceID
+                && header.driver_version == properties.driverVersion
+                && memcmp(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0
+                && header.data_size >= sizeof(VkPipelineCacheHeaderVersionOne)
+                && header.data_size <= file.size() - sizeof(header)
+                && fnv1a(file.data() + sizeof(header), header.data_size) == header.checksum) {
+                data = file.data() + sizeof(header);
+                data_size = header.data_size;
+            }
+        }
 
-        vkGetPhysicalDeviceProperties(device, &device_properties);
-        vkGetPhysicalDeviceFeatures(device, &device_features);
+        VkPipelineCacheCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        create_info.initialDataSize = data_size;
+        create_info.pInitialData = data;
 
-        int score = 0;
-        if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-            score += 1000;
+        VkResult result = this->_vk.vkCreatePipelineCache(this->_logical_device, &create_info, this->get_allocation_callbacks(), &this->_pipeline_cache);
+        std::vector<uint8_t>().swap(this->_pipeline_cache_file);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create pipeline cache");
         }
+    }
 
-        score += device_properties.limits.maxImageDimension2D;
+    // Write the pipeline cache back to disk
+    // Failures only cost us a warm start, so they are reported and ignored
+    void
+    age_device::_save_pipeline_cache() {
+        AGE_PROFILE_FUNCTION();
+        if (this->_pipeline_cache_path.empty()) {
+            return;
+        }
 
-        
+        size_t size = 0;
+        if (this->_vk.vkGetPipelineCacheData(this->_logical_device, this->_pipeline_cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+            return;
+        }
+        std::vector<uint8_t> data(size);
+        if (this->_vk.vkGetPipelineCacheData(this->_logical_device, this->_pipeline_cache, &size, data.data()) != VK_SUCCESS) {
+            return;
+        }
+        data.resize(size);
+
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(this->_physical_device, &properties);
+
+        PipelineCacheFileHeader header{};
+        header.magic = PIPELINE_CACHE_MAGIC;
+        header.vendor_id = properties.vendorID;
+        header.device_id = properties.deviceID;
+        header.driver_version = properties.driverVersion;
+        memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.data_size = data.size();
+        header.checksum = fnv1a(data.data(), data.size());
+
+        if (!replace_file(this->_pipeline_cache_path, &header, sizeof(header), data.data(), data.size())) {
+            age_log::get().write(LogSeverity::warning, "device", "unable to write pipeline cache to " + this->_pipeline_cache_path);
+        }
+    }
 
-        // Check if the device has a geometry shader
-        if (!device_features.geometryShader
-            || !swap_chain_adequate)
+    // Score a GPU against the requirements
+    // Anything missing a requirement scores 0, the rest start at 1 and
+    // gain points for each preference they meet
+    int
+    age_device::_score_device(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(device, &properties);
+        if (major_minor(properties.apiVersion) < major_minor(this->_requirements.api_version)
+            || !this->_check_device_extension_support(device)) {
+            return 0;
+        }
+
+        QueueFamilyIndices indices = this->_find_queue_families(device);
+        if (!indices.is_complete()) {
+            return 0;
+        }
+
+        // VkPhysicalDeviceFeatures is nothing but VkBool32 members
+        DeviceFeatures features = this->_query_features(device);
+        const VkBool32 *required = reinterpret_cast<const VkBool32*>(&this->_requirements.features);
+        const VkBool32 *supported = reinterpret_cast<const VkBool32*>(&features.core);
+        for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); i++) {
+            if (required[i] && !supported[i]) {
+                return 0;
+            }
+        }
+
+        VkPhysicalDeviceMemoryProperties memory_properties;
+        this->_vk.vkGetPhysicalDeviceMemoryProperties(device, &memory_properties);
+        VkDeviceSize device_local_bytes = 0;
+        for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+            if (memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                device_local_bytes = std::max(device_local_bytes, memory_properties.memoryHeaps[i].size);
+            }
+        }
+        if (device_local_bytes < this->_requirements.min_device_local_bytes) {
+            return 0;
+        }
+
+        // Surface queries go last, they are the slowest
+        SwapChainSupportDetails swap_chain_support = this->_query_swap_chain_support(device);
+        if (swap_chain_support.formats.empty() || swap_chain_support.present_modes.empty()) {
             return 0;
+        }
 
+        int score = 1;
+        if (this->_requirements.prefer_discrete && properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+            score += 10000;
+        }
+        if (this->_bindless_enabled && features.descriptor_indexing) {
+            score += 4000;
+        }
+        if (this->_requirements.prefer_async_compute && indices.compute_family != indices.graphics_family) {
+            score += 1000;
+        }
+        if (this->_requirements.prefer_dedicated_transfer && indices.transfer_family != indices.graphics_family) {
+            score += 500;
+        }
+        score += static_cast<int>(std::min<VkDeviceSize>(device_local_bytes >> 30, 256)); // GiB break the ties
         return score;
     }
 
@@ -317,14 +870,17 @@ namespace age {
     bool
     age_device::_check_device_extension_support(VkPhysicalDevice device) {
         uint32_t extension_count;
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+        this->_vk.vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
 
         std::vector<VkExtensionProperties> available_extensions(extension_count);
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
+        this->_vk.vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
         std::set <std::string> required_extensions{this->_device_extensions.begin(), this->_device_extensions.end()};
 
+        bool verbose = age_log::get().is_enabled(LogSeverity::verbose);
         for (const VkExtensionProperties& extension : available_extensions) {
-            std::cout << "Extension name: " << extension.extensionName << std::endl;
+            if (verbose) {
+                age_log::get().write(LogSeverity::verbose, "device", std::string("extension ") + extension.extensionName);
+            }
             required_extensions.erase(extension.extensionName);              
         }
         return required_extensions.empty();
@@ -337,77 +893,199 @@ namespace age {
         SwapChainSupportDetails details;
 
         // Get the surface and device capabilities
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, this->_window_surface, &details.capabilities);
+        this->_vk.vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, this->_window_surface, &details.capabilities);
 
         // Get the surface and device formats
-        vkGetPhysicalDeviceSurfaceFormatsKHR(device, this->_window_surface, &format_count, nullptr);
+        this->_vk.vkGetPhysicalDeviceSurfaceFormatsKHR(device, this->_window_surface, &format_count, nullptr);
         if (format_count != 0) {
             details.formats.resize(format_count);
-            vkGetPhysicalDeviceSurfaceFormatsKHR(device, this->_window_surface, &format_count, details.formats.data());
+            this->_vk.vkGetPhysicalDeviceSurfaceFormatsKHR(device, this->_window_surface, &format_count, details.formats.data());
         }
 
         // Get the surface and device present modes
-        vkGetPhysicalDeviceSurfacePresentModesKHR(device, this->_window_surface, &present_mode_count, nullptr);
+        this->_vk.vkGetPhysicalDeviceSurfacePresentModesKHR(device, this->_window_surface, &present_mode_count, nullptr);
         if (present_mode_count != 0) {
             details.present_modes.resize(present_mode_count);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, this->_window_surface, &present_mode_count, details.present_modes.data());
+            this->_vk.vkGetPhysicalDeviceSurfacePresentModesKHR(device, this->_window_surface, &present_mode_count, details.present_modes.data());
         }
 
         return details;
     }
 
+    // Query a GPU's features
+    // Everything comes from one vkGetPhysicalDeviceFeatures2 call with the
+    // 1.2 features chained when both the instance and the GPU run 1.2.
+    // A 1.0 instance or GPU only has the core features to offer
+    age_device::DeviceFeatures
+    age_device::_query_features(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(device, &properties);
+        uint32_t version = std::min(major_minor(properties.apiVersion), this->_api_version);
+
+        DeviceFeatures result{};
+        if (version < VK_API_VERSION_1_1 || this->_vk.vkGetPhysicalDeviceFeatures2 == nullptr) {
+            this->_vk.vkGetPhysicalDeviceFeatures(device, &result.core);
+            return result;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12_features{};
+        vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = version >= VK_API_VERSION_1_2 ? &vulkan12_features : nullptr;
+        this->_vk.vkGetPhysicalDeviceFeatures2(device, &features);
+
+        result.core = features.features;
+        result.descriptor_indexing = version >= VK_API_VERSION_1_2
+                                     && vulkan12_features.timelineSemaphore
+                                     && vulkan12_features.descriptorIndexing
+                                     && vulkan12_features.runtimeDescriptorArray
+                                     && vulkan12_features.descriptorBindingPartiallyBound
+                                     && vulkan12_features.descriptorBindingUpdateUnusedWhilePending
+                                     && vulkan12_features.descriptorBindingSampledImageUpdateAfterBind
+                                     && vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind
+                                     && vulkan12_features.shaderSampledImageArrayNonUniformIndexing
+                                     && vulkan12_features.shaderStorageBufferArrayNonUniformIndexing;
+        return result;
+    }
+
+    // Get the UUID that identifies a GPU across runs
+    bool
+    age_device::_get_device_uuid(VkPhysicalDevice device, uint8_t *uuid) {
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(device, &properties);
+        if (std::min(major_minor(properties.apiVersion), this->_api_version) < VK_API_VERSION_1_1
+            || this->_vk.vkGetPhysicalDeviceProperties2 == nullptr) {
+            return false;
+        }
+
+        VkPhysicalDeviceIDProperties id_properties{};
+        id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &id_properties;
+        this->_vk.vkGetPhysicalDeviceProperties2(device, &properties2);
+        memcpy(uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+        return true;
+    }
+
+    // Hash the requirements and the UUIDs of every installed GPU
+    // Returns 0 when caching is off or a GPU has no UUID
+    uint64_t
+    age_device::_get_device_cache_key(const std::vector<VkPhysicalDevice> &devices) {
+        if (this->_device_cache_path.empty()) {
+            return 0;
+        }
+
+        const DeviceRequirements &requirements = this->_requirements;
+        uint64_t key = fnv1a(&requirements.api_version, sizeof(requirements.api_version));
+        for (const char *extension : this->_device_extensions) {
+            key = fnv1a(extension, strlen(extension) + 1, key);
+        }
+        key = fnv1a(&requirements.features, sizeof(requirements.features), key);
+        key = fnv1a(&requirements.min_device_local_bytes, sizeof(requirements.min_device_local_bytes), key);
+        bool preferences[] = {
+            requirements.prefer_discrete,
+            requirements.prefer_async_compute,
+            requirements.prefer_dedicated_transfer,
+            this->_bindless_enabled
+        };
+        key = fnv1a(preferences, sizeof(preferences), key);
+
+        for (VkPhysicalDevice device : devices) {
+            uint8_t uuid[VK_UUID_SIZE];
+            if (!this->_get_device_uuid(device, uuid)) {
+                return 0;
+            }
+            key = fnv1a(uuid, VK_UUID_SIZE, key);
+        }
+        return key | 1;
+    }
+
+    // Read the GPU chosen by a previous run with the same key
+    bool
+    age_device::_load_device_choice(uint64_t key, uint8_t *uuid) {
+        std::ifstream file(this->_device_cache_path, std::ios::binary);
+        DeviceChoiceFile choice{};
+        if (!file || !file.read(reinterpret_cast<char*>(&choice), sizeof(choice))
+            || choice.magic != DEVICE_CHOICE_MAGIC
+            || choice.key != key) {
+            return false;
+        }
+        memcpy(uuid, choice.device_uuid, VK_UUID_SIZE);
+        return true;
+    }
+
+    // Remember the chosen GPU for the next start
+    void
+    age_device::_save_device_choice(uint64_t key) {
+        DeviceChoiceFile choice{};
+        choice.magic = DEVICE_CHOICE_MAGIC;
+        choice.key = key;
+        if (!this->_get_device_uuid(this->_physical_device, choice.device_uuid)
+            || !replace_file(this->_device_cache_path, &choice, sizeof(choice), nullptr, 0)) {
+            age_log::get().write(LogSeverity::warning, "device", "unable to write device choice to " + this->_device_cache_path);
+        }
+    }
+
     // Find and the queue families
     QueueFamilyIndices
     age_device::_find_queue_families(VkPhysicalDevice device) {
         QueueFamilyIndices indices;
 
         uint32_t queue_family_count = 0;
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, nullptr);
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, nullptr);
 
         std::vector <VkQueueFamilyProperties> queue_families(queue_family_count);
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families.data());
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families.data());
 
         // Set the indices of the queue families
-        int i = 0;
-        for (const VkQueueFamilyProperties queue_family : queue_families) {
-            if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        // Presenting from the graphics family is preferred so that
+        // swapchain images never need to change queue ownership
+        for (uint32_t i = 0; i < queue_family_count; i++) {
+            if (!indices.graphics_family.has_value() && (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
                 indices.graphics_family = i;
             }
 
             // Make sure the physical device can draw to the surface
             VkBool32 present_support = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _window_surface, &present_support);
-            if (present_support) {
+            this->_vk.vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _window_surface, &present_support);
+            if (present_support
+                && (!indices.present_family.has_value() || indices.graphics_family == i)) {
                 indices.present_family = i;
             }
+        }
 
-            if (indices.is_complete())
+        // A transfer-only family maps to the copy engines on discrete GPUs.
+        // Graphics families always support transfers, so they are the fallback
+        indices.transfer_family = indices.graphics_family;
+        for (uint32_t i = 0; i < queue_family_count; i++) {
+            VkQueueFlags flags = queue_families[i].queueFlags;
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                indices.transfer_family = i;
                 break;
-            i++;
+            }
         }
 
-        return indices;
-    }
-
-    // Check if a device is suitable for the 
-    // operations that we are going to perform
-    // with it
-    bool
-    age_device::_is_device_suitable(VkPhysicalDevice device) {
-        VkPhysicalDeviceProperties device_properties;
-        VkPhysicalDeviceFeatures device_features;
-
-        vkGetPhysicalDeviceProperties(device, &device_properties);
-        vkGetPhysicalDeviceFeatures(device, &device_features);
+        // A compute family without graphics runs on the async compute
+        // engines and overlaps with rasterization
+        indices.compute_family = indices.graphics_family;
+        for (uint32_t i = 0; i < queue_family_count; i++) {
+            VkQueueFlags flags = queue_families[i].queueFlags;
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                indices.compute_family = i;
+                break;
+            }
+        }
 
-        return device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU
-               && device_features.geometryShader;
+        return indices;
     }
 
     // Setup the validation debug messenger 
     // using our callback function
     void
     age_device::_setup_debug_messenger() {
+        AGE_PROFILE_FUNCTION();
         if (!this->enable_validation_layers) {
             return;
         }
@@ -418,50 +1096,22 @@ namespace age {
         this->_populate_debug_messenger_create_info(debug_info);
         debug_info.pUserData = nullptr; // you can set this pointer to be used in the callback
 
-        if (this->_create_debug_utils_messenger(this->_instance, &debug_info, nullptr, &this->_debug_messenger) != VK_SUCCESS) {
+        if (this->_vk.vkCreateDebugUtilsMessengerEXT == nullptr
+            || this->_vk.vkCreateDebugUtilsMessengerEXT(this->_instance, &debug_info, this->get_allocation_callbacks(), &this->_debug_messenger) != VK_SUCCESS) {
             throw std::runtime_error("Error: failed to setup the debug messenger");
         }
     }
  
-    // Setup proxy to create the debug messenger
-    VkResult 
-    age_device::_create_debug_utils_messenger(
-            VkInstance instance,
-            const VkDebugUtilsMessengerCreateInfoEXT *debug_info,
-            const VkAllocationCallbacks *p_allocator,
-            VkDebugUtilsMessengerEXT *p_debug_messenger
-        ) {
-        auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-        if (func != nullptr) {
-            return func(instance, debug_info, p_allocator, p_debug_messenger);
-        } else {
-            return VK_ERROR_EXTENSION_NOT_PRESENT;
-        }
-    }
-
-    // Static member to destroy the debug messenger on cleanup
-    void
-    age_device::destroy_debug_messenger(
-            VkInstance instance,
-            VkDebugUtilsMessengerEXT debug_messenger,
-            const VkAllocationCallbacks *p_allocator
-        ) {
-        auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-        if (func != nullptr) {
-            func(instance, debug_messenger, p_allocator);
-        }
-    }
-
     // Check if all of the requested layers are available 
     // and list them
     bool
     age_device::_check_validation_layer_support() {
         // Find the available layers
         uint32_t layer_count;
-        vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
+        this->_vk.vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
 
         std::vector <VkLayerProperties> available_layers(layer_count);
-        vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
+        this->_vk.vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
 
         // Iterate through the all layers in the validation layers field, and
         // see if they exist in the available layers list
@@ -485,14 +1135,14 @@ namespace age {
 
     // Get a list of all the extensions that are required for 
     // vulkan to run properly
+    // The surface extensions come from the window since a
+    // headless window does not go through GLFW at all
     std::vector <const char*> 
     age_device::_get_required_extensions() {
-        uint32_t glfw_extension_count = 0;
-        const char** glfw_extensions;
-        
-        glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-        std::vector<const char*> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
+        std::vector<const char*> extensions = this->_window.get_required_instance_extensions();
 
+        // Needed by VK_KHR_timeline_semaphore on a 1.0 instance
+        extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
         if (this->enable_validation_layers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
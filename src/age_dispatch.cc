@@ -0,0 +1,53 @@
+#include "age_dispatch.hh"
+
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Missing core functions mean a broken driver or a list entry
+    // whose extension was never enabled, either way we cannot go on
+    void
+    age_dispatch::load_global() {
+#define AGE_LOAD_GLOBAL(name)                                                                   \
+        this->name = (PFN_##name) vkGetInstanceProcAddr(VK_NULL_HANDLE, #name);                 \
+        if (this->name == nullptr) {                                                            \
+            throw std::runtime_error(std::string("Error: failed to load ") + #name);            \
+        }
+        AGE_GLOBAL_FUNCTIONS(AGE_LOAD_GLOBAL)
+#undef AGE_LOAD_GLOBAL
+
+#define AGE_LOAD_GLOBAL_OPTIONAL(name)                                                          \
+        this->name = (PFN_##name) vkGetInstanceProcAddr(VK_NULL_HANDLE, #name);
+        AGE_GLOBAL_OPTIONAL_FUNCTIONS(AGE_LOAD_GLOBAL_OPTIONAL)
+#undef AGE_LOAD_GLOBAL_OPTIONAL
+    }
+
+    void
+    age_dispatch::load_instance(VkInstance instance) {
+#define AGE_LOAD_INSTANCE(name)                                                                 \
+        this->name = (PFN_##name) vkGetInstanceProcAddr(instance, #name);                       \
+        if (this->name == nullptr) {                                                            \
+            throw std::runtime_error(std::string("Error: failed to load ") + #name);            \
+        }
+        AGE_INSTANCE_FUNCTIONS(AGE_LOAD_INSTANCE)
+#undef AGE_LOAD_INSTANCE
+
+#define AGE_LOAD_INSTANCE_EXTENSION(name)                                                       \
+        this->name = (PFN_##name) vkGetInstanceProcAddr(instance, #name);
+        AGE_INSTANCE_EXTENSION_FUNCTIONS(AGE_LOAD_INSTANCE_EXTENSION)
+#undef AGE_LOAD_INSTANCE_EXTENSION
+    }
+
+    void
+    age_dispatch::load_device(VkDevice device) {
+#define AGE_LOAD_DEVICE(name)                                                                   \
+        this->name = (PFN_##name) this->vkGetDeviceProcAddr(device, #name);                     \
+        if (this->name == nullptr) {                                                            \
+            throw std::runtime_error(std::string("Error: failed to load ") + #name);            \
+        }
+        AGE_DEVICE_FUNCTIONS(AGE_LOAD_DEVICE)
+#undef AGE_LOAD_DEVICE
+    }
+}
@@ -1,11 +1,15 @@
 #include "age_engine.hh"
 #include "age_window.hh"
 #include "age_swapchain.hh"
+#include "age_cpu_profiler.hh"
+#include "age_log.hh"
 
 #include <GLFW/glfw3.h>
+#include <cmath>
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
@@ -16,30 +20,402 @@ namespace age {
      *********************************************/
 
     // Constructor
-    age_engine::age_engine(uint32_t width, uint32_t height, std::string name)
-    : _window{width, height, name}, _device(_window), _swapchain(_device, _window.get_extent()) {
+    // The window and device come first, everything built on top of them
+    // only needs the device and is created in parallel on the job system
+    age_engine::age_engine(uint32_t width, uint32_t height, std::string name, EngineConfig config)
+    : _config{config},
+      _start_us{age_trace::now_us()},
+      _jobs{config.worker_threads},
+      _window{width, height, name, config.headless},
+      _device(_window, config.pipeline_cache_path, config.device_requirements, config.device_cache_path, &_jobs),
+      _vk{_device.get_dispatch()},
+      _frame_count{0},
+      _acquire_ms{0.0},
+      _startup_ms{0.0} {
+        // Scopes are only collected when they will be written out,
+        // otherwise the trace would grow for as long as the engine runs
+        if (!this->_config.trace_path.empty()) {
+            AGE_PROFILE_THREAD("main");
+            age_cpu_profiler::get().start(&this->_trace);
+        }
+
+        VkExtent2D extent = this->_window.get_extent();
+        age_init_graph graph(&this->_jobs);
+        uint32_t swapchain = graph.add_step("create_swapchain", [this, extent]() {
+            this->_swapchain = std::make_unique<age_swapchain>(this->_device, extent, this->_config.frames_in_flight, this->_config.present_policy);
+        });
+        uint32_t upload_manager = graph.add_step("create_upload_manager", [this]() {
+            this->_upload_manager = std::make_unique<age_upload_manager>(this->_device);
+        });
+        graph.add_step("create_uniform_ring", [this]() {
+            this->_uniform_ring = std::make_unique<age_uniform_ring>(this->_device, this->_config.frames_in_flight);
+        });
+        if (this->_device.is_bindless_enabled()) {
+            graph.add_step("create_bindless", [this]() {
+                this->_bindless = std::make_unique<age_bindless>(this->_device);
+            });
+        }
+        if (!this->_config.asset_pack_path.empty()) {
+            graph.add_step("open_asset_pack", [this]() {
+                this->_assets = std::make_unique<age_asset_pack>(this->_device, *this->_upload_manager, this->_config.asset_pack_path);
+            }, {upload_manager});
+        }
+        graph.add_step("create_pipeline_manager", [this]() {
+            this->_pipelines = std::make_unique<age_pipeline_manager>(this->_device, this->_jobs, this->_config.hot_reload_shaders);
+        });
+        graph.add_step("create_compute", [this]() {
+            this->_compute = std::make_unique<age_compute>(this->_device, this->_config.frames_in_flight);
+        });
+        graph.add_step("create_command_recorder", [this]() {
+            this->_recorder = std::make_unique<age_command_recorder>(this->_device, this->_jobs, this->_config.frames_in_flight);
+        });
+        uint32_t gpu_profiler = graph.add_step("create_gpu_profiler", [this]() {
+            this->_gpu_profiler = std::make_unique<age_gpu_profiler>(this->_device, this->_config.frames_in_flight);
+            if (!this->_config.trace_path.empty()) {
+                this->_gpu_profiler->set_trace(&this->_trace);
+            }
+        });
+        uint32_t render_graph = graph.add_step("create_render_graph", [this]() {
+            this->_render_graph = std::make_unique<age_render_graph>(this->_device);
+        });
+        graph.add_step("create_command_buffers", [this]() {
+            this->_create_command_buffers();
+        }, {swapchain});
+        graph.add_step("build_render_graph", [this]() {
+            this->_build_render_graph();
+        }, {gpu_profiler, render_graph});
+        if (this->_config.startup) {
+            this->_config.startup(this->_device, graph);
+        }
+        graph.run();
+
+        this->_startup_timings = this->_device.get_startup_timings();
+        std::vector<InitStepTiming> timings = graph.get_timings();
+        this->_startup_timings.insert(this->_startup_timings.end(), timings.begin(), timings.end());
+        this->_startup_ms = (age_trace::now_us() - this->_start_us) / 1000.0;
+        age_log::get().write(LogSeverity::info, "engine", "startup " + graph.get_report());
     }
 
     // Destructor
     age_engine::~age_engine() {
+        // The collector must not outlive the trace it writes into
+        age_cpu_profiler::get().stop();
+
+        // Nothing may still be executing when the members are torn down
+        this->_vk.vkDeviceWaitIdle(this->_device.get_device());
+        this->_vk.vkFreeCommandBuffers(
+                this->_device.get_device(),
+                this->_device.get_command_pool(),
+                static_cast<uint32_t>(this->_command_buffers.size()),
+                this->_command_buffers.data());
     }
 
     // Runs the event loop
     void
     age_engine::run() {
-        this->_window.open();
-        while (!this->_window.should_close()) {
-            // Event loop
+        this->_main_loop();
+        this->_vk.vkDeviceWaitIdle(this->_device.get_device());
+
+        this->_gpu_profiler->read_pending();
+        if (!this->_config.trace_path.empty()) {
+            age_cpu_profiler::get().stop();
+            if (!this->_trace.write(this->_config.trace_path)) {
+                throw std::runtime_error("Error: failed to write trace to " + this->_config.trace_path);
+            }
         }
     }
 
 
+    // Switch the present policy
+    // The swapchain is recreated in place, frames in flight finish on the old one
+    void
+    age_engine::set_present_policy(PresentPolicy policy) {
+        this->_swapchain->set_present_policy(policy);
+    }
+
+    // Get the device
+    age_device&
+    age_engine::get_device() {
+        return this->_device;
+    }
+
+    // Get the job system
+    // Shared by every subsystem that wants to spread work across cores
+    age_job_system&
+    age_engine::get_job_system() {
+        return this->_jobs;
+    }
+
+    // Get the upload manager
+    // Copies requested during a frame are submitted on the
+    // transfer queue before the next frame is drawn
+    age_upload_manager&
+    age_engine::get_upload_manager() {
+        return *this->_upload_manager;
+    }
+
+    // Get the uniform ring
+    // Allocate from it while the frame's passes are recorded: the frame
+    // callback runs before the slot is free again
+    age_uniform_ring&
+    age_engine::get_uniform_ring() {
+        return *this->_uniform_ring;
+    }
+
+    // Get the bindless heap
+    // Only there when bindless was requested and the GPU supports it
+    age_bindless*
+    age_engine::get_bindless() {
+        return this->_bindless.get();
+    }
+
+    // Get the asset pack
+    // Loads upload through the engine's upload manager, so
+    // they go out with the next frame
+    age_asset_pack*
+    age_engine::get_assets() {
+        return this->_assets.get();
+    }
+
+    // Get the pipeline manager
+    // Shader changes are picked up at the start of every frame
+    age_pipeline_manager&
+    age_engine::get_pipelines() {
+        return *this->_pipelines;
+    }
+
+    // Get the async compute context
+    age_compute&
+    age_engine::get_compute() {
+        return *this->_compute;
+    }
+
+    // Get the parallel command recorder
+    // Its pools for the current frame slot are reset once the slot is free
+    age_command_recorder&
+    age_engine::get_command_recorder() {
+        return *this->_recorder;
+    }
+
+    // Get the GPU profiler
+    age_gpu_profiler&
+    age_engine::get_gpu_profiler() {
+        return *this->_gpu_profiler;
+    }
+
+    // Get the trace that CPU and GPU scopes are collected into
+    age_trace&
+    age_engine::get_trace() {
+        return this->_trace;
+    }
+
+    // Make the next frame's graphics work wait for a timeline value
+    // This is how compute results and uploads are chained into rendering
+    // without the CPU waiting for them
+    void
+    age_engine::add_frame_wait(TimelineWait wait) {
+        this->_frame_waits.push_back(wait);
+    }
+
+    // Run a function at the start of every frame
+    // Uploads and frame waits it adds are part of that frame
+    void
+    age_engine::set_frame_callback(FrameCallback callback) {
+        this->_frame_callback = std::move(callback);
+    }
+
+    FrameStats
+    age_engine::get_frame_stats() {
+        return this->_frame_stats;
+    }
+
+    // Get how long each startup step took
+    // Steps are recorded by the thread they ran on, so overlapping
+    // steps show what ran in parallel
+    std::vector<InitStepTiming>
+    age_engine::get_startup_timings() {
+        return this->_startup_timings;
+    }
+
+    // Get the time from the start of construction until the
+    // engine was ready to draw its first frame
+    double
+    age_engine::get_startup_ms() {
+        return this->_startup_ms;
+    }
+
+
     /**********************************************
      *                 Private
      *********************************************/
 
+    // Acquire -> record -> submit -> present until the window
+    // closes or the frame limit is reached
     void
     age_engine::_main_loop() {
+        while (!this->_window.should_close()) {
+            if (this->_config.frame_limit != 0 && this->_frame_count >= this->_config.frame_limit) {
+                break;
+            }
+
+            AGE_PROFILE_ZONE("frame");
+            double start_us = age_trace::now_us();
+            this->_acquire_ms = 0.0;
+
+            this->_window.poll_events();
+            this->_pipelines->update();
+            if (this->_frame_callback) {
+                this->_frame_callback(*this, this->_frame_count);
+            }
+            this->_upload_manager->flush();
+            this->_draw_frame();
+
+            this->_frame_stats.frame_ms = (age_trace::now_us() - start_us) / 1000.0;
+            this->_frame_stats.cpu_ms = this->_frame_stats.frame_ms - this->_acquire_ms;
+        }
+    }
+
+    // Draw a single frame
+    void
+    age_engine::_draw_frame() {
+        AGE_PROFILE_FUNCTION();
+        uint32_t image_index;
+        double acquire_start_us = age_trace::now_us();
+        VkResult result = this->_swapchain->acquire_next_image(&image_index);
+        this->_acquire_ms = (age_trace::now_us() - acquire_start_us) / 1000.0;
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            this->_recreate_swapchain();
+            return;
+        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Error: failed to acquire swapchain image");
+        }
+
+        // The acquire waited for this slot's previous frame, so
+        // everything recorded for it can be recycled
+        this->_recorder->begin_frame(this->_swapchain->get_current_frame());
+        this->_uniform_ring->begin_frame(this->_swapchain->get_current_frame());
+        if (this->_bindless) {
+            this->_bindless->flush();
+        }
+        this->_device.get_deletion_queue().collect();
+
+        VkCommandBuffer command_buffer = this->_command_buffers[this->_swapchain->get_current_frame()];
+        this->_vk.vkResetCommandBuffer(command_buffer, 0);
+        this->_record_command_buffer(command_buffer, image_index);
+
+        result = this->_swapchain->submit_command_buffers(&command_buffer, 1, image_index, this->_frame_waits);
+        this->_frame_waits.clear();
+        this->_frame_count++;
+
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || this->_window.was_resized()) {
+            this->_recreate_swapchain();
+        } else if (result != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to present swapchain image");
+        }
+    }
+
+    // Rebuild the swapchain for the current window size
+    // Frames already in flight finish on the old swapchain, so
+    // there is no need to wait for the device to go idle
+    void
+    age_engine::_recreate_swapchain() {
+        AGE_PROFILE_FUNCTION();
+        this->_window.reset_resized_flag();
+
+        VkExtent2D extent = this->_window.get_extent();
+        while (extent.width == 0 || extent.height == 0) { // minimized
+            this->_window.wait_events();
+            if (this->_window.should_close()) {
+                return;
+            }
+            extent = this->_window.get_extent();
+        }
 
+        this->_swapchain->recreate(extent);
+    }
+
+    // Allocate one primary command buffer per frame in flight so a
+    // frame can be recorded while the previous one is still executing
+    void
+    age_engine::_create_command_buffers() {
+        this->_command_buffers.resize(this->_swapchain->get_frames_in_flight());
+
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = this->_device.get_command_pool();
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = static_cast<uint32_t>(this->_command_buffers.size());
+
+        if (this->_vk.vkAllocateCommandBuffers(this->_device.get_device(), &alloc_info, this->_command_buffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to allocate command buffers");
+        }
+    }
+
+    // Declare the frame's passes
+    // For now a single pass clears the swapchain image to a color
+    // that changes over time, the graph handles the layout transitions
+    void
+    age_engine::_build_render_graph() {
+        this->_backbuffer = this->_render_graph->import_image(
+                "backbuffer",
+                VK_IMAGE_ASPECT_COLOR_BIT,
+                VK_IMAGE_LAYOUT_UNDEFINED, // previous contents are discarded
+                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+        uint32_t clear = this->_render_graph->add_pass("clear", [this](VkCommandBuffer command_buffer, age_render_graph &graph) {
+            VkImageSubresourceRange range{};
+            range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            range.baseMipLevel = 0;
+            range.levelCount = 1;
+            range.baseArrayLayer = 0;
+            range.layerCount = 1;
+
+            float t = static_cast<float>(this->_frame_count) * 0.01F;
+            VkClearColorValue clear_color = {{
+                0.5F + 0.5F * std::sin(t),
+                0.5F + 0.5F * std::sin(t + 2.094F),
+                0.5F + 0.5F * std::sin(t + 4.188F),
+                1.0F
+            }};
+            this->_vk.vkCmdClearColorImage(
+                    command_buffer,
+                    graph.get_image(this->_backbuffer),
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    &clear_color,
+                    1,
+                    &range);
+        });
+        this->_render_graph->write(clear, this->_backbuffer, ResourceUsage::transfer_dst);
+
+        this->_render_graph->set_profiler(this->_gpu_profiler.get());
+        this->_render_graph->compile();
+    }
+
+    // Record the work for one frame
+    void
+    age_engine::_record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) {
+        AGE_PROFILE_FUNCTION();
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (this->_vk.vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to begin recording command buffer");
+        }
+
+        this->_gpu_profiler->begin_frame(command_buffer, this->_swapchain->get_current_frame());
+        uint32_t frame_scope = this->_gpu_profiler->begin_scope(command_buffer, "frame");
+
+        this->_render_graph->set_imported_image(
+                this->_backbuffer,
+                this->_swapchain->get_image(image_index),
+                this->_swapchain->get_image_view(image_index));
+        this->_render_graph->execute(command_buffer);
+
+        this->_gpu_profiler->end_scope(command_buffer, frame_scope);
+
+        if (this->_vk.vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to record command buffer");
+        }
     }
 }
@@ -0,0 +1,213 @@
+#include "age_gpu_profiler.hh"
+
+#include <cstdint>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_gpu_profiler::age_gpu_profiler(age_device &device, uint32_t frames_in_flight, uint32_t max_scopes)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _max_queries{max_scopes * 2},
+      _current{0},
+      _depth{0},
+      _read_frames{0},
+      _dropped_frames{0},
+      _trace{nullptr} {
+        VkPhysicalDeviceProperties properties;
+        this->_vk.vkGetPhysicalDeviceProperties(this->_device.get_physical_device(), &properties);
+        this->_ns_per_tick = static_cast<double>(properties.limits.timestampPeriod);
+
+        uint32_t queue_family_count = 0;
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(this->_device.get_physical_device(), &queue_family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+        this->_vk.vkGetPhysicalDeviceQueueFamilyProperties(this->_device.get_physical_device(), &queue_family_count, queue_families.data());
+
+        uint32_t valid_bits = queue_families[this->_device.find_physical_device_queue_families().graphics_family.value()].timestampValidBits;
+        this->_supported = valid_bits != 0;
+        this->_tick_mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t(1) << valid_bits) - 1;
+        if (!this->_supported) {
+            return;
+        }
+
+        this->_frames.resize(frames_in_flight);
+        for (Frame &frame : this->_frames) {
+            VkQueryPoolCreateInfo pool_info{};
+            pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            pool_info.queryCount = this->_max_queries;
+
+            if (this->_vk.vkCreateQueryPool(this->_device.get_device(), &pool_info, this->_device.get_allocation_callbacks(), &frame.pool) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create timestamp query pool");
+            }
+            frame.query_count = 0;
+            frame.cpu_start_us = 0.0;
+        }
+        this->_ticks.resize(this->_max_queries);
+    }
+
+    // Destructor
+    age_gpu_profiler::~age_gpu_profiler() {
+        for (Frame &frame : this->_frames) {
+            this->_vk.vkDestroyQueryPool(this->_device.get_device(), frame.pool, this->_device.get_allocation_callbacks());
+        }
+    }
+
+    // Start profiling a frame
+    // Must be recorded before any scope and outside of a render pass
+    void
+    age_gpu_profiler::begin_frame(VkCommandBuffer command_buffer, uint32_t frame_slot) {
+        if (!this->_supported) {
+            return;
+        }
+
+        this->_current = frame_slot;
+        this->_depth = 0;
+        Frame &frame = this->_frames[frame_slot];
+        if (frame.query_count > 0) {
+            this->_read_results(frame);
+        }
+
+        this->_vk.vkCmdResetQueryPool(command_buffer, frame.pool, 0, this->_max_queries);
+        frame.scopes.clear();
+        frame.query_count = 0;
+        frame.cpu_start_us = age_trace::now_us();
+    }
+
+    // Open a scope
+    // Returns UINT32_MAX when the frame ran out of queries, ending that is a no-op
+    uint32_t
+    age_gpu_profiler::begin_scope(VkCommandBuffer command_buffer, const char *name) {
+        if (!this->_supported) {
+            return UINT32_MAX;
+        }
+
+        Frame &frame = this->_frames[this->_current];
+        if (frame.query_count + 2 > this->_max_queries) {
+            return UINT32_MAX;
+        }
+
+        uint32_t query = frame.query_count++;
+        frame.query_count++; // reserve the end query so begin and end stay paired
+        this->_vk.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, query);
+        frame.scopes.push_back({name, this->_depth++, query, UINT32_MAX});
+        return static_cast<uint32_t>(frame.scopes.size() - 1);
+    }
+
+    // Close a scope once all the work recorded inside it has finished
+    void
+    age_gpu_profiler::end_scope(VkCommandBuffer command_buffer, uint32_t scope) {
+        if (!this->_supported || scope == UINT32_MAX) {
+            return;
+        }
+
+        Frame &frame = this->_frames[this->_current];
+        Scope &entry = frame.scopes[scope];
+        entry.end_query = entry.begin_query + 1;
+        this->_vk.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.pool, entry.end_query);
+        this->_depth--;
+    }
+
+    // Read the frames that were never revisited
+    // Used at shutdown so the last frames make it into the trace
+    void
+    age_gpu_profiler::read_pending() {
+        for (Frame &frame : this->_frames) {
+            if (frame.query_count > 0) {
+                this->_read_results(frame);
+                frame.query_count = 0;
+            }
+        }
+    }
+
+    void
+    age_gpu_profiler::set_trace(age_trace *trace) {
+        this->_trace = trace;
+    }
+
+    bool
+    age_gpu_profiler::is_supported() {
+        return this->_supported;
+    }
+
+    const std::vector<GpuScopeResult>&
+    age_gpu_profiler::get_results() {
+        return this->_results;
+    }
+
+    uint64_t
+    age_gpu_profiler::get_read_frames() {
+        return this->_read_frames;
+    }
+
+    uint64_t
+    age_gpu_profiler::get_dropped_frames() {
+        return this->_dropped_frames;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Read a finished frame's timestamps without waiting
+    void
+    age_gpu_profiler::_read_results(Frame &frame) {
+        VkResult result = this->_vk.vkGetQueryPoolResults(
+                this->_device.get_device(),
+                frame.pool,
+                0,
+                frame.query_count,
+                frame.query_count * sizeof(uint64_t),
+                this->_ticks.data(),
+                sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT);
+        if (result == VK_NOT_READY) {
+            this->_dropped_frames++;
+            return;
+        } else if (result != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to read timestamp queries");
+        }
+
+        // Ticks are converted relative to the frame's first timestamp,
+        // masking so a wrapping counter still gives the right difference
+        uint64_t origin = frame.scopes.empty() ? 0 : this->_ticks[frame.scopes.front().begin_query];
+        this->_results.clear();
+        this->_read_frames++;
+        std::vector<TraceEvent> events;
+        for (const Scope &scope : frame.scopes) {
+            if (scope.end_query == UINT32_MAX) {
+                continue;
+            }
+
+            uint64_t begin = (this->_ticks[scope.begin_query] - origin) & this->_tick_mask;
+            uint64_t end = (this->_ticks[scope.end_query] - origin) & this->_tick_mask;
+            double start_ms = static_cast<double>(begin) * this->_ns_per_tick / 1e6;
+            double duration_ms = static_cast<double>(end - begin) * this->_ns_per_tick / 1e6;
+            this->_results.push_back({scope.name, scope.depth, start_ms, duration_ms});
+
+            // The GPU clock is not the CPU clock, frames are placed
+            // on the trace where the CPU recorded them
+            if (this->_trace != nullptr) {
+                events.push_back({
+                    scope.name,
+                    "gpu",
+                    TRACE_PROCESS_GPU,
+                    1,
+                    frame.cpu_start_us + start_ms * 1000.0,
+                    duration_ms * 1000.0});
+            }
+        }
+
+        if (this->_trace != nullptr) {
+            this->_trace->add_events(events);
+        }
+    }
+}
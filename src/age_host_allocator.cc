@@ -0,0 +1,263 @@
+#include "age_host_allocator.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_host_allocator::age_host_allocator()
+    : _arena_used{ARENA_SIZE} {
+        for (uint32_t i = 0; i < CLASS_COUNT; i++) {
+            this->_free_lists[i] = nullptr;
+        }
+
+        this->_callbacks.pUserData = this;
+        this->_callbacks.pfnAllocation = &age_host_allocator::_allocation;
+        this->_callbacks.pfnReallocation = &age_host_allocator::_reallocation;
+        this->_callbacks.pfnFree = &age_host_allocator::_free;
+        this->_callbacks.pfnInternalAllocation = &age_host_allocator::_internal_allocation;
+        this->_callbacks.pfnInternalFree = &age_host_allocator::_internal_free;
+    }
+
+    // Destructor
+    age_host_allocator::~age_host_allocator() {
+        for (void *arena : this->_arenas) {
+            std::free(arena);
+        }
+    }
+
+    const VkAllocationCallbacks*
+    age_host_allocator::get_callbacks() {
+        return &this->_callbacks;
+    }
+
+    HostAllocationStats
+    age_host_allocator::get_stats(VkSystemAllocationScope scope) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_stats[std::min<uint32_t>(static_cast<uint32_t>(scope), SCOPE_COUNT - 1)];
+    }
+
+    HostAllocationStats
+    age_host_allocator::get_total_stats() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        HostAllocationStats total;
+        for (const HostAllocationStats &stats : this->_stats) {
+            total.live_count += stats.live_count;
+            total.total_count += stats.total_count;
+            total.pooled_count += stats.pooled_count;
+            total.live_bytes += stats.live_bytes;
+            total.peak_bytes += stats.peak_bytes;
+            total.internal_bytes += stats.internal_bytes;
+            total.internal_peak_bytes += stats.internal_peak_bytes;
+        }
+        return total;
+    }
+
+    uint64_t
+    age_host_allocator::get_arena_bytes() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return static_cast<uint64_t>(this->_arenas.size()) * ARENA_SIZE;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Vulkan entry points
+    // None of them may throw, failures are reported by returning null
+
+    void* VKAPI_CALL
+    age_host_allocator::_allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        return static_cast<age_host_allocator*>(user_data)->_allocate(size, alignment, scope);
+    }
+
+    // Grows in place when the block has room, otherwise moves the data
+    void* VKAPI_CALL
+    age_host_allocator::_reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        age_host_allocator *allocator = static_cast<age_host_allocator*>(user_data);
+        if (original == nullptr) {
+            return allocator->_allocate(size, alignment, scope);
+        } else if (size == 0) {
+            allocator->_release(original);
+            return nullptr;
+        }
+
+        Header *header = static_cast<Header*>(original) - 1;
+        if (size <= header->capacity) {
+            std::lock_guard<std::mutex> lock(allocator->_mutex);
+            HostAllocationStats &stats = allocator->_stats[header->scope];
+            stats.live_bytes = stats.live_bytes - header->size + size;
+            stats.peak_bytes = std::max(stats.peak_bytes, stats.live_bytes);
+            stats.total_count++;
+            header->size = size;
+            return original;
+        }
+
+        void *memory = allocator->_allocate(size, alignment, scope);
+        if (memory == nullptr) {
+            return nullptr; // the original stays valid
+        }
+        std::memcpy(memory, original, header->size);
+        allocator->_release(original);
+        return memory;
+    }
+
+    void VKAPI_CALL
+    age_host_allocator::_free(void *user_data, void *memory) {
+        if (memory != nullptr) {
+            static_cast<age_host_allocator*>(user_data)->_release(memory);
+        }
+    }
+
+    // The driver allocated this itself, it is only counted
+    void VKAPI_CALL
+    age_host_allocator::_internal_allocation(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+        age_host_allocator *allocator = static_cast<age_host_allocator*>(user_data);
+        std::lock_guard<std::mutex> lock(allocator->_mutex);
+        HostAllocationStats &stats = allocator->_stats[std::min<uint32_t>(static_cast<uint32_t>(scope), SCOPE_COUNT - 1)];
+        stats.internal_bytes += size;
+        stats.internal_peak_bytes = std::max(stats.internal_peak_bytes, stats.internal_bytes);
+    }
+
+    void VKAPI_CALL
+    age_host_allocator::_internal_free(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+        age_host_allocator *allocator = static_cast<age_host_allocator*>(user_data);
+        std::lock_guard<std::mutex> lock(allocator->_mutex);
+        HostAllocationStats &stats = allocator->_stats[std::min<uint32_t>(static_cast<uint32_t>(scope), SCOPE_COUNT - 1)];
+        stats.internal_bytes -= std::min<uint64_t>(stats.internal_bytes, size);
+    }
+
+    // Blocks start 16 byte aligned and the header is a multiple of 16 bytes,
+    // so only alignments above 16 need padding in front of the header
+    void*
+    age_host_allocator::_allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        if (size == 0) {
+            return nullptr;
+        }
+        alignment = std::max<size_t>(alignment, alignof(Header));
+        size_t needed = sizeof(Header) + (alignment - alignof(Header)) + size;
+
+        uint32_t size_class = NO_CLASS;
+        for (uint32_t i = 0; i < CLASS_COUNT; i++) {
+            if (needed <= (MIN_CLASS_SIZE << i)) {
+                size_class = i;
+                break;
+            }
+        }
+        uint32_t scope_index = std::min<uint32_t>(static_cast<uint32_t>(scope), SCOPE_COUNT - 1);
+
+        void *block;
+        size_t block_size;
+        if (size_class == NO_CLASS) {
+            block = std::malloc(needed);
+            block_size = needed;
+            if (block == nullptr) {
+                return nullptr;
+            }
+        } else {
+            block_size = MIN_CLASS_SIZE << size_class;
+        }
+
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (size_class != NO_CLASS) {
+            block = this->_take_block(size_class);
+            if (block == nullptr) {
+                return nullptr;
+            }
+        }
+
+        uintptr_t start = reinterpret_cast<uintptr_t>(block);
+        uintptr_t user = (start + sizeof(Header) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        Header *header = reinterpret_cast<Header*>(user) - 1;
+        header->size_class = size_class;
+        header->scope = scope_index;
+        header->size = size;
+        header->capacity = block_size - (user - start);
+        header->offset = user - start;
+
+        HostAllocationStats &stats = this->_stats[scope_index];
+        stats.live_count++;
+        stats.total_count++;
+        stats.pooled_count += size_class != NO_CLASS ? 1 : 0;
+        stats.live_bytes += size;
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.live_bytes);
+        return reinterpret_cast<void*>(user);
+    }
+
+    // Pooled blocks go back on their free list, the rest back to malloc
+    void
+    age_host_allocator::_release(void *memory) {
+        Header *header = static_cast<Header*>(memory) - 1;
+        void *block = static_cast<uint8_t*>(memory) - header->offset;
+        uint32_t size_class = header->size_class;
+
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            HostAllocationStats &stats = this->_stats[header->scope];
+            stats.live_count--;
+            stats.live_bytes -= header->size;
+
+            if (size_class != NO_CLASS) {
+                *static_cast<void**>(block) = this->_free_lists[size_class];
+                this->_free_lists[size_class] = block;
+                return;
+            }
+        }
+        std::free(block);
+    }
+
+    // Pop a free block of the class or carve a new one from the newest arena
+    void*
+    age_host_allocator::_take_block(uint32_t size_class) {
+        void *block = this->_free_lists[size_class];
+        if (block != nullptr) {
+            this->_free_lists[size_class] = *static_cast<void**>(block);
+            return block;
+        }
+
+        size_t block_size = MIN_CLASS_SIZE << size_class;
+        if (this->_arena_used + block_size > ARENA_SIZE) {
+            // The tail of the old arena is given to the smaller classes
+            // instead of being wasted
+            if (!this->_arenas.empty()) {
+                uint8_t *arena = static_cast<uint8_t*>(this->_arenas.back());
+                for (uint32_t i = size_class; i-- > 0;) {
+                    size_t size = MIN_CLASS_SIZE << i;
+                    while (this->_arena_used + size <= ARENA_SIZE) {
+                        void *tail = arena + this->_arena_used;
+                        *static_cast<void**>(tail) = this->_free_lists[i];
+                        this->_free_lists[i] = tail;
+                        this->_arena_used += size;
+                    }
+                }
+            }
+
+            void *arena = std::malloc(ARENA_SIZE);
+            if (arena == nullptr) {
+                return nullptr;
+            }
+            try {
+                this->_arenas.push_back(arena);
+            } catch (const std::bad_alloc&) {
+                std::free(arena);
+                return nullptr;
+            }
+            this->_arena_used = 0;
+        }
+
+        block = static_cast<uint8_t*>(this->_arenas.back()) + this->_arena_used;
+        this->_arena_used += block_size;
+        return block;
+    }
+}
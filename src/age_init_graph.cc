@@ -0,0 +1,190 @@
+#include "age_init_graph.hh"
+#include "age_cpu_profiler.hh"
+#include "age_trace.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_init_graph::age_init_graph(age_job_system *jobs)
+    : _jobs{jobs},
+      _finished{0},
+      _total_ms{0.0} {
+        // Without workers nothing would ever pick the jobs up
+        if (this->_jobs != nullptr && this->_jobs->get_worker_count() == 0) {
+            this->_jobs = nullptr;
+        }
+    }
+
+    // Add a step
+    // Dependencies must have been added before
+    uint32_t
+    age_init_graph::add_step(
+            const char *name,
+            std::function<void()> step,
+            std::vector<uint32_t> dependencies,
+            bool main_thread) {
+        uint32_t id = static_cast<uint32_t>(this->_steps.size());
+        for (uint32_t dependency : dependencies) {
+            if (dependency >= id) {
+                throw std::runtime_error(std::string("Error: startup step ") + name + " depends on a step added after it");
+            }
+            this->_steps[dependency].dependents.push_back(id);
+        }
+
+        this->_steps.push_back({name, std::move(step), {}, static_cast<uint32_t>(dependencies.size()), main_thread, false});
+        return id;
+    }
+
+    // Run the graph
+    // The calling thread runs its own steps and sleeps while only workers have something to do
+    void
+    age_init_graph::run() {
+        double start_us = age_trace::now_us();
+
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        for (uint32_t id = 0; id < this->_steps.size(); id++) {
+            if (this->_steps[id].remaining == 0) {
+                this->_ready(id);
+            }
+        }
+
+        while (this->_finished < this->_steps.size()) {
+            if (!this->_main_ready.empty()) {
+                uint32_t id = this->_main_ready.front();
+                this->_main_ready.pop_front();
+                lock.unlock();
+                this->_execute(id);
+                lock.lock();
+                continue;
+            }
+            this->_changed.wait(lock);
+        }
+
+        this->_total_ms = (age_trace::now_us() - start_us) / 1000.0;
+        if (this->_error) {
+            std::rethrow_exception(this->_error);
+        }
+    }
+
+    std::vector<InitStepTiming>
+    age_init_graph::get_timings() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_timings;
+    }
+
+    double
+    age_init_graph::get_total_ms() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_total_ms;
+    }
+
+    // Summarize the run
+    // Steps are listed by start time so the overlap is easy to read
+    std::string
+    age_init_graph::get_report() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (this->_timings.empty()) {
+            return "";
+        }
+
+        std::vector<InitStepTiming> timings = this->_timings;
+        std::sort(timings.begin(), timings.end(), [](const InitStepTiming &a, const InitStepTiming &b) {
+            return a.start_ms < b.start_ms;
+        });
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "%.2f ms over %zu steps", this->_total_ms, timings.size());
+        std::string report = line;
+        double base_ms = timings.front().start_ms;
+        for (const InitStepTiming &timing : timings) {
+            std::snprintf(line, sizeof(line), "\n  %-28s +%8.2f ms %8.2f ms  thread %u",
+                    timing.name,
+                    timing.start_ms - base_ms,
+                    timing.duration_ms,
+                    timing.thread);
+            report += line;
+        }
+        return report;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    void
+    age_init_graph::_ready(uint32_t id) {
+        if (this->_jobs == nullptr || this->_steps[id].main_thread || this->_steps[id].skipped) {
+            this->_main_ready.push_back(id);
+            this->_changed.notify_all();
+            return;
+        }
+        this->_jobs->run([this, id]() {
+            this->_execute(id);
+        });
+    }
+
+    void
+    age_init_graph::_execute(uint32_t id) {
+        Step &step = this->_steps[id];
+        if (step.skipped) {
+            this->_finish(id, true);
+            return;
+        }
+
+        double start_us = age_trace::now_us();
+        bool failed = false;
+        {
+#ifdef AGE_PROFILING
+            age_cpu_zone zone(step.name);
+#endif
+            try {
+                step.function();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(this->_mutex);
+                if (!this->_error) {
+                    this->_error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+        double end_us = age_trace::now_us();
+
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_timings.push_back({step.name, age_job_system::get_thread_index(), start_us / 1000.0, (end_us - start_us) / 1000.0});
+        }
+        this->_finish(id, failed);
+    }
+
+    // Release the dependents of a step
+    // The notify happens under the lock: once the last step is counted
+    // run() may return and the graph go away
+    void
+    age_init_graph::_finish(uint32_t id, bool failed) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        for (uint32_t dependent : this->_steps[id].dependents) {
+            Step &step = this->_steps[dependent];
+            if (failed) {
+                step.skipped = true;
+            }
+            if (--step.remaining == 0) {
+                this->_ready(dependent);
+            }
+        }
+        this->_finished++;
+        this->_changed.notify_all();
+    }
+}
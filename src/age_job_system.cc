@@ -0,0 +1,455 @@
+#include "age_job_system.hh"
+#include "age_cpu_profiler.hh"
+#include "age_log.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <mutex>
+#include <thread>
+
+namespace age {
+
+    // A queued unit of work
+    struct age_job {
+        std::function<void()> function;
+        age_job_counter *counter;       // decremented when the job is done
+    };
+
+    namespace {
+        thread_local age_job_system *t_system = nullptr; // job system the thread works for
+        thread_local uint32_t t_thread_index = 0;        // 0 outside of the worker pool
+        thread_local uint32_t t_random = 0x9E3779B9u;    // victim selection state
+
+        uint32_t
+        next_random() {
+            // xorshift32
+            t_random ^= t_random << 13;
+            t_random ^= t_random >> 17;
+            t_random ^= t_random << 5;
+            return t_random;
+        }
+    }
+
+    /**********************************************
+     *              age_job_counter
+     *********************************************/
+
+    age_job_counter::age_job_counter()
+    : _value{0} {}
+
+    bool
+    age_job_counter::is_done() {
+        return this->_value.load(std::memory_order_acquire) == 0;
+    }
+
+    uint32_t
+    age_job_counter::get_value() {
+        return this->_value.load(std::memory_order_acquire);
+    }
+
+
+    /**********************************************
+     *               age_job_deque
+     *********************************************/
+
+    age_job_deque::Array::Array(int64_t size)
+    : capacity{size},
+      slots{new std::atomic<age_job*>[static_cast<size_t>(size)]} {}
+
+    age_job*
+    age_job_deque::Array::get(int64_t index) {
+        return this->slots[index & (this->capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void
+    age_job_deque::Array::put(int64_t index, age_job *job) {
+        this->slots[index & (this->capacity - 1)].store(job, std::memory_order_relaxed);
+    }
+
+    // Constructor
+    age_job_deque::age_job_deque()
+    : _top{0},
+      _bottom{0} {
+        this->_arrays.push_back(std::make_unique<Array>(256));
+        this->_array.store(this->_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    // Destructor
+    // Jobs still queued are dropped, the job system drains deques before this
+    age_job_deque::~age_job_deque() {}
+
+    // Push a job at the bottom
+    // The orderings follow Le et al., "Correct and Efficient
+    // Work-Stealing for Weak Memory Models" (PPoPP 2013)
+    void
+    age_job_deque::push(age_job *job) {
+        int64_t bottom = this->_bottom.load(std::memory_order_relaxed);
+        int64_t top = this->_top.load(std::memory_order_acquire);
+        Array *array = this->_array.load(std::memory_order_relaxed);
+
+        if (bottom - top > array->capacity - 1) {
+            array = this->_grow(array, bottom, top);
+        }
+        array->put(bottom, job);
+        std::atomic_thread_fence(std::memory_order_release);
+        this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Pop the most recently pushed job
+    // Only races with thieves over the last remaining job
+    age_job*
+    age_job_deque::pop() {
+        int64_t bottom = this->_bottom.load(std::memory_order_relaxed) - 1;
+        Array *array = this->_array.load(std::memory_order_relaxed);
+        this->_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = this->_top.load(std::memory_order_relaxed);
+
+        age_job *job = nullptr;
+        if (top <= bottom) {
+            job = array->get(bottom);
+            if (top == bottom) {
+                // Last job, whoever moves top first gets it
+                if (!this->_top.compare_exchange_strong(
+                            top,
+                            top + 1,
+                            std::memory_order_seq_cst,
+                            std::memory_order_relaxed)) {
+                    job = nullptr;
+                }
+                this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+        } else {
+            this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Take the oldest job
+    age_job*
+    age_job_deque::steal() {
+        int64_t top = this->_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = this->_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        Array *array = this->_array.load(std::memory_order_acquire);
+        age_job *job = array->get(top);
+        if (!this->_top.compare_exchange_strong(
+                    top,
+                    top + 1,
+                    std::memory_order_seq_cst,
+                    std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return job;
+    }
+
+    // Double the array, copying the live range over
+    age_job_deque::Array*
+    age_job_deque::_grow(Array *array, int64_t bottom, int64_t top) {
+        std::unique_ptr<Array> larger = std::make_unique<Array>(array->capacity * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            larger->put(i, array->get(i));
+        }
+
+        Array *result = larger.get();
+        this->_arrays.push_back(std::move(larger));
+        this->_array.store(result, std::memory_order_release);
+        return result;
+    }
+
+
+    /**********************************************
+     *              age_job_system
+     *********************************************/
+
+    // Constructor
+    age_job_system::age_job_system(uint32_t worker_count)
+    : _queued{0},
+      _sleeping{0},
+      _stop{false} {
+        if (worker_count == 0) {
+            uint32_t cores = std::thread::hardware_concurrency();
+            worker_count = cores > 1 ? cores - 1 : 1;
+        }
+
+        // Create every worker before starting any, thieves index the whole list
+        for (uint32_t i = 0; i < worker_count; i++) {
+            this->_workers.push_back(std::make_unique<Worker>());
+        }
+        for (uint32_t i = 0; i < worker_count; i++) {
+            this->_workers[i]->thread = std::thread(&age_job_system::_worker_loop, this, i);
+        }
+    }
+
+    // Destructor
+    // Jobs that were never run are dropped
+    age_job_system::~age_job_system() {
+        {
+            std::lock_guard<std::mutex> lock(this->_sleep_mutex);
+            this->_stop.store(true);
+        }
+        this->_wake.notify_all();
+
+        for (std::unique_ptr<Worker> &worker : this->_workers) {
+            worker->thread.join();
+        }
+
+        for (std::unique_ptr<Worker> &worker : this->_workers) {
+            while (age_job *job = worker->deque.steal()) {
+                delete job;
+            }
+        }
+        for (age_job *job : this->_injection) {
+            delete job;
+        }
+    }
+
+    // Queue a job
+    void
+    age_job_system::run(std::function<void()> function, age_job_counter *counter, age_job_counter *dependency) {
+        age_job *job = new age_job{std::move(function), counter};
+        if (counter != nullptr) {
+            counter->_value.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (dependency != nullptr) {
+            // The finishing job takes the same lock after reaching zero,
+            // so the job is either seen here as ready or released there
+            std::lock_guard<std::mutex> lock(dependency->_mutex);
+            if (dependency->_value.load(std::memory_order_acquire) != 0) {
+                dependency->_waiting.push_back(job);
+                return;
+            }
+        }
+
+        this->_schedule(job);
+    }
+
+    // Wait for a counter to reach zero
+    // The waiting thread keeps executing jobs in the meantime
+    void
+    age_job_system::wait(age_job_counter &counter) {
+        while (!counter.is_done()) {
+            age_job *job = this->_find_job();
+            if (job != nullptr) {
+                this->_execute(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        // The last job may still hold the lock after setting zero
+        std::exception_ptr exception;
+        {
+            std::lock_guard<std::mutex> lock(counter._mutex);
+            exception.swap(counter._exception);
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    // Run a function over [0, count) in ranges of grain items
+    // A grain of 0 picks one that gives every thread a few ranges
+    void
+    age_job_system::parallel_for(
+            uint32_t count,
+            uint32_t grain,
+            const std::function<void(uint32_t begin, uint32_t end)> &function) {
+        if (count == 0) {
+            return;
+        }
+        if (grain == 0) {
+            grain = std::max<uint32_t>(count / (this->get_thread_count() * 4), 1);
+        }
+        if (count <= grain) {
+            function(0, count);
+            return;
+        }
+
+        age_job_counter counter;
+        for (uint32_t begin = 0; begin < count; begin += grain) {
+            uint32_t end = std::min(count, begin + grain);
+            this->run([&function, begin, end]() { function(begin, end); }, &counter);
+        }
+        this->wait(counter);
+    }
+
+    uint32_t
+    age_job_system::get_worker_count() {
+        return static_cast<uint32_t>(this->_workers.size());
+    }
+
+    uint32_t
+    age_job_system::get_thread_count() {
+        return static_cast<uint32_t>(this->_workers.size()) + 1;
+    }
+
+    // Index of the calling thread
+    // Useful to pick per-thread resources without locking
+    uint32_t
+    age_job_system::get_thread_index() {
+        return t_thread_index;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Run jobs until the system is destroyed, sleeping when there are none
+    void
+    age_job_system::_worker_loop(uint32_t index) {
+        t_system = this;
+        t_thread_index = index + 1;
+        t_random = 0x9E3779B9u * (index + 1);
+        AGE_PROFILE_THREAD("worker " + std::to_string(index + 1));
+
+        while (!this->_stop.load(std::memory_order_relaxed)) {
+            age_job *job = this->_find_job();
+            if (job != nullptr) {
+                this->_execute(job);
+                continue;
+            }
+
+            // Jobs tend to arrive in bursts, spin a little before sleeping
+            for (uint32_t spin = 0; spin < 64 && job == nullptr; spin++) {
+                std::this_thread::yield();
+                job = this->_find_job();
+            }
+            if (job != nullptr) {
+                this->_execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->_sleep_mutex);
+            this->_sleeping.fetch_add(1);
+            this->_wake.wait(lock, [this]() {
+                return this->_queued.load() > 0 || this->_stop.load();
+            });
+            this->_sleeping.fetch_sub(1);
+        }
+    }
+
+    // Make a job runnable
+    // Workers push to their own deque, other threads to the injection queue
+    void
+    age_job_system::_schedule(age_job *job) {
+        this->_queued.fetch_add(1);
+        if (t_system == this) {
+            this->_workers[t_thread_index - 1]->deque.push(job);
+        } else {
+            std::lock_guard<std::mutex> lock(this->_injection_mutex);
+            this->_injection.push_back(job);
+        }
+
+        // Taking the lock orders the notify after a worker's predicate check
+        if (this->_sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(this->_sleep_mutex);
+            this->_wake.notify_one();
+        }
+    }
+
+    // Find a job to run
+    // Own deque first (most recent work, warm in cache), then
+    // the injection queue, then steal from a random worker
+    age_job*
+    age_job_system::_find_job() {
+        age_job *job = nullptr;
+        if (t_system == this) {
+            job = this->_workers[t_thread_index - 1]->deque.pop();
+        }
+
+        if (job == nullptr) {
+            std::unique_lock<std::mutex> lock(this->_injection_mutex, std::try_to_lock);
+            if (lock.owns_lock() && !this->_injection.empty()) {
+                job = this->_injection.front();
+                this->_injection.pop_front();
+            }
+        }
+
+        if (job == nullptr) {
+            uint32_t count = static_cast<uint32_t>(this->_workers.size());
+            uint32_t start = next_random() % count;
+            for (uint32_t i = 0; i < count && job == nullptr; i++) {
+                uint32_t victim = (start + i) % count;
+                if (t_system == this && victim == t_thread_index - 1) {
+                    continue;
+                }
+                job = this->_workers[victim]->deque.steal();
+            }
+        }
+
+        if (job != nullptr) {
+            this->_queued.fetch_sub(1);
+        }
+        return job;
+    }
+
+    // Run a job and finish it, even when it throws
+    // Escaping a worker would terminate the process, and skipping the
+    // finish would leave waiters spinning on a counter that never reaches zero
+    void
+    age_job_system::_execute(age_job *job) {
+        age_job_counter *counter = job->counter;
+        try {
+            job->function();
+        } catch (...) {
+            if (counter != nullptr) {
+                std::lock_guard<std::mutex> lock(counter->_mutex);
+                if (!counter->_exception) {
+                    counter->_exception = std::current_exception();
+                }
+            } else {
+                // Nobody waits for the job, so nobody could handle it
+                try {
+                    throw;
+                } catch (const std::exception &e) {
+                    age_log::get().write(LogSeverity::error, "jobs", std::string("Job without a counter threw: ") + e.what());
+                } catch (...) {
+                    age_log::get().write(LogSeverity::error, "jobs", "Job without a counter threw an unknown exception");
+                }
+            }
+        }
+        delete job;
+        this->_finish(counter);
+    }
+
+    // Decrement a counter and release the jobs that waited for it
+    void
+    age_job_system::_finish(age_job_counter *counter) {
+        if (counter == nullptr) {
+            return;
+        }
+
+        // Only the last decrement takes the lock
+        uint32_t value = counter->_value.load(std::memory_order_relaxed);
+        while (value > 1) {
+            if (counter->_value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+
+        // Reaching zero under the lock lets wait() know when the
+        // counter is no longer touched and may be destroyed
+        std::vector<age_job*> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->_mutex);
+            if (counter->_value.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                ready.swap(counter->_waiting);
+            }
+        }
+        for (age_job *job : ready) {
+            this->_schedule(job);
+        }
+    }
+}
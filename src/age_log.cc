@@ -0,0 +1,279 @@
+#include "age_log.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace age {
+
+    namespace {
+        const char*
+        severity_name(LogSeverity severity) {
+            switch (severity) {
+                case LogSeverity::verbose: return "verbose";
+                case LogSeverity::info:    return "info";
+                case LogSeverity::warning: return "warning";
+                case LogSeverity::error:   return "error";
+            }
+            return "";
+        }
+
+        double
+        now_us() {
+            return std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        const double REPORT_INTERVAL_US = 5.0 * 1000.0 * 1000.0; // how often repeat counts are summarized
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // The one log every subsystem writes to
+    age_log&
+    age_log::get() {
+        static age_log log;
+        return log;
+    }
+
+    // Queue a message
+    // Only allocates and swaps a pointer, all I/O happens on the writer thread
+    void
+    age_log::write(LogSeverity severity, const char *tag, std::string message, uint64_t key) {
+        if (!this->is_enabled(severity)) {
+            return;
+        }
+
+        Message *node = new Message{severity, tag, std::move(message), key, {nullptr}};
+        this->_push(node);
+        this->_pushed.fetch_add(1, std::memory_order_release);
+
+        // Errors are written right away, everything else within a few milliseconds
+        if (severity == LogSeverity::error) {
+            this->_wake_writer();
+        }
+    }
+
+    bool
+    age_log::is_enabled(LogSeverity severity) {
+        return static_cast<int>(severity) >= this->_min_severity.load(std::memory_order_relaxed);
+    }
+
+    void
+    age_log::set_min_severity(LogSeverity severity) {
+        this->_min_severity.store(static_cast<int>(severity), std::memory_order_relaxed);
+    }
+
+    void
+    age_log::set_output(std::FILE *file) {
+        this->_output.store(file, std::memory_order_relaxed);
+    }
+
+    // Wait for the writer to catch up with everything queued before the call
+    void
+    age_log::flush() {
+        uint64_t target = this->_pushed.load(std::memory_order_acquire);
+
+        std::unique_lock<std::mutex> lock(this->_writer_mutex);
+        if (!this->_running) {
+            return;
+        }
+        this->_wake = true;
+        this->_writer_wake.notify_one();
+        this->_flushed.wait(lock, [this, target]() {
+            return this->_written >= target || !this->_running;
+        });
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Constructor
+    age_log::age_log()
+    : _pushed{0},
+      _min_severity{static_cast<int>(LogSeverity::warning)},
+      _running{true},
+      _wake{false},
+      _written{0},
+      _output{stderr},
+      _last_report_us{now_us()},
+      _window_start_us{now_us()},
+      _window_lines{0},
+      _rate_dropped{0} {
+        Message *stub = new Message{LogSeverity::verbose, "", std::string(), 0, {nullptr}};
+        this->_head.store(stub, std::memory_order_relaxed);
+        this->_tail = stub;
+        this->_writer = std::thread(&age_log::_run, this);
+    }
+
+    // Destructor
+    age_log::~age_log() {
+        {
+            std::lock_guard<std::mutex> lock(this->_writer_mutex);
+            this->_running = false;
+        }
+        this->_writer_wake.notify_all();
+        this->_writer.join();
+        this->_flushed.notify_all();
+
+        while (Message *message = this->_pop()) {
+            delete message;
+        }
+        delete this->_tail;
+    }
+
+    // Multiple producer push (Vyukov)
+    // A producer swaps itself in as the head, then links the old head to it.
+    // Until that link is made the writer simply sees the queue end early
+    void
+    age_log::_push(Message *message) {
+        Message *previous = this->_head.exchange(message, std::memory_order_acq_rel);
+        previous->next.store(message, std::memory_order_release);
+    }
+
+    // Single consumer pop
+    // The returned node becomes the new stub, the caller deletes the old one
+    // after moving the payload out
+    age_log::Message*
+    age_log::_pop() {
+        Message *next = this->_tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return nullptr;
+        }
+        Message *consumed = this->_tail;
+        this->_tail = next;
+        return consumed;
+    }
+
+    // Write queued messages every few milliseconds until the log is destroyed
+    void
+    age_log::_run() {
+        std::unique_lock<std::mutex> lock(this->_writer_mutex);
+        while (this->_running) {
+            lock.unlock();
+            this->_drain();
+            if (now_us() - this->_last_report_us >= REPORT_INTERVAL_US) {
+                this->_report_repeats();
+            }
+            lock.lock();
+            this->_writer_wake.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+                return !this->_running || this->_wake;
+            });
+            this->_wake = false;
+        }
+        lock.unlock();
+
+        this->_drain();
+        this->_report_repeats();
+    }
+
+    void
+    age_log::_wake_writer() {
+        {
+            std::lock_guard<std::mutex> lock(this->_writer_mutex);
+            this->_wake = true;
+        }
+        this->_writer_wake.notify_one();
+    }
+
+    void
+    age_log::_drain() {
+        uint64_t handled = 0;
+        while (Message *consumed = this->_pop()) {
+            delete consumed;
+            this->_emit(*this->_tail);
+            this->_tail->text = std::string(); // the stub keeps no memory
+            handled++;
+        }
+        if (handled == 0) {
+            return;
+        }
+
+        std::fflush(this->_output.load(std::memory_order_relaxed));
+        {
+            std::lock_guard<std::mutex> lock(this->_writer_mutex);
+            this->_written += handled;
+        }
+        this->_flushed.notify_all();
+    }
+
+    // Write one message, unless it is a repeat or over the rate limit
+    void
+    age_log::_emit(const Message &message) {
+        if (message.key != 0) {
+            KeyState &state = this->_keys[message.key];
+            if (state.count++ == 0) {
+                state.tag = message.tag;
+                state.text = message.text.substr(0, 160);
+                state.reported = 0;
+            }
+            if (state.count > REPEATS_SHOWN) {
+                return;
+            }
+        }
+
+        if (message.severity != LogSeverity::error && !this->_take_line()) {
+            this->_rate_dropped++;
+            return;
+        }
+
+        std::FILE *output = this->_output.load(std::memory_order_relaxed);
+        if (this->_rate_dropped > 0) {
+            std::fprintf(output, "[warning] log: %llu messages dropped by the rate limit\n",
+                    static_cast<unsigned long long>(this->_rate_dropped));
+            this->_rate_dropped = 0;
+        }
+        std::fprintf(output, "[%s] %s: %s\n", severity_name(message.severity), message.tag, message.text.c_str());
+        if (message.key != 0 && this->_keys[message.key].count == REPEATS_SHOWN) {
+            std::fprintf(output, "[info] log: further repeats of this message are counted, not shown\n");
+        }
+    }
+
+    // Summarize the repeats counted since the last report
+    void
+    age_log::_report_repeats() {
+        this->_last_report_us = now_us();
+
+        std::FILE *output = this->_output.load(std::memory_order_relaxed);
+        bool reported = false;
+        for (std::pair<const uint64_t, KeyState> &entry : this->_keys) {
+            KeyState &state = entry.second;
+            uint64_t seen = std::max<uint64_t>(state.reported, REPEATS_SHOWN);
+            if (state.count > seen) {
+                std::fprintf(output, "[info] log: %s message repeated %llu more times: %s\n",
+                        state.tag.c_str(),
+                        static_cast<unsigned long long>(state.count - seen),
+                        state.text.c_str());
+                state.reported = state.count;
+                reported = true;
+            }
+        }
+        if (reported) {
+            std::fflush(output);
+        }
+    }
+
+    // Take one line from the current one second window
+    bool
+    age_log::_take_line() {
+        double now = now_us();
+        if (now - this->_window_start_us >= 1000.0 * 1000.0) {
+            this->_window_start_us = now;
+            this->_window_lines = 0;
+        }
+        if (this->_window_lines >= LINES_PER_SECOND) {
+            return false;
+        }
+        this->_window_lines++;
+        return true;
+    }
+}
@@ -0,0 +1,608 @@
+#include "age_pipeline_manager.hh"
+#include "age_compute.hh"
+#include "age_cpu_profiler.hh"
+#include "age_deletion_queue.hh"
+#include "age_log.hh"
+#include "age_trace.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    // Split a path into the directory inotify watches and the file name
+    // its events report
+    static std::pair<std::string, std::string>
+    split_path(const std::string &path) {
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos) {
+            return {".", path};
+        }
+        return {slash == 0 ? "/" : path.substr(0, slash), path.substr(slash + 1)};
+    }
+
+    // FNV-1a, pass a previous result to extend it
+    static uint64_t
+    hash_bytes(uint64_t hash, const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    static uint64_t
+    hash_value(uint64_t hash, const T &value) {
+        return hash_bytes(hash, &value, sizeof(value));
+    }
+
+    // The terminator keeps "ab" + "c" apart from "a" + "bc"
+    static uint64_t
+    hash_string(uint64_t hash, const std::string &string) {
+        return hash_bytes(hash, string.c_str(), string.size() + 1);
+    }
+
+    // Vertex input descriptions are plain 32 bit fields without padding
+    template <typename T>
+    static uint64_t
+    hash_array(uint64_t hash, const std::vector<T> &array) {
+        hash = hash_value(hash, array.size());
+        return array.empty() ? hash : hash_bytes(hash, array.data(), array.size() * sizeof(T));
+    }
+
+    template <typename T>
+    static bool
+    same_array(const std::vector<T> &a, const std::vector<T> &b) {
+        return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_pipeline_manager::age_pipeline_manager(age_device &device, age_job_system &jobs, bool hot_reload)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _jobs{jobs},
+      _pending_builds{0},
+      _inotify_fd{-1} {
+        if (hot_reload) {
+            this->_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (this->_inotify_fd < 0) {
+                age_log::get().write(LogSeverity::warning, "pipelines", "inotify is unavailable, shader hot reload is off");
+            }
+        }
+    }
+
+    // Destructor
+    age_pipeline_manager::~age_pipeline_manager() {
+        this->wait_idle();
+        if (this->_inotify_fd >= 0) {
+            close(this->_inotify_fd);
+        }
+        for (Pipeline &pipeline : this->_pipelines) {
+            if (pipeline.pipeline != VK_NULL_HANDLE) {
+                this->_vk.vkDestroyPipeline(this->_device.get_device(), pipeline.pipeline, this->_device.get_allocation_callbacks());
+            }
+        }
+    }
+
+    uint32_t
+    age_pipeline_manager::create_compute(const ComputePipelineDesc &desc, uint32_t fallback) {
+        if (desc.layout == VK_NULL_HANDLE) {
+            throw std::runtime_error("Error: compute pipeline " + desc.shader_path + " needs a pipeline layout");
+        }
+
+        Pipeline pipeline{};
+        pipeline.compute = true;
+        pipeline.compute_desc = desc;
+        pipeline.fallback = fallback;
+        return this->_add(std::move(pipeline), {desc.shader_path});
+    }
+
+    uint32_t
+    age_pipeline_manager::create_graphics(const GraphicsPipelineDesc &desc, uint32_t fallback) {
+        if (desc.layout == VK_NULL_HANDLE || desc.render_pass == VK_NULL_HANDLE) {
+            throw std::runtime_error("Error: graphics pipeline " + desc.vertex_shader_path + " needs a pipeline layout and a render pass");
+        }
+
+        std::vector<std::string> shader_paths = {desc.vertex_shader_path};
+        if (!desc.fragment_shader_path.empty()) {
+            shader_paths.push_back(desc.fragment_shader_path);
+        }
+
+        Pipeline pipeline{};
+        pipeline.compute = false;
+        pipeline.graphics_desc = desc;
+        pipeline.fallback = fallback;
+        return this->_add(std::move(pipeline), shader_paths);
+    }
+
+    // Get the pipeline to bind
+    // A pipeline that is not built yet, or failed to build, is
+    // stood in for by its fallback
+    VkPipeline
+    age_pipeline_manager::get(uint32_t handle) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        while (handle != INVALID_PIPELINE) {
+            if (handle >= this->_pipelines.size()) {
+                throw std::runtime_error("Error: invalid pipeline handle " + std::to_string(handle));
+            }
+            const Pipeline &pipeline = this->_pipelines[handle];
+            if (pipeline.pipeline != VK_NULL_HANDLE) {
+                return pipeline.pipeline;
+            }
+            handle = pipeline.fallback;
+        }
+        return VK_NULL_HANDLE;
+    }
+
+    PipelineState
+    age_pipeline_manager::get_state(uint32_t handle) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (handle >= this->_pipelines.size()) {
+            throw std::runtime_error("Error: invalid pipeline handle " + std::to_string(handle));
+        }
+        return this->_pipelines[handle].state;
+    }
+
+    // Wait for every queued build
+    // Useful after startup when the first frame should not show fallbacks
+    void
+    age_pipeline_manager::wait_idle() {
+        this->_run_inline();
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        this->_idle.wait(lock, [this]() {
+            return this->_pending_builds == 0;
+        });
+    }
+
+    // Queue rebuilds for shaders written since the last call
+    // Only drains the inotify queue, the builds run on the job system
+    void
+    age_pipeline_manager::update() {
+        if (this->_inotify_fd < 0) {
+            return;
+        }
+
+        // Editors either rewrite the file or rename a new one over it
+        std::vector<std::pair<int, std::string>> events;
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t size = read(this->_inotify_fd, buffer, sizeof(buffer));
+            if (size <= 0) {
+                break;
+            }
+            for (char *cursor = buffer; cursor < buffer + size;) {
+                const inotify_event *event = reinterpret_cast<const inotify_event*>(cursor);
+                if (event->len > 0 && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0) {
+                    events.emplace_back(event->wd, event->name);
+                }
+                cursor += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (events.empty()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            std::set<uint32_t> changed;
+            for (const std::pair<int, std::string> &event : events) {
+                auto directory = this->_watched_directories.find(event.first);
+                if (directory == this->_watched_directories.end()) {
+                    continue;
+                }
+                auto users = this->_users.find(directory->second + "/" + event.second);
+                if (users == this->_users.end()) {
+                    continue;
+                }
+                age_log::get().write(LogSeverity::info, "pipelines", "reloading " + users->first);
+                changed.insert(users->second.begin(), users->second.end());
+            }
+            for (uint32_t handle : changed) {
+                this->_schedule(handle);
+            }
+        }
+        this->_run_inline();
+    }
+
+    PipelineManagerStats
+    age_pipeline_manager::get_stats() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        PipelineManagerStats stats = this->_stats;
+        stats.pipeline_count = static_cast<uint32_t>(this->_pipelines.size());
+        stats.pending_builds = this->_pending_builds;
+        stats.hit_rate = stats.request_count > 0
+                         ? static_cast<double>(stats.hit_count) / static_cast<double>(stats.request_count)
+                         : 0.0;
+        for (const Pipeline &pipeline : this->_pipelines) {
+            stats.ready_count += pipeline.state == PipelineState::ready ? 1 : 0;
+            stats.failed_count += pipeline.state == PipelineState::failed ? 1 : 0;
+        }
+        return stats;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    uint32_t
+    age_pipeline_manager::_add(Pipeline pipeline, const std::vector<std::string> &shader_paths) {
+        uint64_t hash = age_pipeline_manager::_hash(pipeline);
+        uint32_t handle;
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            handle = static_cast<uint32_t>(this->_pipelines.size());
+            if (pipeline.fallback != INVALID_PIPELINE && pipeline.fallback >= handle) {
+                throw std::runtime_error("Error: fallback pipeline " + std::to_string(pipeline.fallback) + " does not exist");
+            }
+
+            // The full comparison guards against hash collisions
+            this->_stats.request_count++;
+            auto candidates = this->_by_hash.equal_range(hash);
+            for (auto candidate = candidates.first; candidate != candidates.second; candidate++) {
+                if (age_pipeline_manager::_same_desc(this->_pipelines[candidate->second], pipeline)) {
+                    this->_stats.hit_count++;
+                    return candidate->second;
+                }
+            }
+            this->_by_hash.emplace(hash, handle);
+
+            pipeline.pipeline = VK_NULL_HANDLE;
+            pipeline.state = PipelineState::building;
+            pipeline.building = false;
+            pipeline.rebuild = false;
+            this->_pipelines.push_back(std::move(pipeline));
+
+            if (this->_inotify_fd >= 0) {
+                for (const std::string &path : shader_paths) {
+                    this->_watch(handle, path);
+                }
+            }
+            this->_schedule(handle);
+        }
+        this->_run_inline();
+        return handle;
+    }
+
+    // Hash every field that ends up in the create info
+    uint64_t
+    age_pipeline_manager::_hash(const Pipeline &pipeline) {
+        uint64_t hash = hash_value(0xcbf29ce484222325ull, pipeline.compute);
+        if (pipeline.compute) {
+            const ComputePipelineDesc &desc = pipeline.compute_desc;
+            hash = hash_string(hash, desc.shader_path);
+            hash = hash_string(hash, desc.entry_point);
+            return hash_value(hash, desc.layout);
+        }
+
+        const GraphicsPipelineDesc &desc = pipeline.graphics_desc;
+        hash = hash_string(hash, desc.vertex_shader_path);
+        hash = hash_string(hash, desc.fragment_shader_path);
+        hash = hash_string(hash, desc.entry_point);
+        hash = hash_value(hash, desc.layout);
+        hash = hash_value(hash, desc.render_pass);
+        hash = hash_value(hash, desc.subpass);
+        hash = hash_array(hash, desc.vertex_bindings);
+        hash = hash_array(hash, desc.vertex_attributes);
+        hash = hash_value(hash, desc.topology);
+        hash = hash_value(hash, desc.polygon_mode);
+        hash = hash_value(hash, desc.cull_mode);
+        hash = hash_value(hash, desc.front_face);
+        hash = hash_value(hash, desc.samples);
+        hash = hash_value(hash, desc.depth_test);
+        hash = hash_value(hash, desc.depth_write);
+        hash = hash_value(hash, desc.depth_compare);
+        hash = hash_value(hash, desc.alpha_blend);
+        return hash_value(hash, desc.color_attachment_count);
+    }
+
+    // Same pipeline state, the fallback does not count
+    bool
+    age_pipeline_manager::_same_desc(const Pipeline &a, const Pipeline &b) {
+        if (a.compute != b.compute) {
+            return false;
+        }
+        if (a.compute) {
+            return a.compute_desc.shader_path == b.compute_desc.shader_path
+                   && a.compute_desc.entry_point == b.compute_desc.entry_point
+                   && a.compute_desc.layout == b.compute_desc.layout;
+        }
+
+        const GraphicsPipelineDesc &x = a.graphics_desc;
+        const GraphicsPipelineDesc &y = b.graphics_desc;
+        return x.vertex_shader_path == y.vertex_shader_path
+               && x.fragment_shader_path == y.fragment_shader_path
+               && x.entry_point == y.entry_point
+               && x.layout == y.layout
+               && x.render_pass == y.render_pass
+               && x.subpass == y.subpass
+               && same_array(x.vertex_bindings, y.vertex_bindings)
+               && same_array(x.vertex_attributes, y.vertex_attributes)
+               && x.topology == y.topology
+               && x.polygon_mode == y.polygon_mode
+               && x.cull_mode == y.cull_mode
+               && x.front_face == y.front_face
+               && x.samples == y.samples
+               && x.depth_test == y.depth_test
+               && x.depth_write == y.depth_write
+               && x.depth_compare == y.depth_compare
+               && x.alpha_blend == y.alpha_blend
+               && x.color_attachment_count == y.color_attachment_count;
+    }
+
+    // Queue a build, or mark a running one to be repeated
+    // A build that is already running may have read the old file
+    void
+    age_pipeline_manager::_schedule(uint32_t handle) {
+        Pipeline &pipeline = this->_pipelines[handle];
+        if (pipeline.building) {
+            pipeline.rebuild = true;
+            return;
+        }
+        pipeline.building = true;
+        this->_pending_builds++;
+
+        // Without workers the caller builds once it lets go of the lock
+        if (this->_jobs.get_worker_count() == 0) {
+            this->_inline_builds.push_back(handle);
+            return;
+        }
+        this->_jobs.run([this, handle]() {
+            this->_build(handle);
+        });
+    }
+
+    void
+    age_pipeline_manager::_run_inline() {
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        while (!this->_inline_builds.empty()) {
+            uint32_t handle = this->_inline_builds.front();
+            this->_inline_builds.pop_front();
+            lock.unlock();
+            this->_build(handle);
+            lock.lock();
+        }
+    }
+
+    // Read the shaders and compile one pipeline
+    // The descriptions never change after creation, so they are read
+    // without the lock; only publishing the result takes it
+    void
+    age_pipeline_manager::_build(uint32_t handle) {
+        AGE_PROFILE_FUNCTION();
+        const Pipeline *pipeline;
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            pipeline = &this->_pipelines[handle];
+        }
+
+        double start_us = age_trace::now_us();
+        VkPipeline built = VK_NULL_HANDLE;
+        std::string error;
+        try {
+            built = this->_compile(*pipeline);
+        } catch (const std::exception &e) {
+            error = e.what();
+        }
+        double build_ms = (age_trace::now_us() - start_us) / 1000.0;
+
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        Pipeline &entry = this->_pipelines[handle];
+        if (built != VK_NULL_HANDLE) {
+            // Frames in flight may still bind the old pipeline
+            if (entry.pipeline != VK_NULL_HANDLE) {
+                this->_device.get_deletion_queue().destroy_pipeline(entry.pipeline);
+                this->_stats.reload_count++;
+            }
+            entry.pipeline = built;
+            entry.state = PipelineState::ready;
+        } else if (entry.state == PipelineState::ready) {
+            age_log::get().write(LogSeverity::warning, "pipelines", error + ", keeping the previous pipeline");
+        } else {
+            entry.state = PipelineState::failed;
+            age_log::get().write(LogSeverity::error, "pipelines", error);
+        }
+        this->_stats.build_count++;
+        this->_stats.last_build_ms = build_ms;
+        this->_stats.max_build_ms = std::max(this->_stats.max_build_ms, build_ms);
+        this->_stats.total_build_ms += build_ms;
+
+        entry.building = false;
+        if (entry.rebuild) {
+            entry.rebuild = false;
+            this->_schedule(handle);
+        }
+        if (--this->_pending_builds == 0) {
+            this->_idle.notify_all();
+        }
+    }
+
+    VkPipeline
+    age_pipeline_manager::_compile(const Pipeline &pipeline) {
+        VkDevice dev = this->_device.get_device();
+        VkPipeline result = VK_NULL_HANDLE;
+
+        if (pipeline.compute) {
+            const ComputePipelineDesc &desc = pipeline.compute_desc;
+            VkShaderModule shader_module = this->_create_shader_module(desc.shader_path);
+
+            VkComputePipelineCreateInfo pipeline_info{};
+            pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipeline_info.stage.module = shader_module;
+            pipeline_info.stage.pName = desc.entry_point.c_str();
+            pipeline_info.layout = desc.layout;
+
+            VkResult status = this->_vk.vkCreateComputePipelines(
+                    dev,
+                    this->_device.get_pipeline_cache(),
+                    1,
+                    &pipeline_info,
+                    this->_device.get_allocation_callbacks(),
+                    &result);
+            this->_vk.vkDestroyShaderModule(dev, shader_module, this->_device.get_allocation_callbacks());
+            if (status != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create compute pipeline " + desc.shader_path);
+            }
+            return result;
+        }
+
+        const GraphicsPipelineDesc &desc = pipeline.graphics_desc;
+        std::vector<VkShaderModule> shader_modules;
+        std::vector<VkPipelineShaderStageCreateInfo> stages;
+        try {
+            shader_modules.push_back(this->_create_shader_module(desc.vertex_shader_path));
+            if (!desc.fragment_shader_path.empty()) {
+                shader_modules.push_back(this->_create_shader_module(desc.fragment_shader_path));
+            }
+        } catch (...) {
+            for (VkShaderModule shader_module : shader_modules) {
+                this->_vk.vkDestroyShaderModule(dev, shader_module, this->_device.get_allocation_callbacks());
+            }
+            throw;
+        }
+        for (size_t i = 0; i < shader_modules.size(); i++) {
+            VkPipelineShaderStageCreateInfo stage{};
+            stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stage.stage = i == 0 ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+            stage.module = shader_modules[i];
+            stage.pName = desc.entry_point.c_str();
+            stages.push_back(stage);
+        }
+
+        VkPipelineVertexInputStateCreateInfo vertex_input{};
+        vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertex_input.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertex_bindings.size());
+        vertex_input.pVertexBindingDescriptions = desc.vertex_bindings.data();
+        vertex_input.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertex_attributes.size());
+        vertex_input.pVertexAttributeDescriptions = desc.vertex_attributes.data();
+
+        VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+        input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        input_assembly.topology = desc.topology;
+
+        // Viewport and scissor are set when recording, so one pipeline serves every extent
+        VkPipelineViewportStateCreateInfo viewport{};
+        viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewport.viewportCount = 1;
+        viewport.scissorCount = 1;
+        VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamic{};
+        dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic.dynamicStateCount = 2;
+        dynamic.pDynamicStates = dynamic_states;
+
+        VkPipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterization.polygonMode = desc.polygon_mode;
+        rasterization.cullMode = desc.cull_mode;
+        rasterization.frontFace = desc.front_face;
+        rasterization.lineWidth = 1.0F;
+
+        VkPipelineMultisampleStateCreateInfo multisample{};
+        multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisample.rasterizationSamples = desc.samples;
+
+        VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+        depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depth_stencil.depthTestEnable = desc.depth_test ? VK_TRUE : VK_FALSE;
+        depth_stencil.depthWriteEnable = desc.depth_write ? VK_TRUE : VK_FALSE;
+        depth_stencil.depthCompareOp = desc.depth_compare;
+
+        VkPipelineColorBlendAttachmentState blend_attachment{};
+        blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+                                          | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        if (desc.alpha_blend) {
+            blend_attachment.blendEnable = VK_TRUE;
+            blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+            blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+        }
+        std::vector<VkPipelineColorBlendAttachmentState> blend_attachments(desc.color_attachment_count, blend_attachment);
+        VkPipelineColorBlendStateCreateInfo color_blend{};
+        color_blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        color_blend.attachmentCount = desc.color_attachment_count;
+        color_blend.pAttachments = blend_attachments.data();
+
+        VkGraphicsPipelineCreateInfo pipeline_info{};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipeline_info.stageCount = static_cast<uint32_t>(stages.size());
+        pipeline_info.pStages = stages.data();
+        pipeline_info.pVertexInputState = &vertex_input;
+        pipeline_info.pInputAssemblyState = &input_assembly;
+        pipeline_info.pViewportState = &viewport;
+        pipeline_info.pRasterizationState = &rasterization;
+        pipeline_info.pMultisampleState = &multisample;
+        pipeline_info.pDepthStencilState = &depth_stencil;
+        pipeline_info.pColorBlendState = &color_blend;
+        pipeline_info.pDynamicState = &dynamic;
+        pipeline_info.layout = desc.layout;
+        pipeline_info.renderPass = desc.render_pass;
+        pipeline_info.subpass = desc.subpass;
+
+        VkResult status = this->_vk.vkCreateGraphicsPipelines(
+                dev,
+                this->_device.get_pipeline_cache(),
+                1,
+                &pipeline_info,
+                this->_device.get_allocation_callbacks(),
+                &result);
+        for (VkShaderModule shader_module : shader_modules) {
+            this->_vk.vkDestroyShaderModule(dev, shader_module, this->_device.get_allocation_callbacks());
+        }
+        if (status != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create graphics pipeline " + desc.vertex_shader_path);
+        }
+        return result;
+    }
+
+    VkShaderModule
+    age_pipeline_manager::_create_shader_module(const std::string &path) {
+        std::vector<char> code = age_compute_pipeline::read_spirv(path);
+
+        VkShaderModuleCreateInfo module_info{};
+        module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        module_info.codeSize = code.size();
+        module_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+        VkShaderModule shader_module;
+        if (this->_vk.vkCreateShaderModule(this->_device.get_device(), &module_info, this->_device.get_allocation_callbacks(), &shader_module) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create shader module " + path);
+        }
+        return shader_module;
+    }
+
+    // Watch the directory of a shader
+    // Watching the file itself would lose it when an editor renames a new file over it
+    void
+    age_pipeline_manager::_watch(uint32_t handle, const std::string &path) {
+        std::pair<std::string, std::string> parts = split_path(path);
+        int watch = inotify_add_watch(this->_inotify_fd, parts.first.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (watch < 0) {
+            age_log::get().write(LogSeverity::warning, "pipelines", "unable to watch " + parts.first + " for shader changes");
+            return;
+        }
+        this->_watched_directories[watch] = parts.first;
+        this->_users[parts.first + "/" + parts.second].push_back(handle);
+    }
+}
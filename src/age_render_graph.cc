@@ -0,0 +1,689 @@
+#include "age_render_graph.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+
+    namespace {
+        // What a use of an image requires from the pipeline
+        struct Requirement {
+            VkImageLayout layout;
+            VkPipelineStageFlags stages;
+            VkAccessFlags access;
+            VkImageUsageFlags usage;
+        };
+
+        Requirement
+        requirement_for(ResourceUsage usage, bool write) {
+            switch (usage) {
+                case ResourceUsage::color_attachment:
+                    return {
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                        write ? VkAccessFlags(VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT)
+                              : VkAccessFlags(VK_ACCESS_COLOR_ATTACHMENT_READ_BIT),
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+                    };
+                case ResourceUsage::depth_attachment:
+                    return {
+                        write ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        write ? VkAccessFlags(VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT)
+                              : VkAccessFlags(VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT),
+                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+                    };
+                case ResourceUsage::sampled:
+                    if (write) {
+                        throw std::runtime_error("Error: sampled images cannot be written");
+                    }
+                    return {
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT,
+                        VK_IMAGE_USAGE_SAMPLED_BIT
+                    };
+                case ResourceUsage::storage:
+                    return {
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        write ? VkAccessFlags(VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+                              : VkAccessFlags(VK_ACCESS_SHADER_READ_BIT),
+                        VK_IMAGE_USAGE_STORAGE_BIT
+                    };
+                case ResourceUsage::transfer_src:
+                    if (write) {
+                        throw std::runtime_error("Error: transfer sources cannot be written");
+                    }
+                    return {
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_TRANSFER_READ_BIT,
+                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                    };
+                case ResourceUsage::transfer_dst:
+                    return {
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                    };
+            }
+            throw std::runtime_error("Error: unknown resource usage");
+        }
+
+        const VkAccessFlags WRITE_ACCESS =
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+            | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+            | VK_ACCESS_SHADER_WRITE_BIT
+            | VK_ACCESS_TRANSFER_WRITE_BIT
+            | VK_ACCESS_MEMORY_WRITE_BIT;
+
+        bool
+        lifetimes_overlap(int32_t first_a, int32_t last_a, int32_t first_b, int32_t last_b) {
+            return !(last_a < first_b || last_b < first_a);
+        }
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_render_graph::age_render_graph(age_device &device)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _compiled{false},
+      _profiler{nullptr} {}
+
+    // Destructor
+    // The caller makes sure no frame using the graph is still executing
+    age_render_graph::~age_render_graph() {
+        this->_destroy_transients();
+    }
+
+    // Declare an image that the graph creates
+    // Its contents do not survive from one execution to the next
+    uint32_t
+    age_render_graph::create_image(const std::string &name, const TransientImageDesc &desc) {
+        Resource resource{};
+        resource.name = name;
+        resource.imported = false;
+        resource.desc = desc;
+        resource.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resource.final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resource.usage = desc.usage;
+        resource.image = VK_NULL_HANDLE;
+        resource.view = VK_NULL_HANDLE;
+
+        this->_resources.push_back(resource);
+        this->_compiled = false;
+        return static_cast<uint32_t>(this->_resources.size() - 1);
+    }
+
+    // Declare an image that lives outside the graph
+    // Passes writing imported images are what keeps the graph alive
+    uint32_t
+    age_render_graph::import_image(
+            const std::string &name,
+            VkImageAspectFlags aspect,
+            VkImageLayout initial_layout,
+            VkImageLayout final_layout) {
+        Resource resource{};
+        resource.name = name;
+        resource.imported = true;
+        resource.desc.aspect = aspect;
+        resource.initial_layout = initial_layout;
+        resource.final_layout = final_layout;
+        resource.image = VK_NULL_HANDLE;
+        resource.view = VK_NULL_HANDLE;
+
+        this->_resources.push_back(resource);
+        this->_compiled = false;
+        return static_cast<uint32_t>(this->_resources.size() - 1);
+    }
+
+    // Point an imported resource at this frame's image
+    void
+    age_render_graph::set_imported_image(uint32_t resource, VkImage image, VkImageView view) {
+        if (!this->_resources[resource].imported) {
+            throw std::runtime_error("Error: " + this->_resources[resource].name + " is not an imported image");
+        }
+        this->_resources[resource].image = image;
+        this->_resources[resource].view = view;
+    }
+
+    // Add a pass
+    // Passes run in the order they are added
+    uint32_t
+    age_render_graph::add_pass(const std::string &name, PassExecute execute) {
+        Pass pass{};
+        pass.name = name;
+        pass.execute = std::move(execute);
+        pass.alive = false;
+
+        this->_passes.push_back(std::move(pass));
+        this->_compiled = false;
+        return static_cast<uint32_t>(this->_passes.size() - 1);
+    }
+
+    void
+    age_render_graph::read(uint32_t pass, uint32_t resource, ResourceUsage usage) {
+        this->_passes[pass].uses.push_back({resource, usage, false});
+        this->_compiled = false;
+    }
+
+    void
+    age_render_graph::write(uint32_t pass, uint32_t resource, ResourceUsage usage) {
+        this->_passes[pass].uses.push_back({resource, usage, true});
+        this->_compiled = false;
+    }
+
+    // Turn the declared passes into an execution plan
+    // Transient images are recreated, so no frame using the
+    // previous plan may still be executing
+    void
+    age_render_graph::compile() {
+        this->_destroy_transients();
+        this->_stats = RenderGraphStats{};
+        this->_stats.pass_count = static_cast<uint32_t>(this->_passes.size());
+
+        this->_cull();
+        this->_allocate_transients();
+        this->_plan_barriers();
+        this->_compiled = true;
+    }
+
+    // Record the live passes with the barriers between them
+    void
+    age_render_graph::execute(VkCommandBuffer command_buffer) {
+        if (!this->_compiled) {
+            throw std::runtime_error("Error: render graph executed before it was compiled");
+        }
+
+        for (Pass &pass : this->_passes) {
+            if (!pass.alive) {
+                continue;
+            }
+            // Barriers are part of the pass's cost
+            uint32_t scope = UINT32_MAX;
+            if (this->_profiler != nullptr) {
+                scope = this->_profiler->begin_scope(command_buffer, pass.name.c_str());
+            }
+            this->_record_batch(command_buffer, pass.barriers);
+            pass.execute(command_buffer, *this);
+            if (this->_profiler != nullptr) {
+                this->_profiler->end_scope(command_buffer, scope);
+            }
+        }
+        this->_record_batch(command_buffer, this->_final_barriers);
+    }
+
+    void
+    age_render_graph::set_profiler(age_gpu_profiler *profiler) {
+        this->_profiler = profiler;
+    }
+
+    VkImage
+    age_render_graph::get_image(uint32_t resource) {
+        return this->_resources[resource].image;
+    }
+
+    VkImageView
+    age_render_graph::get_image_view(uint32_t resource) {
+        return this->_resources[resource].view;
+    }
+
+    RenderGraphStats
+    age_render_graph::get_stats() {
+        return this->_stats;
+    }
+
+    // Find the passes that contribute to an imported image
+    // Walking backwards, a pass is live if it writes an imported image
+    // or an image a later live pass reads
+    std::vector<bool>
+    age_render_graph::cull_passes(const std::vector<std::vector<PassAccess>> &passes, const std::vector<bool> &imported) {
+        std::vector<bool> alive(passes.size(), false);
+        std::vector<bool> needed(imported.size(), false);
+
+        for (size_t p = passes.size(); p-- > 0;) {
+            for (const PassAccess &access : passes[p]) {
+                if (access.write && (imported[access.resource] || needed[access.resource])) {
+                    alive[p] = true;
+                }
+            }
+
+            if (alive[p]) {
+                for (const PassAccess &access : passes[p]) {
+                    if (!access.write) {
+                        needed[access.resource] = true;
+                    }
+                }
+            }
+        }
+        return alive;
+    }
+
+    // Place transient images in shared memory blocks
+    // Images are placed largest first at the lowest offset that does not
+    // overlap an image whose lifetime overlaps theirs. Images that share
+    // a memory type go in the same block
+    std::vector<VkMemoryRequirements>
+    age_render_graph::place_transients(const std::vector<TransientLifetime> &images, std::vector<TransientPlacement> &placements) {
+        std::vector<uint32_t> order(images.size());
+        for (uint32_t i = 0; i < images.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&images](uint32_t a, uint32_t b) {
+            return images[a].requirements.size > images[b].requirements.size;
+        });
+
+        std::vector<VkMemoryRequirements> groups;
+        std::vector<std::vector<uint32_t>> group_members;
+        placements.assign(images.size(), TransientPlacement{});
+
+        for (uint32_t i : order) {
+            const TransientLifetime &image = images[i];
+
+            uint32_t group = 0;
+            while (group < groups.size()
+                   && (groups[group].memoryTypeBits & image.requirements.memoryTypeBits) == 0) {
+                group++;
+            }
+            if (group == groups.size()) {
+                VkMemoryRequirements requirements{};
+                requirements.size = 0;
+                requirements.alignment = 1;
+                requirements.memoryTypeBits = image.requirements.memoryTypeBits;
+                groups.push_back(requirements);
+                group_members.emplace_back();
+            }
+            groups[group].memoryTypeBits &= image.requirements.memoryTypeBits;
+
+            // Candidate offsets are the start of the block and the end
+            // of every image that is alive at the same time
+            VkDeviceSize alignment = image.requirements.alignment;
+            std::vector<VkDeviceSize> candidates = {0};
+            for (uint32_t other : group_members[group]) {
+                if (lifetimes_overlap(image.first_pass, image.last_pass, images[other].first_pass, images[other].last_pass)) {
+                    VkDeviceSize end = placements[other].offset + images[other].requirements.size;
+                    candidates.push_back((end + alignment - 1) / alignment * alignment);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            VkDeviceSize offset = 0;
+            for (VkDeviceSize candidate : candidates) {
+                bool fits = true;
+                for (uint32_t other : group_members[group]) {
+                    const TransientPlacement &placed = placements[other];
+                    if (lifetimes_overlap(image.first_pass, image.last_pass, images[other].first_pass, images[other].last_pass)
+                        && candidate < placed.offset + images[other].requirements.size
+                        && placed.offset < candidate + image.requirements.size) {
+                        fits = false;
+                        break;
+                    }
+                }
+                if (fits) {
+                    offset = candidate;
+                    break;
+                }
+            }
+
+            placements[i].group = group;
+            placements[i].offset = offset;
+            groups[group].size = std::max(groups[group].size, offset + image.requirements.size);
+            groups[group].alignment = std::max(groups[group].alignment, alignment);
+            group_members[group].push_back(i);
+        }
+        return groups;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Keep only the passes that contribute to an imported image
+    void
+    age_render_graph::_cull() {
+        std::vector<std::vector<PassAccess>> passes(this->_passes.size());
+        for (size_t p = 0; p < this->_passes.size(); p++) {
+            for (const Use &use : this->_passes[p].uses) {
+                passes[p].push_back({use.resource, use.write});
+            }
+        }
+        std::vector<bool> imported(this->_resources.size());
+        for (size_t r = 0; r < this->_resources.size(); r++) {
+            imported[r] = this->_resources[r].imported;
+        }
+
+        std::vector<bool> alive = age_render_graph::cull_passes(passes, imported);
+        for (size_t p = 0; p < this->_passes.size(); p++) {
+            this->_passes[p].alive = alive[p];
+            if (!alive[p]) {
+                this->_stats.culled_pass_count++;
+            }
+        }
+
+        // Lifetimes over the live passes
+        for (Resource &resource : this->_resources) {
+            resource.first_pass = -1;
+            resource.last_pass = -1;
+        }
+        for (size_t p = 0; p < this->_passes.size(); p++) {
+            if (!this->_passes[p].alive) {
+                continue;
+            }
+            for (const Use &use : this->_passes[p].uses) {
+                Resource &resource = this->_resources[use.resource];
+                if (resource.first_pass < 0) {
+                    resource.first_pass = static_cast<int32_t>(p);
+                }
+                resource.last_pass = static_cast<int32_t>(p);
+                resource.usage |= requirement_for(use.usage, use.write).usage;
+            }
+        }
+    }
+
+    // Create the live transient images and place them in shared memory
+    void
+    age_render_graph::_allocate_transients() {
+        VkDevice device = this->_device.get_device();
+
+        std::vector<uint32_t> transients;
+        for (uint32_t r = 0; r < this->_resources.size(); r++) {
+            Resource &resource = this->_resources[r];
+            if (resource.imported || resource.first_pass < 0) {
+                continue;
+            }
+
+            VkImageCreateInfo image_info{};
+            image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            image_info.imageType = VK_IMAGE_TYPE_2D;
+            image_info.format = resource.desc.format;
+            image_info.extent = {resource.desc.extent.width, resource.desc.extent.height, 1};
+            image_info.mipLevels = 1;
+            image_info.arrayLayers = 1;
+            image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+            image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            image_info.usage = resource.usage;
+            image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            if (this->_vk.vkCreateImage(device, &image_info, this->_device.get_allocation_callbacks(), &resource.image) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create transient image " + resource.name);
+            }
+            this->_vk.vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+            this->_stats.transient_bytes += resource.requirements.size;
+            transients.push_back(r);
+        }
+
+        std::vector<TransientLifetime> lifetimes;
+        for (uint32_t r : transients) {
+            const Resource &resource = this->_resources[r];
+            lifetimes.push_back({resource.requirements, resource.first_pass, resource.last_pass});
+        }
+        std::vector<TransientPlacement> placements;
+        std::vector<VkMemoryRequirements> groups = age_render_graph::place_transients(lifetimes, placements);
+        for (size_t i = 0; i < transients.size(); i++) {
+            this->_resources[transients[i]].group = placements[i].group;
+            this->_resources[transients[i]].offset = placements[i].offset;
+        }
+
+        for (const VkMemoryRequirements &requirements : groups) {
+            this->_memory.push_back(this->_device.get_allocator().allocate(
+                    requirements,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    AllocationKind::optimal,
+                    true));
+            this->_stats.allocated_bytes += requirements.size;
+        }
+
+        for (uint32_t r : transients) {
+            Resource &resource = this->_resources[r];
+            const age_allocation &memory = this->_memory[resource.group];
+            this->_vk.vkBindImageMemory(device, resource.image, memory.memory, memory.offset + resource.offset);
+
+            VkImageViewCreateInfo view_info{};
+            view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            view_info.image = resource.image;
+            view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            view_info.format = resource.desc.format;
+            view_info.subresourceRange.aspectMask = resource.desc.aspect;
+            view_info.subresourceRange.baseMipLevel = 0;
+            view_info.subresourceRange.levelCount = 1;
+            view_info.subresourceRange.baseArrayLayer = 0;
+            view_info.subresourceRange.layerCount = 1;
+
+            if (this->_vk.vkCreateImageView(device, &view_info, this->_device.get_allocation_callbacks(), &resource.view) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create transient image view " + resource.name);
+            }
+        }
+    }
+
+    // Work out the barriers before every live pass
+    // A first walk finds the state each transient image is left in. Those
+    // states seed the real walk: an image's memory may last have been used
+    // by another image placed over it, or by itself in the previous frame
+    void
+    age_render_graph::_plan_barriers() {
+        std::vector<State> states(this->_resources.size());
+        this->_simulate(states, false);
+
+        std::vector<State> initial(this->_resources.size());
+        for (uint32_t r = 0; r < this->_resources.size(); r++) {
+            const Resource &resource = this->_resources[r];
+            if (resource.imported) {
+                initial[r].layout = resource.initial_layout;
+                if (resource.initial_layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+                    // Written by whatever ran before the graph
+                    initial[r].write_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                    initial[r].write_access = VK_ACCESS_MEMORY_WRITE_BIT;
+                }
+                continue;
+            }
+            if (resource.first_pass < 0) {
+                continue;
+            }
+
+            for (uint32_t o = 0; o < this->_resources.size(); o++) {
+                const Resource &other = this->_resources[o];
+                if (other.imported || other.first_pass < 0 || other.group != resource.group) {
+                    continue;
+                }
+                if (other.offset < resource.offset + resource.requirements.size
+                    && resource.offset < other.offset + other.requirements.size) {
+                    initial[r].write_stages |= states[o].write_stages | states[o].read_stages;
+                    initial[r].write_access |= states[o].write_access;
+                }
+            }
+        }
+
+        this->_simulate(initial, true);
+
+        this->_stats.barrier_count = 0;
+        this->_stats.image_barrier_count = 0;
+        for (const Pass &pass : this->_passes) {
+            if (pass.alive && !pass.barriers.barriers.empty()) {
+                this->_stats.barrier_count++;
+                this->_stats.image_barrier_count += static_cast<uint32_t>(pass.barriers.barriers.size());
+            }
+        }
+        if (!this->_final_barriers.barriers.empty()) {
+            this->_stats.barrier_count++;
+            this->_stats.image_barrier_count += static_cast<uint32_t>(this->_final_barriers.barriers.size());
+        }
+    }
+
+    // Walk the live passes in order, updating the state of every image
+    // When record is set the barriers each pass needs are stored with it
+    void
+    age_render_graph::_simulate(std::vector<State> &states, bool record) {
+        for (Pass &pass : this->_passes) {
+            if (!pass.alive) {
+                continue;
+            }
+            pass.barriers = BarrierBatch{};
+
+            // Merge the uses of the same image within the pass
+            std::vector<uint32_t> resources;
+            std::vector<Requirement> requirements;
+            std::vector<bool> writes;
+            for (const Use &use : pass.uses) {
+                Requirement requirement = requirement_for(use.usage, use.write);
+                std::vector<uint32_t>::iterator found = std::find(resources.begin(), resources.end(), use.resource);
+                if (found == resources.end()) {
+                    resources.push_back(use.resource);
+                    requirements.push_back(requirement);
+                    writes.push_back(use.write);
+                    continue;
+                }
+
+                size_t index = static_cast<size_t>(found - resources.begin());
+                if (requirements[index].layout != requirement.layout) {
+                    throw std::runtime_error("Error: pass " + pass.name + " uses "
+                                             + this->_resources[use.resource].name + " in two layouts");
+                }
+                requirements[index].stages |= requirement.stages;
+                requirements[index].access |= requirement.access;
+                writes[index] = writes[index] || use.write;
+            }
+
+            for (size_t i = 0; i < resources.size(); i++) {
+                State &state = states[resources[i]];
+                const Requirement &need = requirements[i];
+                bool layout_change = state.layout != need.layout;
+
+                if (layout_change || writes[i]) {
+                    // Layout transitions and writes wait for every earlier
+                    // access, only earlier writes need to be made available
+                    VkPipelineStageFlags src_stages = state.write_stages | state.read_stages;
+                    if (layout_change || src_stages != 0) {
+                        pass.barriers.src_stages |= src_stages;
+                        pass.barriers.dst_stages |= need.stages;
+                        pass.barriers.barriers.push_back({
+                            resources[i], state.layout, need.layout, state.write_access, need.access});
+                    }
+
+                    state.layout = need.layout;
+                    if (writes[i]) {
+                        state.write_stages = need.stages;
+                        state.write_access = need.access & WRITE_ACCESS;
+                        state.read_stages = 0;
+                        state.read_access = 0;
+                    } else {
+                        // The transition counts as a write made visible to these stages
+                        state.write_stages = need.stages;
+                        state.write_access = 0;
+                        state.read_stages = need.stages;
+                        state.read_access = need.access;
+                    }
+                } else {
+                    // Read after write needs the write made visible to new stages,
+                    // reads after reads need nothing
+                    VkPipelineStageFlags new_stages = need.stages & ~state.read_stages;
+                    if (state.write_stages != 0 && new_stages != 0) {
+                        pass.barriers.src_stages |= state.write_stages;
+                        pass.barriers.dst_stages |= need.stages;
+                        pass.barriers.barriers.push_back({
+                            resources[i], state.layout, state.layout, state.write_access, need.access});
+                    }
+                    state.read_stages |= need.stages;
+                    state.read_access |= need.access;
+                }
+            }
+
+            if (!record) {
+                pass.barriers = BarrierBatch{};
+            }
+        }
+
+        // Leave imported images in the layout their owner expects
+        this->_final_barriers = BarrierBatch{};
+        if (!record) {
+            return;
+        }
+        for (uint32_t r = 0; r < this->_resources.size(); r++) {
+            const Resource &resource = this->_resources[r];
+            State &state = states[r];
+            if (!resource.imported
+                || resource.final_layout == VK_IMAGE_LAYOUT_UNDEFINED
+                || resource.final_layout == state.layout) {
+                continue;
+            }
+
+            this->_final_barriers.src_stages |= state.write_stages | state.read_stages;
+            this->_final_barriers.dst_stages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            this->_final_barriers.barriers.push_back({r, state.layout, resource.final_layout, state.write_access, 0});
+            state.layout = resource.final_layout;
+        }
+    }
+
+    // Destroy the transient images and give their memory back
+    void
+    age_render_graph::_destroy_transients() {
+        VkDevice device = this->_device.get_device();
+        for (Resource &resource : this->_resources) {
+            if (resource.imported) {
+                continue;
+            }
+            if (resource.view != VK_NULL_HANDLE) {
+                this->_vk.vkDestroyImageView(device, resource.view, this->_device.get_allocation_callbacks());
+                resource.view = VK_NULL_HANDLE;
+            }
+            if (resource.image != VK_NULL_HANDLE) {
+                this->_vk.vkDestroyImage(device, resource.image, this->_device.get_allocation_callbacks());
+                resource.image = VK_NULL_HANDLE;
+            }
+        }
+
+        for (age_allocation &memory : this->_memory) {
+            this->_device.get_allocator().free(memory);
+        }
+        this->_memory.clear();
+    }
+
+    // Record one batch of barriers as a single pipeline barrier
+    void
+    age_render_graph::_record_batch(VkCommandBuffer command_buffer, const BarrierBatch &batch) {
+        if (batch.barriers.empty()) {
+            return;
+        }
+
+        std::vector<VkImageMemoryBarrier> barriers(batch.barriers.size());
+        for (size_t i = 0; i < batch.barriers.size(); i++) {
+            const Barrier &barrier = batch.barriers[i];
+            const Resource &resource = this->_resources[barrier.resource];
+
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].srcAccessMask = barrier.src_access;
+            barriers[i].dstAccessMask = barrier.dst_access;
+            barriers[i].oldLayout = barrier.old_layout;
+            barriers[i].newLayout = barrier.new_layout;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = resource.image;
+            barriers[i].subresourceRange.aspectMask = resource.desc.aspect;
+            barriers[i].subresourceRange.baseMipLevel = 0;
+            barriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            barriers[i].subresourceRange.baseArrayLayer = 0;
+            barriers[i].subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        }
+
+        this->_vk.vkCmdPipelineBarrier(
+                command_buffer,
+                batch.src_stages != 0 ? batch.src_stages : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+                batch.dst_stages != 0 ? batch.dst_stages : VkPipelineStageFlags(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT),
+                0,
+                0, nullptr,
+                0, nullptr,
+                static_cast<uint32_t>(barriers.size()),
+                barriers.data());
+    }
+}
@@ -1,5 +1,6 @@
 #include "age_swapchain.hh"
 #include "age_device.hh"
+#include "age_cpu_profiler.hh"
 #include <algorithm>
 #include <limits>
 #include <stdexcept>
@@ -9,34 +10,295 @@
 namespace age {
 
     // Constructor //
-    age_swapchain::age_swapchain(age_device &device, VkExtent2D extent)
-    : _device{device}, _extent{extent} {
+    age_swapchain::age_swapchain(
+            age_device &device,
+            VkExtent2D extent,
+            uint32_t frames_in_flight,
+            PresentPolicy policy)
+    : _device{device}, _vk{device.get_dispatch()}, _extent{extent}, _policy{policy}, _swapchain{VK_NULL_HANDLE},
+      _frames_in_flight{frames_in_flight}, _current_frame{0} {
+        if (this->_frames_in_flight == 0) {
+            throw std::runtime_error("Error: at least one frame must be in flight");
+        }
         this->_init();
     }
 
     // Destrcutor //
     age_swapchain::~age_swapchain() {
+        // The owner waits for the device to be idle before we get here,
+        // so none of the sync objects are still in use. Retired swapchains
+        // are left to the deletion queue, which the device flushes
+        for (size_t i = 0; i < this->_frames_in_flight; i++) {
+            this->_vk.vkDestroySemaphore(this->_device.get_device(), this->_image_available[i], this->_device.get_allocation_callbacks());
+            this->_vk.vkDestroyFence(this->_device.get_device(), this->_in_flight_fences[i], this->_device.get_allocation_callbacks());
+        }
+        for (VkSemaphore semaphore : this->_render_finished) {
+            this->_vk.vkDestroySemaphore(this->_device.get_device(), semaphore, this->_device.get_allocation_callbacks());
+        }
+
         // Image views are explicitly created by us, so we clean them up
         for (VkImageView image_view : this->_swapchain_image_views) {
-            vkDestroyImageView(this->_device.get_device(), image_view, nullptr);
+            if (image_view != VK_NULL_HANDLE) {
+                this->_vk.vkDestroyImageView(this->_device.get_device(), image_view, this->_device.get_allocation_callbacks());
+            }
         }
 
         // Destroy the swapchain
         if (this->_swapchain != nullptr) {
-            vkDestroySwapchainKHR(this->_device.get_device(), this->_swapchain, nullptr);
+            this->_vk.vkDestroySwapchainKHR(this->_device.get_device(), this->_swapchain, this->_device.get_allocation_callbacks());
             this->_swapchain = nullptr;
         }
     }
 
+    // Recreate the swapchain for a new extent
+    //
+    // The old swapchain is handed to the driver as oldSwapchain so it can
+    // reuse its resources, then handed to the deletion queue instead of
+    // destroyed: frames that are still in flight keep using its images and
+    // semaphores until the next frame's timeline value is signaled. The
+    // per-frame sync objects are kept as they are
+    void
+    age_swapchain::recreate(VkExtent2D extent) {
+        AGE_PROFILE_FUNCTION();
+        this->_extent = extent;
+
+        age_deletion_queue &deletion_queue = this->_device.get_deletion_queue();
+        for (VkImageView image_view : this->_swapchain_image_views) {
+            if (image_view != VK_NULL_HANDLE) {
+                deletion_queue.destroy_image_view(image_view);
+            }
+        }
+        for (VkSemaphore semaphore : this->_render_finished) {
+            deletion_queue.destroy_semaphore(semaphore);
+        }
+        VkSwapchainKHR old_swapchain = this->_swapchain;
+        deletion_queue.destroy_swapchain(old_swapchain);
+
+        this->_create_swapchain(old_swapchain);
+        this->_swapchain_image_views.assign(this->_swapchain_images.size(), VK_NULL_HANDLE);
+        this->_images_in_flight.assign(this->_swapchain_images.size(), VK_NULL_HANDLE);
+        this->_create_present_semaphores();
+    }
+
+    // Switch the present policy at runtime
+    // This goes through the same non-stalling recreation as a resize
+    void
+    age_swapchain::set_present_policy(PresentPolicy policy) {
+        if (policy == this->_policy) {
+            return;
+        }
+
+        this->_policy = policy;
+        this->recreate(this->_extent);
+    }
+
+    // Acquire the next image to render to
+    //
+    // The only place the CPU blocks is on the fence of the frame slot
+    // we are about to reuse, so up to _frames_in_flight frames can be
+    // recorded while the GPU is still executing earlier ones
+    VkResult
+    age_swapchain::acquire_next_image(uint32_t *image_index) {
+        AGE_PROFILE_FUNCTION();
+        this->_vk.vkWaitForFences(
+                this->_device.get_device(),
+                1,
+                &this->_in_flight_fences[this->_current_frame],
+                VK_TRUE,
+                std::numeric_limits<uint64_t>::max());
+
+        VkResult result = this->_vk.vkAcquireNextImageKHR(
+                this->_device.get_device(),
+                this->_swapchain,
+                std::numeric_limits<uint64_t>::max(),
+                this->_image_available[this->_current_frame], // signaled once the presentation engine releases the image
+                VK_NULL_HANDLE,
+                image_index);
+
+        // Views are built the first time an image shows up so a recreation
+        // does not pay for all of them at once
+        if ((result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+            && this->_swapchain_image_views[*image_index] == VK_NULL_HANDLE) {
+            this->_create_image_view(*image_index);
+        }
+        return result;
+    }
+
+    // Submit the recorded command buffers for the current frame
+    // and queue the image for presentation
+    VkResult
+    age_swapchain::submit_command_buffers(
+            const VkCommandBuffer *buffers,
+            uint32_t buffer_count,
+            uint32_t image_index,
+            const std::vector<TimelineWait> &waits) {
+        AGE_PROFILE_FUNCTION();
+        // The image may have been acquired out of order and still be used
+        // by a frame in a different slot
+        if (this->_images_in_flight[image_index] != VK_NULL_HANDLE) {
+            this->_vk.vkWaitForFences(
+                    this->_device.get_device(),
+                    1,
+                    &this->_images_in_flight[image_index],
+                    VK_TRUE,
+                    std::numeric_limits<uint64_t>::max());
+        }
+        this->_images_in_flight[image_index] = this->_in_flight_fences[this->_current_frame];
+
+        // Timeline waits (compute results, uploads) go after the image
+        // semaphore, which is binary so its value is ignored. The same goes
+        // for the render-finished semaphore next to the frame timeline
+        std::vector<VkSemaphore> wait_semaphores = {this->_image_available[this->_current_frame]};
+        std::vector<VkPipelineStageFlags> wait_stages = {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+        std::vector<uint64_t> wait_values = {0};
+        for (const TimelineWait &wait : waits) {
+            wait_semaphores.push_back(wait.semaphore);
+            wait_stages.push_back(wait.stage);
+            wait_values.push_back(wait.value);
+        }
+        age_deletion_queue &deletion_queue = this->_device.get_deletion_queue();
+        VkSemaphore signal_semaphores[] = {this->_render_finished[image_index], deletion_queue.get_frame_semaphore()};
+        uint64_t signal_values[] = {0, deletion_queue.signal_frame()};
+
+        VkTimelineSemaphoreSubmitInfo timeline_info{};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+        timeline_info.pWaitSemaphoreValues = wait_values.data();
+        timeline_info.signalSemaphoreValueCount = 2;
+        timeline_info.pSignalSemaphoreValues = signal_values;
+
+        VkSubmitInfo submit_info{};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.pNext = &timeline_info;
+        submit_info.waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size());
+        submit_info.pWaitSemaphores = wait_semaphores.data();
+        submit_info.pWaitDstStageMask = wait_stages.data();
+        submit_info.commandBufferCount = buffer_count;
+        submit_info.pCommandBuffers = buffers;
+        submit_info.signalSemaphoreCount = 2;
+        submit_info.pSignalSemaphores = signal_semaphores;
+
+        this->_vk.vkResetFences(this->_device.get_device(), 1, &this->_in_flight_fences[this->_current_frame]);
+        if (this->_device.queue_submit(
+                this->_device.get_graphics_queue(),
+                1,
+                &submit_info,
+                this->_in_flight_fences[this->_current_frame]) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to submit frame command buffers");
+        }
+
+        VkPresentInfoKHR present_info{};
+        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present_info.waitSemaphoreCount = 1;
+        present_info.pWaitSemaphores = signal_semaphores;
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &this->_swapchain;
+        present_info.pImageIndices = &image_index;
+
+        VkResult result = this->_device.queue_present(this->_device.get_present_queue(), &present_info);
+
+        this->_current_frame = (this->_current_frame + 1) % this->_frames_in_flight;
+        return result;
+    }
+
+    uint32_t
+    age_swapchain::get_frames_in_flight() {
+        return this->_frames_in_flight;
+    }
+
+    uint32_t
+    age_swapchain::get_current_frame() {
+        return this->_current_frame;
+    }
+
+    uint32_t
+    age_swapchain::get_image_count() {
+        return static_cast<uint32_t>(this->_swapchain_images.size());
+    }
+
+    VkImage
+    age_swapchain::get_image(uint32_t index) {
+        return this->_swapchain_images[index];
+    }
+
+    VkImageView
+    age_swapchain::get_image_view(uint32_t index) {
+        return this->_swapchain_image_views[index];
+    }
+
+    VkFormat
+    age_swapchain::get_image_format() {
+        return this->_swapchain_image_format;
+    }
+
+    VkExtent2D
+    age_swapchain::get_extent() {
+        return this->_swapchain_extent;
+    }
+
+    PresentPolicy
+    age_swapchain::get_present_policy() {
+        return this->_policy;
+    }
+
+    VkPresentModeKHR
+    age_swapchain::get_present_mode() {
+        return this->_present_mode;
+    }
+
     void
     age_swapchain::_init() {
-        this->_create_swapchain();
-        this->_create_image_views();
+        AGE_PROFILE_FUNCTION();
+        this->_create_swapchain(VK_NULL_HANDLE);
+        this->_swapchain_image_views.assign(this->_swapchain_images.size(), VK_NULL_HANDLE);
+        this->_create_sync_objects();
+        this->_create_present_semaphores();
+    }
+
+    // Create the semaphores and fences used to pace the frames
+    // The fences start signaled so the first wait on each slot returns immediately
+    void
+    age_swapchain::_create_sync_objects() {
+        this->_image_available.resize(this->_frames_in_flight);
+        this->_in_flight_fences.resize(this->_frames_in_flight);
+        this->_images_in_flight.assign(this->_swapchain_images.size(), VK_NULL_HANDLE);
+
+        VkSemaphoreCreateInfo semaphore_info{};
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fence_info{};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        for (size_t i = 0; i < this->_frames_in_flight; i++) {
+            if (this->_vk.vkCreateSemaphore(this->_device.get_device(), &semaphore_info, this->_device.get_allocation_callbacks(), &this->_image_available[i]) != VK_SUCCESS
+                || this->_vk.vkCreateFence(this->_device.get_device(), &fence_info, this->_device.get_allocation_callbacks(), &this->_in_flight_fences[i]) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create frame synchronization objects");
+            }
+        }
+    }
+
+    // One render-finished semaphore per image: the presentation engine holds
+    // on to it until the image is presented, which is not tied to our frame slots
+    void
+    age_swapchain::_create_present_semaphores() {
+        VkSemaphoreCreateInfo semaphore_info{};
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        this->_render_finished.resize(this->_swapchain_images.size());
+        for (size_t i = 0; i < this->_swapchain_images.size(); i++) {
+            if (this->_vk.vkCreateSemaphore(this->_device.get_device(), &semaphore_info, this->_device.get_allocation_callbacks(), &this->_render_finished[i]) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create frame synchronization objects");
+            }
+        }
     }
 
     // Create the swapchain
+    // When replacing a swapchain the old one is passed along so the
+    // driver can hand its resources over to the new one
     void
-    age_swapchain::_create_swapchain() {
+    age_swapchain::_create_swapchain(VkSwapchainKHR old_swapchain) {
+        AGE_PROFILE_FUNCTION();
         SwapChainSupportDetails swap_chain_support = this->_device.get_swapchain_support();
         
         VkSurfaceFormatKHR surface_format = this->_choose_swap_surface_format(
@@ -46,16 +308,9 @@ namespace age {
         VkExtent2D extent = this->_choose_swap_extent(
                 swap_chain_support.capabilities);
 
-        // Choose one more image than the minimum so that we don't have to wait for the driver
-        // to complete internal operations before we can acquire another image to render to
-        uint32_t image_count = swap_chain_support.capabilities.minImageCount + 1;
- 
-        // Make sure that we do not exceed the max number of images that the driver is capable of
-        // 0 is a special case here where it means there is no maximum number of images
-        if (swap_chain_support.capabilities.maxImageCount > 0
-                && image_count > swap_chain_support.capabilities.maxImageCount) {
-            image_count = swap_chain_support.capabilities.maxImageCount;
-        }
+        uint32_t image_count = this->_choose_image_count(
+                swap_chain_support.capabilities,
+                present_mode);
 
         VkSwapchainCreateInfoKHR create_info{};
         create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -66,6 +321,10 @@ namespace age {
         create_info.imageExtent = extent;
         create_info.imageArrayLayers = 1; // specifies the amount of layers each image consists of. Always 1 unless developing stereoscopic 3D application
         create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // specifies the kinds of operations we'll use the images in swap chain for. We can edit this to do post-processing
+        if (!(swap_chain_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+            throw std::runtime_error("Error: swapchain images cannot be used as transfer destinations");
+        }
+        create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; // allows clearing and copying straight into the image
 
         QueueFamilyIndices indices = this->_device.find_physical_device_queue_families();
         uint32_t queue_family_indices[] = {
@@ -94,19 +353,19 @@ namespace age {
         create_info.presentMode = present_mode; // we do not want to render pixels that are covered
                                                 // -- obscured by a window
         create_info.clipped = VK_TRUE;
-        create_info.oldSwapchain = VK_NULL_HANDLE;
+        create_info.oldSwapchain = old_swapchain;
         
-        if (vkCreateSwapchainKHR(this->_device.get_device(), &create_info, nullptr, &this->_swapchain) != VK_SUCCESS) {
+        if (this->_vk.vkCreateSwapchainKHR(this->_device.get_device(), &create_info, this->_device.get_allocation_callbacks(), &this->_swapchain) != VK_SUCCESS) {
             throw std::runtime_error("Error: unable to create swapchain");
         }
 
-        vkGetSwapchainImagesKHR(
+        this->_vk.vkGetSwapchainImagesKHR(
                 this->_device.get_device(),
                 this->_swapchain,
                 &image_count,
                 nullptr);
         this->_swapchain_images.resize(image_count);
-        vkGetSwapchainImagesKHR(
+        this->_vk.vkGetSwapchainImagesKHR(
                 this->_device.get_device(),
                 this->_swapchain,
                 &image_count,
@@ -114,42 +373,39 @@ namespace age {
 
         this->_swapchain_image_format = surface_format.format;
         this->_swapchain_extent = extent;
+        this->_present_mode = present_mode;
     }
 
+    // Create the view for a single swapchain image
     void 
-    age_swapchain::_create_image_views() {
-        this->_swapchain_image_views.resize(this->_swapchain_images.size());
+    age_swapchain::_create_image_view(uint32_t index) {
+        VkImageViewCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        create_info.image = this->_swapchain_images[index]; 
+        
+        // treat images as 2D textures
+        create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;       
+        create_info.format = this->_swapchain_image_format;
 
-        for (size_t i = 0; i < this->_swapchain_images.size(); i++) {
-            VkImageViewCreateInfo create_info{};
-            create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            create_info.image = this->_swapchain_images[i]; 
-            
-            // treat images as 2D textures
-            create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;       
-            create_info.format = this->_swapchain_image_format;
-
-            // Swizzle the colors 
-            // for example you can map all channels to the red channel for monochrome texture
-            // or map constant values of 0 or 1 to a channel
-            create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-
-            // Describes the image purpose and which part of the image should be accessed
-            // These images will be used as color targets without any mipmapping levels or multiple layers
-            create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            create_info.subresourceRange.baseMipLevel = 0;
-            create_info.subresourceRange.levelCount = 1;
-            create_info.subresourceRange.baseArrayLayer = 0;
-            create_info.subresourceRange.layerCount = 1;
-
-            if (vkCreateImageView(this->_device.get_device(), &create_info, nullptr, &this->_swapchain_image_views[i])
-                != VK_SUCCESS) {
-                throw std::runtime_error("Error: unable to create image views");
-            }
+        // Swizzle the colors 
+        // for example you can map all channels to the red channel for monochrome texture
+        // or map constant values of 0 or 1 to a channel
+        create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+        // Describes the image purpose and which part of the image should be accessed
+        // These images will be used as color targets without any mipmapping levels or multiple layers
+        create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        create_info.subresourceRange.baseMipLevel = 0;
+        create_info.subresourceRange.levelCount = 1;
+        create_info.subresourceRange.baseArrayLayer = 0;
+        create_info.subresourceRange.layerCount = 1;
 
+        if (this->_vk.vkCreateImageView(this->_device.get_device(), &create_info, this->_device.get_allocation_callbacks(), &this->_swapchain_image_views[index])
+            != VK_SUCCESS) {
+            throw std::runtime_error("Error: unable to create image views");
         }
     }
 
@@ -171,19 +427,71 @@ namespace age {
     // Choose the present mode
     // This is the conditions for swapping
     // the images to the screen
-    // Choose mailbox swapping preferably
+    // Take the first mode in the policy's preference list that the
+    // surface supports; FIFO is guaranteed to be available
     VkPresentModeKHR
     age_swapchain::_choose_swap_present_mode(
             const std::vector<VkPresentModeKHR>& available_present_modes) {
-        for (const VkPresentModeKHR available_present_mode : available_present_modes) {
-            if (available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                return available_present_mode;
+        std::vector<VkPresentModeKHR> preferred;
+        switch (this->_policy) {
+            case PresentPolicy::low_latency:
+                preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+                break;
+            case PresentPolicy::max_throughput:
+                preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+                break;
+            case PresentPolicy::power_saving:
+                break;
+            case PresentPolicy::uncapped_benchmark:
+                preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+                break;
+        }
+
+        for (const VkPresentModeKHR preferred_mode : preferred) {
+            for (const VkPresentModeKHR available_present_mode : available_present_modes) {
+                if (available_present_mode == preferred_mode) {
+                    return available_present_mode;
+                }
             }
         }
 
         return VK_PRESENT_MODE_FIFO_KHR;
     }
 
+    // Choose how many images the swapchain holds
+    // Fewer queued images means less latency between recording and scanout,
+    // more images means the GPU never waits for the presentation engine
+    uint32_t
+    age_swapchain::_choose_image_count(
+            const VkSurfaceCapabilitiesKHR& capabilities,
+            VkPresentModeKHR present_mode) {
+        uint32_t image_count = capabilities.minImageCount + 1;
+        switch (this->_policy) {
+            case PresentPolicy::low_latency:
+                // Mailbox needs a spare image to replace, FIFO queues should stay as short as possible
+                image_count = present_mode == VK_PRESENT_MODE_MAILBOX_KHR
+                              ? std::max(capabilities.minImageCount + 1, 3u)
+                              : capabilities.minImageCount;
+                break;
+            case PresentPolicy::max_throughput:
+                image_count = capabilities.minImageCount + 2;
+                break;
+            case PresentPolicy::power_saving:
+                image_count = capabilities.minImageCount;
+                break;
+            case PresentPolicy::uncapped_benchmark:
+                image_count = capabilities.minImageCount + 1;
+                break;
+        }
+ 
+        // Make sure that we do not exceed the max number of images that the driver is capable of
+        // 0 is a special case here where it means there is no maximum number of images
+        if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount) {
+            image_count = capabilities.maxImageCount;
+        }
+        return image_count;
+    }
+
     // Get the resolution of the swap chain images
     // This is normally equal to the resolution of the window,
     // but that is not always true (high retina displays can differ in
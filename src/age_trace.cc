@@ -0,0 +1,120 @@
+#include "age_trace.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace age {
+
+    namespace {
+        const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+        // Write a string as a JSON string literal
+        void
+        write_json_string(FILE *file, const std::string &value) {
+            fputc('"', file);
+            for (char c : value) {
+                if (c == '"' || c == '\\') {
+                    fputc('\\', file);
+                    fputc(c, file);
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    fprintf(file, "\\u%04x", c);
+                } else {
+                    fputc(c, file);
+                }
+            }
+            fputc('"', file);
+        }
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_trace::age_trace() {
+        this->set_track_name(TRACE_PROCESS_CPU, 0, "CPU");
+        this->set_track_name(TRACE_PROCESS_GPU, 0, "GPU");
+    }
+
+    void
+    age_trace::add_event(TraceEvent event) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_events.push_back(std::move(event));
+    }
+
+    void
+    age_trace::add_events(std::vector<TraceEvent> &events) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        for (TraceEvent &event : events) {
+            this->_events.push_back(std::move(event));
+        }
+        events.clear();
+    }
+
+    // Name a track
+    // Thread 0 names the process itself
+    void
+    age_trace::set_track_name(uint32_t process, uint32_t thread, const std::string &name) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        for (TrackName &track : this->_track_names) {
+            if (track.process == process && track.thread == thread) {
+                track.name = name;
+                return;
+            }
+        }
+        this->_track_names.push_back({process, thread, name});
+    }
+
+    // Write every event collected so far
+    bool
+    age_trace::write(const std::string &path) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        FILE *file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        bool first = true;
+        for (const TrackName &track : this->_track_names) {
+            fputs(first ? "" : ",\n", file);
+            first = false;
+            fprintf(file, "{\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"name\":\"%s\",\"args\":{\"name\":",
+                    track.process,
+                    track.thread,
+                    track.thread == 0 ? "process_name" : "thread_name");
+            write_json_string(file, track.name);
+            fputs("}}", file);
+        }
+        for (const TraceEvent &event : this->_events) {
+            fputs(first ? "" : ",\n", file);
+            first = false;
+            fprintf(file, "{\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"cat\":\"%s\",\"name\":",
+                    event.process,
+                    event.thread,
+                    event.start_us,
+                    event.duration_us,
+                    event.category);
+            write_json_string(file, event.name);
+            fputc('}', file);
+        }
+        fputs("\n]}\n", file);
+
+        return fclose(file) == 0;
+    }
+
+    size_t
+    age_trace::get_event_count() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_events.size();
+    }
+
+    double
+    age_trace::now_us() {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace_epoch).count();
+    }
+}
@@ -0,0 +1,161 @@
+#include "age_uniform_ring.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+namespace age {
+
+    namespace {
+        VkDeviceSize
+        align_up(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_uniform_ring::age_uniform_ring(age_device &device, uint32_t frames_in_flight, VkDeviceSize frame_capacity)
+    : _device{device},
+      _frames_in_flight{frames_in_flight},
+      _buffer{VK_NULL_HANDLE},
+      _generation{0},
+      _frame{0},
+      _head{0},
+      _frame_bytes{0},
+      _frame_allocations{0} {
+        if (this->_frames_in_flight == 0) {
+            throw std::runtime_error("Error: the uniform ring needs at least one frame");
+        }
+
+        VkPhysicalDeviceProperties properties;
+        this->_device.get_dispatch().vkGetPhysicalDeviceProperties(this->_device.get_physical_device(), &properties);
+        this->_alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+        this->_max_range = properties.limits.maxUniformBufferRange;
+
+        this->_create_buffer(align_up(std::max<VkDeviceSize>(frame_capacity, 1), this->_alignment));
+    }
+
+    // Destructor
+    // The owner waits for the device to be idle first
+    age_uniform_ring::~age_uniform_ring() {
+        this->_device.get_allocator().destroy_buffer(this->_buffer, this->_allocation);
+    }
+
+    // Start writing the constants of a frame slot
+    // Call once the slot's previous frame has finished on the GPU
+    void
+    age_uniform_ring::begin_frame(uint32_t frame) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_stats.last_frame_bytes = this->_frame_bytes;
+        this->_stats.last_frame_allocations = this->_frame_allocations;
+        this->_stats.peak_frame_bytes = std::max(this->_stats.peak_frame_bytes, this->_frame_bytes);
+
+        this->_frame = frame % this->_frames_in_flight;
+        this->_head = 0;
+        this->_frame_bytes = 0;
+        this->_frame_allocations = 0;
+    }
+
+    // Bump size bytes off the current frame's region
+    UniformAllocation
+    age_uniform_ring::allocate(VkDeviceSize size) {
+        if (size > this->_max_range) {
+            throw std::runtime_error("Error: uniform data is larger than maxUniformBufferRange");
+        }
+
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        VkDeviceSize padded = align_up(std::max<VkDeviceSize>(size, 1), this->_alignment);
+        if (this->_head + padded > this->_stats.frame_capacity) {
+            this->_grow(this->_frame_bytes + padded);
+        }
+
+        VkDeviceSize offset = this->_frame * this->_stats.frame_capacity + this->_head;
+        this->_head += padded;
+        this->_frame_bytes += padded;
+        this->_frame_allocations++;
+
+        UniformAllocation allocation;
+        allocation.buffer = this->_buffer;
+        allocation.offset = static_cast<uint32_t>(offset);
+        allocation.data = static_cast<char*>(this->_allocation.mapped) + offset;
+        return allocation;
+    }
+
+    VkBuffer
+    age_uniform_ring::get_buffer() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_buffer;
+    }
+
+    uint64_t
+    age_uniform_ring::get_generation() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_generation;
+    }
+
+    VkDeviceSize
+    age_uniform_ring::get_alignment() {
+        return this->_alignment;
+    }
+
+    UniformRingStats
+    age_uniform_ring::get_stats() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_stats;
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Create the buffer with a region of frame_capacity bytes per frame
+    // Coherent memory means no flushes are needed after writing it.
+    // The previous buffer, if any, goes to the deletion queue once the new one exists
+    void
+    age_uniform_ring::_create_buffer(VkDeviceSize frame_capacity) {
+        VkDeviceSize size = frame_capacity * this->_frames_in_flight;
+        if (size > UINT32_MAX) {
+            throw std::runtime_error("Error: uniform ring does not fit in 32 bit dynamic offsets");
+        }
+
+        VkBuffer buffer;
+        age_allocation allocation;
+        this->_device.get_allocator().create_buffer(
+                size,
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                buffer,
+                allocation);
+
+        if (this->_buffer != VK_NULL_HANDLE) {
+            this->_device.get_deletion_queue().destroy_buffer(this->_buffer, this->_allocation);
+        }
+        this->_buffer = buffer;
+        this->_allocation = allocation;
+        this->_stats.frame_capacity = frame_capacity;
+        this->_generation++;
+    }
+
+    // Replace the buffer with one whose regions hold size bytes
+    // Frames still in flight, and this frame's earlier allocations, keep
+    // pointing at the old buffer until the GPU is done with them.
+    // The current frame continues from the start of its new region
+    void
+    age_uniform_ring::_grow(VkDeviceSize size) {
+        VkDeviceSize frame_capacity = this->_stats.frame_capacity;
+        while (frame_capacity < size) {
+            frame_capacity *= 2;
+        }
+
+        this->_create_buffer(frame_capacity);
+        this->_head = 0;
+        this->_stats.grow_count++;
+    }
+}
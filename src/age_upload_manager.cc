@@ -0,0 +1,377 @@
+#include "age_upload_manager.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan_core.h>
+
+namespace age {
+
+    /**********************************************
+     *                Public
+     *********************************************/
+
+    // Constructor
+    age_upload_manager::age_upload_manager(age_device &device, VkDeviceSize staging_size)
+    : _device{device},
+      _vk{device.get_dispatch()},
+      _staging_size{staging_size},
+      _head{0},
+      _tail{0},
+      _recording{VK_NULL_HANDLE},
+      _submitted_value{0} {
+        // The staging ring stays mapped for the lifetime of the manager
+        // Coherent memory means no flushes are needed after writing it
+        this->_device.get_allocator().create_buffer(
+                this->_staging_size,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                this->_staging_buffer,
+                this->_staging_allocation);
+
+        VkCommandPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_info.queueFamilyIndex = this->_device.find_physical_device_queue_families().transfer_family.value();
+
+        if (this->_vk.vkCreateCommandPool(this->_device.get_device(), &pool_info, this->_device.get_allocation_callbacks(), &this->_command_pool) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to create upload command pool");
+        }
+
+        this->_timeline = this->_device.create_timeline_semaphore(0);
+    }
+
+    // Destructor
+    age_upload_manager::~age_upload_manager() {
+        uint64_t value = this->flush();
+        this->wait(value);
+
+        this->_vk.vkDestroySemaphore(this->_device.get_device(), this->_timeline, this->_device.get_allocation_callbacks());
+        this->_vk.vkDestroyCommandPool(this->_device.get_device(), this->_command_pool, this->_device.get_allocation_callbacks());
+        this->_device.get_allocator().destroy_buffer(this->_staging_buffer, this->_staging_allocation);
+    }
+
+    // Copy data into a buffer
+    // Uploads larger than half the ring are split so that one half
+    // can be filled while the transfer queue copies the other
+    uint64_t
+    age_upload_manager::upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const void *data, VkDeviceSize size) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        // Nothing is recorded, so the next value may never be signaled
+        if (size == 0) {
+            return this->_submitted_value;
+        }
+
+        const char *src = static_cast<const char*>(data);
+        VkDeviceSize max_chunk = std::max<VkDeviceSize>(this->_staging_size / 2, 1);
+        VkDeviceSize done = 0;
+        while (done < size) {
+            VkDeviceSize chunk = std::min(size - done, max_chunk);
+
+            // The copy is done under the lock so a concurrent flush
+            // can never submit a range that is still being written
+            VkDeviceSize offset = this->_reserve(chunk, 4);
+            std::memcpy(static_cast<char*>(this->_staging_allocation.mapped) + offset, src + done, chunk);
+
+            VkBufferCopy region{};
+            region.srcOffset = offset;
+            region.dstOffset = dst_offset + done;
+            region.size = chunk;
+            this->_vk.vkCmdCopyBuffer(this->_get_recording(), this->_staging_buffer, dst, 1, &region);
+
+            done += chunk;
+        }
+
+        return this->_submitted_value + 1;
+    }
+
+    // Copy tightly packed texels into mip 0, layer 0 of a color image
+    // The previous contents are discarded. The image is left in final_layout
+    // once the returned value is signaled
+    uint64_t
+    age_upload_manager::upload_image(
+            VkImage dst,
+            VkExtent3D extent,
+            const void *data,
+            VkDeviceSize size,
+            VkImageLayout final_layout) {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        // Rows must hold whole texels, any padding would be copied as texels
+        if (extent.width == 0 || extent.height == 0 || extent.depth == 0) {
+            throw std::runtime_error("Error: image upload has an empty extent");
+        }
+        VkDeviceSize row_pitch = size / (static_cast<VkDeviceSize>(extent.height) * extent.depth);
+        VkDeviceSize texel_size = row_pitch / extent.width;
+        if (texel_size == 0
+            || row_pitch != texel_size * extent.width
+            || row_pitch * extent.height * extent.depth != size) {
+            throw std::runtime_error("Error: image upload size does not match its extent");
+        }
+        if (row_pitch > this->_staging_size) {
+            throw std::runtime_error("Error: image row does not fit in the staging ring");
+        }
+
+        VkImageSubresourceRange range{};
+        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.baseMipLevel = 0;
+        range.levelCount = 1;
+        range.baseArrayLayer = 0;
+        range.layerCount = 1;
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = dst;
+        barrier.subresourceRange = range;
+        this->_vk.vkCmdPipelineBarrier(
+                this->_get_recording(),
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier);
+
+        // Buffer offsets of image copies must be a multiple of both
+        // the texel size and 4. Chunks are whole rows of one slice
+        VkDeviceSize alignment = std::lcm<VkDeviceSize>(texel_size, 4);
+        uint32_t max_rows = static_cast<uint32_t>(std::max<VkDeviceSize>(this->_staging_size / 2 / row_pitch, 1));
+        const char *src = static_cast<const char*>(data);
+        for (uint32_t z = 0; z < extent.depth; z++) {
+            uint32_t y = 0;
+            while (y < extent.height) {
+                uint32_t rows = std::min(extent.height - y, max_rows);
+                VkDeviceSize chunk = rows * row_pitch;
+
+                VkDeviceSize offset = this->_reserve(chunk, alignment);
+                std::memcpy(
+                        static_cast<char*>(this->_staging_allocation.mapped) + offset,
+                        src + (static_cast<VkDeviceSize>(z) * extent.height + y) * row_pitch,
+                        chunk);
+
+                VkBufferImageCopy region{};
+                region.bufferOffset = offset;
+                region.bufferRowLength = 0; // tightly packed
+                region.bufferImageHeight = 0;
+                region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.imageSubresource.mipLevel = 0;
+                region.imageSubresource.baseArrayLayer = 0;
+                region.imageSubresource.layerCount = 1;
+                region.imageOffset = {0, static_cast<int32_t>(y), static_cast<int32_t>(z)};
+                region.imageExtent = {extent.width, rows, 1};
+                this->_vk.vkCmdCopyBufferToImage(
+                        this->_get_recording(),
+                        this->_staging_buffer,
+                        dst,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        1,
+                        &region);
+
+                y += rows;
+            }
+        }
+
+        // The consumer synchronizes with the timeline semaphore, which
+        // makes the writes available, so nothing needs to be blocked here
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = final_layout;
+        this->_vk.vkCmdPipelineBarrier(
+                this->_get_recording(),
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier);
+
+        return this->_submitted_value + 1;
+    }
+
+    // Submit the copies recorded since the last flush
+    uint64_t
+    age_upload_manager::flush() {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_flush();
+    }
+
+    // Check if the transfer queue has signaled a value
+    bool
+    age_upload_manager::is_complete(uint64_t value) {
+        return this->get_completed_value() >= value;
+    }
+
+    // Block until the transfer queue has signaled a value
+    // A value that has not been flushed yet is flushed first
+    void
+    age_upload_manager::wait(uint64_t value) {
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            if (value > this->_submitted_value) {
+                this->_flush();
+            }
+        }
+        if (this->_device.wait_semaphore(this->_timeline, value) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to wait for upload");
+        }
+    }
+
+    VkSemaphore
+    age_upload_manager::get_semaphore() {
+        return this->_timeline;
+    }
+
+    uint64_t
+    age_upload_manager::get_completed_value() {
+        return this->_device.get_semaphore_value(this->_timeline);
+    }
+
+
+    /**********************************************
+     *                 Private
+     *********************************************/
+
+    // Take space from the staging ring
+    // When the ring is full the oldest batch is waited on, this is the
+    // only place an upload can block and only happens when the transfer
+    // queue falls a whole ring behind
+    VkDeviceSize
+    age_upload_manager::_reserve(VkDeviceSize size, VkDeviceSize alignment) {
+        for (;;) {
+            // Start from the beginning whenever the ring is empty
+            if (this->_head == this->_tail && this->_in_flight.empty()) {
+                this->_head = 0;
+                this->_tail = 0;
+            }
+
+            VkDeviceSize position = this->_head % this->_staging_size;
+            VkDeviceSize start = (position + alignment - 1) / alignment * alignment;
+            if (start + size > this->_staging_size) { // does not fit before the end, wrap around
+                start = 0;
+            }
+            VkDeviceSize skip = start >= position ? start - position : this->_staging_size - position;
+
+            if (this->_head + skip + size - this->_tail <= this->_staging_size) {
+                this->_head += skip + size;
+                return start;
+            }
+
+            // Out of space, release whatever the GPU is done with
+            // and wait for the oldest batch if that is not enough
+            this->_retire_completed();
+            if (this->_head == this->_tail && this->_in_flight.empty()) {
+                continue;
+            }
+            if (this->_in_flight.empty()) {
+                if (this->_recording == VK_NULL_HANDLE) {
+                    throw std::runtime_error("Error: upload does not fit in the staging ring");
+                }
+                this->_flush();
+            }
+            if (this->_device.wait_semaphore(this->_timeline, this->_in_flight.front().value) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to wait for upload");
+            }
+            this->_retire_completed();
+        }
+    }
+
+    // Get the command buffer of the open batch, starting one if needed
+    VkCommandBuffer
+    age_upload_manager::_get_recording() {
+        if (this->_recording != VK_NULL_HANDLE) {
+            return this->_recording;
+        }
+
+        this->_retire_completed();
+        if (!this->_free_command_buffers.empty()) {
+            this->_recording = this->_free_command_buffers.back();
+            this->_free_command_buffers.pop_back();
+            this->_vk.vkResetCommandBuffer(this->_recording, 0);
+        } else {
+            VkCommandBufferAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool = this->_command_pool;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            alloc_info.commandBufferCount = 1;
+
+            if (this->_vk.vkAllocateCommandBuffers(this->_device.get_device(), &alloc_info, &this->_recording) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to allocate upload command buffer");
+            }
+        }
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (this->_vk.vkBeginCommandBuffer(this->_recording, &begin_info) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to begin upload command buffer");
+        }
+
+        return this->_recording;
+    }
+
+    // Submit the open batch on the transfer queue
+    // The batch signals the next timeline value when its copies are done
+    uint64_t
+    age_upload_manager::_flush() {
+        if (this->_recording == VK_NULL_HANDLE) {
+            return this->_submitted_value;
+        }
+
+        if (this->_vk.vkEndCommandBuffer(this->_recording) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to record upload command buffer");
+        }
+
+        uint64_t value = this->_submitted_value + 1;
+
+        VkTimelineSemaphoreSubmitInfo timeline_info{};
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.signalSemaphoreValueCount = 1;
+        timeline_info.pSignalSemaphoreValues = &value;
+
+        VkSubmitInfo submit_info{};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.pNext = &timeline_info;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &this->_recording;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &this->_timeline;
+
+        if (this->_device.queue_submit(this->_device.get_transfer_queue(), 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("Error: failed to submit uploads");
+        }
+
+        this->_in_flight.push_back({this->_recording, value, this->_head});
+        this->_recording = VK_NULL_HANDLE;
+        this->_submitted_value = value;
+        return value;
+    }
+
+    // Release the staging space and command buffers of every batch the
+    // transfer queue has finished
+    void
+    age_upload_manager::_retire_completed() {
+        if (this->_in_flight.empty()) {
+            return;
+        }
+
+        uint64_t completed = this->get_completed_value();
+        while (!this->_in_flight.empty() && this->_in_flight.front().value <= completed) {
+            // Space reserved by the open batch lies past ring_end, so
+            // the tail only moves over ranges the GPU has finished with
+            this->_tail = this->_in_flight.front().ring_end;
+            this->_free_command_buffers.push_back(this->_in_flight.front().command_buffer);
+            this->_in_flight.pop_front();
+        }
+    }
+}
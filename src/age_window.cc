@@ -8,16 +8,25 @@
 namespace age {
 
     // Set the member fields and create the glfw window
-    age_window::age_window(uint32_t width, uint32_t height, std::string name) {
+    // In headless mode no GLFW window is created at all, so the engine
+    // can run on machines without an X server
+    age_window::age_window(uint32_t width, uint32_t height, std::string name, bool headless) {
         this->_width = width;
         this->_height = height;
         this->_name = name;
+        this->_headless = headless;
+        this->_framebuffer_resized = false;
+        this->_window = nullptr;
 
         this->init_window();
     }
 
     // Destroy the window and close GLFW
     age_window::~age_window() {
+        if (this->_headless) {
+            return;
+        }
+
         glfwDestroyWindow(this->_window);
         printf("Window '%s' destroyed\n", this->_name.c_str());
         glfwTerminate();
@@ -26,18 +35,33 @@ namespace age {
     // Initialize GLFW and create the window member field
     void
     age_window::init_window() {
+        if (this->_headless)
+            return;
+
         if (!glfwInit()) 
             throw new std::runtime_error("Error: could not initialize GLFW");
         
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
         this->_window = glfwCreateWindow(this->_width, this->_height, this->_name.c_str(), nullptr, nullptr);
         if (!this->_window)
             throw new std::runtime_error("Error: unable to create GLFW window");
+
+        glfwSetWindowUserPointer(this->_window, this);
+        glfwSetFramebufferSizeCallback(this->_window, age_window::_resize_framebuffer_callback);
         return;
     }
 
+    // Track the new framebuffer size so the swapchain can be recreated
+    void
+    age_window::_resize_framebuffer_callback(GLFWwindow* window, int width, int height) {
+        age_window *self = static_cast<age_window*>(glfwGetWindowUserPointer(window));
+        self->_framebuffer_resized = true;
+        self->_width = static_cast<uint32_t>(width);
+        self->_height = static_cast<uint32_t>(height);
+    }
+
     // Create and return the extent of the window
     VkExtent2D
     age_window::get_extent() {
@@ -50,15 +74,86 @@ namespace age {
     }
 
     // Determine if the window should close
+    // A headless window never asks to be closed
     bool
     age_window::should_close() {
+        if (this->_headless)
+            return false;
         return glfwWindowShouldClose(this->_window);
     }
 
+    // Process pending window events without blocking
+    void
+    age_window::poll_events() {
+        if (this->_headless)
+            return;
+        glfwPollEvents();
+    }
+
+    // Block until an event arrives
+    void
+    age_window::wait_events() {
+        if (this->_headless)
+            return;
+        glfwWaitEvents();
+    }
+
+    bool
+    age_window::was_resized() {
+        return this->_framebuffer_resized;
+    }
+
+    void
+    age_window::reset_resized_flag() {
+        this->_framebuffer_resized = false;
+    }
+
+    // Determine if the window is backed by a headless surface
+    bool
+    age_window::is_headless() {
+        return this->_headless;
+    }
+
+    // Get the instance extensions that are needed to create
+    // the surface for this window
+    std::vector<const char*>
+    age_window::get_required_instance_extensions() {
+        if (this->_headless) {
+            return {
+                VK_KHR_SURFACE_EXTENSION_NAME,
+                VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME
+            };
+        }
+
+        uint32_t glfw_extension_count = 0;
+        const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        if (glfw_extensions == nullptr) {
+            throw std::runtime_error("Error: GLFW cannot provide the vulkan surface extensions");
+        }
+
+        return std::vector<const char*>(glfw_extensions, glfw_extensions + glfw_extension_count);
+    }
+
     // Create the surface to interface with the window
+    // Headless windows get a VK_EXT_headless_surface which 
+    // accepts any extent and never needs a display server
     void
-    age_window::create_window_surface(VkInstance instance, VkSurfaceKHR *surface) {
-        if (glfwCreateWindowSurface(instance, this->_window, nullptr, surface) != VK_SUCCESS) {
+    age_window::create_window_surface(VkInstance instance, const VkAllocationCallbacks *allocation_callbacks, VkSurfaceKHR *surface) {
+        if (this->_headless) {
+            auto func = (PFN_vkCreateHeadlessSurfaceEXT) vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+            if (func == nullptr) {
+                throw std::runtime_error("Error: VK_EXT_headless_surface is not supported by the driver");
+            }
+
+            VkHeadlessSurfaceCreateInfoEXT create_info{};
+            create_info.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+            if (func(instance, &create_info, allocation_callbacks, surface) != VK_SUCCESS) {
+                throw std::runtime_error("Error: failed to create headless surface");
+            }
+            return;
+        }
+
+        if (glfwCreateWindowSurface(instance, this->_window, allocation_callbacks, surface) != VK_SUCCESS) {
             throw std::runtime_error("Error: failed to create window surface");
         }
     }
@@ -66,7 +161,9 @@ namespace age {
     // Open the window
     void
     age_window::open() {
-        if (this->_window) {
+        if (this->_headless) {
+            return;
+        } else if (this->_window) {
             while (!glfwWindowShouldClose(this->_window)) {
                 glfwPollEvents();
             }
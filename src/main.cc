@@ -1,13 +1,59 @@
 #include "age_engine.hh"
+#include "age_log.hh"
 
 #include <iostream>
 #include <string>
 #include <exception>
+#include <cstring>
+#include <cstdlib>
 #include <GLFW/glfw3.h>
 
 int
-main (void) {
-    age::age_engine engine = age::age_engine(800, 600, "Apollo Engine");
+main (int argc, char **argv) {
+    age::EngineConfig config;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            config.headless = true;
+        } else if (strcmp(argv[i], "--bindless") == 0) {
+            config.device_requirements.bindless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            config.frame_limit = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            config.frames_in_flight = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            config.worker_threads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--assets") == 0 && i + 1 < argc) {
+            config.asset_pack_path = argv[++i];
+        } else if (strcmp(argv[i], "--hot-reload") == 0) {
+            config.hot_reload_shaders = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            const char *level = argv[++i];
+            if (strcmp(level, "verbose") == 0) {
+                age::age_log::get().set_min_severity(age::LogSeverity::verbose);
+            } else if (strcmp(level, "info") == 0) {
+                age::age_log::get().set_min_severity(age::LogSeverity::info);
+            } else if (strcmp(level, "error") == 0) {
+                age::age_log::get().set_min_severity(age::LogSeverity::error);
+            } else {
+                age::age_log::get().set_min_severity(age::LogSeverity::warning);
+            }
+        } else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "throughput") == 0) {
+                config.present_policy = age::PresentPolicy::max_throughput;
+            } else if (strcmp(policy, "power") == 0) {
+                config.present_policy = age::PresentPolicy::power_saving;
+            } else if (strcmp(policy, "benchmark") == 0) {
+                config.present_policy = age::PresentPolicy::uncapped_benchmark;
+            } else {
+                config.present_policy = age::PresentPolicy::low_latency;
+            }
+        }
+    }
+
+    age::age_engine engine = age::age_engine(800, 600, "Apollo Engine", config);
 
     try {
         engine.run();
@@ -0,0 +1,109 @@
+#include "age_unit_test.hh"
+#include "age_allocator.hh"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+using age::age_memory_block;
+
+namespace {
+    const VkDeviceSize BLOCK_SIZE = 1024 * 1024;
+
+    bool
+    overlaps(VkDeviceSize offset_a, VkDeviceSize size_a, VkDeviceSize offset_b, VkDeviceSize size_b) {
+        return offset_a < offset_b + size_b && offset_b < offset_a + size_a;
+    }
+}
+
+AGE_TEST(tlsf_allocations_are_aligned_and_disjoint) {
+    age_memory_block block(VK_NULL_HANDLE, BLOCK_SIZE, nullptr);
+
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        uint32_t node;
+    };
+    std::vector<Range> ranges;
+    const VkDeviceSize sizes[] = {1, 100, 4096, 3000, 65536, 17, 256};
+    const VkDeviceSize alignments[] = {1, 16, 256, 4096, 64, 4, 1024};
+    for (int i = 0; i < 7; i++) {
+        Range range{0, sizes[i], 0};
+        AGE_CHECK(block.allocate(sizes[i], alignments[i], range.offset, range.node));
+        AGE_CHECK(range.offset % alignments[i] == 0);
+        AGE_CHECK(range.offset + range.size <= BLOCK_SIZE);
+        for (const Range &other : ranges) {
+            AGE_CHECK(!overlaps(range.offset, range.size, other.offset, other.size));
+        }
+        ranges.push_back(range);
+    }
+    AGE_CHECK(block.get_allocation_count() == 7);
+    AGE_CHECK(!block.empty());
+}
+
+AGE_TEST(tlsf_free_coalesces_neighbours) {
+    age_memory_block block(VK_NULL_HANDLE, BLOCK_SIZE, nullptr);
+
+    // Three neighbours, freed middle first so both merges are exercised
+    VkDeviceSize offsets[3];
+    uint32_t nodes[3];
+    for (int i = 0; i < 3; i++) {
+        AGE_CHECK(block.allocate(BLOCK_SIZE / 4, 1, offsets[i], nodes[i]));
+    }
+    AGE_CHECK(block.get_used() == 3 * BLOCK_SIZE / 4);
+
+    block.free(nodes[1]);
+    block.free(nodes[0]);
+    block.free(nodes[2]);
+    AGE_CHECK(block.empty());
+    AGE_CHECK(block.get_used() == 0);
+    AGE_CHECK(block.get_largest_free_range() == BLOCK_SIZE);
+
+    // Only possible if every range merged back into one
+    VkDeviceSize offset;
+    uint32_t node;
+    AGE_CHECK(block.allocate(BLOCK_SIZE, 1, offset, node));
+    AGE_CHECK(offset == 0);
+}
+
+AGE_TEST(tlsf_reuses_freed_ranges) {
+    age_memory_block block(VK_NULL_HANDLE, BLOCK_SIZE, nullptr);
+
+    VkDeviceSize offset_a, offset_b, offset_c;
+    uint32_t node_a, node_b, node_c;
+    AGE_CHECK(block.allocate(BLOCK_SIZE / 2, 1, offset_a, node_a));
+    AGE_CHECK(block.allocate(BLOCK_SIZE / 2, 1, offset_b, node_b));
+
+    // Full, until a range comes back
+    AGE_CHECK(!block.allocate(1024, 1, offset_c, node_c));
+    block.free(node_a);
+    AGE_CHECK(block.allocate(BLOCK_SIZE / 4, 1, offset_c, node_c));
+    AGE_CHECK(overlaps(offset_c, BLOCK_SIZE / 4, offset_a, BLOCK_SIZE / 2));
+}
+
+AGE_TEST(tlsf_alignment_padding_is_returned) {
+    age_memory_block block(VK_NULL_HANDLE, BLOCK_SIZE, nullptr);
+
+    VkDeviceSize small_offset, aligned_offset;
+    uint32_t small_node, aligned_node;
+    AGE_CHECK(block.allocate(16, 1, small_offset, small_node));
+    AGE_CHECK(block.allocate(4096, 4096, aligned_offset, aligned_node));
+    AGE_CHECK(aligned_offset % 4096 == 0);
+
+    // Only the requested bytes count as used, the padding went back
+    AGE_CHECK(block.get_used() == 16 + 4096);
+
+    block.free(small_node);
+    block.free(aligned_node);
+    AGE_CHECK(block.get_largest_free_range() == BLOCK_SIZE);
+}
+
+AGE_TEST(tlsf_rejects_requests_larger_than_the_block) {
+    age_memory_block block(VK_NULL_HANDLE, BLOCK_SIZE, nullptr);
+
+    VkDeviceSize offset;
+    uint32_t node;
+    AGE_CHECK(!block.allocate(BLOCK_SIZE + 1, 1, offset, node));
+    AGE_CHECK(block.empty());
+    AGE_CHECK(block.get_largest_free_range() == BLOCK_SIZE);
+}
@@ -0,0 +1,91 @@
+#include "age_unit_test.hh"
+#include "age_init_graph.hh"
+#include "age_job_system.hh"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using age::age_init_graph;
+using age::age_job_system;
+
+AGE_TEST(init_graph_runs_steps_after_their_dependencies) {
+    age_job_system jobs(4);
+    age_init_graph graph(&jobs);
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto step = [&mutex, &order](const char *name) {
+        return [&mutex, &order, name]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(name);
+        };
+    };
+    uint32_t a = graph.add_step("a", step("a"));
+    uint32_t b = graph.add_step("b", step("b"), {a});
+    uint32_t c = graph.add_step("c", step("c"), {a});
+    graph.add_step("d", step("d"), {b, c});
+    graph.run();
+
+    AGE_CHECK(order.size() == 4);
+    AGE_CHECK(order.front() == "a");
+    AGE_CHECK(order.back() == "d");
+    AGE_CHECK(graph.get_timings().size() == 4);
+}
+
+AGE_TEST(init_graph_runs_main_thread_steps_on_the_caller) {
+    age_job_system jobs(2);
+    age_init_graph graph(&jobs);
+
+    std::thread::id caller = std::this_thread::get_id();
+    std::thread::id ran_on;
+    uint32_t load = graph.add_step("load", []() {});
+    graph.add_step("surface", [&ran_on]() { ran_on = std::this_thread::get_id(); }, {load}, true);
+    graph.run();
+    AGE_CHECK(ran_on == caller);
+}
+
+AGE_TEST(init_graph_skips_dependents_of_a_failed_step_and_rethrows) {
+    age_job_system jobs(4);
+    age_init_graph graph(&jobs);
+
+    std::atomic<bool> dependent_ran{false};
+    std::atomic<bool> independent_ran{false};
+    uint32_t failing = graph.add_step("failing", []() { throw std::runtime_error("no device"); });
+    uint32_t dependent = graph.add_step("dependent", [&dependent_ran]() { dependent_ran = true; }, {failing});
+    graph.add_step("transitive", [&dependent_ran]() { dependent_ran = true; }, {dependent});
+    graph.add_step("independent", [&independent_ran]() { independent_ran = true; });
+
+    std::string message;
+    try {
+        graph.run();
+    } catch (const std::runtime_error &e) {
+        message = e.what();
+    }
+    AGE_CHECK(message == "no device");
+    AGE_CHECK(!dependent_ran.load());
+    AGE_CHECK(independent_ran.load());
+}
+
+AGE_TEST(init_graph_without_a_job_system_runs_inline) {
+    age_init_graph graph(nullptr);
+    int value = 0;
+    uint32_t first = graph.add_step("first", [&value]() { value = 1; });
+    graph.add_step("second", [&value]() { value *= 2; }, {first});
+    graph.run();
+    AGE_CHECK(value == 2);
+}
+
+AGE_TEST(init_graph_rejects_forward_dependencies) {
+    age_init_graph graph(nullptr);
+    bool thrown = false;
+    try {
+        graph.add_step("early", []() {}, {3});
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    AGE_CHECK(thrown);
+}
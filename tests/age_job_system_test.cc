@@ -0,0 +1,146 @@
+#include "age_unit_test.hh"
+#include "age_job_system.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using age::age_job_counter;
+using age::age_job_deque;
+using age::age_job_system;
+
+AGE_TEST(job_deque_pops_newest_and_steals_oldest) {
+    age_job_deque deque;
+    std::vector<age::age_job*> jobs;
+    for (uintptr_t i = 1; i <= 1000; i++) {
+        jobs.push_back(reinterpret_cast<age::age_job*>(i * 8)); // never dereferenced
+        deque.push(jobs.back());
+    }
+
+    // More than the initial array, so this also covers growing
+    AGE_CHECK(deque.steal() == jobs.front());
+    AGE_CHECK(deque.pop() == jobs.back());
+    for (size_t i = 1; i < jobs.size() - 1; i++) {
+        AGE_CHECK(deque.steal() == jobs[i]);
+    }
+    AGE_CHECK(deque.pop() == nullptr);
+    AGE_CHECK(deque.steal() == nullptr);
+}
+
+AGE_TEST(job_counter_reaches_zero_after_every_job) {
+    age_job_system jobs(4);
+    age_job_counter counter;
+    std::atomic<uint32_t> done{0};
+    for (int i = 0; i < 1000; i++) {
+        jobs.run([&done]() { done.fetch_add(1); }, &counter);
+    }
+    jobs.wait(counter);
+    AGE_CHECK(counter.is_done());
+    AGE_CHECK(counter.get_value() == 0);
+    AGE_CHECK(done.load() == 1000);
+}
+
+AGE_TEST(job_dependency_runs_after_its_counter) {
+    age_job_system jobs(4);
+    age_job_counter first;
+    age_job_counter second;
+    std::atomic<uint32_t> done{0};
+    std::atomic<bool> ordered{true};
+
+    for (int i = 0; i < 100; i++) {
+        jobs.run([&done]() { done.fetch_add(1); }, &first);
+    }
+    for (int i = 0; i < 10; i++) {
+        jobs.run([&done, &ordered]() {
+            if (done.load() < 100) {
+                ordered.store(false);
+            }
+        }, &second, &first);
+    }
+    jobs.wait(second);
+    AGE_CHECK(ordered.load());
+    AGE_CHECK(first.is_done());
+}
+
+AGE_TEST(job_wait_runs_nested_jobs) {
+    // Jobs wait for jobs they spawned without blocking a worker
+    age_job_system jobs(2);
+    age_job_counter outer;
+    std::atomic<uint32_t> done{0};
+    for (int i = 0; i < 8; i++) {
+        jobs.run([&jobs, &done]() {
+            age_job_counter inner;
+            for (int j = 0; j < 8; j++) {
+                jobs.run([&done]() { done.fetch_add(1); }, &inner);
+            }
+            jobs.wait(inner);
+        }, &outer);
+    }
+    jobs.wait(outer);
+    AGE_CHECK(done.load() == 64);
+}
+
+AGE_TEST(job_parallel_for_covers_the_range_once) {
+    age_job_system jobs(4);
+    std::vector<std::atomic<uint32_t>> hits(10007);
+    jobs.parallel_for(static_cast<uint32_t>(hits.size()), 64, [&hits](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            hits[i].fetch_add(1);
+        }
+    });
+
+    bool once = true;
+    for (std::atomic<uint32_t> &hit : hits) {
+        once = once && hit.load() == 1;
+    }
+    AGE_CHECK(once);
+}
+
+AGE_TEST(job_exception_is_rethrown_by_wait) {
+    age_job_system jobs(4);
+    age_job_counter counter;
+    std::atomic<uint32_t> done{0};
+    for (int i = 0; i < 100; i++) {
+        jobs.run([i, &done]() {
+            done.fetch_add(1);
+            if (i % 10 == 3) {
+                throw std::runtime_error("job " + std::to_string(i));
+            }
+        }, &counter);
+    }
+
+    bool thrown = false;
+    try {
+        jobs.wait(counter);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    // Every job still ran and finished, so the counter may be reused
+    AGE_CHECK(thrown);
+    AGE_CHECK(counter.is_done());
+    AGE_CHECK(done.load() == 100);
+
+    jobs.run([]() {}, &counter);
+    jobs.wait(counter);
+    AGE_CHECK(counter.is_done());
+}
+
+AGE_TEST(job_parallel_for_rethrows_after_every_range) {
+    age_job_system jobs(4);
+    std::atomic<uint32_t> ranges{0};
+    bool thrown = false;
+    try {
+        jobs.parallel_for(1000, 10, [&ranges](uint32_t begin, uint32_t end) {
+            ranges.fetch_add(1);
+            if (begin == 500) {
+                throw std::runtime_error("range");
+            }
+        });
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    AGE_CHECK(thrown);
+    AGE_CHECK(ranges.load() == 100);
+}
@@ -0,0 +1,182 @@
+#include "age_unit_test.hh"
+#include "age_render_graph.hh"
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+using age::age_render_graph;
+using age::PassAccess;
+using age::TransientLifetime;
+using age::TransientPlacement;
+
+namespace {
+    // Stands in for vkGetImageMemoryRequirements
+    TransientLifetime
+    image(VkDeviceSize size, VkDeviceSize alignment, uint32_t memory_type_bits, int32_t first_pass, int32_t last_pass) {
+        TransientLifetime lifetime{};
+        lifetime.requirements.size = size;
+        lifetime.requirements.alignment = alignment;
+        lifetime.requirements.memoryTypeBits = memory_type_bits;
+        lifetime.first_pass = first_pass;
+        lifetime.last_pass = last_pass;
+        return lifetime;
+    }
+
+    bool
+    overlaps(const TransientLifetime &a, const TransientPlacement &pa, const TransientLifetime &b, const TransientPlacement &pb) {
+        return pa.group == pb.group
+               && pa.offset < pb.offset + b.requirements.size
+               && pb.offset < pa.offset + a.requirements.size;
+    }
+
+    bool
+    lifetimes_overlap(const TransientLifetime &a, const TransientLifetime &b) {
+        return !(a.last_pass < b.first_pass || b.last_pass < a.first_pass);
+    }
+
+    // No two images that are alive at the same time share memory
+    bool
+    placement_is_safe(const std::vector<TransientLifetime> &images, const std::vector<TransientPlacement> &placements) {
+        for (size_t a = 0; a < images.size(); a++) {
+            if (placements[a].offset % images[a].requirements.alignment != 0) {
+                return false;
+            }
+            for (size_t b = a + 1; b < images.size(); b++) {
+                if (lifetimes_overlap(images[a], images[b]) && overlaps(images[a], placements[a], images[b], placements[b])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+AGE_TEST(render_graph_culls_passes_nothing_reads) {
+    // Resources: 0 swapchain (imported), 1 depth, 2 color, 3 debug
+    std::vector<bool> imported = {true, false, false, false};
+    std::vector<std::vector<PassAccess>> passes = {
+        {{1, true}},                    // 0 depth prepass
+        {{1, false}, {2, true}},        // 1 lighting
+        {{2, false}, {3, true}},        // 2 debug view, only feeds the unused image 3
+        {{2, false}, {0, true}},        // 3 tonemap into the swapchain
+    };
+
+    std::vector<bool> alive = age_render_graph::cull_passes(passes, imported);
+    AGE_CHECK(alive.size() == 4);
+    AGE_CHECK(alive[0]);
+    AGE_CHECK(alive[1]);
+    AGE_CHECK(!alive[2]);
+    AGE_CHECK(alive[3]);
+}
+
+AGE_TEST(render_graph_culls_chains_behind_a_culled_pass) {
+    // Pass 1 only feeds pass 2, which writes nothing that is read
+    std::vector<bool> imported = {true, false, false, false};
+    std::vector<std::vector<PassAccess>> passes = {
+        {{0, true}},
+        {{1, true}},
+        {{1, false}, {2, true}},
+        {{3, true}},
+    };
+
+    std::vector<bool> alive = age_render_graph::cull_passes(passes, imported);
+    AGE_CHECK(alive[0]);
+    AGE_CHECK(!alive[1]);
+    AGE_CHECK(!alive[2]);
+    AGE_CHECK(!alive[3]);
+}
+
+AGE_TEST(render_graph_reads_before_a_write_keep_earlier_writers) {
+    // The write in pass 2 does not hide pass 0's write from pass 1
+    std::vector<bool> imported = {true, false};
+    std::vector<std::vector<PassAccess>> passes = {
+        {{1, true}},
+        {{1, false}, {0, true}},
+        {{1, true}},
+    };
+
+    std::vector<bool> alive = age_render_graph::cull_passes(passes, imported);
+    AGE_CHECK(alive[0]);
+    AGE_CHECK(alive[1]);
+    AGE_CHECK(!alive[2]);
+}
+
+AGE_TEST(render_graph_aliases_images_with_disjoint_lifetimes) {
+    std::vector<TransientLifetime> images = {
+        image(4096, 256, 0x3, 0, 1),
+        image(4096, 256, 0x3, 2, 3),    // starts after the first one ends
+        image(1024, 256, 0x3, 1, 2),    // overlaps both
+    };
+
+    std::vector<TransientPlacement> placements;
+    std::vector<VkMemoryRequirements> groups = age_render_graph::place_transients(images, placements);
+    AGE_CHECK(placements.size() == 3);
+    AGE_CHECK(groups.size() == 1);
+    AGE_CHECK(placement_is_safe(images, placements));
+
+    // The two large images share memory, the small one sits after them
+    AGE_CHECK(placements[0].offset == placements[1].offset);
+    AGE_CHECK(placements[2].offset == 4096);
+    AGE_CHECK(groups[0].size == 4096 + 1024);
+    AGE_CHECK(groups[0].alignment == 256);
+    AGE_CHECK(groups[0].memoryTypeBits == 0x3);
+}
+
+AGE_TEST(render_graph_respects_alignment_when_placing) {
+    std::vector<TransientLifetime> images = {
+        image(1000, 16, 0x1, 0, 2),
+        image(500, 4096, 0x1, 1, 1),
+    };
+
+    std::vector<TransientPlacement> placements;
+    std::vector<VkMemoryRequirements> groups = age_render_graph::place_transients(images, placements);
+    AGE_CHECK(placement_is_safe(images, placements));
+    AGE_CHECK(placements[1].offset == 4096);
+    AGE_CHECK(groups[0].size == 4096 + 500);
+    AGE_CHECK(groups[0].alignment == 4096);
+}
+
+AGE_TEST(render_graph_splits_incompatible_memory_types) {
+    std::vector<TransientLifetime> images = {
+        image(4096, 256, 0x1, 0, 0),
+        image(2048, 256, 0x2, 1, 1),    // could alias the first, but no type fits both
+        image(1024, 256, 0x3, 2, 2),    // joins the first group that has a type it fits
+    };
+
+    std::vector<TransientPlacement> placements;
+    std::vector<VkMemoryRequirements> groups = age_render_graph::place_transients(images, placements);
+    AGE_CHECK(groups.size() == 2);
+    AGE_CHECK(placements[0].group != placements[1].group);
+    AGE_CHECK(placements[2].group == placements[0].group);
+    AGE_CHECK(placements[2].offset == 0);
+    AGE_CHECK(groups[placements[0].group].memoryTypeBits == 0x1);
+    AGE_CHECK(groups[placements[1].group].memoryTypeBits == 0x2);
+    AGE_CHECK(placement_is_safe(images, placements));
+}
+
+AGE_TEST(render_graph_placement_is_safe_on_a_busy_frame) {
+    // Pseudo random lifetimes and sizes, checked against the brute force rule
+    std::vector<TransientLifetime> images;
+    uint32_t seed = 12345;
+    for (int i = 0; i < 64; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        int32_t first = static_cast<int32_t>((seed >> 8) % 16);
+        int32_t last = first + static_cast<int32_t>((seed >> 16) % 6);
+        VkDeviceSize size = 256 * (1 + (seed >> 20) % 64);
+        VkDeviceSize alignment = 1ull << (4 + (seed >> 28) % 9);
+        images.push_back(image(size, alignment, 0x7, first, last));
+    }
+
+    std::vector<TransientPlacement> placements;
+    std::vector<VkMemoryRequirements> groups = age_render_graph::place_transients(images, placements);
+    AGE_CHECK(groups.size() == 1);
+    AGE_CHECK(placement_is_safe(images, placements));
+
+    VkDeviceSize total = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        total += images[i].requirements.size;
+        AGE_CHECK(placements[i].offset + images[i].requirements.size <= groups[0].size);
+    }
+    AGE_CHECK(groups[0].size < total);
+}
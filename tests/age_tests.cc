@@ -0,0 +1,35 @@
+#include "age_unit_test.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+// Run every registered test, or only those whose name contains argv[1]
+int
+main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : nullptr;
+
+    int failed_tests = 0;
+    int run = 0;
+    for (const age::age_test_case &test : age::age_test_cases()) {
+        if (filter != nullptr && std::strstr(test.name, filter) == nullptr) {
+            continue;
+        }
+
+        int failures = age::age_test_failures();
+        try {
+            test.function();
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s: unexpected exception: %s\n", test.name, e.what());
+            age::age_test_failures()++;
+        }
+        run++;
+
+        bool passed = age::age_test_failures() == failures;
+        failed_tests += passed ? 0 : 1;
+        std::printf("[%s] %s\n", passed ? " OK " : "FAIL", test.name);
+    }
+
+    std::printf("%d tests, %d failed\n", run, failed_tests);
+    return failed_tests == 0 ? 0 : 1;
+}
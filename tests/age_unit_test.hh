@@ -0,0 +1,55 @@
+#pragma once
+#ifndef AGE_UNIT_TEST
+#define AGE_UNIT_TEST
+
+#include <cstdio>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace age {
+
+    // Minimal unit test registry for the CPU-only parts of the engine
+    // Tests register themselves with AGE_TEST and report failures with
+    // AGE_CHECK, which logs and keeps going so one run shows every failure
+    struct age_test_case {
+        const char *name;
+        std::function<void()> function;
+    };
+
+    inline std::vector<age_test_case>&
+    age_test_cases() {
+        static std::vector<age_test_case> cases;
+        return cases;
+    }
+
+    inline int&
+    age_test_failures() {
+        static int failures = 0;
+        return failures;
+    }
+
+    struct age_test_registration {
+        age_test_registration(const char *name, std::function<void()> function) {
+            age_test_cases().push_back({name, std::move(function)});
+        }
+    };
+}
+
+#define AGE_TEST_CONCAT_(a, b) a##b
+#define AGE_TEST_CONCAT(a, b) AGE_TEST_CONCAT_(a, b)
+
+#define AGE_TEST(name)                                                                              \
+    static void name();                                                                             \
+    static age::age_test_registration AGE_TEST_CONCAT(name, _registration)(#name, name);            \
+    static void name()
+
+#define AGE_CHECK(condition)                                                                        \
+    do {                                                                                            \
+        if (!(condition)) {                                                                         \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+            age::age_test_failures()++;                                                             \
+        }                                                                                           \
+    } while (0)
+
+#endif /* AGE_UNIT_TEST */
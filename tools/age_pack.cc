@@ -0,0 +1,1103 @@
+#include "age_asset_format.hh"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Offline asset packer
+// Converts source assets into the pack format age_asset_pack maps at
+// runtime. Assets are named by their path, relative to --root if given:
+//
+//   .obj            mesh, polygons are triangulated
+//   .gltf .glb      one mesh per glTF mesh, named path#mesh when there are
+//                   several; node transforms are not applied
+//   .png            RGBA8 texture, sRGB unless --linear comes before it
+//   .spv            SPIR-V shader
+//
+//   bin/age_pack --out PACK [--root DIR] [--linear | --srgb] FILE...
+//   bin/age_pack --list PACK
+
+namespace {
+
+    using age::AssetEntry;
+    using age::AssetType;
+    using age::AssetVertex;
+
+    struct PackInput {
+        std::string path;
+        bool linear = false;            // texture holds data, not color
+    };
+
+    struct PackOptions {
+        std::string out_path;
+        std::string root;               // stripped from asset names
+        std::vector<PackInput> inputs;
+    };
+
+    // An asset ready to be written
+    struct PackedAsset {
+        std::string name;
+        AssetEntry entry;               // offset is filled in when the pack is written
+        std::vector<uint8_t> data;
+    };
+
+    struct MeshData {
+        std::vector<AssetVertex> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    std::vector<uint8_t>
+    read_file(const std::string &path) {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Error: failed to open " + path);
+        }
+        std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()))) {
+            throw std::runtime_error("Error: failed to read " + path);
+        }
+        return bytes;
+    }
+
+    std::string
+    lower_extension(const std::string &path) {
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+            return "";
+        }
+        std::string extension = path.substr(dot);
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        return extension;
+    }
+
+    std::string
+    directory_of(const std::string &path) {
+        size_t slash = path.rfind('/');
+        return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    }
+
+    uint32_t
+    read_be32(const uint8_t *bytes) {
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16)
+               | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+    }
+
+    uint32_t
+    read_le32(const uint8_t *bytes) {
+        return bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8)
+               | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+
+    /**** Meshes ****/
+
+    // Fill in normals for vertices that came without one
+    // Face normals are summed, weighted by area, over every face sharing the vertex
+    void
+    compute_normals(MeshData &mesh) {
+        for (AssetVertex &vertex : mesh.vertices) {
+            vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0.0F;
+        }
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            AssetVertex &a = mesh.vertices[mesh.indices[i]];
+            AssetVertex &b = mesh.vertices[mesh.indices[i + 1]];
+            AssetVertex &c = mesh.vertices[mesh.indices[i + 2]];
+            float e1[3], e2[3];
+            for (int k = 0; k < 3; k++) {
+                e1[k] = b.position[k] - a.position[k];
+                e2[k] = c.position[k] - a.position[k];
+            }
+            float n[3] = {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0]
+            };
+            for (int k = 0; k < 3; k++) {
+                a.normal[k] += n[k];
+                b.normal[k] += n[k];
+                c.normal[k] += n[k];
+            }
+        }
+        for (AssetVertex &vertex : mesh.vertices) {
+            float length = std::sqrt(vertex.normal[0] * vertex.normal[0]
+                                     + vertex.normal[1] * vertex.normal[1]
+                                     + vertex.normal[2] * vertex.normal[2]);
+            for (int k = 0; k < 3 && length > 0.0F; k++) {
+                vertex.normal[k] /= length;
+            }
+        }
+    }
+
+    PackedAsset
+    pack_mesh(const MeshData &mesh) {
+        if (mesh.vertices.empty() || mesh.indices.empty()) {
+            throw std::runtime_error("Error: mesh has no triangles");
+        }
+
+        PackedAsset asset{};
+        asset.entry.type = AssetType::mesh;
+        asset.entry.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+        asset.entry.index_count = static_cast<uint32_t>(mesh.indices.size());
+
+        size_t vertex_bytes = mesh.vertices.size() * sizeof(AssetVertex);
+        size_t index_bytes = mesh.indices.size() * sizeof(uint32_t);
+        asset.data.resize(vertex_bytes + index_bytes);
+        memcpy(asset.data.data(), mesh.vertices.data(), vertex_bytes);
+        memcpy(asset.data.data() + vertex_bytes, mesh.indices.data(), index_bytes);
+        asset.entry.size = asset.data.size();
+        return asset;
+    }
+
+    // Wavefront OBJ
+    // Vertices are shared between faces that use the same
+    // position, texture coordinate and normal
+    MeshData
+    load_obj(const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("Error: failed to open " + path);
+        }
+
+        std::vector<float> positions;
+        std::vector<float> uvs;
+        std::vector<float> normals;
+        std::map<std::tuple<long, long, long>, uint32_t> unique;
+        MeshData mesh;
+        bool missing_normals = false;
+
+        // OBJ indices are 1 based, negative ones count back from the end
+        auto resolve = [&](long index, size_t count, size_t line_number) -> long {
+            long resolved = index > 0 ? index - 1 : static_cast<long>(count) + index;
+            if (index == 0 || resolved < 0 || resolved >= static_cast<long>(count)) {
+                throw std::runtime_error("Error: " + path + ":" + std::to_string(line_number) + " index out of range");
+            }
+            return resolved;
+        };
+
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            const char *c = line.c_str();
+            while (*c == ' ' || *c == '\t') {
+                c++;
+            }
+
+            if (strncmp(c, "v ", 2) == 0 || strncmp(c, "vn ", 3) == 0 || strncmp(c, "vt ", 3) == 0) {
+                std::vector<float> &target = c[1] == ' ' ? positions : (c[1] == 'n' ? normals : uvs);
+                int wanted = c[1] == 't' ? 2 : 3;
+                char *end = const_cast<char*>(c + 2);
+                for (int k = 0; k < wanted; k++) {
+                    char *start = end;
+                    float value = strtof(start, &end);
+                    if (end == start) {
+                        throw std::runtime_error("Error: " + path + ":" + std::to_string(line_number) + " malformed vertex");
+                    }
+                    target.push_back(value);
+                }
+            } else if (strncmp(c, "f ", 2) == 0) {
+                std::vector<uint32_t> face;
+                char *cursor = const_cast<char*>(c + 2);
+                while (true) {
+                    while (*cursor == ' ' || *cursor == '\t') {
+                        cursor++;
+                    }
+                    if (*cursor == '\0' || *cursor == '\r') {
+                        break;
+                    }
+
+                    long v = strtol(cursor, &cursor, 10);
+                    long vt = 0;
+                    long vn = 0;
+                    if (*cursor == '/') {
+                        cursor++;
+                        if (*cursor != '/') {
+                            vt = strtol(cursor, &cursor, 10);
+                        }
+                        if (*cursor == '/') {
+                            cursor++;
+                            vn = strtol(cursor, &cursor, 10);
+                        }
+                    }
+
+                    std::tuple<long, long, long> key{
+                        resolve(v, positions.size() / 3, line_number),
+                        vt != 0 ? resolve(vt, uvs.size() / 2, line_number) : -1,
+                        vn != 0 ? resolve(vn, normals.size() / 3, line_number) : -1
+                    };
+                    auto found = unique.find(key);
+                    if (found == unique.end()) {
+                        AssetVertex vertex{};
+                        memcpy(vertex.position, &positions[std::get<0>(key) * 3], sizeof(vertex.position));
+                        if (std::get<1>(key) >= 0) {
+                            vertex.uv[0] = uvs[std::get<1>(key) * 2];
+                            vertex.uv[1] = 1.0F - uvs[std::get<1>(key) * 2 + 1]; // OBJ puts v = 0 at the bottom
+                        }
+                        if (std::get<2>(key) >= 0) {
+                            memcpy(vertex.normal, &normals[std::get<2>(key) * 3], sizeof(vertex.normal));
+                        } else {
+                            missing_normals = true;
+                        }
+                        found = unique.emplace(key, static_cast<uint32_t>(mesh.vertices.size())).first;
+                        mesh.vertices.push_back(vertex);
+                    }
+                    face.push_back(found->second);
+                }
+
+                // Fan triangulation, fine for the convex polygons exporters write
+                for (size_t k = 1; k + 1 < face.size(); k++) {
+                    mesh.indices.push_back(face[0]);
+                    mesh.indices.push_back(face[k]);
+                    mesh.indices.push_back(face[k + 1]);
+                }
+            }
+        }
+
+        if (missing_normals) {
+            compute_normals(mesh);
+        }
+        return mesh;
+    }
+
+
+    /**** glTF ****/
+
+    // Just enough JSON for glTF
+    struct JsonValue {
+        enum class Type { null, boolean, number, string, array, object };
+
+        Type type = Type::null;
+        bool boolean = false;
+        double number = 0.0;
+        std::string string;
+        std::vector<JsonValue> array;
+        std::vector<std::pair<std::string, JsonValue>> object;
+
+        const JsonValue*
+        get(const char *key) const {
+            for (const std::pair<std::string, JsonValue> &member : this->object) {
+                if (member.first == key) {
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+
+        // Member as an unsigned integer, fallback when it is absent
+        uint64_t
+        get_uint(const char *key, uint64_t fallback) const {
+            const JsonValue *value = this->get(key);
+            if (value == nullptr) {
+                return fallback;
+            }
+            if (value->type != Type::number || value->number < 0.0) {
+                throw std::runtime_error(std::string("Error: glTF member ") + key + " is not an unsigned integer");
+            }
+            return static_cast<uint64_t>(value->number);
+        }
+    };
+
+    class JsonParser {
+        public:
+            JsonParser(const char *begin, const char *end)
+            : _cursor{begin}, _end{end} {}
+
+            JsonValue
+            parse() {
+                JsonValue value = this->_value();
+                this->_skip_space();
+                if (this->_cursor != this->_end) {
+                    throw std::runtime_error("Error: trailing data after glTF JSON");
+                }
+                return value;
+            }
+
+        private:
+            void
+            _skip_space() {
+                while (this->_cursor < this->_end && (*this->_cursor == ' ' || *this->_cursor == '\t'
+                       || *this->_cursor == '\n' || *this->_cursor == '\r')) {
+                    this->_cursor++;
+                }
+            }
+
+            void
+            _expect(char c) {
+                this->_skip_space();
+                if (this->_cursor >= this->_end || *this->_cursor != c) {
+                    throw std::runtime_error(std::string("Error: malformed glTF JSON, expected ") + c);
+                }
+                this->_cursor++;
+            }
+
+            bool
+            _match(const char *literal) {
+                size_t length = strlen(literal);
+                if (static_cast<size_t>(this->_end - this->_cursor) >= length && strncmp(this->_cursor, literal, length) == 0) {
+                    this->_cursor += length;
+                    return true;
+                }
+                return false;
+            }
+
+            JsonValue
+            _value() {
+                this->_skip_space();
+                if (this->_cursor >= this->_end) {
+                    throw std::runtime_error("Error: glTF JSON ends early");
+                }
+
+                JsonValue value;
+                char c = *this->_cursor;
+                if (c == '{') {
+                    value.type = JsonValue::Type::object;
+                    this->_cursor++;
+                    this->_skip_space();
+                    if (this->_cursor < this->_end && *this->_cursor == '}') {
+                        this->_cursor++;
+                        return value;
+                    }
+                    do {
+                        this->_skip_space();
+                        std::string key = this->_string();
+                        this->_expect(':');
+                        value.object.emplace_back(std::move(key), this->_value());
+                        this->_skip_space();
+                    } while (this->_cursor < this->_end && *this->_cursor == ',' && ++this->_cursor);
+                    this->_expect('}');
+                } else if (c == '[') {
+                    value.type = JsonValue::Type::array;
+                    this->_cursor++;
+                    this->_skip_space();
+                    if (this->_cursor < this->_end && *this->_cursor == ']') {
+                        this->_cursor++;
+                        return value;
+                    }
+                    do {
+                        value.array.push_back(this->_value());
+                        this->_skip_space();
+                    } while (this->_cursor < this->_end && *this->_cursor == ',' && ++this->_cursor);
+                    this->_expect(']');
+                } else if (c == '"') {
+                    value.type = JsonValue::Type::string;
+                    value.string = this->_string();
+                } else if (this->_match("true")) {
+                    value.type = JsonValue::Type::boolean;
+                    value.boolean = true;
+                } else if (this->_match("false")) {
+                    value.type = JsonValue::Type::boolean;
+                } else if (this->_match("null")) {
+                    value.type = JsonValue::Type::null;
+                } else {
+                    // strtod stops at the end of the number, the buffer ends in a NUL
+                    char *number_end = nullptr;
+                    value.type = JsonValue::Type::number;
+                    value.number = strtod(this->_cursor, &number_end);
+                    if (number_end == this->_cursor || number_end > this->_end) {
+                        throw std::runtime_error("Error: malformed glTF JSON value");
+                    }
+                    this->_cursor = number_end;
+                }
+                return value;
+            }
+
+            // Escapes other than \uXXXX are kept, names in glTF files are ASCII in practice
+            std::string
+            _string() {
+                if (this->_cursor >= this->_end || *this->_cursor != '"') {
+                    throw std::runtime_error("Error: malformed glTF JSON, expected a string");
+                }
+                this->_cursor++;
+                std::string result;
+                while (this->_cursor < this->_end && *this->_cursor != '"') {
+                    char c = *this->_cursor++;
+                    if (c == '\\' && this->_cursor < this->_end) {
+                        char escaped = *this->_cursor++;
+                        switch (escaped) {
+                            case 'n': result += '\n'; break;
+                            case 't': result += '\t'; break;
+                            case 'r': result += '\r'; break;
+                            case 'b': result += '\b'; break;
+                            case 'f': result += '\f'; break;
+                            case 'u':
+                                this->_cursor = std::min(this->_cursor + 4, this->_end);
+                                result += '?';
+                                break;
+                            default: result += escaped; break;
+                        }
+                    } else {
+                        result += c;
+                    }
+                }
+                if (this->_cursor >= this->_end) {
+                    throw std::runtime_error("Error: glTF JSON string is not terminated");
+                }
+                this->_cursor++;
+                return result;
+            }
+
+            const char *_cursor;
+            const char *_end;
+    };
+
+    std::vector<uint8_t>
+    decode_base64(const std::string &text) {
+        auto value_of = [](char c) -> int {
+            if (c >= 'A' && c <= 'Z') return c - 'A';
+            if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+            if (c >= '0' && c <= '9') return c - '0' + 52;
+            if (c == '+') return 62;
+            if (c == '/') return 63;
+            return -1;
+        };
+
+        std::vector<uint8_t> bytes;
+        uint32_t bits = 0;
+        int bit_count = 0;
+        for (char c : text) {
+            int value = value_of(c);
+            if (value < 0) {
+                continue;   // padding and line breaks
+            }
+            bits = (bits << 6) | static_cast<uint32_t>(value);
+            bit_count += 6;
+            if (bit_count >= 8) {
+                bit_count -= 8;
+                bytes.push_back(static_cast<uint8_t>(bits >> bit_count));
+            }
+        }
+        return bytes;
+    }
+
+    class GltfFile {
+        public:
+            // A .glb carries the JSON and the first buffer in one file
+            GltfFile(const std::string &path)
+            : _path{path} {
+                std::vector<uint8_t> file = read_file(path);
+                std::string json;
+                if (file.size() >= 12 && read_le32(file.data()) == 0x46546c67) { // "glTF"
+                    size_t offset = 12;
+                    while (offset + 8 <= file.size()) {
+                        uint32_t length = read_le32(file.data() + offset);
+                        uint32_t type = read_le32(file.data() + offset + 4);
+                        if (length > file.size() - offset - 8) {
+                            throw std::runtime_error("Error: " + path + " has a truncated chunk");
+                        }
+                        const uint8_t *chunk = file.data() + offset + 8;
+                        if (type == 0x4e4f534a) {       // "JSON"
+                            json.assign(reinterpret_cast<const char*>(chunk), length);
+                        } else if (type == 0x004e4942) { // "BIN"
+                            this->_glb_buffer.assign(chunk, chunk + length);
+                        }
+                        offset += 8 + ((length + 3) & ~3u);
+                    }
+                } else {
+                    json.assign(file.begin(), file.end());
+                }
+
+                this->_root = JsonParser(json.c_str(), json.c_str() + json.size()).parse();
+                const JsonValue *buffers = this->_root.get("buffers");
+                for (size_t i = 0; buffers != nullptr && i < buffers->array.size(); i++) {
+                    this->_buffers.push_back(this->_load_buffer(buffers->array[i], i));
+                }
+            }
+
+            // Each glTF mesh with its primitives merged
+            std::vector<std::pair<std::string, MeshData>>
+            get_meshes() {
+                std::vector<std::pair<std::string, MeshData>> meshes;
+                const JsonValue &list = this->_member(this->_root, "meshes");
+                for (size_t i = 0; i < list.array.size(); i++) {
+                    const JsonValue &mesh = list.array[i];
+                    const JsonValue *name = mesh.get("name");
+                    MeshData data;
+                    bool missing_normals = false;
+                    for (const JsonValue &primitive : this->_member(mesh, "primitives").array) {
+                        this->_append_primitive(primitive, data, missing_normals);
+                    }
+                    if (missing_normals) {
+                        compute_normals(data);
+                    }
+                    meshes.emplace_back(name != nullptr && !name->string.empty() ? name->string : std::to_string(i), std::move(data));
+                }
+                return meshes;
+            }
+
+        private:
+            const JsonValue&
+            _member(const JsonValue &object, const char *key) {
+                const JsonValue *value = object.get(key);
+                if (value == nullptr) {
+                    throw std::runtime_error("Error: " + this->_path + " is missing " + key);
+                }
+                return *value;
+            }
+
+            const JsonValue&
+            _element(const char *list, uint64_t index) {
+                const JsonValue &array = this->_member(this->_root, list);
+                if (index >= array.array.size()) {
+                    throw std::runtime_error("Error: " + this->_path + " refers to a missing " + list + " entry");
+                }
+                return array.array[index];
+            }
+
+            std::vector<uint8_t>
+            _load_buffer(const JsonValue &buffer, size_t index) {
+                const JsonValue *uri = buffer.get("uri");
+                std::vector<uint8_t> bytes;
+                if (uri == nullptr) {
+                    if (index != 0) {
+                        throw std::runtime_error("Error: " + this->_path + " has a buffer without data");
+                    }
+                    bytes = this->_glb_buffer;
+                } else if (uri->string.compare(0, 5, "data:") == 0) {
+                    size_t comma = uri->string.find(";base64,");
+                    if (comma == std::string::npos) {
+                        throw std::runtime_error("Error: " + this->_path + " has a data URI that is not base64");
+                    }
+                    bytes = decode_base64(uri->string.substr(comma + 8));
+                } else {
+                    bytes = read_file(directory_of(this->_path) + uri->string);
+                }
+
+                if (bytes.size() < buffer.get_uint("byteLength", 0)) {
+                    throw std::runtime_error("Error: " + this->_path + " has a buffer shorter than its byteLength");
+                }
+                return bytes;
+            }
+
+            // Read an accessor as floats, normalized integers are converted
+            std::vector<float>
+            _read_floats(uint64_t index, uint32_t components) {
+                const JsonValue &accessor = this->_element("accessors", index);
+                uint64_t component_type = accessor.get_uint("componentType", 0);
+                uint32_t component_size = component_type == 5126 ? 4 : component_type == 5123 ? 2 : component_type == 5121 ? 1 : 0;
+                const JsonValue *normalized = accessor.get("normalized");
+                if (component_size == 0 || (component_size != 4 && (normalized == nullptr || !normalized->boolean))) {
+                    throw std::runtime_error("Error: " + this->_path + " has an unsupported vertex attribute type");
+                }
+
+                std::vector<float> values;
+                this->_visit(accessor, components * component_size, [&](const uint8_t *element) {
+                    for (uint32_t k = 0; k < components; k++) {
+                        const uint8_t *component = element + k * component_size;
+                        if (component_size == 4) {
+                            float value;
+                            memcpy(&value, component, 4);
+                            values.push_back(value);
+                        } else if (component_size == 2) {
+                            uint16_t value;
+                            memcpy(&value, component, 2);
+                            values.push_back(value / 65535.0F);
+                        } else {
+                            values.push_back(*component / 255.0F);
+                        }
+                    }
+                });
+                return values;
+            }
+
+            std::vector<uint32_t>
+            _read_indices(uint64_t index) {
+                const JsonValue &accessor = this->_element("accessors", index);
+                uint64_t component_type = accessor.get_uint("componentType", 0);
+                uint32_t size = component_type == 5125 ? 4 : component_type == 5123 ? 2 : component_type == 5121 ? 1 : 0;
+                if (size == 0) {
+                    throw std::runtime_error("Error: " + this->_path + " has an unsupported index type");
+                }
+
+                std::vector<uint32_t> indices;
+                this->_visit(accessor, size, [&](const uint8_t *element) {
+                    uint32_t value = 0;
+                    memcpy(&value, element, size); // little endian
+                    indices.push_back(value);
+                });
+                return indices;
+            }
+
+            // Call visit with a pointer to every element of an accessor
+            template <typename Visit>
+            void
+            _visit(const JsonValue &accessor, uint32_t element_size, Visit visit) {
+                if (accessor.get("sparse") != nullptr) {
+                    throw std::runtime_error("Error: " + this->_path + " uses sparse accessors, which are not supported");
+                }
+                const JsonValue &view = this->_element("bufferViews", accessor.get_uint("bufferView", UINT64_MAX));
+                uint64_t buffer_index = view.get_uint("buffer", 0);
+                if (buffer_index >= this->_buffers.size()) {
+                    throw std::runtime_error("Error: " + this->_path + " refers to a missing buffer");
+                }
+                const std::vector<uint8_t> &buffer = this->_buffers[buffer_index];
+
+                uint64_t count = accessor.get_uint("count", 0);
+                uint64_t stride = view.get_uint("byteStride", element_size);
+                uint64_t start = view.get_uint("byteOffset", 0) + accessor.get_uint("byteOffset", 0);
+                uint64_t end = count == 0 ? start : start + (count - 1) * stride + element_size;
+                if (end > buffer.size() || end - view.get_uint("byteOffset", 0) > view.get_uint("byteLength", 0)) {
+                    throw std::runtime_error("Error: " + this->_path + " has an accessor outside its buffer");
+                }
+                for (uint64_t i = 0; i < count; i++) {
+                    visit(buffer.data() + start + i * stride);
+                }
+            }
+
+            void
+            _append_primitive(const JsonValue &primitive, MeshData &mesh, bool &missing_normals) {
+                if (primitive.get_uint("mode", 4) != 4) {
+                    throw std::runtime_error("Error: " + this->_path + " has a primitive that is not a triangle list");
+                }
+                const JsonValue &attributes = this->_member(primitive, "attributes");
+                std::vector<float> positions = this->_read_floats(attributes.get_uint("POSITION", UINT64_MAX), 3);
+                std::vector<float> normals;
+                std::vector<float> uvs;
+                if (attributes.get("NORMAL") != nullptr) {
+                    normals = this->_read_floats(attributes.get_uint("NORMAL", 0), 3);
+                } else {
+                    missing_normals = true;
+                }
+                if (attributes.get("TEXCOORD_0") != nullptr) {
+                    uvs = this->_read_floats(attributes.get_uint("TEXCOORD_0", 0), 2);
+                }
+
+                size_t vertex_count = positions.size() / 3;
+                if ((!normals.empty() && normals.size() != positions.size()) || (!uvs.empty() && uvs.size() / 2 != vertex_count)) {
+                    throw std::runtime_error("Error: " + this->_path + " has attributes of different lengths");
+                }
+
+                uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+                for (size_t i = 0; i < vertex_count; i++) {
+                    AssetVertex vertex{};
+                    memcpy(vertex.position, &positions[i * 3], sizeof(vertex.position));
+                    if (!normals.empty()) {
+                        memcpy(vertex.normal, &normals[i * 3], sizeof(vertex.normal));
+                    }
+                    if (!uvs.empty()) {
+                        memcpy(vertex.uv, &uvs[i * 2], sizeof(vertex.uv));
+                    }
+                    mesh.vertices.push_back(vertex);
+                }
+
+                std::vector<uint32_t> indices;
+                if (primitive.get("indices") != nullptr) {
+                    indices = this->_read_indices(primitive.get_uint("indices", 0));
+                } else {
+                    for (uint32_t i = 0; i < vertex_count; i++) {
+                        indices.push_back(i);
+                    }
+                }
+                for (uint32_t index : indices) {
+                    if (index >= vertex_count) {
+                        throw std::runtime_error("Error: " + this->_path + " has an index out of range");
+                    }
+                    mesh.indices.push_back(base + index);
+                }
+            }
+
+            std::string _path;
+            JsonValue _root;
+            std::vector<uint8_t> _glb_buffer;
+            std::vector<std::vector<uint8_t>> _buffers;
+    };
+
+
+    /**** Textures ****/
+
+    // PNG decoded to RGBA8
+    // Every color type and bit depth is read, interlaced images are not
+    PackedAsset
+    load_png(const std::string &path, bool linear) {
+        static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::vector<uint8_t> file = read_file(path);
+        if (file.size() < 8 || memcmp(file.data(), SIGNATURE, 8) != 0) {
+            throw std::runtime_error("Error: " + path + " is not a PNG");
+        }
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint8_t bit_depth = 0;
+        uint8_t color_type = 0;
+        std::vector<uint8_t> palette;       // RGBA entries
+        std::vector<uint8_t> compressed;
+        bool has_key = false;               // tRNS color key of gray and RGB images
+        uint16_t key[3] = {};
+
+        size_t offset = 8;
+        bool ended = false;
+        while (!ended && offset + 12 <= file.size()) {
+            uint32_t length = read_be32(file.data() + offset);
+            if (length > file.size() - offset - 12) {
+                throw std::runtime_error("Error: " + path + " has a truncated chunk");
+            }
+            const uint8_t *type = file.data() + offset + 4;
+            const uint8_t *data = type + 4;
+            if (crc32(crc32(0, nullptr, 0), type, length + 4) != read_be32(data + length)) {
+                throw std::runtime_error("Error: " + path + " has a corrupt chunk");
+            }
+
+            if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+                width = read_be32(data);
+                height = read_be32(data + 4);
+                bit_depth = data[8];
+                color_type = data[9];
+                if (data[12] != 0) {
+                    throw std::runtime_error("Error: " + path + " is interlaced, save it without interlacing");
+                }
+            } else if (memcmp(type, "PLTE", 4) == 0) {
+                for (uint32_t i = 0; i + 2 < length; i += 3) {
+                    palette.insert(palette.end(), {data[i], data[i + 1], data[i + 2], 255});
+                }
+            } else if (memcmp(type, "tRNS", 4) == 0) {
+                if (color_type == 3) {
+                    for (uint32_t i = 0; i < length && i * 4 + 3 < palette.size(); i++) {
+                        palette[i * 4 + 3] = data[i];
+                    }
+                } else if (length >= 2) {
+                    has_key = true;
+                    for (uint32_t i = 0; i < 3 && i * 2 + 1 < length; i++) {
+                        key[i] = static_cast<uint16_t>((data[i * 2] << 8) | data[i * 2 + 1]);
+                    }
+                }
+            } else if (memcmp(type, "IDAT", 4) == 0) {
+                compressed.insert(compressed.end(), data, data + length);
+            } else if (memcmp(type, "IEND", 4) == 0) {
+                ended = true;
+            }
+            offset += 12 + length;
+        }
+
+        uint32_t channels = color_type == 0 ? 1 : color_type == 2 ? 3 : color_type == 3 ? 1 : color_type == 4 ? 2 : color_type == 6 ? 4 : 0;
+        bool valid_depth = bit_depth == 8 || bit_depth == 16
+                           || ((color_type == 0 || color_type == 3) && (bit_depth == 1 || bit_depth == 2 || bit_depth == 4));
+        if (width == 0 || height == 0 || channels == 0 || !valid_depth || (color_type == 3 && palette.empty())) {
+            throw std::runtime_error("Error: " + path + " has an unsupported PNG header");
+        }
+
+        uint64_t row_bytes = (static_cast<uint64_t>(width) * channels * bit_depth + 7) / 8;
+        uint64_t filter_bytes = std::max<uint64_t>(1, channels * bit_depth / 8);  // distance to the byte a filter looks back at
+        uLongf raw_size = static_cast<uLongf>((row_bytes + 1) * height);
+        std::vector<uint8_t> raw(raw_size);
+        if (uncompress(raw.data(), &raw_size, compressed.data(), static_cast<uLong>(compressed.size())) != Z_OK
+            || raw_size != raw.size()) {
+            throw std::runtime_error("Error: " + path + " has corrupt image data");
+        }
+
+        // Undo the per row filters in place
+        std::vector<uint8_t> zero_row(row_bytes, 0);
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t filter = raw[y * (row_bytes + 1)];
+            uint8_t *row = &raw[y * (row_bytes + 1) + 1];
+            const uint8_t *previous = y > 0 ? &raw[(y - 1) * (row_bytes + 1) + 1] : zero_row.data();
+            for (uint64_t x = 0; x < row_bytes; x++) {
+                int a = x >= filter_bytes ? row[x - filter_bytes] : 0;
+                int b = previous[x];
+                int c = x >= filter_bytes ? previous[x - filter_bytes] : 0;
+                int predictor = 0;
+                switch (filter) {
+                    case 0: predictor = 0; break;
+                    case 1: predictor = a; break;
+                    case 2: predictor = b; break;
+                    case 3: predictor = (a + b) / 2; break;
+                    case 4: {
+                        int p = a + b - c;
+                        int pa = std::abs(p - a);
+                        int pb = std::abs(p - b);
+                        int pc = std::abs(p - c);
+                        predictor = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+                        break;
+                    }
+                    default:
+                        throw std::runtime_error("Error: " + path + " has an unknown row filter");
+                }
+                row[x] = static_cast<uint8_t>(row[x] + predictor);
+            }
+        }
+
+        PackedAsset asset{};
+        asset.entry.type = AssetType::texture;
+        asset.entry.format = linear ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB;
+        asset.entry.width = width;
+        asset.entry.height = height;
+        asset.data.resize(static_cast<size_t>(width) * height * 4);
+
+        uint32_t max_value = (1u << bit_depth) - 1;
+        for (uint32_t y = 0; y < height; y++) {
+            const uint8_t *row = &raw[y * (row_bytes + 1) + 1];
+            // Sample k of the row at full precision
+            auto sample = [&](uint64_t k) -> uint32_t {
+                if (bit_depth == 16) {
+                    return (static_cast<uint32_t>(row[k * 2]) << 8) | row[k * 2 + 1];
+                }
+                if (bit_depth == 8) {
+                    return row[k];
+                }
+                uint64_t bit = k * bit_depth;
+                return (row[bit / 8] >> (8 - bit_depth - bit % 8)) & max_value;
+            };
+            auto to_byte = [&](uint32_t value) -> uint8_t {
+                return static_cast<uint8_t>(bit_depth == 16 ? value >> 8 : value * 255 / max_value);
+            };
+
+            for (uint32_t x = 0; x < width; x++) {
+                uint8_t *out = &asset.data[(static_cast<size_t>(y) * width + x) * 4];
+                uint64_t first = static_cast<uint64_t>(x) * channels;
+                if (color_type == 3) {
+                    uint32_t index = sample(first);
+                    if (index * 4 + 3 >= palette.size()) {
+                        throw std::runtime_error("Error: " + path + " uses a color outside its palette");
+                    }
+                    memcpy(out, &palette[index * 4], 4);
+                } else if (color_type == 0 || color_type == 4) {
+                    uint32_t gray = sample(first);
+                    out[0] = out[1] = out[2] = to_byte(gray);
+                    out[3] = color_type == 4 ? to_byte(sample(first + 1)) : (has_key && gray == key[0] ? 0 : 255);
+                } else {
+                    uint32_t r = sample(first);
+                    uint32_t g = sample(first + 1);
+                    uint32_t b = sample(first + 2);
+                    out[0] = to_byte(r);
+                    out[1] = to_byte(g);
+                    out[2] = to_byte(b);
+                    out[3] = color_type == 6 ? to_byte(sample(first + 3))
+                                             : (has_key && r == key[0] && g == key[1] && b == key[2] ? 0 : 255);
+                }
+            }
+        }
+
+        asset.entry.size = asset.data.size();
+        return asset;
+    }
+
+
+    /**** Shaders ****/
+
+    PackedAsset
+    load_spirv(const std::string &path) {
+        PackedAsset asset{};
+        asset.data = read_file(path);
+        if (asset.data.size() < 20 || asset.data.size() % 4 != 0 || read_le32(asset.data.data()) != 0x07230203) {
+            throw std::runtime_error("Error: " + path + " is not little endian SPIR-V");
+        }
+        asset.entry.type = AssetType::shader;
+        asset.entry.size = asset.data.size();
+        return asset;
+    }
+
+
+    /**** Pack file ****/
+
+    uint64_t
+    align_up(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Write the header, the hash index and the aligned asset data
+    // Written to a temporary file first so a failed run leaves the old pack in place
+    void
+    write_pack(const std::string &path, std::vector<PackedAsset> &assets) {
+        uint32_t slot_count = 1;
+        while (slot_count < assets.size() * 2) {    // at most half full keeps probes short
+            slot_count *= 2;
+        }
+
+        std::vector<AssetEntry> index(slot_count);
+        std::map<uint64_t, const std::string*> names;
+        uint64_t offset = align_up(sizeof(age::AssetPackHeader) + static_cast<uint64_t>(slot_count) * sizeof(AssetEntry),
+                                   age::ASSET_PACK_ALIGNMENT);
+        for (PackedAsset &asset : assets) {
+            asset.entry.id = age::asset_id(asset.name.c_str());
+            auto inserted = names.emplace(asset.entry.id, &asset.name);
+            if (!inserted.second) {
+                throw std::runtime_error("Error: asset names " + *inserted.first->second + " and " + asset.name
+                        + (*inserted.first->second == asset.name ? " are the same" : " hash to the same id"));
+            }
+
+            asset.entry.offset = offset;
+            offset = align_up(offset + asset.entry.size, age::ASSET_PACK_ALIGNMENT);
+
+            uint32_t slot = age::asset_slot(asset.entry.id, slot_count);
+            while (index[slot].type != AssetType::empty) {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            index[slot] = asset.entry;
+        }
+
+        age::AssetPackHeader header{};
+        header.magic = age::ASSET_PACK_MAGIC;
+        header.version = age::ASSET_PACK_VERSION;
+        header.asset_count = static_cast<uint32_t>(assets.size());
+        header.slot_count = slot_count;
+        header.index_offset = sizeof(header);
+        header.file_size = offset;
+
+        std::string temp_path = path + ".tmp";
+        std::FILE *file = std::fopen(temp_path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("Error: failed to open " + temp_path);
+        }
+
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+                       && std::fwrite(index.data(), sizeof(AssetEntry), index.size(), file) == index.size();
+        static const uint8_t PADDING[age::ASSET_PACK_ALIGNMENT] = {};
+        uint64_t position = sizeof(header) + index.size() * sizeof(AssetEntry);
+        for (const PackedAsset &asset : assets) {
+            if (!written) {
+                break;
+            }
+            written = std::fwrite(PADDING, 1, asset.entry.offset - position, file) == asset.entry.offset - position
+                      && std::fwrite(asset.data.data(), 1, asset.data.size(), file) == asset.data.size();
+            position = asset.entry.offset + asset.data.size();
+        }
+        if (written && position < header.file_size) {
+            written = std::fwrite(PADDING, 1, header.file_size - position, file) == header.file_size - position;
+        }
+        written = std::fclose(file) == 0 && written;
+
+        if (!written || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+            std::remove(temp_path.c_str());
+            throw std::runtime_error("Error: failed to write " + path);
+        }
+    }
+
+    // Print the index of a pack
+    void
+    list_pack(const std::string &path) {
+        std::vector<uint8_t> file = read_file(path);
+        age::AssetPackHeader header{};
+        if (file.size() < sizeof(header)) {
+            throw std::runtime_error("Error: " + path + " is not an asset pack");
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        if (header.magic != age::ASSET_PACK_MAGIC || header.version != age::ASSET_PACK_VERSION
+            || header.index_offset + static_cast<uint64_t>(header.slot_count) * sizeof(AssetEntry) > file.size()) {
+            throw std::runtime_error("Error: " + path + " is not a version " + std::to_string(age::ASSET_PACK_VERSION) + " asset pack");
+        }
+
+        std::printf("%s: %u assets, %u slots, %llu bytes\n", path.c_str(), header.asset_count, header.slot_count,
+                static_cast<unsigned long long>(header.file_size));
+        for (uint32_t slot = 0; slot < header.slot_count; slot++) {
+            AssetEntry entry;
+            memcpy(&entry, file.data() + header.index_offset + slot * sizeof(AssetEntry), sizeof(entry));
+            if (entry.type == AssetType::empty) {
+                continue;
+            }
+            std::printf("  %016llx  %10llu bytes  ", static_cast<unsigned long long>(entry.id),
+                    static_cast<unsigned long long>(entry.size));
+            switch (entry.type) {
+                case AssetType::mesh:
+                    std::printf("mesh     %u vertices, %u indices\n", entry.vertex_count, entry.index_count);
+                    break;
+                case AssetType::texture:
+                    std::printf("texture  %ux%u format %u\n", entry.width, entry.height, entry.format);
+                    break;
+                case AssetType::shader:
+                    std::printf("shader\n");
+                    break;
+                default:
+                    std::printf("unknown type %u\n", static_cast<uint32_t>(entry.type));
+                    break;
+            }
+        }
+    }
+
+    std::string
+    asset_name(const std::string &path, const std::string &root) {
+        if (!root.empty() && path.compare(0, root.size(), root) == 0) {
+            size_t start = root.size();
+            while (start < path.size() && path[start] == '/') {
+                start++;
+            }
+            return path.substr(start);
+        }
+        return path;
+    }
+}
+
+int
+main (int argc, char **argv) {
+    PackOptions options;
+    std::string list_path;
+    bool linear = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            options.out_path = argv[++i];
+        } else if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            options.root = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0 && i + 1 < argc) {
+            list_path = argv[++i];
+        } else if (strcmp(argv[i], "--linear") == 0) {
+            linear = true;
+        } else if (strcmp(argv[i], "--srgb") == 0) {
+            linear = false;
+        } else if (argv[i][0] == '-') {
+            std::cerr << "Error: unknown argument " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        } else {
+            options.inputs.push_back({argv[i], linear});
+        }
+    }
+
+    try {
+        if (!list_path.empty()) {
+            list_pack(list_path);
+            return EXIT_SUCCESS;
+        }
+        if (options.out_path.empty()) {
+            std::cerr << "usage: age_pack --out PACK [--root DIR] [--linear | --srgb] FILE...\n"
+                      << "       age_pack --list PACK" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<PackedAsset> assets;
+        for (const PackInput &input : options.inputs) {
+            std::string extension = lower_extension(input.path);
+            std::string name = asset_name(input.path, options.root);
+            if (extension == ".obj") {
+                assets.push_back(pack_mesh(load_obj(input.path)));
+                assets.back().name = name;
+            } else if (extension == ".gltf" || extension == ".glb") {
+                std::vector<std::pair<std::string, MeshData>> meshes = GltfFile(input.path).get_meshes();
+                for (const std::pair<std::string, MeshData> &mesh : meshes) {
+                    assets.push_back(pack_mesh(mesh.second));
+                    assets.back().name = meshes.size() == 1 ? name : name + "#" + mesh.first;
+                }
+            } else if (extension == ".png") {
+                assets.push_back(load_png(input.path, input.linear));
+                assets.back().name = name;
+            } else if (extension == ".spv") {
+                assets.push_back(load_spirv(input.path));
+                assets.back().name = name;
+            } else {
+                throw std::runtime_error("Error: no packer for " + input.path);
+            }
+        }
+
+        write_pack(options.out_path, assets);
+        std::cerr << "age_pack: wrote " << assets.size() << " assets to " << options.out_path << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}